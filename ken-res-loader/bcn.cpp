@@ -0,0 +1,672 @@
+#include "bcn.h"
+#include "simd.h"
+
+#include <float.h>
+#include <math.h>
+#include <memory.h>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	// the channels of a block, [channel][pixel]
+	typedef float Channels[4][16];
+
+	inline float clamp255(float v) noexcept
+	{
+		return v < 0.f ? 0.f : v > 255.f ? 255.f : v;
+	}
+
+	// nearest palette entry of every pixel, returns the squared error
+	float selectIndices(const Channels& channels, int channelCount, const float (*palette)[4], int paletteSize, uint8_t* indices) noexcept
+	{
+		float total = 0.f;
+#ifdef KRB_SSE2
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 best = _mm_set1_ps(FLT_MAX);
+			__m128i bestIndex = _mm_setzero_si128();
+			for (int p = 0; p < paletteSize; p++)
+			{
+				__m128 distance = _mm_setzero_ps();
+				for (int c = 0; c < channelCount; c++)
+				{
+					__m128 d = _mm_sub_ps(_mm_loadu_ps(channels[c] + i), _mm_set1_ps(palette[p][c]));
+					distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+				}
+				__m128i less = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+				best = _mm_min_ps(distance, best);
+				bestIndex = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi32(p)), _mm_andnot_si128(less, bestIndex));
+			}
+			int32_t index[4];
+			float error[4];
+			_mm_storeu_si128((__m128i*)index, bestIndex);
+			_mm_storeu_ps(error, best);
+			for (int k = 0; k < 4; k++)
+			{
+				indices[i + k] = (uint8_t)index[k];
+				total += error[k];
+			}
+		}
+#else
+		for (int i = 0; i < 16; i++)
+		{
+			float best = FLT_MAX;
+			for (int p = 0; p < paletteSize; p++)
+			{
+				float distance = 0.f;
+				for (int c = 0; c < channelCount; c++)
+				{
+					float d = channels[c][i] - palette[p][c];
+					distance += d * d;
+				}
+				if (distance < best)
+				{
+					best = distance;
+					indices[i] = (uint8_t)p;
+				}
+			}
+			total += best;
+		}
+#endif
+		return total;
+	}
+
+	// the bounding box corners on the diagonal that follows the covariance, inset against the outliers
+	void getBoxEndpoints(const Channels& channels, int channelCount, const bool* used, float* lo, float* hi) noexcept
+	{
+		float mean[4] = { 0.f, };
+		int count = 0;
+		for (int c = 0; c < channelCount; c++)
+		{
+			lo[c] = 255.f;
+			hi[c] = 0.f;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			if (used && !used[i]) continue;
+			count++;
+			for (int c = 0; c < channelCount; c++)
+			{
+				float v = channels[c][i];
+				if (v < lo[c]) lo[c] = v;
+				if (v > hi[c]) hi[c] = v;
+				mean[c] += v;
+			}
+		}
+		if (count == 0) return;
+
+		int major = 0;
+		for (int c = 0; c < channelCount; c++)
+		{
+			mean[c] /= count;
+			if (hi[c] - lo[c] > hi[major] - lo[major]) major = c;
+		}
+		for (int c = 0; c < channelCount; c++)
+		{
+			float inset = (hi[c] - lo[c]) / 16.f;
+			lo[c] += inset;
+			hi[c] -= inset;
+			if (c == major) continue;
+
+			float covariance = 0.f;
+			for (int i = 0; i < 16; i++)
+			{
+				if (used && !used[i]) continue;
+				covariance += (channels[major][i] - mean[major]) * (channels[c][i] - mean[c]);
+			}
+			if (covariance < 0.f)
+			{
+				float t = lo[c];
+				lo[c] = hi[c];
+				hi[c] = t;
+			}
+		}
+	}
+
+	// the extent along the principal axis, the axis is found by the power iteration
+	void getAxisEndpoints(const Channels& channels, int channelCount, const bool* used, float* lo, float* hi) noexcept
+	{
+		float mean[4] = { 0.f, };
+		int count = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			if (used && !used[i]) continue;
+			count++;
+			for (int c = 0; c < channelCount; c++) mean[c] += channels[c][i];
+		}
+		if (count == 0)
+		{
+			for (int c = 0; c < channelCount; c++) lo[c] = hi[c] = 0.f;
+			return;
+		}
+		for (int c = 0; c < channelCount; c++) mean[c] /= count;
+
+		float covariance[4][4] = { { 0.f, }, };
+		for (int i = 0; i < 16; i++)
+		{
+			if (used && !used[i]) continue;
+			for (int a = 0; a < channelCount; a++)
+			{
+				for (int b = a; b < channelCount; b++)
+				{
+					covariance[a][b] += (channels[a][i] - mean[a]) * (channels[b][i] - mean[b]);
+				}
+			}
+		}
+		for (int a = 0; a < channelCount; a++)
+		{
+			for (int b = 0; b < a; b++) covariance[a][b] = covariance[b][a];
+		}
+
+		// start from the widest channel
+		float axis[4] = { 0.f, };
+		int major = 0;
+		for (int c = 1; c < channelCount; c++)
+		{
+			if (covariance[c][c] > covariance[major][major]) major = c;
+		}
+		axis[major] = 1.f;
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = { 0.f, };
+			float length = 0.f;
+			for (int a = 0; a < channelCount; a++)
+			{
+				for (int b = 0; b < channelCount; b++) next[a] += covariance[a][b] * axis[b];
+				length += next[a] * next[a];
+			}
+			if (length < 1e-12f) break;
+			length = 1.f / sqrtf(length);
+			for (int c = 0; c < channelCount; c++) axis[c] = next[c] * length;
+		}
+
+		float tmin = FLT_MAX;
+		float tmax = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			if (used && !used[i]) continue;
+			float t = 0.f;
+			for (int c = 0; c < channelCount; c++) t += (channels[c][i] - mean[c]) * axis[c];
+			if (t < tmin) tmin = t;
+			if (t > tmax) tmax = t;
+		}
+		for (int c = 0; c < channelCount; c++)
+		{
+			lo[c] = clamp255(mean[c] + axis[c] * tmin);
+			hi[c] = clamp255(mean[c] + axis[c] * tmax);
+		}
+	}
+
+	// least squares endpoints for the indices, weights[index] is the weight of e0
+	bool refineEndpoints(const Channels& channels, int channelCount, const uint8_t* indices, const float* weights, const bool* used, float* e0, float* e1) noexcept
+	{
+		float aa = 0.f, ab = 0.f, bb = 0.f;
+		float ax[4] = { 0.f, };
+		float bx[4] = { 0.f, };
+		for (int i = 0; i < 16; i++)
+		{
+			if (used && !used[i]) continue;
+			float a = weights[indices[i]];
+			float b = 1.f - a;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channelCount; c++)
+			{
+				ax[c] += a * channels[c][i];
+				bx[c] += b * channels[c][i];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (fabsf(det) < 1e-6f) return false;
+		float inverse = 1.f / det;
+		for (int c = 0; c < channelCount; c++)
+		{
+			e0[c] = clamp255((bb * ax[c] - ab * bx[c]) * inverse);
+			e1[c] = clamp255((aa * bx[c] - ab * ax[c]) * inverse);
+		}
+		return true;
+	}
+
+	inline uint16_t to565(const float* rgb) noexcept
+	{
+		int r = (int)(rgb[0] * 31.f / 255.f + 0.5f);
+		int g = (int)(rgb[1] * 63.f / 255.f + 0.5f);
+		int b = (int)(rgb[2] * 31.f / 255.f + 0.5f);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+	inline void from565(uint16_t color, float* rgb) noexcept
+	{
+		int r = color >> 11;
+		int g = (color >> 5) & 63;
+		int b = color & 31;
+		rgb[0] = (float)((r << 3) | (r >> 2));
+		rgb[1] = (float)((g << 2) | (g >> 4));
+		rgb[2] = (float)((b << 3) | (b >> 2));
+	}
+
+	// BC1 color block, the 3-color mode with the transparent index for the alpha below 128
+	void encodeColor(const uint8_t (*pixels)[4], uint8_t* dest, kr_bcpreset_t preset, bool allowTransparent) noexcept
+	{
+		Channels channels;
+		bool opaque[16];
+		bool hasTransparent = false;
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 3; c++) channels[c][i] = pixels[i][c];
+			opaque[i] = !allowTransparent || pixels[i][3] >= 128;
+			if (!opaque[i]) hasTransparent = true;
+		}
+
+		uint16_t best0 = 0;
+		uint16_t best1 = 0;
+		uint32_t bestBits = 0xffffffff; // all transparent
+		float bestError = FLT_MAX;
+
+		float e0[3], e1[3];
+		if (preset == BcPresetFast) getBoxEndpoints(channels, 3, opaque, e1, e0);
+		else getAxisEndpoints(channels, 3, opaque, e1, e0);
+
+		int iterations = preset == BcPresetFast ? 1 : 3;
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			uint16_t c0 = to565(e0);
+			uint16_t c1 = to565(e1);
+			// c0 > c1 selects the 4-color mode
+			if (hasTransparent ? c0 > c1 : c0 < c1)
+			{
+				uint16_t t = c0;
+				c0 = c1;
+				c1 = t;
+			}
+
+			float palette[4][4];
+			from565(c0, palette[0]);
+			from565(c1, palette[1]);
+			int paletteSize;
+			static const float weights4[4] = { 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+			static const float weights3[4] = { 1.f, 0.f, 0.5f, 0.f };
+			const float* weights = hasTransparent ? weights3 : weights4;
+			if (hasTransparent)
+			{
+				for (int c = 0; c < 3; c++) palette[2][c] = (palette[0][c] + palette[1][c]) * 0.5f;
+				paletteSize = 3;
+			}
+			else
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					palette[2][c] = (palette[0][c] * 2.f + palette[1][c]) / 3.f;
+					palette[3][c] = (palette[0][c] + palette[1][c] * 2.f) / 3.f;
+				}
+				paletteSize = c0 == c1 ? 1 : 4;
+			}
+
+			uint8_t indices[16];
+			float error = selectIndices(channels, 3, palette, paletteSize, indices);
+			if (hasTransparent)
+			{
+				// the transparent pixels do not count
+				error = 0.f;
+				for (int i = 0; i < 16; i++)
+				{
+					if (!opaque[i])
+					{
+						indices[i] = 3;
+						continue;
+					}
+					for (int c = 0; c < 3; c++)
+					{
+						float d = channels[c][i] - palette[indices[i]][c];
+						error += d * d;
+					}
+				}
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				best0 = c0;
+				best1 = c1;
+				bestBits = 0;
+				for (int i = 0; i < 16; i++) bestBits |= (uint32_t)indices[i] << (i * 2);
+			}
+
+			if (iteration + 1 < iterations)
+			{
+				// the refined endpoints are ordered as the palette
+				if (!refineEndpoints(channels, 3, indices, weights, opaque, e0, e1)) break;
+			}
+		}
+
+		dest[0] = (uint8_t)best0;
+		dest[1] = (uint8_t)(best0 >> 8);
+		dest[2] = (uint8_t)best1;
+		dest[3] = (uint8_t)(best1 >> 8);
+		memcpy(dest + 4, &bestBits, 4);
+	}
+
+	// BC4 block, 8 interpolated values or 6 with 0 and 255
+	void encodeSingle(const uint8_t* values, uint8_t* dest, kr_bcpreset_t preset) noexcept
+	{
+		Channels channels;
+		int lo = 255;
+		int hi = 0;
+		int innerLo = 255;
+		int innerHi = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int v = values[i];
+			channels[0][i] = (float)v;
+			if (v < lo) lo = v;
+			if (v > hi) hi = v;
+			if (v != 0 && v != 255)
+			{
+				if (v < innerLo) innerLo = v;
+				if (v > innerHi) innerHi = v;
+			}
+		}
+
+		uint8_t indices[16];
+		uint8_t bestIndices[16];
+		float palette[8][4];
+		float bestError;
+		int ep0 = hi;
+		int ep1 = lo;
+
+		if (hi == lo)
+		{
+			memset(bestIndices, 0, sizeof(bestIndices));
+			bestError = 0.f;
+		}
+		else
+		{
+			// ep0 > ep1
+			palette[0][0] = (float)hi;
+			palette[1][0] = (float)lo;
+			for (int i = 1; i < 7; i++) palette[i + 1][0] = (float)(((7 - i) * hi + i * lo + 3) / 7);
+			bestError = selectIndices(channels, 1, palette, 8, bestIndices);
+		}
+
+		if (preset != BcPresetFast && bestError > 0.f && innerLo <= innerHi && (lo == 0 || hi == 255))
+		{
+			// ep0 <= ep1, the extremes are exact
+			palette[0][0] = (float)innerLo;
+			palette[1][0] = (float)innerHi;
+			for (int i = 1; i < 5; i++) palette[i + 1][0] = (float)(((5 - i) * innerLo + i * innerHi + 2) / 5);
+			palette[6][0] = 0.f;
+			palette[7][0] = 255.f;
+			float error = selectIndices(channels, 1, palette, 8, indices);
+			if (error < bestError)
+			{
+				bestError = error;
+				ep0 = innerLo;
+				ep1 = innerHi;
+				memcpy(bestIndices, indices, sizeof(indices));
+			}
+		}
+
+		dest[0] = (uint8_t)ep0;
+		dest[1] = (uint8_t)ep1;
+		uint64_t bits = 0;
+		for (int i = 0; i < 16; i++) bits |= (uint64_t)bestIndices[i] << (i * 3);
+		for (int i = 0; i < 6; i++) dest[2 + i] = (uint8_t)(bits >> (i * 8));
+	}
+
+	class BitWriter
+	{
+	public:
+		BitWriter(uint8_t* dest) noexcept
+			:m_dest(dest), m_position(0)
+		{
+			memset(dest, 0, 16);
+		}
+		void put(uint32_t value, int bits) noexcept
+		{
+			for (int i = 0; i < bits; i++, m_position++)
+			{
+				if (value & (1 << i)) m_dest[m_position >> 3] |= (uint8_t)(1 << (m_position & 7));
+			}
+		}
+
+	private:
+		uint8_t* m_dest;
+		int m_position;
+	};
+
+	// 7-bit endpoint with the shared p-bit, the opaque and the transparent alpha stay exact
+	void quantizeBc7Endpoint(const float* endpoint, uint8_t* q, uint8_t* pbit) noexcept
+	{
+		float bestError = FLT_MAX;
+		for (int p = 0; p < 2; p++)
+		{
+			if (endpoint[3] >= 255.f && p == 0) continue;
+			if (endpoint[3] <= 0.f && p == 1) continue;
+			uint8_t candidate[4];
+			float error = 0.f;
+			for (int c = 0; c < 4; c++)
+			{
+				int v = (int)((endpoint[c] - p) * 0.5f + 0.5f);
+				if (v < 0) v = 0;
+				else if (v > 127) v = 127;
+				candidate[c] = (uint8_t)v;
+				float d = (float)((v << 1) | p) - endpoint[c];
+				error += d * d;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				memcpy(q, candidate, 4);
+				*pbit = (uint8_t)p;
+			}
+		}
+	}
+
+	// BC7 mode 6, a single subset of RGBA 7.7.7.7 endpoints with p-bits and 4-bit indices
+	void encodeBc7(const uint8_t (*pixels)[4], uint8_t* dest, kr_bcpreset_t preset) noexcept
+	{
+		static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		static const float refineWeights[16] = {
+			1.f, 60 / 64.f, 55 / 64.f, 51 / 64.f, 47 / 64.f, 43 / 64.f, 38 / 64.f, 34 / 64.f,
+			30 / 64.f, 26 / 64.f, 21 / 64.f, 17 / 64.f, 13 / 64.f, 9 / 64.f, 4 / 64.f, 0.f };
+
+		Channels channels;
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++) channels[c][i] = pixels[i][c];
+		}
+
+		float e0[4], e1[4];
+		if (preset == BcPresetFast) getBoxEndpoints(channels, 4, nullptr, e0, e1);
+		else getAxisEndpoints(channels, 4, nullptr, e0, e1);
+
+		uint8_t bestQ[2][4] = { { 0, }, };
+		uint8_t bestP[2] = { 0, 0 };
+		uint8_t bestIndices[16] = { 0, };
+		float bestError = FLT_MAX;
+
+		int iterations = preset == BcPresetFast ? 1 : 3;
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			uint8_t q[2][4];
+			uint8_t p[2];
+			quantizeBc7Endpoint(e0, q[0], &p[0]);
+			quantizeBc7Endpoint(e1, q[1], &p[1]);
+
+			float palette[16][4];
+			for (int c = 0; c < 4; c++)
+			{
+				int a = (q[0][c] << 1) | p[0];
+				int b = (q[1][c] << 1) | p[1];
+				for (int i = 0; i < 16; i++) palette[i][c] = (float)(((64 - weights[i]) * a + weights[i] * b + 32) >> 6);
+			}
+
+			uint8_t indices[16];
+			float error = selectIndices(channels, 4, palette, 16, indices);
+			if (error < bestError)
+			{
+				bestError = error;
+				memcpy(bestQ, q, sizeof(q));
+				memcpy(bestP, p, sizeof(p));
+				memcpy(bestIndices, indices, sizeof(indices));
+			}
+
+			if (iteration + 1 < iterations)
+			{
+				if (!refineEndpoints(channels, 4, indices, refineWeights, nullptr, e0, e1)) break;
+			}
+		}
+
+		// the first index has an implicit zero msb
+		if (bestIndices[0] & 8)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				uint8_t t = bestQ[0][c];
+				bestQ[0][c] = bestQ[1][c];
+				bestQ[1][c] = t;
+			}
+			uint8_t t = bestP[0];
+			bestP[0] = bestP[1];
+			bestP[1] = t;
+			for (int i = 0; i < 16; i++) bestIndices[i] = (uint8_t)(15 - bestIndices[i]);
+		}
+
+		BitWriter writer(dest);
+		writer.put(1 << 6, 7);
+		for (int c = 0; c < 4; c++)
+		{
+			writer.put(bestQ[0][c], 7);
+			writer.put(bestQ[1][c], 7);
+		}
+		writer.put(bestP[0], 1);
+		writer.put(bestP[1], 1);
+		writer.put(bestIndices[0], 3);
+		for (int i = 1; i < 16; i++) writer.put(bestIndices[i], 4);
+	}
+}
+
+uint32_t BcEncoder::getBlockBytes(kr_pixelformat_t pixelformat) noexcept
+{
+	switch (pixelformat)
+	{
+	case PixelFormatBC1: return 8;
+	case PixelFormatBC3: return 16;
+	case PixelFormatBC4: return 8;
+	case PixelFormatBC5: return 16;
+	case PixelFormatBC7: return 16;
+	default: return 0;
+	}
+}
+bool BcEncoder::isSourceFormat(kr_pixelformat_t pixelformat) noexcept
+{
+	switch (pixelformat)
+	{
+	case PixelFormatIndex:
+	case PixelFormatA8:
+	case PixelFormatRGB8:
+	case PixelFormatXRGB8:
+	case PixelFormatARGB8:
+	case PixelFormatBGR8:
+	case PixelFormatXBGR8:
+	case PixelFormatABGR8:
+	case PixelFormatRGBA32F:
+		return true;
+	default:
+		return false;
+	}
+}
+void BcEncoder::convertRow(uint8_t* dest, const uint8_t* src, kr_pixelformat_t pixelformat, uint32_t width, const KrbImagePalette* palette) noexcept
+{
+	for (uint32_t x = 0; x < width; x++, dest += 4)
+	{
+		switch (pixelformat)
+		{
+		case PixelFormatIndex:
+		{
+			uint32_t color = palette ? palette->color[src[x]] : 0xff000000 | src[x] * 0x010101;
+			dest[0] = (uint8_t)(color >> 16);
+			dest[1] = (uint8_t)(color >> 8);
+			dest[2] = (uint8_t)color;
+			dest[3] = (uint8_t)(color >> 24);
+			break;
+		}
+		case PixelFormatA8:
+			dest[0] = dest[1] = dest[2] = dest[3] = src[x];
+			break;
+		case PixelFormatRGB8:
+			dest[0] = src[x * 3 + 2];
+			dest[1] = src[x * 3 + 1];
+			dest[2] = src[x * 3];
+			dest[3] = 0xff;
+			break;
+		case PixelFormatXRGB8:
+		case PixelFormatARGB8:
+			dest[0] = src[x * 4 + 2];
+			dest[1] = src[x * 4 + 1];
+			dest[2] = src[x * 4];
+			dest[3] = pixelformat == PixelFormatARGB8 ? src[x * 4 + 3] : 0xff;
+			break;
+		case PixelFormatBGR8:
+			memcpy(dest, src + x * 3, 3);
+			dest[3] = 0xff;
+			break;
+		case PixelFormatXBGR8:
+		case PixelFormatABGR8:
+			memcpy(dest, src + x * 4, 4);
+			if (pixelformat == PixelFormatXBGR8) dest[3] = 0xff;
+			break;
+		case PixelFormatRGBA32F:
+		{
+			const float* in = (const float*)src + x * 4;
+			for (int c = 0; c < 4; c++) dest[c] = (uint8_t)(clamp255(in[c] * 255.f) + 0.5f);
+			break;
+		}
+		default:
+			memset(dest, 0, 4);
+			break;
+		}
+	}
+}
+void BcEncoder::encodeBlockRow(kr_pixelformat_t pixelformat, kr_bcpreset_t preset, uint8_t* dest, const uint8_t* rgba, size_t pitch, uint32_t width) noexcept
+{
+	uint32_t blockBytes = getBlockBytes(pixelformat);
+	for (uint32_t x = 0; x < width; x += 4, dest += blockBytes)
+	{
+		uint8_t pixels[16][4];
+		for (int y = 0; y < 4; y++)
+		{
+			memcpy(pixels[y * 4], rgba + pitch * y + x * 4, 16);
+		}
+
+		uint8_t values[16];
+		switch (pixelformat)
+		{
+		case PixelFormatBC1:
+			encodeColor(pixels, dest, preset, true);
+			break;
+		case PixelFormatBC3:
+			for (int i = 0; i < 16; i++) values[i] = pixels[i][3];
+			encodeSingle(values, dest, preset);
+			encodeColor(pixels, dest + 8, preset, false);
+			break;
+		case PixelFormatBC4:
+			for (int i = 0; i < 16; i++) values[i] = pixels[i][0];
+			encodeSingle(values, dest, preset);
+			break;
+		case PixelFormatBC5:
+			for (int i = 0; i < 16; i++) values[i] = pixels[i][0];
+			encodeSingle(values, dest, preset);
+			for (int i = 0; i < 16; i++) values[i] = pixels[i][1];
+			encodeSingle(values, dest + 8, preset);
+			break;
+		case PixelFormatBC7:
+			encodeBc7(pixels, dest, preset);
+			break;
+		default:
+			break;
+		}
+	}
+}
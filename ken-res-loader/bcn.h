@@ -0,0 +1,25 @@
+#pragma once
+
+#include "include/image.h"
+
+namespace kr
+{
+	namespace backend
+	{
+		// block compression of 4x4 pixel blocks
+		class BcEncoder
+		{
+		public:
+			// 0 if not a block format
+			static uint32_t getBlockBytes(kr_pixelformat_t pixelformat) noexcept;
+
+			// the formats convertRow takes
+			static bool isSourceFormat(kr_pixelformat_t pixelformat) noexcept;
+			// to [R,G,B,A], palette is for PixelFormatIndex
+			static void convertRow(uint8_t* dest, const uint8_t* src, kr_pixelformat_t pixelformat, uint32_t width, const KrbImagePalette* palette) noexcept;
+
+			// 4 rows of [R,G,B,A] to a row of blocks, width is a multiple of 4
+			static void encodeBlockRow(kr_pixelformat_t pixelformat, kr_bcpreset_t preset, uint8_t* dest, const uint8_t* rgba, size_t pitch, uint32_t width) noexcept;
+		};
+	}
+}
@@ -0,0 +1,331 @@
+#include "bmp.h"
+#include "imagedecoder.h"
+#include "lazyimage.h"
+#include "util.h"
+
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <new>
+
+using namespace kr;
+
+namespace
+{
+#pragma pack(push, 1)
+	struct BMP_HEADER {
+		uint16_t    bfType;
+		uint32_t    bfSize;
+		uint16_t    bfReserved1;
+		uint16_t    bfReserved2;
+		uint32_t    bfOffBits;
+	};
+
+	struct BITMAP_FILE
+	{
+		uint32_t      biSize;
+		int32_t       biWidth;
+		int32_t       biHeight;
+		uint16_t      biPlanes;
+		uint16_t      biBitCount;
+		uint32_t      biCompression;
+		uint32_t      biSizeImage;
+		int32_t       biXPelsPerMeter;
+		int32_t       biYPelsPerMeter;
+		uint32_t      biClrUsed;
+		uint32_t      biClrImportant;
+
+		void* getBits() const noexcept
+		{
+			return (uint8_t*)this + biSize;
+		}
+		uint32_t getLineBytes() const noexcept
+		{
+			return (biWidth * biBitCount + 31) >> 5 << 2;
+		}
+		const KrbImagePalette* getPalette() const noexcept
+		{
+			return (KrbImagePalette*)((uint8_t*)this + sizeof(BITMAP_FILE));
+		}
+	};
+#pragma pack(pop)
+
+	// fills the image info and the palette if it is given, the rows are bottom-up if biHeight is positive
+	bool getBmpInfo(const BITMAP_FILE* bi, KrbImagePalette* palette, KrbImageInfo* info) noexcept
+	{
+		if (bi->biWidth <= 0 || bi->biHeight == 0) return false;
+		info->width = bi->biWidth;
+		info->height = bi->biHeight < 0 ? -bi->biHeight : bi->biHeight;
+		info->pitchBytes = bi->getLineBytes();
+
+		switch (bi->biBitCount)
+		{
+		case 8:
+			info->pixelformat = PixelFormatIndex;
+			if (!palette) break;
+			memcpy(palette->color, bi->getPalette(), sizeof(uint32_t) * 256);
+			for (uint32_t& v : palette->color)
+			{
+				((uint8_t*)& v)[3] = 0xff;
+			}
+			break;
+		case 16:
+			info->pixelformat = PixelFormatX1RGB5;
+			break;
+		case 24:
+			info->pixelformat = PixelFormatRGB8;
+			break;
+		case 32:
+			info->pixelformat = PixelFormatARGB8;
+			break;
+		default:
+			assert(!"Not Supported Yet");
+			return false;
+		}
+		return true;
+	}
+
+	// header, info and palette, then the rows one by one
+	class BmpDecoder :public KrbImageDecoder
+	{
+	public:
+		BmpDecoder(KrbImageCallback* callback) noexcept
+			:KrbImageDecoder(callback)
+		{
+		}
+
+		kr_decodestatus_t poll() noexcept override
+		{
+			switch (m_state)
+			{
+			case State::Header:
+			{
+				if (available() < sizeof(BMP_HEADER)) return needMore();
+				BMP_HEADER bfh;
+				memcpy(&bfh, peek(), sizeof(bfh));
+				consume(sizeof(bfh));
+				if (bfh.bfType != "BM"_sig) return fail();
+				if (bfh.bfOffBits < sizeof(bfh) + sizeof(BITMAP_FILE)) return fail();
+				m_infoSize = bfh.bfOffBits - sizeof(bfh);
+				m_state = State::Info;
+			}
+			// fallthrough
+			case State::Info:
+			{
+				if (available() < m_infoSize) return needMore();
+				const BITMAP_FILE* bi = (const BITMAP_FILE*)peek();
+				KrbImageInfo info;
+				if (!getBmpInfo(bi, m_callback->palette, &info)) return fail();
+				m_bottomUp = bi->biHeight > 0;
+				m_lineBytes = info.pitchBytes;
+				m_widthBytes = (size_t)info.width * bi->biBitCount / 8;
+				m_height = info.height;
+				consume(m_infoSize);
+
+				m_rowByRow = m_callback->row != nullptr && !m_bottomUp;
+				info.rowByRow = m_rowByRow;
+				m_dest = (uint8_t*)m_callback->start(m_callback, &info);
+				if (!m_dest) return fail();
+				m_pitchBytes = info.pitchBytes;
+				m_state = State::Rows;
+			}
+			// fallthrough
+			case State::Rows:
+				while (m_y < m_height)
+				{
+					if (available() < m_lineBytes) return needMore();
+					uint32_t y = m_bottomUp ? m_height - 1 - m_y : m_y;
+					uint8_t* dest = m_rowByRow ? m_callback->row(m_callback, y) : m_dest + (size_t)y * m_pitchBytes;
+					if (!dest) return fail();
+					memcpy(dest, peek(), m_widthBytes);
+					consume(m_lineBytes);
+					m_y++;
+				}
+				m_state = State::Done;
+				return DecodeStatusDone;
+			case State::Done:
+				return DecodeStatusDone;
+			default:
+				return DecodeStatusFailed;
+			}
+		}
+
+	private:
+		enum class State
+		{
+			Header,
+			Info,
+			Rows,
+			Done,
+			Failed,
+		};
+
+		kr_decodestatus_t fail() noexcept
+		{
+			m_state = State::Failed;
+			return DecodeStatusFailed;
+		}
+
+		State m_state = State::Header;
+		size_t m_infoSize = 0;
+		size_t m_lineBytes = 0;
+		size_t m_widthBytes = 0;
+		bool m_bottomUp = true;
+		bool m_rowByRow = false;
+		uint32_t m_height = 0;
+		uint32_t m_y = 0;
+		uint8_t* m_dest = nullptr;
+		uint32_t m_pitchBytes = 0;
+	};
+}
+
+bool backend::Bmp::load(KrbImageCallback* callback, KrbFile* file) noexcept
+{
+	uint64_t start = file->tell();
+	BMP_HEADER bfh;
+	if (file->read(&bfh, sizeof(bfh)) != sizeof(bfh)) return false;
+	if (bfh.bfType != "BM"_sig) return false;
+	if (bfh.bfOffBits < sizeof(bfh) + sizeof(BITMAP_FILE)) return false;
+
+	size_t tempBufferSize = bfh.bfOffBits - sizeof(bfh);
+	uint8_t * tempBuffer = (uint8_t*)malloc(tempBufferSize);
+	if (!tempBuffer) return false;
+	BITMAP_FILE * bi = (BITMAP_FILE*)tempBuffer;
+	file->read(tempBuffer, tempBufferSize);
+
+	KrbImageInfo info;
+	if (!getBmpInfo(bi, callback->palette, &info))
+	{
+		free(tempBuffer);
+		return false;
+	}
+
+	size_t widthBytes = info.pitchBytes;
+	size_t totalBytes = widthBytes * info.height;
+	size_t srcWidth = (size_t)info.width * bi->biBitCount / 8;
+	if (callback->row)
+	{
+		// the row output, the bottom-up rows are read by seeking
+		bool bottomUp = bi->biHeight > 0;
+		free(tempBuffer);
+		info.rowByRow = true;
+		if (!callback->start(callback, &info)) return false;
+		for (uint32_t y = 0; y < info.height; y++)
+		{
+			uint8_t* row = callback->row(callback, y);
+			if (!row) return false;
+			uint32_t line = bottomUp ? info.height - 1 - y : y;
+			file->seek_set(start + bfh.bfOffBits + (uint64_t)widthBytes * line);
+			if (file->read(row, srcWidth) != srcWidth) return false;
+		}
+		return true;
+	}
+	if (bi->biSizeImage < totalBytes)
+		bi->biSizeImage = (uint32_t)totalBytes;
+
+	uint8_t * imageBuffer = (uint8_t*)malloc(bi->biSizeImage);
+	if (!imageBuffer)
+	{
+		free(tempBuffer);
+		return false;
+	}
+	file->read(imageBuffer, bi->biSizeImage);
+
+	uint8_t* dest = (uint8_t*)callback->start(callback, &info);
+	if (!dest)
+	{
+		free(imageBuffer);
+		free(tempBuffer);
+		return false;
+	}
+
+	uint8_t* src = imageBuffer;
+	intptr_t srcPitch = (intptr_t)widthBytes;
+	if (bi->biHeight > 0)
+	{
+		src += totalBytes - widthBytes;
+		srcPitch = -srcPitch;
+	}
+	uint8_t* dest_end = dest + (size_t)info.pitchBytes * info.height;
+	while (dest != dest_end)
+	{
+		memcpy(dest, src, srcWidth);
+		dest += info.pitchBytes;
+		src += srcPitch;
+	}
+
+	free(imageBuffer);
+	free(tempBuffer);
+	return true;
+}
+
+KrbImageDecoder* backend::Bmp::createDecoder(KrbImageCallback* callback) noexcept
+{
+	return new(std::nothrow) BmpDecoder(callback);
+}
+
+namespace
+{
+	// every row is at a known offset
+	class BmpRowReader :public backend::RowReader
+	{
+	public:
+		BmpRowReader(KrbFile* file, uint64_t dataPos, size_t lineBytes, size_t widthBytes, uint32_t height, bool bottomUp) noexcept
+			:m_file(file), m_dataPos(dataPos), m_lineBytes(lineBytes), m_widthBytes(widthBytes), m_height(height), m_bottomUp(bottomUp)
+		{
+		}
+
+		uint32_t getBandRows() const noexcept override
+		{
+			return 1;
+		}
+		bool read(uint8_t* dest, size_t pitch, uint32_t y0, uint32_t y1) noexcept override
+		{
+			for (uint32_t y = y0; y < y1; y++)
+			{
+				uint32_t line = m_bottomUp ? m_height - 1 - y : y;
+				m_file->seek_set(m_dataPos + (uint64_t)m_lineBytes * line);
+				if (m_file->read(dest, m_widthBytes) != m_widthBytes) return false;
+				dest += pitch;
+			}
+			return true;
+		}
+
+	private:
+		KrbFile* const m_file;
+		const uint64_t m_dataPos;
+		const size_t m_lineBytes;
+		const size_t m_widthBytes;
+		const uint32_t m_height;
+		const bool m_bottomUp;
+	};
+}
+
+backend::RowReader* backend::Bmp::openRows(KrbFile* file, KrbImageInfo* info, KrbImagePalette* palette) noexcept
+{
+	uint64_t start = file->tell();
+	BMP_HEADER bfh;
+	if (file->read(&bfh, sizeof(bfh)) != sizeof(bfh)) return nullptr;
+	if (bfh.bfType != "BM"_sig) return nullptr;
+	if (bfh.bfOffBits < sizeof(bfh) + sizeof(BITMAP_FILE)) return nullptr;
+
+	size_t infoSize = bfh.bfOffBits - sizeof(bfh);
+	uint8_t* infoBuffer = (uint8_t*)malloc(infoSize);
+	if (!infoBuffer) return nullptr;
+	finally { free(infoBuffer); };
+	if (file->read(infoBuffer, infoSize) != infoSize) return nullptr;
+	const BITMAP_FILE* bi = (const BITMAP_FILE*)infoBuffer;
+	if (!getBmpInfo(bi, palette, info)) return nullptr;
+	size_t widthBytes = (size_t)info->width * bi->biBitCount / 8;
+	return new(std::nothrow) BmpRowReader(file, start + bfh.bfOffBits, info->pitchBytes, widthBytes, info->height, bi->biHeight > 0);
+}
+bool backend::Bmp::probe(KrbFile* file, KrbImageInfo* info) noexcept
+{
+	BMP_HEADER bfh;
+	BITMAP_FILE bi;
+	if (file->read(&bfh, sizeof(bfh)) != sizeof(bfh)) return false;
+	if (bfh.bfType != "BM"_sig) return false;
+	if (bfh.bfOffBits < sizeof(bfh) + sizeof(BITMAP_FILE)) return false;
+	if (file->read(&bi, sizeof(bi)) != sizeof(bi)) return false;
+	return getBmpInfo(&bi, nullptr, info);
+}
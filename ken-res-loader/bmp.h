@@ -0,0 +1,23 @@
+#pragma once
+
+#include "include/common.h"
+#include "include/image.h"
+
+namespace kr
+{
+	namespace backend
+	{
+		class RowReader;
+
+		class Bmp
+		{
+		public:
+			static bool load(KrbImageCallback* callback, KrbFile* file) noexcept;
+			static KrbImageDecoder* createDecoder(KrbImageCallback* callback) noexcept;
+			// nullptr if the file cannot seek to the rows, the file is left anywhere
+			static RowReader* openRows(KrbFile* file, KrbImageInfo* info, KrbImagePalette* palette) noexcept;
+			// the header only, the file is left anywhere
+			static bool probe(KrbFile* file, KrbImageInfo* info) noexcept;
+		};
+	}
+}
@@ -6,8 +6,87 @@
 
 #include "include/common.h"
 
+#include <new>
+
+#ifdef _MSC_VER
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 using namespace kr;
 
+namespace
+{
+	struct MemoryFile
+	{
+		const uint8_t* data;
+		uint64_t size;
+		uint64_t pos;
+		bool mapped; // unmapped by close
+	};
+
+	void seekMemory(KrbFile* fp, uint64_t pos) noexcept
+	{
+		MemoryFile* file = (MemoryFile*)fp->param;
+		file->pos = pos < file->size ? pos : file->size;
+	}
+
+	const KrbFileVFTable memoryVftable = {
+		[](KrbFile* fp, const void* data, size_t size) {
+		},
+		[](KrbFile* fp, void* data, size_t size)->size_t {
+			MemoryFile* file = (MemoryFile*)fp->param;
+			uint64_t left = file->size - file->pos;
+			if (size > left) size = (size_t)left;
+			memcpy(data, file->data + file->pos, size);
+			file->pos += size;
+			return size;
+		},
+		[](KrbFile* fp)->uint64_t {
+			return ((MemoryFile*)fp->param)->pos;
+		},
+		[](KrbFile* fp, uint64_t pos) {
+			seekMemory(fp, pos);
+		},
+		[](KrbFile* fp, uint64_t pos) {
+			seekMemory(fp, ((MemoryFile*)fp->param)->pos + pos);
+		},
+		[](KrbFile* fp, uint64_t pos) {
+			seekMemory(fp, ((MemoryFile*)fp->param)->size + pos);
+		},
+		[](KrbFile* fp) {
+			MemoryFile* file = (MemoryFile*)fp->param;
+			if (file->mapped)
+			{
+#ifdef _MSC_VER
+				UnmapViewOfFile(file->data);
+#else
+				munmap((void*)file->data, (size_t)file->size);
+#endif
+			}
+			delete file;
+		},
+	};
+
+	bool openMemory(KrbFile* fp, const void* data, uint64_t size, bool mapped) noexcept
+	{
+		MemoryFile* file = new(std::nothrow) MemoryFile;
+		if (!file) return false;
+		file->data = (const uint8_t*)data;
+		file->size = size;
+		file->pos = 0;
+		file->mapped = mapped;
+		fp->param = file;
+		fp->vftable = &memoryVftable;
+		return true;
+	}
+}
+
 const KrbFileVFTable vftable = {
 	[](KrbFile * fp, const void* data, size_t size) {
 		fwrite(data, 1, size, (FILE*)fp->param);
@@ -60,3 +139,59 @@ bool KEN_EXTERNAL kr::krb_fopen(KrbFile* fp, const fchar_t* path, const fchar_t*
 	fp->vftable = &vftable;
 	return true;
 }
+const void* KEN_EXTERNAL kr::krb_fmapped(KrbFile* fp, uint64_t pos, size_t size)
+{
+	if (fp->vftable != &memoryVftable) return nullptr;
+	MemoryFile* file = (MemoryFile*)fp->param;
+	if (pos > file->size || size > file->size - pos) return nullptr;
+	return file->data + pos;
+}
+bool KEN_EXTERNAL kr::krb_mopen(KrbFile* fp, const void* data, size_t size)
+{
+	return openMemory(fp, data, size, false);
+}
+bool KEN_EXTERNAL kr::krb_fmap(KrbFile* fp, const fchar_t* path)
+{
+	void* data;
+	uint64_t size;
+#ifdef _MSC_VER
+	HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	size = fileSize.QuadPart;
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping) return false;
+	data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping); // the view keeps the mapping
+	if (!data) return false;
+#else
+	int file = open(path, O_RDONLY);
+	if (file < 0) return false;
+	struct stat st;
+	if (fstat(file, &st) != 0 || st.st_size == 0)
+	{
+		close(file);
+		return false;
+	}
+	size = st.st_size;
+	data = mmap(nullptr, (size_t)size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (data == MAP_FAILED) return false;
+#endif
+	if (!openMemory(fp, data, size, true))
+	{
+#ifdef _MSC_VER
+		UnmapViewOfFile(data);
+#else
+		munmap(data, (size_t)size);
+#endif
+		return false;
+	}
+	return true;
+}
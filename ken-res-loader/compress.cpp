@@ -16,6 +16,10 @@ bool KEN_EXTERNAL kr::krb_load_compress(KrbExtension extension, KrbCompressCallb
 	}
 	return false;
 }
+bool KEN_EXTERNAL kr::krb_load_compress_auto(KrbCompressCallback* callback, KrbFile* file)
+{
+	return krb_load_compress(krb_sniff(file), callback, file);
+}
 //bool KEN_EXTERNAL kr::krb_save_compress(KrbExtension extension, const KrbImageSaveInfo* info, KrbFile* file)
 //{
 //	switch (extension)
@@ -2,144 +2,738 @@
 #include "kpng.h"
 #include "jpeg.h"
 #include "tga.h"
+#include "bmp.h"
+#include "texture.h"
+#include "tiled.h"
+#include "lazyimage.h"
+#include "qoi.h"
+#include "mipmap.h"
+#include "bcn.h"
+#include "pixelconvert.h"
+#include "layout.h"
+#include "parallel.h"
+#include "resample.h"
+#include "imagedecoder.h"
 #include "util.h"
 
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <memory>
+#include <new>
+#include <vector>
 
 using namespace kr;
 
-#pragma pack(push, 1)
-struct BMP_HEADER {
-	uint16_t    bfType;
-	uint32_t    bfSize;
-	uint16_t    bfReserved1;
-	uint16_t    bfReserved2;
-	uint32_t    bfOffBits;
-};
-
-struct BITMAP_FILE
-{
-	uint32_t      biSize;
-	int32_t       biWidth;
-	int32_t       biHeight;
-	uint16_t      biPlanes;
-	uint16_t      biBitCount;
-	uint32_t      biCompression;
-	uint32_t      biSizeImage;
-	int32_t       biXPelsPerMeter;
-	int32_t       biYPelsPerMeter;
-	uint32_t      biClrUsed;
-	uint32_t      biClrImportant;
-
-	void* getBits() const noexcept
+namespace
+{
+	bool loadImage(KrbExtension extension, KrbImageCallback* callback, KrbFile* file) noexcept
 	{
-		return (uint8_t*)this + biSize;
+		switch (extension)
+		{
+		case KrbExtension::ImagePng:
+			return kr::backend::Png::load(callback, file);
+		case KrbExtension::ImageJpeg:
+		case KrbExtension::ImageJpg:
+			return kr::backend::Jpeg::load(callback, file);
+		case KrbExtension::ImageTga:
+			return kr::backend::Tga::load(callback, file);
+		case KrbExtension::ImageBmp:
+			return kr::backend::Bmp::load(callback, file);
+		case KrbExtension::ImageDds:
+		case KrbExtension::ImageKtx2:
+			return kr::backend::Texture::load(extension, callback, file);
+		case KrbExtension::ImageQoi:
+			return kr::backend::Qoi::load(callback, file);
+		default:
+			return false;
+		}
 	}
-	uint32_t getLineBytes() const noexcept
+
+	// sets mipLevels before the user start and keeps the buffer for the mip stage
+	// the levels of the files with mipmaps are kept, the info is kept for KrbImageCallback::finish
+	class MipmapCallback :public KrbImageCallback
 	{
-		return (biWidth * biBitCount + 31) >> 5 << 2;
-	}
-	const KrbImagePalette* getPalette() const noexcept
+	public:
+		MipmapCallback(KrbImageCallback* user) noexcept
+			:m_user(user), m_buffer(nullptr)
+		{
+			start = [](KrbImageCallback* _this, KrbImageInfo* info)->void* {
+				MipmapCallback* callback = static_cast<MipmapCallback*>(_this);
+				if (callback->m_user->mipFilter != ImageFilterNone && info->layout == ImageLayoutLinear)
+				{
+					if (info->mipLevels <= 1) info->mipLevels = kr::backend::Mipmap::getLevelCount(info->pixelformat, info->width, info->height);
+					else callback->m_loaded = true;
+				}
+				callback->m_buffer = callback->m_user->start(callback->m_user, info);
+				callback->m_info = *info;
+				return callback->m_buffer;
+			};
+			if (user->progress)
+			{
+				progress = [](KrbImageCallback* _this, uint32_t pass, bool final) {
+					MipmapCallback* callback = static_cast<MipmapCallback*>(_this);
+					callback->m_user->progress(callback->m_user, pass, final);
+				};
+			}
+			if (user->row && user->mipFilter == ImageFilterNone)
+			{
+				row = [](KrbImageCallback* _this, uint32_t y)->uint8_t* {
+					MipmapCallback* callback = static_cast<MipmapCallback*>(_this);
+					return callback->m_user->row(callback->m_user, y);
+				};
+			}
+			palette = user->palette;
+			flags = user->flags;
+			requestFormat = user->requestFormat;
+		}
+
+		bool finish() noexcept
+		{
+			if (!m_buffer) return false;
+			if (m_loaded || m_user->mipFilter == ImageFilterNone || m_info.layout != ImageLayoutLinear) return true;
+			return kr::backend::Mipmap::generate(&m_info, m_buffer, m_user->mipFilter, m_user->flags);
+		}
+
+		const KrbImageInfo& info() const noexcept
+		{
+			return m_info;
+		}
+
+	private:
+		KrbImageCallback* const m_user;
+		KrbImageInfo m_info;
+		void* m_buffer;
+		bool m_loaded = false; // the levels came from the file
+	};
+
+	// gathers the statistics of the decoded pixels for KrbImageCallback::finish
+	// a row is scanned when the next one is requested, the loaders without the row output are scanned after the load
+	class StatisticsCallback :public KrbImageCallback
 	{
-		return (KrbImagePalette*)((uint8_t*)this + sizeof(BITMAP_FILE));
-	}
-};
+	public:
+		StatisticsCallback(KrbImageCallback* next) noexcept
+			:m_next(next)
+		{
+			start = [](KrbImageCallback* _this, KrbImageInfo* info)->void* {
+				return static_cast<StatisticsCallback*>(_this)->onStart(info);
+			};
+			row = [](KrbImageCallback* _this, uint32_t y)->uint8_t* {
+				return static_cast<StatisticsCallback*>(_this)->onRow(y);
+			};
+			palette = next->palette ? next->palette : &m_palette;
+			flags = next->flags;
+			requestFormat = next->requestFormat;
+		}
 
-#pragma pack(pop)
+		bool finish() noexcept
+		{
+			if (!m_buffer) return false;
+			if (m_pending)
+			{
+				m_pending = false;
+				m_statistics.addRow(m_line, m_width);
+			}
+			else if (!m_rowByRow)
+			{
+				for (uint32_t y = 0; y < m_height; y++)
+				{
+					m_statistics.addRow(m_buffer + (size_t)m_pitchBytes * y, m_width);
+				}
+			}
+			return true;
+		}
 
+		void get(KrbImageInfo* info) const noexcept
+		{
+			m_statistics.get(info, palette);
+		}
 
+	private:
+		void* onStart(KrbImageInfo* info) noexcept
+		{
+			// the rows pass through to the next stage
+			m_rowByRow = info->rowByRow;
+			m_nextRows = m_rowByRow && m_next->row != nullptr;
+			info->rowByRow = m_nextRows;
+			m_buffer = (uint8_t*)m_next->start(m_next, info);
+			if (!m_buffer) return nullptr;
+			if (!m_statistics.init(info->pixelformat)) m_rowByRow = true; // nothing to scan
+			m_width = info->width;
+			m_height = info->height;
+			m_pitchBytes = info->pitchBytes;
+			return m_buffer;
+		}
 
-bool KEN_EXTERNAL kr::krb_load_image(KrbExtension extension, KrbImageCallback* callback, KrbFile* file)
-{
-	switch (extension)
+		uint8_t* onRow(uint32_t y) noexcept
+		{
+			if (m_pending) m_statistics.addRow(m_line, m_width);
+			m_line = m_nextRows ? m_next->row(m_next, y) : m_buffer + (size_t)m_pitchBytes * y;
+			m_pending = m_line != nullptr;
+			return m_line;
+		}
+
+		KrbImageCallback* const m_next;
+		KrbImagePalette m_palette;
+		kr::backend::PixelStatistics m_statistics;
+		uint8_t* m_buffer = nullptr;
+		uint32_t m_pitchBytes = 0;
+		uint32_t m_width = 0;
+		uint32_t m_height = 0;
+
+		bool m_rowByRow = false;
+		bool m_nextRows = false; // the rows are the row output of the next stage
+		uint8_t* m_line = nullptr; // the row being written
+		bool m_pending = false;
+	};
+
+	// arranges the rows as KrbImageCallback::layout, a band of rows at a time
+	// the rows of the sequential loaders are gathered to a band, the others are decoded to a full size buffer first
+	class LayoutCallback :public KrbImageCallback
 	{
-	case KrbExtension::ImagePng:
-		return kr::backend::Png::load(callback, file);
-	case KrbExtension::ImageJpeg:
-	case KrbExtension::ImageJpg:
-		return kr::backend::Jpeg::load(callback, file);
-	case KrbExtension::ImageTga:
-		return kr::backend::Tga::load(callback, file);
-	case KrbExtension::ImageBmp:
+	public:
+		LayoutCallback(KrbImageCallback* next, const KrbImageCallback* user) noexcept
+			:m_next(next), m_request(user->layout)
+		{
+			start = [](KrbImageCallback* _this, KrbImageInfo* info)->void* {
+				return static_cast<LayoutCallback*>(_this)->onStart(info);
+			};
+			row = [](KrbImageCallback* _this, uint32_t y)->uint8_t* {
+				return static_cast<LayoutCallback*>(_this)->onRow(y);
+			};
+			palette = next->palette;
+			flags = user->flags;
+			requestFormat = next->requestFormat;
+		}
+
+		bool finish() noexcept
+		{
+			if (!m_arranging) return m_buffer != nullptr;
+			uint32_t band = m_layout.getBandRows();
+			if (m_rowByRow)
+			{
+				if (m_rows != m_height) return false;
+				uint32_t y = (m_height - 1) / band * band;
+				m_layout.writeBand(m_buffer, m_source.data(), m_sourcePitch, y, m_height - y);
+				return true;
+			}
+			for (uint32_t y = 0; y < m_height; y += band)
+			{
+				uint32_t rows = m_height - y < band ? m_height - y : band;
+				m_layout.writeBand(m_buffer, m_source.data() + m_sourcePitch * y, m_sourcePitch, y, rows);
+			}
+			return true;
+		}
+
+	private:
+		void* onStart(KrbImageInfo* info) noexcept
+		{
+			bool rowByRow = info->rowByRow;
+			info->rowByRow = false;
+
+			if (m_request == ImageLayoutLinear || !kr::backend::ImageLayout::isSupported(m_request, info->pixelformat))
+			{
+				// loaded as is
+				m_buffer = (uint8_t*)m_next->start(m_next, info);
+				m_destPitch = info->pitchBytes;
+				return m_buffer;
+			}
+
+			info->mipLevels = 1;
+			KrbImageInfo dest = *info;
+			dest.layout = m_request;
+			if (!m_layout.init(&dest)) return nullptr;
+			m_buffer = (uint8_t*)m_next->start(m_next, &dest);
+			if (!m_buffer) return nullptr;
+			m_arranging = true;
+			m_rowByRow = rowByRow;
+			m_height = info->height;
+			m_sourcePitch = info->pitchBytes;
+
+			try
+			{
+				// a band of rows, or the full image
+				m_source.resize(m_sourcePitch * (rowByRow ? m_layout.getBandRows() : info->height));
+				return m_source.data();
+			}
+			catch (...)
+			{
+				return nullptr;
+			}
+		}
+
+		uint8_t* onRow(uint32_t y) noexcept
+		{
+			if (!m_arranging) return m_buffer + (size_t)m_destPitch * y;
+			uint32_t band = m_layout.getBandRows();
+			if (y != m_rows) return nullptr;
+			m_rows++;
+			if (y != 0 && y % band == 0) m_layout.writeBand(m_buffer, m_source.data(), m_sourcePitch, y - band, band);
+			return m_source.data() + m_sourcePitch * (y % band);
+		}
+
+		KrbImageCallback* const m_next;
+		const kr_imagelayout_t m_request;
+		kr::backend::ImageLayout m_layout;
+		uint8_t* m_buffer = nullptr;
+		uint32_t m_destPitch = 0;
+		bool m_arranging = false;
+
+		bool m_rowByRow = false;
+		uint32_t m_height = 0;
+		uint32_t m_rows = 0; // the rows requested
+		std::vector<uint8_t> m_source; // the band being written, or the full image of the loaders without the row output
+		size_t m_sourcePitch = 0;
+	};
+
+	// premultiplies the alpha and converts to linear float as the rows come from the loader
+	// the rows are passed on to the row output of the next stage while they are in cache
+	class ConvertCallback :public KrbImageCallback
 	{
-		BMP_HEADER bfh;
-		file->read(&bfh, sizeof(bfh));
-		if (bfh.bfType != "BM"_sig) return false;
-
-		size_t tempBufferSize = bfh.bfOffBits - sizeof(bfh);
-		uint8_t * tempBuffer = (uint8_t*)malloc(tempBufferSize);
-		BITMAP_FILE * bi = (BITMAP_FILE*)tempBuffer;
-		file->read(tempBuffer, tempBufferSize);
-
-		size_t widthBytes = (bi->biWidth * bi->biBitCount + 7) / 8;
-		widthBytes = (widthBytes + 3) & ~3;
-		size_t totalBytes = widthBytes * bi->biHeight;
-		if (bi->biSizeImage == 0)
-			bi->biSizeImage = (int)totalBytes;
-
-		uint8_t * imageBuffer = (uint8_t*)malloc(bi->biSizeImage);
-		file->read(imageBuffer, bi->biSizeImage);
-
-		KrbImageInfo info;
-		info.width = bi->biWidth;
-		info.height = bi->biHeight;
-		info.pitchBytes = (uint32_t)widthBytes;
-
-		switch (bi->biBitCount)
-		{
-		case 8:
-			info.pixelformat = PixelFormatIndex;
-			assert(callback->palette);
-			memcpy(callback->palette->color, bi->getPalette(), sizeof(uint32_t) * 256);
-			for (uint32_t& v : callback->palette->color)
-			{
-				((uint8_t*)& v)[3] = 0xff;
-			}
-			break;
-		case 16:
-			info.pixelformat = PixelFormatX1RGB5;
-			break;
-		case 24:
-			info.pixelformat = PixelFormatRGB8;
-			break;
-		case 32:
-			info.pixelformat = PixelFormatARGB8;
-			break;
-		default:
-			assert(!"Not Supported Yet");
-			free(imageBuffer);
-			free(tempBuffer);
-			return false;
+	public:
+		ConvertCallback(KrbImageCallback* next, const KrbImageCallback* user) noexcept
+			:m_next(next), m_user(user)
+		{
+			start = [](KrbImageCallback* _this, KrbImageInfo* info)->void* {
+				return static_cast<ConvertCallback*>(_this)->onStart(info);
+			};
+			row = [](KrbImageCallback* _this, uint32_t y)->uint8_t* {
+				return static_cast<ConvertCallback*>(_this)->onRow(y);
+			};
+			palette = next->palette ? next->palette : &m_palette;
+			flags = user->flags;
+			// [R,G,B,A] converts without swizzling
+			requestFormat = (user->flags & ImageFlagSrgbToLinear) ? PixelFormatABGR8 : next->requestFormat;
 		}
 
-		uint8_t* dest = (uint8_t*)callback->start(callback, &info);
-		if (!dest)
+		bool finish() noexcept
 		{
-			free(imageBuffer);
-			free(tempBuffer);
-			return false;
+			if (!m_converter) return m_buffer != nullptr;
+			if (m_pending)
+			{
+				m_pending = false;
+				return flushRow();
+			}
+			if (m_rowByRow) return m_rows == m_height;
+
+			// the loaders without the row output
+			const uint8_t* line = m_source.empty() ? m_buffer : m_source.data();
+			for (uint32_t y = 0; y < m_height; y++, line += m_sourcePitch)
+			{
+				m_converter->convert(m_buffer + (size_t)m_destPitch * y, line, m_width);
+			}
+			return true;
+		}
+
+	private:
+		void* onStart(KrbImageInfo* info) noexcept
+		{
+			bool rowByRow = info->rowByRow;
+			info->rowByRow = false;
+
+			m_converter.reset(new(std::nothrow) kr::backend::PixelConverter(info->pixelformat, m_user->requestFormat, flags, palette));
+			if (!m_converter) return nullptr;
+			if (m_converter->destFormat() == PixelFormatInvalid)
+			{
+				// loaded as is
+				m_converter.reset();
+				m_buffer = (uint8_t*)m_next->start(m_next, info);
+				m_destPitch = info->pitchBytes;
+				return m_buffer;
+			}
+
+			m_width = info->width;
+			m_height = info->height;
+			m_nextRows = rowByRow && m_next->row != nullptr;
+			// the levels of the file are not converted
+			info->mipLevels = 1;
+			KrbImageInfo dest = *info;
+			if (!m_converter->isInPlace())
+			{
+				dest.pixelformat = m_converter->destFormat();
+				dest.pitchBytes = kr::backend::Mipmap::getLevelPitch(dest.pixelformat, dest.width);
+			}
+			dest.rowByRow = m_nextRows;
+			m_buffer = (uint8_t*)m_next->start(m_next, &dest);
+			if (!m_buffer) return nullptr;
+			// the loader writes to the destination pitch in place
+			if (m_converter->isInPlace()) info->pitchBytes = dest.pitchBytes;
+			m_destPitch = dest.pitchBytes;
+			m_sourcePitch = info->pitchBytes;
+			m_rowByRow = rowByRow;
+
+			try
+			{
+				// the loader writes to the destination, the rows are premultiplied there
+				if (m_converter->isInPlace()) return m_buffer;
+				if (rowByRow)
+				{
+					m_staging.resize(info->pitchBytes);
+					return m_staging.data();
+				}
+				m_source.resize((size_t)info->pitchBytes * info->height);
+				return m_source.data();
+			}
+			catch (...)
+			{
+				return nullptr;
+			}
 		}
 
-		size_t srcWidth = info.width * bi->biBitCount / 8;
-		uint8_t* src = imageBuffer + totalBytes * info.height - widthBytes;
-		uint8_t* dest_end = dest + totalBytes;
-		while (dest != dest_end)
+		uint8_t* onRow(uint32_t y) noexcept
 		{
-			memcpy(dest, src, srcWidth);
-			dest += info.pitchBytes;
-			src -= widthBytes;
+			if (!m_converter) return m_buffer + (size_t)m_destPitch * y;
+			if (m_pending && !flushRow()) return nullptr;
+			m_pending = true;
+			if (!m_converter->isInPlace()) return m_staging.data();
+			m_line = destRow(y);
+			return m_line;
 		}
 
-		free(imageBuffer);
-		free(tempBuffer);
-		return true;
-	}
-	default:
-		return false;
+		uint8_t* destRow(uint32_t y) noexcept
+		{
+			if (m_nextRows) return m_next->row(m_next, y);
+			return m_buffer + (size_t)m_destPitch * y;
+		}
+
+		// converts the row written last
+		bool flushRow() noexcept
+		{
+			if (m_rows == m_height) return false;
+			uint32_t y = m_rows++;
+			if (m_converter->isInPlace())
+			{
+				m_converter->convert(m_line, m_line, m_width);
+				return true;
+			}
+			uint8_t* dest = destRow(y);
+			if (!dest) return false;
+			m_converter->convert(dest, m_staging.data(), m_width);
+			return true;
+		}
+
+		KrbImageCallback* const m_next;
+		const KrbImageCallback* const m_user;
+		KrbImagePalette m_palette;
+		std::unique_ptr<kr::backend::PixelConverter> m_converter;
+		uint8_t* m_buffer = nullptr;
+		uint32_t m_destPitch = 0;
+		uint32_t m_width = 0;
+		uint32_t m_height = 0;
+
+		bool m_rowByRow = false;
+		bool m_nextRows = false; // the converted rows go to the row output of the next stage
+		uint32_t m_rows = 0; // the rows converted
+		uint8_t* m_line = nullptr; // the in-place row being written
+
+		std::vector<uint8_t> m_staging; // the row being written
+		bool m_pending = false;
+		std::vector<uint8_t> m_source; // the full image of the loaders without the row output
+		uint32_t m_sourcePitch = 0;
+	};
+
+	// resamples the decoded rows into the buffer of the next callback
+	// the rows of the sequential loaders are resampled as they come, the others are decoded to a full size buffer first
+	class ResizeCallback :public KrbImageCallback
+	{
+	public:
+		ResizeCallback(KrbImageCallback* next, const KrbImageCallback* user) noexcept
+			:m_next(next), m_user(user)
+		{
+			start = [](KrbImageCallback* _this, KrbImageInfo* info)->void* {
+				return static_cast<ResizeCallback*>(_this)->onStart(info);
+			};
+			row = [](KrbImageCallback* _this, uint32_t y)->uint8_t* {
+				return static_cast<ResizeCallback*>(_this)->onRow(y);
+			};
+			palette = next->palette;
+			flags = user->flags;
+			requestFormat = next->requestFormat;
+			targetWidth = user->targetWidth;
+			targetHeight = user->targetHeight;
+		}
+
+		bool finish() noexcept
+		{
+			if (!m_resampler) return m_buffer != nullptr;
+			if (m_pending)
+			{
+				m_pending = false;
+				if (!m_resampler->push(m_staging.data())) return false;
+			}
+			else
+			{
+				for (uint8_t* line = m_source.data(); line != m_source.data() + m_source.size(); line += m_pitchBytes)
+				{
+					if (!m_resampler->push(line)) return false;
+				}
+			}
+			return m_resampler->isComplete();
+		}
+
+	private:
+		void* onStart(KrbImageInfo* info) noexcept
+		{
+			bool rowByRow = info->rowByRow;
+			info->rowByRow = false;
+
+			uint32_t width = targetWidth;
+			uint32_t height = targetHeight;
+			kr::backend::Resampler::getTargetSize(info->width, info->height, &width, &height);
+			kr::backend::ResampleFormat format;
+			if (!kr::backend::ResampleFormat::get(info->pixelformat, &format) || (width == info->width && height == info->height))
+			{
+				// loaded as is
+				m_buffer = (uint8_t*)m_next->start(m_next, info);
+				m_pitchBytes = info->pitchBytes;
+				return m_buffer;
+			}
+
+			// the levels of the file are not resized
+			info->mipLevels = 1;
+			KrbImageInfo dest = *info;
+			dest.width = width;
+			dest.height = height;
+			dest.pitchBytes = width * format.size;
+			m_buffer = (uint8_t*)m_next->start(m_next, &dest);
+			if (!m_buffer) return nullptr;
+
+			try
+			{
+				m_resampler.reset(new(std::nothrow) kr::backend::Resampler(format, flags));
+				if (!m_resampler) return nullptr;
+				if (!m_resampler->init(info->width, info->height, width, height, m_user->resizeFilter, m_buffer, dest.pitchBytes)) return nullptr;
+				if (rowByRow)
+				{
+					m_staging.resize((size_t)info->width * format.size);
+					return m_staging.data();
+				}
+				m_pitchBytes = info->pitchBytes;
+				m_source.resize((size_t)info->pitchBytes * info->height);
+				return m_source.data();
+			}
+			catch (...)
+			{
+				return nullptr;
+			}
+		}
+
+		uint8_t* onRow(uint32_t y) noexcept
+		{
+			if (!m_resampler) return m_buffer + (size_t)m_pitchBytes * y;
+			if (m_pending && !m_resampler->push(m_staging.data())) return nullptr;
+			m_pending = true;
+			return m_staging.data();
+		}
+
+		KrbImageCallback* const m_next;
+		const KrbImageCallback* const m_user;
+		uint8_t* m_buffer = nullptr;
+		uint32_t m_pitchBytes = 0;
+
+		std::unique_ptr<kr::backend::Resampler> m_resampler;
+		std::vector<uint8_t> m_staging; // the row being written
+		bool m_pending = false;
+		std::vector<uint8_t> m_source; // the full image of the loaders without the row output
+	};
+
+	// encodes the rows to the block format of requestFormat, a band of block rows at a time
+	// the rows are converted to [R,G,B,A] and the blocks of a band are encoded in parallel
+	class CompressCallback :public KrbImageCallback
+	{
+	public:
+		static constexpr uint32_t BAND_BLOCK_ROWS = 16;
+
+		CompressCallback(KrbImageCallback* next, const KrbImageCallback* user) noexcept
+			:m_next(next), m_format(user->requestFormat), m_preset(user->bcPreset)
+		{
+			start = [](KrbImageCallback* _this, KrbImageInfo* info)->void* {
+				return static_cast<CompressCallback*>(_this)->onStart(info);
+			};
+			row = [](KrbImageCallback* _this, uint32_t y)->uint8_t* {
+				return static_cast<CompressCallback*>(_this)->onRow(y);
+			};
+			palette = user->palette ? user->palette : &m_palette;
+			flags = user->flags;
+			requestFormat = PixelFormatABGR8; // [R,G,B,A] as is
+		}
+
+		bool finish() noexcept
+		{
+			if (!m_encoding) return m_buffer != nullptr;
+			if (m_pending)
+			{
+				m_pending = false;
+				pushRow(m_staging.data());
+			}
+			else
+			{
+				for (uint8_t* line = m_source.data(); line != m_source.data() + m_source.size(); line += m_sourcePitch)
+				{
+					pushRow(line);
+				}
+			}
+			if (m_rows != m_height) return false;
+
+			// the last block row repeats the last row
+			uint32_t filled = m_rows - m_encodedBlockRows * 4;
+			if (filled != 0)
+			{
+				for (uint32_t y = filled; y % 4 != 0; y++)
+				{
+					memcpy(m_band.data() + m_bandPitch * y, m_band.data() + m_bandPitch * (filled - 1), m_bandPitch);
+				}
+				encodeBand((filled + 3) / 4);
+			}
+			return true;
+		}
+
+	private:
+		void* onStart(KrbImageInfo* info) noexcept
+		{
+			bool rowByRow = info->rowByRow;
+			info->rowByRow = false;
+
+			if (!kr::backend::BcEncoder::isSourceFormat(info->pixelformat))
+			{
+				// loaded as is
+				m_buffer = (uint8_t*)m_next->start(m_next, info);
+				m_destPitch = info->pitchBytes;
+				return m_buffer;
+			}
+
+			m_sourceFormat = info->pixelformat;
+			m_width = info->width;
+			m_height = info->height;
+			uint32_t blocksX = (info->width + 3) / 4;
+			info->mipLevels = 1;
+			KrbImageInfo dest = *info;
+			dest.pixelformat = m_format;
+			dest.pitchBytes = blocksX * kr::backend::BcEncoder::getBlockBytes(m_format);
+			m_buffer = (uint8_t*)m_next->start(m_next, &dest);
+			if (!m_buffer) return nullptr;
+			m_destPitch = dest.pitchBytes;
+			m_encoding = true;
+
+			try
+			{
+				m_bandPitch = (size_t)blocksX * 16;
+				m_band.resize(m_bandPitch * BAND_BLOCK_ROWS * 4);
+				if (rowByRow)
+				{
+					m_staging.resize(info->pitchBytes);
+					return m_staging.data();
+				}
+				m_sourcePitch = info->pitchBytes;
+				m_source.resize((size_t)info->pitchBytes * info->height);
+				return m_source.data();
+			}
+			catch (...)
+			{
+				return nullptr;
+			}
+		}
+
+		uint8_t* onRow(uint32_t y) noexcept
+		{
+			if (!m_encoding) return m_buffer + (size_t)m_destPitch * y;
+			if (m_pending) pushRow(m_staging.data());
+			m_pending = true;
+			return m_staging.data();
+		}
+
+		void pushRow(const uint8_t* line) noexcept
+		{
+			if (m_rows == m_height) return;
+			uint32_t y = m_rows++ - m_encodedBlockRows * 4;
+			uint8_t* dest = m_band.data() + m_bandPitch * y;
+			kr::backend::BcEncoder::convertRow(dest, line, m_sourceFormat, m_width, palette);
+
+			// the last block column repeats the last pixel
+			for (size_t x = (size_t)m_width * 4; x < m_bandPitch; x += 4)
+			{
+				memcpy(dest + x, dest + x - 4, 4);
+			}
+			if (y + 1 == BAND_BLOCK_ROWS * 4) encodeBand(BAND_BLOCK_ROWS);
+		}
+
+		void encodeBand(uint32_t blockRows) noexcept
+		{
+			uint8_t* dest = m_buffer + (size_t)m_destPitch * m_encodedBlockRows;
+			uint32_t width = (uint32_t)(m_bandPitch / 4);
+			kr::backend::parallelFor(blockRows, [&](uint32_t i) {
+				kr::backend::BcEncoder::encodeBlockRow(m_format, m_preset, dest + (size_t)m_destPitch * i, m_band.data() + m_bandPitch * 4 * i, m_bandPitch, width);
+			});
+			m_encodedBlockRows += blockRows;
+		}
+
+		KrbImageCallback* const m_next;
+		const kr_pixelformat_t m_format;
+		const kr_bcpreset_t m_preset;
+		KrbImagePalette m_palette;
+		uint8_t* m_buffer = nullptr;
+		uint32_t m_destPitch = 0;
+		bool m_encoding = false;
+
+		kr_pixelformat_t m_sourceFormat = PixelFormatInvalid;
+		uint32_t m_width = 0;
+		uint32_t m_height = 0;
+		uint32_t m_rows = 0; // the rows pushed
+		uint32_t m_encodedBlockRows = 0;
+		std::vector<uint8_t> m_band; // [R,G,B,A] rows of the band, the width is padded to the block
+		size_t m_bandPitch = 0;
+
+		std::vector<uint8_t> m_staging; // the row being written
+		bool m_pending = false;
+		std::vector<uint8_t> m_source; // the full image of the loaders without the row output
+		uint32_t m_sourcePitch = 0;
+	};
+}
+
+bool KEN_EXTERNAL kr::krb_load_image(KrbExtension extension, KrbImageCallback* callback, KrbFile* file)
+{
+	// the loader -> statistics -> premultiply and linear -> resize -> block compression -> layout -> mip chain -> the user
+	KrbImageCallback* target = callback;
+	MipmapCallback mipmap(callback);
+	bool wrapping = callback->mipFilter != ImageFilterNone || callback->finish;
+	if (wrapping) target = &mipmap;
+	LayoutCallback layout(target, callback);
+	bool arranging = callback->layout != ImageLayoutLinear;
+	if (arranging) target = &layout;
+	CompressCallback compress(target, callback);
+	bool compressing = kr::backend::BcEncoder::getBlockBytes(callback->requestFormat) != 0;
+	if (compressing) target = &compress;
+	ResizeCallback resize(target, callback);
+	bool resizing = callback->targetWidth != 0 || callback->targetHeight != 0;
+	if (resizing) target = &resize;
+	ConvertCallback convert(target, callback);
+	bool converting = (callback->flags & (ImageFlagPremultiplyAlpha | ImageFlagSrgbToLinear)) != 0;
+	if (converting) target = &convert;
+	StatisticsCallback statistics(target);
+	if (callback->finish) target = &statistics;
+
+	if (!loadImage(extension, target, file)) return false;
+	if (callback->finish && !statistics.finish()) return false;
+	if (converting && !convert.finish()) return false;
+	if (resizing && !resize.finish()) return false;
+	if (compressing && !compress.finish()) return false;
+	if (arranging && !layout.finish()) return false;
+	if (wrapping && !mipmap.finish()) return false;
+	if (callback->finish)
+	{
+		KrbImageInfo info = mipmap.info();
+		statistics.get(&info);
+		callback->finish(callback, &info);
 	}
-	return false;
+	return true;
+}
+bool KEN_EXTERNAL kr::krb_load_image_auto(KrbImageCallback* callback, KrbFile* file)
+{
+	return krb_load_image(krb_sniff(file), callback, file);
+}
+size_t KEN_EXTERNAL kr::krb_image_level_offset(const KrbImageInfo* info, uint32_t level)
+{
+	return kr::backend::Mipmap::getLevelOffset(info, level);
 }
 bool KEN_EXTERNAL kr::krb_save_image(KrbExtension extension, const KrbImageSaveInfo* info, KrbFile* file)
 {
@@ -152,6 +746,8 @@ bool KEN_EXTERNAL kr::krb_save_image(KrbExtension extension, const KrbImageSaveI
 		return kr::backend::Jpeg::save(info, file);
 	case KrbExtension::ImageTga:
 		return kr::backend::Tga::save(info, file);
+	case KrbExtension::ImageQoi:
+		return kr::backend::Qoi::save(info, file);
 	case KrbExtension::ImageBmp:
 		assert(!"Not implemented yet");
 		//BMP_HEADER bfh;
@@ -233,3 +829,107 @@ bool KEN_EXTERNAL kr::krb_save_image(KrbExtension extension, const KrbImageSaveI
 	assert(!"Not supported yet");
 	return false;
 }
+bool KEN_EXTERNAL kr::krb_transform_jpeg(const KrbJpegTransform* transform, KrbFile* dest, KrbFile* src)
+{
+	return kr::backend::Jpeg::transform(transform, dest, src);
+}
+KrbTexture* KEN_EXTERNAL kr::krb_texture_open(KrbExtension extension, KrbFile* file)
+{
+	return kr::backend::Texture::open(extension, file);
+}
+const KrbTextureInfo* KEN_EXTERNAL kr::krb_texture_info(const KrbTexture* texture)
+{
+	return &texture->info;
+}
+bool KEN_EXTERNAL kr::krb_texture_level(const KrbTexture* texture, uint32_t layer, uint32_t face, uint32_t level, KrbTextureLevel* out)
+{
+	const KrbTextureInfo& info = texture->info;
+	if (layer >= info.layers || face >= info.faces || level >= info.mipLevels) return false;
+	texture->getLevel(level, out);
+	uint64_t offset = texture->offsets[((size_t)layer * info.faces + face) * info.mipLevels + level];
+	out->data = texture->data + (offset - texture->begin);
+	return true;
+}
+void KEN_EXTERNAL kr::krb_texture_close(KrbTexture* texture)
+{
+	delete texture;
+}
+bool KEN_EXTERNAL kr::krb_load_image_tiled(KrbExtension extension, KrbFile* file, const fchar_t* path, const KrbTiledLoadOptions* options)
+{
+	return kr::backend::TiledImage::load(extension, file, path, options);
+}
+KrbTiledImage* KEN_EXTERNAL kr::krb_tiled_open(KrbFile* file)
+{
+	return kr::backend::TiledImage::open(file);
+}
+const KrbTiledImageInfo* KEN_EXTERNAL kr::krb_tiled_info(const KrbTiledImage* image)
+{
+	return &image->info;
+}
+const void* KEN_EXTERNAL kr::krb_tiled_tile(const KrbTiledImage* image, uint32_t tileX, uint32_t tileY)
+{
+	const KrbTiledImageInfo& info = image->info;
+	if (tileX >= info.tilesX || tileY >= info.tilesY) return nullptr;
+	return image->data + ((size_t)tileY * info.tilesX + tileX) * info.tileBytes;
+}
+void KEN_EXTERNAL kr::krb_tiled_close(KrbTiledImage* image)
+{
+	delete image;
+}
+KrbImage* KEN_EXTERNAL kr::krb_open_image(KrbExtension extension, KrbFile* file)
+{
+	return KrbImage::open(extension, file);
+}
+const KrbImageInfo* KEN_EXTERNAL kr::krb_image_info(const KrbImage* image)
+{
+	return &image->info;
+}
+const KrbImagePalette* KEN_EXTERNAL kr::krb_image_palette(const KrbImage* image)
+{
+	return &image->palette;
+}
+const uint8_t* KEN_EXTERNAL kr::krb_image_lock_rows(KrbImage* image, uint32_t y0, uint32_t y1)
+{
+	return image->lockRows(y0, y1);
+}
+void KEN_EXTERNAL kr::krb_image_unlock_rows(KrbImage* image, uint32_t y0, uint32_t y1)
+{
+	image->unlockRows(y0, y1);
+}
+void KEN_EXTERNAL kr::krb_image_close(KrbImage* image)
+{
+	delete image;
+}
+KrbImageDecoder* KEN_EXTERNAL kr::krb_image_decoder_create(KrbExtension extension, KrbImageCallback* callback)
+{
+	switch (extension)
+	{
+	case KrbExtension::ImagePng:
+		return kr::backend::Png::createDecoder(callback);
+	case KrbExtension::ImageJpeg:
+	case KrbExtension::ImageJpg:
+		return kr::backend::Jpeg::createDecoder(callback);
+	case KrbExtension::ImageTga:
+		return kr::backend::Tga::createDecoder(callback);
+	case KrbExtension::ImageBmp:
+		return kr::backend::Bmp::createDecoder(callback);
+	default:
+		return nullptr;
+	}
+}
+bool KEN_EXTERNAL kr::krb_image_decoder_feed(KrbImageDecoder* decoder, const void* data, size_t size)
+{
+	return decoder->feed(data, size);
+}
+void KEN_EXTERNAL kr::krb_image_decoder_finish(KrbImageDecoder* decoder)
+{
+	decoder->finish();
+}
+kr_decodestatus_t KEN_EXTERNAL kr::krb_image_decoder_poll(KrbImageDecoder* decoder)
+{
+	return decoder->poll();
+}
+void KEN_EXTERNAL kr::krb_image_decoder_delete(KrbImageDecoder* decoder)
+{
+	delete decoder;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "include/common.h"
+#include "include/image.h"
+
+#include <vector>
+
+namespace kr
+{
+	// base of the push-based decoders
+	// fed bytes are buffered until poll() consumes them
+	class KrbImageDecoder
+	{
+	public:
+		KrbImageDecoder(KrbImageCallback* callback) noexcept
+			:m_callback(callback), m_offset(0), m_finished(false)
+		{
+		}
+		virtual ~KrbImageDecoder() noexcept = default;
+
+		bool feed(const void* data, size_t size) noexcept
+		{
+			try
+			{
+				// drop the consumed bytes, the decoders do not keep pointers between the polls
+				m_input.erase(m_input.begin(), m_input.begin() + m_offset);
+				m_offset = 0;
+				m_input.insert(m_input.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+				return true;
+			}
+			catch (...)
+			{
+				return false;
+			}
+		}
+		void finish() noexcept
+		{
+			m_finished = true;
+		}
+
+		virtual kr_decodestatus_t poll() noexcept = 0;
+
+	protected:
+		size_t available() const noexcept
+		{
+			return m_input.size() - m_offset;
+		}
+		const uint8_t* peek() const noexcept
+		{
+			return m_input.data() + m_offset;
+		}
+		void consume(size_t size) noexcept
+		{
+			m_offset += size;
+		}
+
+		// DecodeStatusFailed if no more bytes will come
+		kr_decodestatus_t needMore() const noexcept
+		{
+			return m_finished ? DecodeStatusFailed : DecodeStatusNeedMore;
+		}
+
+		KrbImageCallback* const m_callback;
+		std::vector<uint8_t> m_input;
+		size_t m_offset;
+		bool m_finished;
+	};
+}
@@ -39,6 +39,10 @@ namespace kr
 		void (*close)(KrbFile* _this);
 	};
 
+	// the address of the bytes [pos, pos + size) of a file of krb_mopen or krb_fmap, nullptr for the other files
+	// not a member of KrbFileVFTable so the tables of the callers keep their size
+	const void* KEN_EXTERNAL krb_fmapped(KrbFile* fp, uint64_t pos, size_t size);
+
 	class KrbFile
 	{
 	public:
@@ -73,10 +77,20 @@ namespace kr
 		{
 			return vftable->close(this);
 		}
+		// nullptr if the file is not in memory
+		inline const void* map(uint64_t pos, size_t size) noexcept
+		{
+			return krb_fmapped(this, pos, size);
+		}
 	};
 
 	bool KEN_EXTERNAL krb_fopen(KrbFile* fp, const fchar_t* path, const fchar_t* mode);
 
+	// read-only files of the memory, map() returns the addresses in it
+	// krb_mopen does not copy, the memory must outlive the file
+	bool KEN_EXTERNAL krb_mopen(KrbFile* fp, const void* data, size_t size);
+	bool KEN_EXTERNAL krb_fmap(KrbFile* fp, const fchar_t* path);
+
 #define KRB_EXTENSION(a,b,c,d) ((a) | ((b) << 8) | ((c) << 16) | ((d) << 24))
 	enum class KrbExtension:uint32_t
 	{
@@ -86,6 +100,9 @@ namespace kr
 		ImageJpeg = KRB_EXTENSION('J', 'P', 'E', 'G'),
 		ImagePng = KRB_EXTENSION('P', 'N', 'G', '\0'),
 		ImageTga = KRB_EXTENSION('T', 'G', 'A', '\0'),
+		ImageDds = KRB_EXTENSION('D', 'D', 'S', '\0'),
+		ImageKtx2 = KRB_EXTENSION('K', 'T', 'X', '2'),
+		ImageQoi = KRB_EXTENSION('Q', 'O', 'I', '\0'),
 
 		SoundWav = KRB_EXTENSION('W', 'A', 'V', '\0'),
 		SoundOgg = KRB_EXTENSION('O', 'G', 'G', '\0'),
@@ -146,4 +163,8 @@ namespace kr
 		return krb_make_extension(p+1);
 	}
 
+	// the format by the first bytes of the file, the file is back at the position of the call
+	// TGA has no signature and is the last guess by its header fields, Invalid if nothing matches
+	KrbExtension KEN_EXTERNAL krb_sniff(KrbFile* file);
+
 }
\ No newline at end of file
@@ -30,5 +30,7 @@ namespace kr
 	};*/
 
 	bool KEN_EXTERNAL krb_load_compress(KrbExtension extension, KrbCompressCallback* callback, KrbFile* file) noexcept;
+	// the format by krb_sniff, false without decoding if the file is not an archive
+	bool KEN_EXTERNAL krb_load_compress_auto(KrbCompressCallback* callback, KrbFile* file);
 	// KrbCompress* KEN_EXTERNAL krb_save_compress(KrbExtension extension, KrbFile* file);
 }
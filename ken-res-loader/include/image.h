@@ -25,9 +25,56 @@ namespace kr
 		PixelFormatXBGR8,		// 0xXXBBGGRR [0xRR,0xGG,0xBB,0xXX]
 		PixelFormatABGR8,		// 0xAABBGGRR [0xRR,0xGG,0xBB,0xAA]
 		PixelFormatRGBA32F,	// [0xRR,0xGG,0xBB,0xAA]
+		PixelFormatYCbCr444,	// planar [Y plane][Cb plane][Cr plane], chroma is full size
+		PixelFormatYCbCr422,	// planar [Y plane][Cb plane][Cr plane], chroma is half width
+		PixelFormatYCbCr420,	// planar [Y plane][Cb plane][Cr plane], chroma is half width, half height
+		// 4x4 blocks, pitchBytes is the bytes of a block row and the buffer has (height + 3) / 4 block rows
+		PixelFormatBC1,		// RGB with 1-bit alpha, 8 bytes per block
+		PixelFormatBC3,		// RGBA, 16 bytes per block
+		PixelFormatBC4,		// R, 8 bytes per block
+		PixelFormatBC5,		// RG, 16 bytes per block
+		PixelFormatBC7,		// RGBA, 16 bytes per block, mode 6 only
+		PixelFormatRGBA16F,	// [0xRR,0xGG,0xBB,0xAA] half floats
 		PixelFormatCount,
 	} kr_pixelformat_t;
 
+	typedef enum _kr_imageflag_t
+	{
+		ImageFlagNone = 0,
+		ImageFlagPlanarYCbCr = 0x1, // JPEG only, write YCbCr planes without color conversion and upsampling
+		ImageFlagBuiltinPng = 0x2, // PNG only, decode 8-bit non-interlaced files without libpng
+		ImageFlagFilterSrgb = 0x4, // mipmaps and resizing, filter the color channels in linear light
+		ImageFlagFilterAlphaWeighted = 0x8, // mipmaps and resizing, weight the color channels by alpha
+		ImageFlagPremultiplyAlpha = 0x10, // krb_load_image only, multiply the color channels by alpha
+		ImageFlagSrgbToLinear = 0x20, // krb_load_image only, decode to linear RGBA32F, or RGBA16F by requestFormat
+	} kr_imageflag_t;
+
+	typedef enum _kr_imagefilter_t
+	{
+		ImageFilterNone,
+		ImageFilterBox, // 2x2 average for the mipmaps
+		ImageFilterBicubic, // catmull-rom
+		ImageFilterKaiser, // kaiser windowed sinc, 3 lobes
+		ImageFilterLanczos, // lanczos3
+	} kr_imagefilter_t;
+
+	typedef enum _kr_imagelayout_t
+	{
+		ImageLayoutLinear, // rows of pitchBytes
+		ImageLayoutMorton, // Z-order in the size padded to powers of 2, pitchBytes is a padded row
+		ImageLayoutTiled4x4, // 4x4 pixel tiles in rows of tiles, pitchBytes is a row of tiles
+		ImageLayoutPlanar, // a plane per channel in the order of the pixel bytes, pitchBytes is a row of a plane
+	} kr_imagelayout_t;
+
+	typedef enum _kr_pngpreset_t
+	{
+		PngPresetStore, // no filter, no compression, for real-time screenshots
+		PngPresetRle, // run-length only
+		PngPresetFast,
+		PngPresetDefault,
+		PngPresetMax, // for shipping assets
+	} kr_pngpreset_t;
+
 	class KrbImageInfo
 	{
 	public:
@@ -36,6 +83,31 @@ namespace kr
 		uint32_t height;
 
 		uint32_t pitchBytes; // in-out(default: recommended pitch)
+
+		// planar formats only
+		// the buffer is [Y: pitchBytes * height][Cb: chromaPitchBytes * chromaHeight][Cr: chromaPitchBytes * chromaHeight]
+		uint32_t chromaWidth = 0;
+		uint32_t chromaHeight = 0;
+		uint32_t chromaPitchBytes = 0; // in-out(default: recommended pitch)
+
+		// more than 1 if KrbImageCallback::mipFilter is set and the format can be filtered
+		// the levels follow the first one without padding, see krb_image_level_offset
+		uint32_t mipLevels = 1;
+
+		// set by the loaders that will write the rows through KrbImageCallback::row, start needs no pixel buffer then
+		bool rowByRow = false;
+
+		// the arrangement of the buffer, see KrbImageCallback::layout
+		kr_imagelayout_t layout = ImageLayoutLinear;
+
+		// the decoded pixels, filled for KrbImageCallback::finish
+		// 8-bit, index, A8 and RGBA32F formats, the alpha of the formats without it is 255
+		bool hasStatistics = false;
+		uint8_t minAlpha = 0;
+		uint8_t maxAlpha = 0;
+		bool allOpaque = false;
+		bool binaryAlpha = false; // every alpha is 0 or 255
+		bool grayscale = false; // R = G = B
 	};
 
 	class KrbImageSaveInfo
@@ -50,6 +122,38 @@ namespace kr
 		int jpegQuality; // max is 100
 		bool tgaCompress;
 		KrbImagePalette* palette;
+		kr_pngpreset_t pngPreset = PngPresetDefault;
+	};
+
+	typedef enum _kr_bcpreset_t
+	{
+		BcPresetFast, // bounding box endpoints
+		BcPresetHigh, // principal axis endpoints with least squares refinement
+	} kr_bcpreset_t;
+
+	typedef enum _kr_jpegtransform_t
+	{
+		JpegTransformNone,
+		JpegTransformFlipHorizontal,
+		JpegTransformFlipVertical,
+		JpegTransformTranspose,
+		JpegTransformTransverse,
+		JpegTransformRotate90, // clockwise
+		JpegTransformRotate180,
+		JpegTransformRotate270,
+	} kr_jpegtransform_t;
+
+	class KrbJpegTransform
+	{
+	public:
+		kr_jpegtransform_t transform;
+
+		// crop rectangle in the transformed image, the origin is aligned down to the MCU boundary
+		// 0 size means the rest of the image
+		uint32_t cropX;
+		uint32_t cropY;
+		uint32_t cropWidth;
+		uint32_t cropHeight;
 	};
 
 	class KrbImagePalette
@@ -64,9 +168,165 @@ namespace kr
 		void* (*start)(KrbImageCallback* _this, KrbImageInfo* _info);
 
 		KrbImagePalette* palette;
+		uint32_t flags = ImageFlagNone; // kr_imageflag_t
+
+		// output format for the loaders that can convert, check KrbImageInfo::pixelformat in start
+		// krb_load_image encodes the block formats from the 8-bit and float formats, without mipmaps
+		kr_pixelformat_t requestFormat = PixelFormatInvalid;
+		kr_bcpreset_t bcPreset = BcPresetHigh;
+
+		// optional, called after each pass of interlaced PNG and progressive JPEG, krb_load_image only
+		// the buffer from start holds a full-size approximation, the last call has final = true
+		void (*progress)(KrbImageCallback* _this, uint32_t pass, bool final) = nullptr;
+
+		// generates the mip chain after decoding, krb_load_image only
+		// 8-bit RGB/XRGB/ARGB/A8 and RGBA32F, the other formats get 1 level
+		// start must allocate krb_image_level_offset(info, info->mipLevels) bytes
+		kr_imagefilter_t mipFilter = ImageFilterNone;
+
+		// resizes while loading, krb_load_image only, 0 on one axis keeps the aspect ratio
+		// the formats of mipFilter, the others are loaded at the source size
+		// JPEG decodes at a reduced DCT scale first, progress is not called
+		uint32_t targetWidth = 0;
+		uint32_t targetHeight = 0;
+		kr_imagefilter_t resizeFilter = ImageFilterLanczos;
+
+		// the arrangement of the output buffer, krb_load_image only
+		// the formats with whole-byte pixels, without mipmaps, the others are linear
+		// the padding of the Morton and tiled layouts is not written
+		kr_imagelayout_t layout = ImageLayoutLinear;
+
+		// optional, row-by-row output for the loaders and the push decoders that write the rows in order from the top
+		// returns the destination of the row y, the row is complete when the next one is requested or the load returns
+		uint8_t* (*row)(KrbImageCallback* _this, uint32_t y) = nullptr;
+
+		// optional, called when the load succeeds, krb_load_image only
+		// info is the one given to start with the statistics of the decoded pixels
+		void (*finish)(KrbImageCallback* _this, const KrbImageInfo* info) = nullptr;
 	};
 
+	// DDS and KTX2 give the first layer or face with the mip levels of the file, volume textures give the first slice
 	bool KEN_EXTERNAL krb_load_image(KrbExtension extension, KrbImageCallback* callback, KrbFile* file);
+	// the format by krb_sniff, false without decoding if the file is not an image
+	bool KEN_EXTERNAL krb_load_image_auto(KrbImageCallback* callback, KrbFile* file);
+
+	// byte offset of the mip level in the buffer from start, level 0 uses pitchBytes and the others are tightly packed
+	// the offset of info->mipLevels is the whole buffer size
+	size_t KEN_EXTERNAL krb_image_level_offset(const KrbImageInfo* info, uint32_t level);
+
+	// a mip level of an array layer or a cube face, the slices of a volume level follow each other
+	class KrbTextureLevel
+	{
+	public:
+		const void* data; // points into the mapped file, or into the copy kept by the texture
+		size_t size;
+		uint32_t width;
+		uint32_t height;
+		uint32_t depth;
+		uint32_t pitchBytes; // a block row of the block formats
+	};
+
+	class KrbTextureInfo
+	{
+	public:
+		kr_pixelformat_t pixelformat;
+		uint32_t width;
+		uint32_t height;
+		uint32_t depth; // 1 if not a volume texture
+		uint32_t mipLevels;
+		uint32_t layers;
+		uint32_t faces; // 6 for the cube maps
+		bool srgb;
+	};
+
+	class KrbTexture;
+
+	// DDS and KTX2 containers without decoding, the levels point into the file if map() works (krb_mopen, krb_fmap)
+	// the other files are read into a copy once, a mapped file must stay open while the texture is used
+	KrbTexture* KEN_EXTERNAL krb_texture_open(KrbExtension extension, KrbFile* file);
+	const KrbTextureInfo* KEN_EXTERNAL krb_texture_info(const KrbTexture* texture);
+	bool KEN_EXTERNAL krb_texture_level(const KrbTexture* texture, uint32_t layer, uint32_t face, uint32_t level, KrbTextureLevel* out);
+	void KEN_EXTERNAL krb_texture_close(KrbTexture* texture);
+
+	// out-of-core loading to a tiled file, see krb_load_image_tiled
+	class KrbTiledLoadOptions
+	{
+	public:
+		uint32_t tileWidth = 256;
+		uint32_t tileHeight = 256; // halved until the band fits in bandBudget
+
+		// the bytes of the row band and the mapped tiles of it, regardless of the image size
+		size_t bandBudget = 64 << 20;
+
+		uint32_t flags = ImageFlagNone; // kr_imageflag_t, ImageFlagBuiltinPng is ignored
+		kr_pixelformat_t requestFormat = PixelFormatInvalid;
+	};
+
+	class KrbTiledImageInfo
+	{
+	public:
+		kr_pixelformat_t pixelformat;
+		uint32_t width;
+		uint32_t height;
+		uint32_t tileWidth;
+		uint32_t tileHeight;
+		uint32_t tilesX;
+		uint32_t tilesY;
+		uint32_t tilePitchBytes; // a row in a tile, the edge tiles are padded with zeros
+		size_t tileBytes;
+		KrbImagePalette palette; // PixelFormatIndex only
+	};
+
+	class KrbTiledImage;
+
+	// decodes the rows a band at a time into the tiles of the file at path, the file is mapped a band of tiles at a time
+	// PNG (libpng), JPEG, TGA and BMP write the rows in order, the files they cannot stream fail if the image exceeds bandBudget
+	bool KEN_EXTERNAL krb_load_image_tiled(KrbExtension extension, KrbFile* file, const fchar_t* path, const KrbTiledLoadOptions* options);
+
+	// random access to the tiles, the file must be mapped (krb_fmap) and stay open while the image is used
+	KrbTiledImage* KEN_EXTERNAL krb_tiled_open(KrbFile* file);
+	const KrbTiledImageInfo* KEN_EXTERNAL krb_tiled_info(const KrbTiledImage* image);
+	const void* KEN_EXTERNAL krb_tiled_tile(const KrbTiledImage* image, uint32_t tileX, uint32_t tileY);
+	void KEN_EXTERNAL krb_tiled_close(KrbTiledImage* image);
+
+	class KrbImage;
+
+	// header-only handles, the rows are decoded on demand a band at a time, PNG, JPEG, TGA and BMP
+	// the file must stay open while the image is used, the pixel format is the one of the loader
+	// uncompressed TGA, BMP and JPEG with restart markers decode any band directly
+	// the others decode in order and continue from the last decoded row, an earlier band restarts from the file start
+	// interlaced PNG and bottom-up RLE TGA decode the whole image on the first lock
+	KrbImage* KEN_EXTERNAL krb_open_image(KrbExtension extension, KrbFile* file);
+	const KrbImageInfo* KEN_EXTERNAL krb_image_info(const KrbImage* image);
+	const KrbImagePalette* KEN_EXTERNAL krb_image_palette(const KrbImage* image); // PixelFormatIndex only
+
+	// decodes the bands of the rows [y0, y1) that are not decoded yet, the rows stay until unlocked
+	// returns the row y0, the rows follow by pitchBytes, nullptr if the rows cannot be decoded
+	const uint8_t* KEN_EXTERNAL krb_image_lock_rows(KrbImage* image, uint32_t y0, uint32_t y1);
+	// the memory of the bands without locks is released
+	void KEN_EXTERNAL krb_image_unlock_rows(KrbImage* image, uint32_t y0, uint32_t y1);
+	void KEN_EXTERNAL krb_image_close(KrbImage* image);
+
+	typedef enum _kr_decodestatus_t
+	{
+		DecodeStatusNeedMore, // feed more bytes, or finish the input
+		DecodeStatusDone,
+		DecodeStatusFailed,
+	} kr_decodestatus_t;
+
+	class KrbImageDecoder;
+
+	// push-based decoding for the bytes from a socket or an async read
+	// poll() decodes the fed bytes only, callback->start is called from it when the header is known
+	KrbImageDecoder* KEN_EXTERNAL krb_image_decoder_create(KrbExtension extension, KrbImageCallback* callback);
+	bool KEN_EXTERNAL krb_image_decoder_feed(KrbImageDecoder* decoder, const void* data, size_t size);
+	void KEN_EXTERNAL krb_image_decoder_finish(KrbImageDecoder* decoder); // no more bytes, truncated files fail
+	kr_decodestatus_t KEN_EXTERNAL krb_image_decoder_poll(KrbImageDecoder* decoder);
+	void KEN_EXTERNAL krb_image_decoder_delete(KrbImageDecoder* decoder);
 	bool KEN_EXTERNAL krb_save_image(KrbExtension extension, const KrbImageSaveInfo* info, KrbFile* file);
 
+	// lossless transform in the DCT domain, without re-encoding
+	// partial MCUs on the flipped edges are trimmed
+	bool KEN_EXTERNAL krb_transform_jpeg(const KrbJpegTransform* transform, KrbFile* dest, KrbFile* src);
+
 }
\ No newline at end of file
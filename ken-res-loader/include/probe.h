@@ -0,0 +1,36 @@
+#pragma once
+
+#include "common.h"
+#include "image.h"
+#include "sound.h"
+
+namespace kr
+{
+	typedef enum _kr_probekind_t
+	{
+		ProbeKindImage,
+		ProbeKindSound,
+		ProbeKindCompress,
+	} kr_probekind_t;
+
+	class KrbProbeInfo
+	{
+	public:
+		kr_probekind_t kind;
+		uint64_t bytesRead; // the bytes read from the file, the seeks over the skipped parts are not counted
+
+		// ProbeKindImage, the info the loader would give to start without a request
+		KrbImageInfo image;
+
+		// ProbeKindSound, the format krb_load_sound writes, totalBytes is the decoded size
+		// MP3 without Xing, Info or VBRI header is estimated by the bitrate of the first frame
+		KrbSoundInfo sound;
+
+		// ProbeKindCompress, the entries of the central directory
+		uint64_t entries;
+	};
+
+	// reads the headers only, PNG, JPEG, TGA, BMP, QOI, WAV, Ogg Vorbis, MP3 and zip
+	// the file is back at the position of the call after it
+	bool KEN_EXTERNAL krb_probe(KrbExtension extension, KrbFile* file, KrbProbeInfo* info);
+}
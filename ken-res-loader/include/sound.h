@@ -36,5 +36,31 @@ namespace kr
 	};
 
 	bool KEN_EXTERNAL krb_load_sound(KrbExtension extension, KrbSoundCallback* callback, KrbFile* file);
+	// the format by krb_sniff, false without decoding if the file is not a supported sound
+	bool KEN_EXTERNAL krb_load_sound_auto(KrbSoundCallback* callback, KrbFile* file);
+
+	class KrbSoundStream;
+
+	// decodes on read with the memory of a frame, WAV, Ogg Vorbis and MP3
+	// the file must stay open while the stream is used, Ogg and MP3 give 16-bit PCM and WAV gives the format of the file
+	// the MP3 length is the count of the Xing, Info or VBRI header, or is estimated by the bitrate of the first frame
+	KrbSoundStream* KEN_EXTERNAL krb_sound_open(KrbExtension extension, KrbFile* file);
+	const KrbSoundInfo* KEN_EXTERNAL krb_sound_info(const KrbSoundStream* stream);
+	// reads up to frames of all channels, info.format.blockAlign bytes each, returns 0 at the end
+	size_t KEN_EXTERNAL krb_sound_read(KrbSoundStream* stream, short* dest, size_t frames);
+	// the frame of the next read, MP3 decodes the frames before it and decodes from the start to seek backward
+	bool KEN_EXTERNAL krb_sound_seek(KrbSoundStream* stream, uint64_t frame);
+	void KEN_EXTERNAL krb_sound_close(KrbSoundStream* stream);
+
+	class KrbMp3Index;
+
+	// the byte offsets and the reservoir back-references of the frames by a walk of the headers, from the position of the file
+	// saved next to the asset, an MP3 stream with it seeks by decoding only the frames the reservoir and the overlap need
+	KrbMp3Index* KEN_EXTERNAL krb_mp3_index_build(KrbFile* file);
+	KrbMp3Index* KEN_EXTERNAL krb_mp3_index_load(KrbFile* file);
+	bool KEN_EXTERNAL krb_mp3_index_save(const KrbMp3Index* index, KrbFile* file);
+	void KEN_EXTERNAL krb_mp3_index_free(KrbMp3Index* index);
+	// false if the stream is not MP3 or the index is of another file, the index must stay while it is set
+	bool KEN_EXTERNAL krb_sound_set_index(KrbSoundStream* stream, const KrbMp3Index* index);
 
 }
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include "inflate.h"
+
+#include <memory.h>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	const uint16_t lengthBase[31] = {
+		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 0, 0 };
+	const uint8_t lengthExtra[31] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0, 0, 0 };
+	const uint16_t distanceBase[32] = {
+		1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+		257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577, 0, 0 };
+	const uint8_t distanceExtra[32] = {
+		0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+		7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 0, 0 };
+	const uint8_t codeLengthOrder[19] = {
+		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	inline uint32_t reverseBits(uint32_t code, int bits) noexcept
+	{
+		code = ((code & 0xaaaa) >> 1) | ((code & 0x5555) << 1);
+		code = ((code & 0xcccc) >> 2) | ((code & 0x3333) << 2);
+		code = ((code & 0xf0f0) >> 4) | ((code & 0x0f0f) << 4);
+		code = ((code & 0xff00) >> 8) | ((code & 0x00ff) << 8);
+		return code >> (16 - bits);
+	}
+
+	inline uint64_t load64le(const uint8_t* src) noexcept
+	{
+		uint64_t value;
+		memcpy(&value, src, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		value = __builtin_bswap64(value);
+#endif
+		return value;
+	}
+}
+
+bool Inflater::Huffman::build(const uint8_t* sizeList, int count) noexcept
+{
+	int sizes[17] = { 0, };
+	uint16_t nextCode[16];
+
+	memset(fast, 0, sizeof(fast));
+	for (int i = 0; i < count; i++) sizes[sizeList[i]]++;
+	sizes[0] = 0;
+	for (int i = 1; i < 16; i++)
+	{
+		if (sizes[i] > (1 << i)) return false;
+	}
+
+	int code = 0;
+	int k = 0;
+	for (int i = 1; i < 16; i++)
+	{
+		nextCode[i] = (uint16_t)code;
+		firstCode[i] = (uint16_t)code;
+		firstSymbol[i] = (uint16_t)k;
+		code += sizes[i];
+		if (sizes[i] && code - 1 >= (1 << i)) return false;
+		maxCode[i] = code << (16 - i); // compared with the 16-bit reversed peek
+		code <<= 1;
+		k += sizes[i];
+	}
+	maxCode[16] = 0x10000;
+
+	for (int i = 0; i < count; i++)
+	{
+		int s = sizeList[i];
+		if (!s) continue;
+		int c = nextCode[s] - firstCode[s] + firstSymbol[s];
+		size[c] = (uint8_t)s;
+		value[c] = (uint16_t)i;
+		if (s <= FAST_BITS)
+		{
+			uint16_t entry = (uint16_t)((s << 9) | i);
+			for (uint32_t j = reverseBits(nextCode[s], s); j < (1 << FAST_BITS); j += (1 << s))
+			{
+				fast[j] = entry;
+			}
+		}
+		nextCode[s]++;
+	}
+	return true;
+}
+
+Inflater::Inflater(const void* src, size_t size) noexcept
+	:m_src((const uint8_t*)src), m_end((const uint8_t*)src + size), m_bits(0), m_count(0), m_overrun(0),
+	m_outStart(nullptr), m_out(nullptr), m_outEnd(nullptr)
+{
+}
+
+void Inflater::refill() noexcept
+{
+	if (m_end - m_src >= 8)
+	{
+		// the bytes above m_count are loaded again at the same position by the next refill
+		m_bits |= load64le(m_src) << m_count;
+		m_src += (63 - m_count) >> 3;
+		m_count |= 56;
+		return;
+	}
+	while (m_count <= 56)
+	{
+		uint64_t byte;
+		if (m_src < m_end) byte = *m_src++;
+		else
+		{
+			byte = 0;
+			m_overrun++;
+		}
+		m_bits |= byte << m_count;
+		m_count += 8;
+	}
+}
+
+inline uint32_t Inflater::bits(int n) noexcept
+{
+	uint32_t value = (uint32_t)(m_bits & ((1ull << n) - 1));
+	m_bits >>= n;
+	m_count -= n;
+	return value;
+}
+
+inline int Inflater::decode(const Huffman& huffman) noexcept
+{
+	uint16_t entry = huffman.fast[m_bits & ((1 << Huffman::FAST_BITS) - 1)];
+	if (entry)
+	{
+		int s = entry >> 9;
+		m_bits >>= s;
+		m_count -= s;
+		return entry & 511;
+	}
+
+	uint32_t k = reverseBits((uint32_t)(m_bits & 0xffff), 16);
+	int s;
+	for (s = Huffman::FAST_BITS + 1; ; s++)
+	{
+		if ((int)k < huffman.maxCode[s]) break;
+	}
+	if (s >= 16) return -1;
+	int c = (int)(k >> (16 - s)) - huffman.firstCode[s] + huffman.firstSymbol[s];
+	if (c >= 288 || huffman.size[c] != s) return -1;
+	m_bits >>= s;
+	m_count -= s;
+	return huffman.value[c];
+}
+
+bool Inflater::readZlibHeader() noexcept
+{
+	if (m_end - m_src < 2) return false;
+	uint8_t cmf = m_src[0];
+	uint8_t flg = m_src[1];
+	if (((cmf << 8) | flg) % 31 != 0) return false;
+	if ((cmf & 15) != 8) return false; // deflate
+	if (flg & 0x20) return false; // preset dictionary
+	m_src += 2;
+	return true;
+}
+
+bool Inflater::readDynamicTables() noexcept
+{
+	uint8_t lengths[286 + 32 + 137];
+	uint8_t codeLengths[19] = { 0, };
+
+	refill();
+	int literalCount = bits(5) + 257;
+	int distanceCount = bits(5) + 1;
+	int codeLengthCount = bits(4) + 4;
+	for (int i = 0; i < codeLengthCount; i++)
+	{
+		refill();
+		codeLengths[codeLengthOrder[i]] = (uint8_t)bits(3);
+	}
+
+	Huffman& codeLength = m_distance; // rebuilt below
+	if (!codeLength.build(codeLengths, 19)) return false;
+
+	int total = literalCount + distanceCount;
+	int n = 0;
+	while (n < total)
+	{
+		refill();
+		int c = decode(codeLength);
+		if (c < 0 || c >= 19) return false;
+		if (c < 16)
+		{
+			lengths[n++] = (uint8_t)c;
+			continue;
+		}
+
+		uint8_t fill = 0;
+		int repeat;
+		if (c == 16)
+		{
+			if (n == 0) return false;
+			repeat = bits(2) + 3;
+			fill = lengths[n - 1];
+		}
+		else if (c == 17)
+		{
+			repeat = bits(3) + 3;
+		}
+		else
+		{
+			repeat = bits(7) + 11;
+		}
+		if (total - n < repeat) return false;
+		memset(lengths + n, fill, repeat);
+		n += repeat;
+	}
+
+	if (lengths[256] == 0) return false;
+	if (!m_length.build(lengths, literalCount)) return false;
+	if (!m_distance.build(lengths + literalCount, distanceCount)) return false;
+	return true;
+}
+
+bool Inflater::readStored() noexcept
+{
+	// back to the byte boundary, the whole bytes in the bit buffer are not consumed yet
+	bits(m_count & 7);
+	size_t unread = (size_t)(m_count >> 3);
+	if (m_overrun > unread) return false;
+	const uint8_t* src = m_src - (unread - m_overrun);
+	m_bits = 0;
+	m_count = 0;
+	m_overrun = 0;
+	if (m_end - src < 4) return false;
+
+	uint32_t length = src[0] | (src[1] << 8);
+	uint32_t nlength = src[2] | (src[3] << 8);
+	if (length != (~nlength & 0xffff)) return false;
+	src += 4;
+	if ((size_t)(m_end - src) < length) return false;
+	if ((size_t)(m_outEnd - m_out) < length) return false;
+	memcpy(m_out, src, length);
+	m_out += length;
+	m_src = src + length;
+	return true;
+}
+
+bool Inflater::readCodes() noexcept
+{
+	uint8_t* out = m_out;
+	uint8_t* outEnd = m_outEnd;
+	for (;;)
+	{
+		refill();
+		int symbol = decode(m_length);
+		if (symbol < 256)
+		{
+			if (symbol < 0) return false;
+			if (out == outEnd) return false;
+			*out++ = (uint8_t)symbol;
+			continue;
+		}
+		if (symbol == 256) break;
+
+		symbol -= 257;
+		if (symbol >= 29) return false;
+		size_t length = lengthBase[symbol] + bits(lengthExtra[symbol]);
+		int distanceSymbol = decode(m_distance);
+		if (distanceSymbol < 0 || distanceSymbol >= 30) return false;
+		size_t distance = distanceBase[distanceSymbol] + bits(distanceExtra[distanceSymbol]);
+
+		if ((size_t)(out - m_outStart) < distance) return false;
+		if ((size_t)(outEnd - out) < length) return false;
+
+		const uint8_t* from = out - distance;
+		uint8_t* end = out + length;
+		if (distance >= 8 && (size_t)(outEnd - end) >= 8)
+		{
+			// may write up to 7 bytes over the end, they are overwritten later
+			do
+			{
+				memcpy(out, from, 8);
+				out += 8;
+				from += 8;
+			} while (out < end);
+		}
+		else if (distance == 1)
+		{
+			memset(out, out[-1], length);
+		}
+		else
+		{
+			do
+			{
+				*out++ = *from++;
+			} while (out < end);
+		}
+		out = end;
+	}
+	m_out = out;
+	return true;
+}
+
+bool Inflater::inflate(void* dest, size_t size) noexcept
+{
+	m_outStart = m_out = (uint8_t*)dest;
+	m_outEnd = m_out + size;
+
+	bool final;
+	do
+	{
+		refill();
+		final = bits(1) != 0;
+		int type = bits(2);
+		switch (type)
+		{
+		case 0:
+			if (!readStored()) return false;
+			break;
+		case 1:
+		{
+			uint8_t lengths[288 + 32];
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 256 - 144);
+			memset(lengths + 256, 7, 280 - 256);
+			memset(lengths + 280, 8, 288 - 280);
+			memset(lengths + 288, 5, 32);
+			if (!m_length.build(lengths, 288)) return false;
+			if (!m_distance.build(lengths + 288, 32)) return false;
+			if (!readCodes()) return false;
+			break;
+		}
+		case 2:
+			if (!readDynamicTables()) return false;
+			if (!readCodes()) return false;
+			break;
+		default:
+			return false;
+		}
+		// the zero bytes after the end must not be consumed
+		size_t unread = (size_t)(m_end - m_src) + (size_t)(m_count >> 3);
+		if (m_overrun > unread) return false;
+		if (m_overrun == unread) break; // flushed stream without the final block
+	} while (!final);
+
+	return m_out == m_outEnd;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace kr
+{
+	namespace backend
+	{
+		// in-memory deflate decoder for the image decoders
+		// table-driven huffman decoding with a 64-bit bit buffer
+		class Inflater
+		{
+		public:
+			Inflater(const void* src, size_t size) noexcept;
+
+			// skips the 2-byte zlib header, preset dictionaries are not supported
+			// the adler32 trailer is not verified
+			bool readZlibHeader() noexcept;
+
+			// decodes the blocks until the final block or the end of the input at a block boundary
+			// fails if the output size is not exactly size
+			bool inflate(void* dest, size_t size) noexcept;
+
+		private:
+			struct Huffman
+			{
+				static constexpr int FAST_BITS = 10;
+
+				uint16_t fast[1 << FAST_BITS]; // (length << 9) | symbol, 0 if the code is longer
+				uint16_t firstCode[16];
+				int maxCode[17];
+				uint16_t firstSymbol[16];
+				uint8_t size[288];
+				uint16_t value[288];
+
+				bool build(const uint8_t* sizeList, int count) noexcept;
+			};
+
+			void refill() noexcept;
+			uint32_t bits(int n) noexcept;
+			int decode(const Huffman& huffman) noexcept;
+			bool readDynamicTables() noexcept;
+			bool readStored() noexcept;
+			bool readCodes() noexcept;
+
+			const uint8_t* m_src;
+			const uint8_t* m_end;
+			uint64_t m_bits;
+			int m_count;
+			size_t m_overrun;
+
+			uint8_t* m_outStart;
+			uint8_t* m_out;
+			uint8_t* m_outEnd;
+
+			Huffman m_length;
+			Huffman m_distance;
+		};
+	}
+}
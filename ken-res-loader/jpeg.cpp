@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <memory.h>
 #include <setjmp.h>
+#include <utility>
 
 extern "C"
 {
@@ -11,6 +12,11 @@ extern "C"
 }
 
 #include "assert.h"
+#include "imagedecoder.h"
+#include "lazyimage.h"
+#include "resample.h"
+#include <new>
+#include <vector>
 
 #include "libloader.h"
 KRL_BEGIN(LibJpeg, L"jpegd.dll", L"jpeg.dll")
@@ -28,6 +34,14 @@ KRL_IMPORT(jpeg_finish_decompress)
 KRL_IMPORT(jpeg_CreateDecompress)
 KRL_IMPORT(jpeg_CreateCompress)
 KRL_IMPORT(jpeg_read_scanlines)
+KRL_IMPORT(jpeg_read_raw_data)
+KRL_IMPORT(jpeg_has_multiple_scans)
+KRL_IMPORT(jpeg_input_complete)
+KRL_IMPORT(jpeg_start_output)
+KRL_IMPORT(jpeg_finish_output)
+KRL_IMPORT(jpeg_read_coefficients)
+KRL_IMPORT(jpeg_write_coefficients)
+KRL_IMPORT(jpeg_copy_critical_parameters)
 KRL_IMPORT(jpeg_resync_to_restart)
 KRL_END()
 
@@ -121,6 +135,8 @@ namespace
 			kr_jpeg_destination_mgr* dest = static_cast<kr_jpeg_destination_mgr*> (cinfo->dest);
 			dest->init_destination = [](j_compress_ptr cinfo) {
 				kr_jpeg_destination_mgr* dest = (kr_jpeg_destination_mgr*)(cinfo->dest);
+				dest->next_output_byte = dest->buffer;
+				dest->free_in_buffer = BUFFERING_SIZE;
 			};
 			dest->empty_output_buffer = [](j_compress_ptr cinfo)->boolean {
 				kr_jpeg_destination_mgr* dest = (kr_jpeg_destination_mgr*)(cinfo->dest);
@@ -131,13 +147,132 @@ namespace
 			};
 			dest->term_destination = [](j_compress_ptr cinfo) {
 				kr_jpeg_destination_mgr* dest = (kr_jpeg_destination_mgr*)(cinfo->dest);
-				dest->file->write(dest->buffer, BUFFERING_SIZE);
+				dest->file->write(dest->buffer, BUFFERING_SIZE - dest->free_in_buffer);
 				dest->next_output_byte = dest->buffer;
 				dest->free_in_buffer = BUFFERING_SIZE;
 			};
 			dest->file = in;
 		}
 	};
+
+	// coefficient order is row-major, the pixel space transform is
+	// transpose first, and then flip in the destination space
+	struct BlockTransform
+	{
+		bool transpose;
+		bool flipH;
+		bool flipV;
+
+		BlockTransform(kr_jpegtransform_t transform) noexcept
+		{
+			static const bool table[][3] = {
+				{ false, false, false }, // JpegTransformNone
+				{ false, true, false }, // JpegTransformFlipHorizontal
+				{ false, false, true }, // JpegTransformFlipVertical
+				{ true, false, false }, // JpegTransformTranspose
+				{ true, true, true }, // JpegTransformTransverse
+				{ true, true, false }, // JpegTransformRotate90
+				{ false, true, true }, // JpegTransformRotate180
+				{ true, false, true }, // JpegTransformRotate270
+			};
+			transpose = table[transform][0];
+			flipH = table[transform][1];
+			flipV = table[transform][2];
+		}
+
+		void operator()(JCOEF* dest, const JCOEF* src) const noexcept
+		{
+			// flipping the pixels negates the odd frequencies
+			for (int k = 0; k < DCTSIZE; k++)
+			{
+				for (int j = 0; j < DCTSIZE; j++)
+				{
+					JCOEF v = transpose ? src[j * DCTSIZE + k] : src[k * DCTSIZE + j];
+					bool negate = (flipH && (j & 1)) != (flipV && (k & 1));
+					*dest++ = negate ? -v : v;
+				}
+			}
+		}
+	};
+
+	kr_pixelformat_t getPlanarFormat(j_decompress_ptr cinfo) noexcept
+	{
+		if (cinfo->jpeg_color_space != JCS_YCbCr) return PixelFormatInvalid;
+		if (cinfo->num_components != 3) return PixelFormatInvalid;
+#if JPEG_LIB_VERSION >= 80
+		if (cinfo->block_size != DCTSIZE) return PixelFormatInvalid;
+#endif
+
+		// chroma must be the smallest plane, raw_data_out does not upsample
+		jpeg_component_info* comp = cinfo->comp_info;
+		if (comp[1].h_samp_factor != 1 || comp[1].v_samp_factor != 1) return PixelFormatInvalid;
+		if (comp[2].h_samp_factor != 1 || comp[2].v_samp_factor != 1) return PixelFormatInvalid;
+		switch ((comp[0].h_samp_factor << 4) | comp[0].v_samp_factor)
+		{
+		case 0x11: return PixelFormatYCbCr444;
+		case 0x21: return PixelFormatYCbCr422;
+		case 0x22: return PixelFormatYCbCr420;
+		default: return PixelFormatInvalid;
+		}
+	}
+
+	// jpeg_start_decompress() must be called with raw_data_out
+	bool readPlanes(j_decompress_ptr cinfo, KrbImageCallback* callback, kr_pixelformat_t pixelformat) noexcept
+	{
+		KRL_USING(LibJpeg, libjpeg, false);
+
+		jpeg_component_info* comp = cinfo->comp_info;
+
+		KrbImageInfo imginfo;
+		imginfo.width = cinfo->output_width;
+		imginfo.height = cinfo->output_height;
+		imginfo.pitchBytes = imginfo.width;
+		imginfo.pixelformat = pixelformat;
+		imginfo.chromaWidth = comp[1].downsampled_width;
+		imginfo.chromaHeight = comp[1].downsampled_height;
+		imginfo.chromaPitchBytes = imginfo.chromaWidth;
+		uint8_t* dest = (uint8_t*)callback->start(callback, &imginfo);
+		if (!dest) return false;
+
+		uint8_t* planes[3];
+		uint32_t pitches[3] = { imginfo.pitchBytes, imginfo.chromaPitchBytes, imginfo.chromaPitchBytes };
+		uint32_t widths[3] = { imginfo.width, imginfo.chromaWidth, imginfo.chromaWidth };
+		uint32_t heights[3] = { imginfo.height, imginfo.chromaHeight, imginfo.chromaHeight };
+		planes[0] = dest;
+		planes[1] = planes[0] + (size_t)pitches[0] * heights[0];
+		planes[2] = planes[1] + (size_t)pitches[1] * heights[1];
+
+		// jpeg_read_raw_data() reads one iMCU row at once, in block-padded width
+		JSAMPARRAY rows[3];
+		uint32_t rowsPerMcu[3];
+		for (int c = 0; c < 3; c++)
+		{
+			rowsPerMcu[c] = comp[c].v_samp_factor * DCTSIZE;
+			rows[c] = (*cinfo->mem->alloc_sarray)
+				((j_common_ptr)cinfo, JPOOL_IMAGE, comp[c].width_in_blocks * DCTSIZE, rowsPerMcu[c]);
+		}
+		JDIMENSION mcuLines = cinfo->max_v_samp_factor * DCTSIZE;
+
+		uint32_t y[3] = { 0, 0, 0 };
+		while (cinfo->output_scanline < cinfo->output_height)
+		{
+			if (libjpeg->jpeg_read_raw_data(cinfo, rows, mcuLines) == 0) break;
+			for (int c = 0; c < 3; c++)
+			{
+				uint32_t lines = heights[c] - y[c];
+				if (lines > rowsPerMcu[c]) lines = rowsPerMcu[c];
+
+				uint8_t* line = planes[c] + (size_t)y[c] * pitches[c];
+				for (uint32_t i = 0; i < lines; i++)
+				{
+					memcpy(line, rows[c][i], widths[c]);
+					line += pitches[c];
+				}
+				y[c] += lines;
+			}
+		}
+		return true;
+	}
 }
 
 bool kr::backend::Jpeg::save(const KrbImageSaveInfo* info, KrbFile* file) noexcept
@@ -297,9 +432,48 @@ bool kr::backend::Jpeg::load(KrbImageCallback* callback, KrbFile* file) noexcept
 
 	/* Step 4: set parameters for decompression */
 
-	/* In this example, we don't need to change any of the defaults set by
-	* jpeg_read_header(), so we do nothing here.
-	*/
+	if (callback->flags & ImageFlagPlanarYCbCr)
+	{
+		kr_pixelformat_t planar = getPlanarFormat(&cinfo);
+		if (planar != PixelFormatInvalid)
+		{
+			// skip color conversion and upsampling, the caller will do it
+			cinfo.raw_data_out = TRUE;
+			cinfo.out_color_space = JCS_YCbCr;
+			(void)libjpeg->jpeg_start_decompress(&cinfo);
+			if (!readPlanes(&cinfo, callback, planar))
+			{
+				libjpeg->jpeg_destroy_decompress(&cinfo);
+				return false;
+			}
+			libjpeg->jpeg_finish_decompress(&cinfo);
+			libjpeg->jpeg_destroy_decompress(&cinfo);
+			return true;
+		}
+	}
+
+	// decode every scan to report the progressive passes
+	bool progressive = callback->progress && libjpeg->jpeg_has_multiple_scans(&cinfo);
+	if (progressive) cinfo.buffered_image = TRUE;
+
+	// the smallest DCT scale not below the target size, the rest is resampled
+	if (callback->targetWidth != 0 || callback->targetHeight != 0)
+	{
+		uint32_t width = callback->targetWidth;
+		uint32_t height = callback->targetHeight;
+		Resampler::getTargetSize(cinfo.image_width, cinfo.image_height, &width, &height);
+		cinfo.scale_num = 8;
+		cinfo.scale_denom = 8;
+		for (unsigned int num = 1; num < 8; num <<= 1)
+		{
+			// the scaled size rounds up
+			if ((cinfo.image_width * num + 7) / 8 >= width && (cinfo.image_height * num + 7) / 8 >= height)
+			{
+				cinfo.scale_num = num;
+				break;
+			}
+		}
+	}
 
 	/* Step 5: Start decompressor */
 
@@ -322,6 +496,8 @@ bool kr::backend::Jpeg::load(KrbImageCallback* callback, KrbFile* file) noexcept
 	imginfo.pitchBytes = row_stride;
 	imginfo.height = cinfo.output_height;
 	imginfo.pixelformat = PixelFormatBGR8;
+	bool rowByRow = callback->row != nullptr && !progressive;
+	imginfo.rowByRow = rowByRow;
 	char* dest = (char*)callback->start(callback, &imginfo);
 	if (!dest)
 	{
@@ -340,15 +516,47 @@ bool kr::backend::Jpeg::load(KrbImageCallback* callback, KrbFile* file) noexcept
 	/* Here we use the library's state variable cinfo.output_scanline as the
 	* loop counter, so that we don't have to keep track ourselves.
 	*/
-	while (cinfo.output_scanline < cinfo.output_height) {
-		/* jpeg_read_scanlines expects an array of pointers to scanlines.
-		* Here the array is only one element long, but you could ask for
-		* more than one scanline at a time if that's more convenient.
-		*/
-		(void)libjpeg->jpeg_read_scanlines(&cinfo, buffer, 1);
-		/* Assume put_scanline_someplace wants a pointer and sample count. */
-		memcpy(dest, buffer[0], row_stride);
-		dest += imginfo.pitchBytes;
+	auto readScanlines = [&](char* line) {
+		while (cinfo.output_scanline < cinfo.output_height) {
+			/* jpeg_read_scanlines expects an array of pointers to scanlines.
+			* Here the array is only one element long, but you could ask for
+			* more than one scanline at a time if that's more convenient.
+			*/
+			(void)libjpeg->jpeg_read_scanlines(&cinfo, buffer, 1);
+			/* Assume put_scanline_someplace wants a pointer and sample count. */
+			memcpy(line, buffer[0], row_stride);
+			line += imginfo.pitchBytes;
+		}
+	};
+	if (progressive)
+	{
+		// jpeg_finish_output() reads until the next scan or EOI
+		uint32_t pass = 0;
+		while (!libjpeg->jpeg_input_complete(&cinfo))
+		{
+			libjpeg->jpeg_start_output(&cinfo, cinfo.input_scan_number);
+			readScanlines(dest);
+			libjpeg->jpeg_finish_output(&cinfo);
+			callback->progress(callback, ++pass, libjpeg->jpeg_input_complete(&cinfo) != FALSE);
+		}
+	}
+	else if (rowByRow)
+	{
+		// straight to the rows without the copy
+		while (cinfo.output_scanline < cinfo.output_height)
+		{
+			JSAMPROW row = callback->row(callback, cinfo.output_scanline);
+			if (!row)
+			{
+				libjpeg->jpeg_destroy_decompress(&cinfo);
+				return false;
+			}
+			(void)libjpeg->jpeg_read_scanlines(&cinfo, &row, 1);
+		}
+	}
+	else
+	{
+		readScanlines(dest);
 	}
 
 	/* Step 7: Finish decompression */
@@ -376,3 +584,680 @@ bool kr::backend::Jpeg::load(KrbImageCallback* callback, KrbFile* file) noexcept
 	/* And we're done! */
 	return true;
 }
+
+namespace
+{
+	// suspending source on the fed bytes, libjpeg backs up to the last complete unit when it suspends
+	struct kr_jpeg_suspend_source_mgr : jpeg_source_mgr {
+		bool finished;
+		size_t skip; // skip_input_data() over the fed bytes
+
+		void make(j_decompress_ptr cinfo) noexcept
+		{
+			cinfo->src = this;
+			init_source = [](j_decompress_ptr cinfo) {};
+			fill_input_buffer = [](j_decompress_ptr cinfo)->boolean {
+				kr_jpeg_suspend_source_mgr* src = (kr_jpeg_suspend_source_mgr*)(cinfo->src);
+				if (!src->finished) return FALSE;
+
+				// truncated file, same as jdatasrc.c
+				static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+				WARNMS(cinfo, JWRN_JPEG_EOF);
+				src->next_input_byte = eoi;
+				src->bytes_in_buffer = 2;
+				return TRUE;
+			};
+			skip_input_data = [](j_decompress_ptr cinfo, long count) {
+				kr_jpeg_suspend_source_mgr* src = (kr_jpeg_suspend_source_mgr*)(cinfo->src);
+				if (count <= 0) return;
+				if ((size_t)count <= src->bytes_in_buffer)
+				{
+					src->bytes_in_buffer -= count;
+					src->next_input_byte += count;
+				}
+				else
+				{
+					src->skip += count - src->bytes_in_buffer;
+					src->next_input_byte += src->bytes_in_buffer;
+					src->bytes_in_buffer = 0;
+				}
+			};
+			KRL_USING(LibJpeg, libjpeg, );
+			resync_to_restart = libjpeg->jpeg_resync_to_restart; /* use default method */
+			term_source = [](j_decompress_ptr cinfo) {};
+			finished = false;
+			skip = 0;
+			bytes_in_buffer = 0;
+			next_input_byte = NULL;
+		}
+	};
+
+	// every step is retried from the start when libjpeg suspends
+	class JpegDecoder :public KrbImageDecoder
+	{
+	public:
+		JpegDecoder(KrbImageCallback* callback) noexcept
+			:KrbImageDecoder(callback)
+		{
+		}
+		~JpegDecoder() noexcept override
+		{
+			KRL_USING(LibJpeg, libjpeg, );
+			if (m_created) libjpeg->jpeg_destroy_decompress(&m_cinfo);
+		}
+
+		kr_decodestatus_t poll() noexcept override
+		{
+			KRL_USING(LibJpeg, libjpeg, DecodeStatusFailed);
+			if (m_state == State::Done) return DecodeStatusDone;
+			if (m_state == State::Failed) return DecodeStatusFailed;
+
+			if (!m_created)
+			{
+				m_cinfo.err = libjpeg->jpeg_std_error(&m_jerr.pub);
+				m_jerr.pub.error_exit = my_error_exit;
+				if (setjmp(m_jerr.setjmp_buffer)) return fail();
+				libjpeg->jpeg_create_decompress(&m_cinfo);
+				m_created = true;
+				m_source.make(&m_cinfo);
+			}
+
+			size_t skip = m_source.skip;
+			if (skip > available()) skip = available();
+			consume(skip);
+			m_source.skip -= skip;
+			if (m_source.skip != 0) return needMore();
+
+			m_source.finished = m_finished;
+			m_source.next_input_byte = peek();
+			m_source.bytes_in_buffer = available();
+			if (setjmp(m_jerr.setjmp_buffer)) return fail();
+			kr_decodestatus_t status = step(libjpeg);
+
+			// the fake EOI is not in the fed bytes
+			const uint8_t* next = m_source.next_input_byte;
+			if (next >= peek() && next <= peek() + available()) consume(next - peek());
+			else consume(available());
+			return status;
+		}
+
+	private:
+		enum class State
+		{
+			Header,
+			Start,
+			Scanlines,
+			Finish,
+			Done,
+			Failed,
+		};
+
+		kr_decodestatus_t fail() noexcept
+		{
+			m_state = State::Failed;
+			return DecodeStatusFailed;
+		}
+
+		kr_decodestatus_t step(const LibJpeg* libjpeg) noexcept
+		{
+			switch (m_state)
+			{
+			case State::Header:
+				if (libjpeg->jpeg_read_header(&m_cinfo, TRUE) == JPEG_SUSPENDED) return needMore();
+				m_state = State::Start;
+				// fallthrough
+			case State::Start:
+			{
+				if (!libjpeg->jpeg_start_decompress(&m_cinfo)) return needMore();
+				m_rowStride = m_cinfo.output_width * m_cinfo.output_components;
+				KrbImageInfo imginfo;
+				imginfo.width = m_cinfo.output_width;
+				imginfo.pitchBytes = m_rowStride;
+				imginfo.height = m_cinfo.output_height;
+				imginfo.pixelformat = PixelFormatBGR8;
+				m_rowByRow = m_callback->row != nullptr;
+				imginfo.rowByRow = m_rowByRow;
+				m_dest = (uint8_t*)m_callback->start(m_callback, &imginfo);
+				if (!m_dest) return fail();
+				m_pitchBytes = imginfo.pitchBytes;
+				m_buffer = (*m_cinfo.mem->alloc_sarray)
+					((j_common_ptr)&m_cinfo, JPOOL_IMAGE, m_rowStride, 1);
+				m_state = State::Scanlines;
+			}
+			// fallthrough
+			case State::Scanlines:
+				while (m_cinfo.output_scanline < m_cinfo.output_height)
+				{
+					uint32_t y = m_cinfo.output_scanline;
+					if (libjpeg->jpeg_read_scanlines(&m_cinfo, m_buffer, 1) == 0) return needMore();
+					uint8_t* line = m_rowByRow ? m_callback->row(m_callback, y) : m_dest + (size_t)y * m_pitchBytes;
+					if (!line) return fail();
+					memcpy(line, m_buffer[0], m_rowStride);
+				}
+				m_state = State::Finish;
+				// fallthrough
+			case State::Finish:
+				if (!libjpeg->jpeg_finish_decompress(&m_cinfo)) return needMore();
+				m_state = State::Done;
+				return DecodeStatusDone;
+			default:
+				return DecodeStatusFailed;
+			}
+		}
+
+		struct jpeg_decompress_struct m_cinfo;
+		struct my_error_mgr m_jerr;
+		kr_jpeg_suspend_source_mgr m_source;
+		bool m_created = false;
+		State m_state = State::Header;
+		bool m_rowByRow = false;
+		uint8_t* m_dest = nullptr;
+		uint32_t m_pitchBytes = 0;
+		uint32_t m_rowStride = 0;
+		JSAMPARRAY m_buffer = nullptr;
+	};
+}
+
+KrbImageDecoder* kr::backend::Jpeg::createDecoder(KrbImageCallback* callback) noexcept
+{
+	return new(std::nothrow) JpegDecoder(callback);
+}
+
+namespace
+{
+	inline uint32_t getBE16(const uint8_t* data) noexcept
+	{
+		return ((uint32_t)data[0] << 8) | data[1];
+	}
+
+	// the sequential files with a restart marker at the start of every band of MCU rows
+	// a band decodes from a copy of the header with the band height and the restart intervals of the band
+	class JpegRowReader :public backend::RowReader
+	{
+	public:
+		JpegRowReader(KrbFile* file) noexcept
+			:m_file(file)
+		{
+		}
+
+		bool open(KrbImageInfo* info) noexcept
+		{
+			try
+			{
+				return parse(info);
+			}
+			catch (...)
+			{
+				return false;
+			}
+		}
+
+		uint32_t getBandRows() const noexcept override
+		{
+			return m_bandRows;
+		}
+		bool read(uint8_t* dest, size_t pitch, uint32_t y0, uint32_t y1) noexcept override
+		{
+			// the bands around them give the chroma rows of the upsampling
+			uint32_t band0 = y0 / m_bandRows;
+			uint32_t band1 = (y1 - 1) / m_bandRows + 1;
+			if (m_contextBands && band0 > 0) band0--;
+			if (m_contextBands && (uint64_t)band1 * m_bandRows < m_height) band1++;
+			return readBands(dest, pitch, y0, y1, band0, band1);
+		}
+
+	private:
+		bool parse(KrbImageInfo* info) noexcept(false)
+		{
+			uint8_t soi[2];
+			if (m_file->read(soi, 2) != 2 || soi[0] != 0xFF || soi[1] != 0xD8) return false;
+			m_header.assign(soi, soi + 2);
+
+			uint32_t components = 0;
+			uint32_t maxH = 1, maxV = 1;
+			bool verticalChroma = false;
+			uint32_t interval = 0;
+			std::vector<uint8_t> segment;
+			for (;;)
+			{
+				uint8_t marker[4];
+				if (m_file->read(marker, 4) != 4 || marker[0] != 0xFF) return false;
+				uint32_t length = getBE16(marker + 2);
+				if (length < 2) return false;
+				segment.resize(length - 2);
+				if (m_file->read(segment.data(), segment.size()) != segment.size()) return false;
+				uint8_t code = marker[1];
+
+				// the application segments other than JFIF and Adobe are left out
+				if ((code >= 0xE1 && code <= 0xED) || code == 0xEF || code == 0xFE) continue;
+				size_t offset = m_header.size() + 4;
+				m_header.insert(m_header.end(), marker, marker + 4);
+				m_header.insert(m_header.end(), segment.begin(), segment.end());
+
+				switch (code)
+				{
+				case 0xC0: case 0xC1: // baseline and extended Huffman
+				{
+					if (segment.size() < 6 || segment[0] != 8) return false;
+					m_heightOffset = offset + 1;
+					m_height = getBE16(&segment[1]);
+					m_width = getBE16(&segment[3]);
+					components = segment[5];
+					if (components != 1 && components != 3) return false;
+					if (segment.size() < 6 + components * 3) return false;
+					for (uint32_t i = 0; i < components; i++)
+					{
+						uint32_t h = segment[7 + i * 3] >> 4;
+						uint32_t v = segment[7 + i * 3] & 15;
+						if (h > maxH) maxH = h;
+						if (v > maxV) maxV = v;
+					}
+					for (uint32_t i = 0; i < components; i++)
+					{
+						if ((segment[7 + i * 3] & 15) != maxV) verticalChroma = true;
+					}
+					break;
+				}
+				case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7: // progressive, lossless and hierarchical
+				case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF: // arithmetic
+					return false;
+				case 0xDD:
+					if (segment.size() < 2) return false;
+					interval = getBE16(segment.data());
+					break;
+				case 0xDA:
+				{
+					// one interleaved scan of every component
+					if (components == 0 || segment.empty() || segment[0] != components) return false;
+					if (interval == 0 || m_width == 0 || m_height == 0) return false;
+					uint32_t mcuWidth = components == 1 ? 8 : maxH * 8;
+					uint32_t mcuHeight = components == 1 ? 8 : maxV * 8;
+					uint32_t mcusPerRow = (m_width + mcuWidth - 1) / mcuWidth;
+					uint32_t mcuRows = (m_height + mcuHeight - 1) / mcuHeight;
+
+					// the first MCU row after the first one that starts an interval
+					uint32_t a = interval, b = mcusPerRow;
+					while (b != 0)
+					{
+						uint32_t t = a % b;
+						a = b;
+						b = t;
+					}
+					uint32_t bandMcuRows = interval / a;
+					if (bandMcuRows >= mcuRows) return false; // a single band
+					m_bandRows = bandMcuRows * mcuHeight;
+					m_intervalsPerBand = (uint32_t)((uint64_t)bandMcuRows * mcusPerRow / interval);
+
+					// the upsampling of the chroma rows at the band edges reads the neighbors
+					m_contextBands = verticalChroma;
+					m_skipRow.resize((size_t)m_width * 3);
+					m_scanPos = m_file->tell();
+					m_starts.push_back(m_scanPos);
+
+					info->width = m_width;
+					info->height = m_height;
+					info->pixelformat = PixelFormatBGR8;
+					info->pitchBytes = m_width * 3;
+					return true;
+				}
+				case 0xD8: case 0xD9:
+					return false;
+				}
+			}
+		}
+
+		// the intervals up to count or the end of the scan
+		void index(size_t count) noexcept(false)
+		{
+			uint8_t buffer[BUFFERING_SIZE];
+			while (m_ends.size() < count && !m_scanEnd)
+			{
+				m_file->seek_set(m_scanPos);
+				size_t size = m_file->read(buffer, sizeof(buffer));
+				if (size == 0)
+				{
+					// truncated, the rest is decoded as the fake EOI
+					m_ends.push_back(m_scanPos);
+					m_scanEnd = true;
+					break;
+				}
+				size_t i = 0;
+				while (i < size && m_ends.size() < count && !m_scanEnd)
+				{
+					if (!m_afterFF)
+					{
+						const uint8_t* next = (const uint8_t*)memchr(buffer + i, 0xFF, size - i);
+						if (!next)
+						{
+							i = size;
+							break;
+						}
+						i = next - buffer + 1;
+						m_afterFF = true;
+						continue;
+					}
+					uint8_t code = buffer[i++];
+					if (code == 0xFF) continue; // fill
+					m_afterFF = false;
+					if (code == 0x00) continue; // stuffed
+					uint64_t markerPos = m_scanPos + i - 2;
+					m_ends.push_back(markerPos);
+					if (code >= JPEG_RST0 && code <= JPEG_RST0 + 7) m_starts.push_back(m_scanPos + i);
+					else m_scanEnd = true;
+				}
+				m_scanPos += i;
+			}
+		}
+
+		// decodes the bands [band0, band1) as one image, the rows outside [y0, y1) are dropped
+		bool readBands(uint8_t* dest, size_t pitch, uint32_t y0, uint32_t y1, uint32_t band0, uint32_t band1) noexcept
+		{
+			uint32_t top = band0 * m_bandRows;
+			uint32_t rows = (uint64_t)band1 * m_bandRows < m_height ? band1 * m_bandRows - top : m_height - top;
+			size_t first = (size_t)band0 * m_intervalsPerBand;
+			size_t last = (size_t)band1 * m_intervalsPerBand;
+			try
+			{
+				index(last);
+				if (last > m_ends.size()) last = m_ends.size();
+				if (first >= last) return false;
+
+				m_stream.assign(m_header.begin(), m_header.end());
+				m_stream[m_heightOffset] = (uint8_t)(rows >> 8);
+				m_stream[m_heightOffset + 1] = (uint8_t)rows;
+				for (size_t i = first; i < last; i++)
+				{
+					// the markers count from RST0 in the band
+					size_t size = (size_t)(m_ends[i] - m_starts[i]);
+					size_t pos = m_stream.size();
+					m_stream.resize(pos + size);
+					m_file->seek_set(m_starts[i]);
+					if (m_file->read(m_stream.data() + pos, size) != size) return false;
+					if (i + 1 < last)
+					{
+						m_stream.push_back(0xFF);
+						m_stream.push_back((uint8_t)(JPEG_RST0 + ((i - first) & 7)));
+					}
+				}
+				m_stream.push_back(0xFF);
+				m_stream.push_back(JPEG_EOI);
+			}
+			catch (...)
+			{
+				return false;
+			}
+			return decode(dest, pitch, y0 - top, y1 - top, rows);
+		}
+
+		bool decode(uint8_t* dest, size_t pitch, uint32_t y0, uint32_t y1, uint32_t rows) noexcept
+		{
+			KRL_USING(LibJpeg, libjpeg, false);
+			struct jpeg_decompress_struct cinfo;
+			struct my_error_mgr jerr;
+			kr_jpeg_suspend_source_mgr source;
+			cinfo.err = libjpeg->jpeg_std_error(&jerr.pub);
+			jerr.pub.error_exit = my_error_exit;
+			if (setjmp(jerr.setjmp_buffer))
+			{
+				libjpeg->jpeg_destroy_decompress(&cinfo);
+				return false;
+			}
+			libjpeg->jpeg_create_decompress(&cinfo);
+			source.make(&cinfo);
+			source.finished = true;
+			source.next_input_byte = m_stream.data();
+			source.bytes_in_buffer = m_stream.size();
+
+			(void)libjpeg->jpeg_read_header(&cinfo, TRUE);
+			cinfo.out_color_space = JCS_RGB;
+			(void)libjpeg->jpeg_start_decompress(&cinfo);
+			if (cinfo.output_width != m_width || cinfo.output_height != rows || cinfo.output_components != 3)
+			{
+				libjpeg->jpeg_destroy_decompress(&cinfo);
+				return false;
+			}
+			while (cinfo.output_scanline < y1)
+			{
+				uint32_t y = cinfo.output_scanline;
+				JSAMPROW row = y < y0 ? m_skipRow.data() : dest + pitch * (y - y0);
+				(void)libjpeg->jpeg_read_scanlines(&cinfo, &row, 1);
+			}
+			// the rows after y1 are not decoded
+			libjpeg->jpeg_destroy_decompress(&cinfo);
+			return true;
+		}
+
+		KrbFile* const m_file;
+		std::vector<uint8_t> m_header; // up to the end of SOS
+		size_t m_heightOffset = 0; // the height of SOF in m_header
+		uint32_t m_width = 0;
+		uint32_t m_height = 0;
+		uint32_t m_bandRows = 0;
+		uint32_t m_intervalsPerBand = 0;
+		bool m_contextBands = false; // a band is decoded with the ones above and below it
+
+		std::vector<uint64_t> m_starts; // the entropy-coded data of the intervals
+		std::vector<uint64_t> m_ends;
+		uint64_t m_scanPos = 0;
+		bool m_afterFF = false;
+		bool m_scanEnd = false; // EOI or another marker
+		std::vector<uint8_t> m_stream;
+		std::vector<uint8_t> m_skipRow;
+	};
+}
+backend::RowReader* kr::backend::Jpeg::openRows(KrbFile* file, KrbImageInfo* info) noexcept
+{
+	JpegRowReader* reader = new(std::nothrow) JpegRowReader(file);
+	if (!reader) return nullptr;
+	if (!reader->open(info))
+	{
+		delete reader;
+		return nullptr;
+	}
+	return reader;
+}
+bool kr::backend::Jpeg::probe(KrbFile* file, KrbImageInfo* info) noexcept
+{
+	uint8_t soi[2];
+	if (file->read(soi, 2) != 2 || soi[0] != 0xFF || soi[1] != 0xD8) return false;
+	for (;;)
+	{
+		uint8_t marker[4];
+		if (file->read(marker, 4) != 4 || marker[0] != 0xFF) return false;
+		uint8_t code = marker[1];
+		uint32_t length = getBE16(marker + 2);
+		if (length < 2) return false;
+
+		// SOFn, C4, C8 and CC are DHT, JPG and DAC
+		if (code >= 0xC0 && code <= 0xCF && code != 0xC4 && code != 0xC8 && code != 0xCC)
+		{
+			uint8_t sof[6];
+			if (length < 8 || file->read(sof, sizeof(sof)) != sizeof(sof)) return false;
+			info->height = getBE16(sof + 1);
+			info->width = getBE16(sof + 3);
+			uint32_t components = sof[5];
+			if (info->width == 0 || info->height == 0) return false;
+			if (components != 1 && components != 3 && components != 4) return false;
+			info->pixelformat = PixelFormatBGR8;
+			info->pitchBytes = info->width * components; // the rows of libjpeg, same as the loader
+			return true;
+		}
+		if (code == 0xDA || code == 0xD9) return false;
+		file->seek_cur(length - 2);
+	}
+}
+
+bool kr::backend::Jpeg::transform(const KrbJpegTransform* transform, KrbFile* dest, KrbFile* src) noexcept
+{
+	KRL_USING(LibJpeg, libjpeg, false);
+	if ((unsigned)transform->transform > JpegTransformRotate270) return false;
+	BlockTransform tr(transform->transform);
+
+	struct jpeg_decompress_struct srcinfo;
+	struct jpeg_compress_struct dstinfo;
+	struct my_error_mgr jerr;
+
+	srcinfo.err = libjpeg->jpeg_std_error(&jerr.pub);
+	dstinfo.err = &jerr.pub;
+	jerr.pub.error_exit = my_error_exit;
+	libjpeg->jpeg_create_decompress(&srcinfo);
+	libjpeg->jpeg_create_compress(&dstinfo);
+	if (setjmp(jerr.setjmp_buffer)) {
+		libjpeg->jpeg_destroy_compress(&dstinfo);
+		libjpeg->jpeg_destroy_decompress(&srcinfo);
+		return false;
+	}
+
+	kr_jpeg_source_mgr::make(&srcinfo, src);
+	(void)libjpeg->jpeg_read_header(&srcinfo, TRUE);
+#if JPEG_LIB_VERSION >= 80
+	if (srcinfo.block_size != DCTSIZE)
+	{
+		libjpeg->jpeg_destroy_compress(&dstinfo);
+		libjpeg->jpeg_destroy_decompress(&srcinfo);
+		return false;
+	}
+#endif
+
+	// geometry of the transformed image
+	uint32_t fullWidth = srcinfo.image_width;
+	uint32_t fullHeight = srcinfo.image_height;
+	uint32_t maxH = srcinfo.max_h_samp_factor;
+	uint32_t maxV = srcinfo.max_v_samp_factor;
+	if (tr.transpose)
+	{
+		std::swap(fullWidth, fullHeight);
+		std::swap(maxH, maxV);
+	}
+	uint32_t mcuWidth = maxH * DCTSIZE;
+	uint32_t mcuHeight = maxV * DCTSIZE;
+	if (tr.flipH) fullWidth -= fullWidth % mcuWidth;
+	if (tr.flipV) fullHeight -= fullHeight % mcuHeight;
+
+	uint32_t cropX = transform->cropX - transform->cropX % mcuWidth;
+	uint32_t cropY = transform->cropY - transform->cropY % mcuHeight;
+	if (cropX >= fullWidth || cropY >= fullHeight)
+	{
+		libjpeg->jpeg_destroy_compress(&dstinfo);
+		libjpeg->jpeg_destroy_decompress(&srcinfo);
+		return false;
+	}
+	uint32_t width = fullWidth - cropX;
+	uint32_t height = fullHeight - cropY;
+	if (transform->cropWidth != 0)
+	{
+		uint32_t request = transform->cropWidth + (transform->cropX - cropX);
+		if (request < width) width = request;
+	}
+	if (transform->cropHeight != 0)
+	{
+		uint32_t request = transform->cropHeight + (transform->cropY - cropY);
+		if (request < height) height = request;
+	}
+
+	// destination coefficient arrays, must be requested before reading
+	struct ComponentGeometry
+	{
+		uint32_t hsamp, vsamp;
+		uint32_t fullBlocksW, fullBlocksH;
+		uint32_t cropBlocksX, cropBlocksY;
+		uint32_t blocksW, blocksH;
+		jvirt_barray_ptr array;
+	};
+	ComponentGeometry geometry[MAX_COMPONENTS];
+	int numComponents = srcinfo.num_components;
+	for (int c = 0; c < numComponents; c++)
+	{
+		jpeg_component_info* comp = &srcinfo.comp_info[c];
+		ComponentGeometry& g = geometry[c];
+		g.hsamp = tr.transpose ? comp->v_samp_factor : comp->h_samp_factor;
+		g.vsamp = tr.transpose ? comp->h_samp_factor : comp->v_samp_factor;
+		g.fullBlocksW = (fullWidth * g.hsamp + mcuWidth - 1) / mcuWidth;
+		g.fullBlocksH = (fullHeight * g.vsamp + mcuHeight - 1) / mcuHeight;
+		g.cropBlocksX = cropX * g.hsamp / mcuWidth;
+		g.cropBlocksY = cropY * g.vsamp / mcuHeight;
+		g.blocksW = (width * g.hsamp + mcuWidth - 1) / mcuWidth;
+		g.blocksH = (height * g.vsamp + mcuHeight - 1) / mcuHeight;
+		g.blocksW = (g.blocksW + g.hsamp - 1) / g.hsamp * g.hsamp;
+		g.blocksH = (g.blocksH + g.vsamp - 1) / g.vsamp * g.vsamp;
+		g.array = (*srcinfo.mem->request_virt_barray)
+			((j_common_ptr)&srcinfo, JPOOL_IMAGE, FALSE, g.blocksW, g.blocksH, g.vsamp);
+	}
+
+	jvirt_barray_ptr* srcCoefs = libjpeg->jpeg_read_coefficients(&srcinfo);
+
+	libjpeg->jpeg_copy_critical_parameters(&srcinfo, &dstinfo);
+	dstinfo.image_width = width;
+	dstinfo.image_height = height;
+	if (tr.transpose)
+	{
+		for (int c = 0; c < numComponents; c++)
+		{
+			jpeg_component_info* comp = &dstinfo.comp_info[c];
+			std::swap(comp->h_samp_factor, comp->v_samp_factor);
+		}
+		for (int i = 0; i < NUM_QUANT_TBLS; i++)
+		{
+			JQUANT_TBL* qtbl = dstinfo.quant_tbl_ptrs[i];
+			if (qtbl == nullptr) continue;
+			for (int k = 0; k < DCTSIZE; k++)
+			{
+				for (int j = k + 1; j < DCTSIZE; j++)
+				{
+					std::swap(qtbl->quantval[k * DCTSIZE + j], qtbl->quantval[j * DCTSIZE + k]);
+				}
+			}
+		}
+	}
+
+	for (int c = 0; c < numComponents; c++)
+	{
+		ComponentGeometry& g = geometry[c];
+		jpeg_component_info* comp = &srcinfo.comp_info[c];
+		uint32_t srcBlocksW = (comp->width_in_blocks + comp->h_samp_factor - 1) / comp->h_samp_factor * comp->h_samp_factor;
+		uint32_t srcBlocksH = (comp->height_in_blocks + comp->v_samp_factor - 1) / comp->v_samp_factor * comp->v_samp_factor;
+
+		for (uint32_t by = 0; by < g.blocksH; by += g.vsamp)
+		{
+			JBLOCKARRAY destRows = (*srcinfo.mem->access_virt_barray)
+				((j_common_ptr)&srcinfo, g.array, by, g.vsamp, TRUE);
+			for (uint32_t row = 0; row < g.vsamp; row++)
+			{
+				uint32_t fy = by + row + g.cropBlocksY;
+				uint32_t ty = tr.flipV ? g.fullBlocksH - 1 - fy : fy;
+				JBLOCKROW destRow = destRows[row];
+				for (uint32_t bx = 0; bx < g.blocksW; bx++)
+				{
+					uint32_t fx = bx + g.cropBlocksX;
+					uint32_t tx = tr.flipH ? g.fullBlocksW - 1 - fx : fx;
+					uint32_t sx = tr.transpose ? ty : tx;
+					uint32_t sy = tr.transpose ? tx : ty;
+
+					// padding blocks out of the source, the unsigned underflow is also caught here
+					if (sx >= srcBlocksW || sy >= srcBlocksH)
+					{
+						memset(destRow[bx], 0, sizeof(JBLOCK));
+						continue;
+					}
+					JBLOCKARRAY srcRow = (*srcinfo.mem->access_virt_barray)
+						((j_common_ptr)&srcinfo, srcCoefs[c], sy, 1, FALSE);
+					tr(destRow[bx], srcRow[0][sx]);
+				}
+			}
+		}
+	}
+
+	kr_jpeg_destination_mgr::make(&dstinfo, dest);
+	jvirt_barray_ptr destCoefs[MAX_COMPONENTS];
+	for (int c = 0; c < numComponents; c++)
+	{
+		destCoefs[c] = geometry[c].array;
+	}
+	libjpeg->jpeg_write_coefficients(&dstinfo, destCoefs);
+	libjpeg->jpeg_finish_compress(&dstinfo);
+	libjpeg->jpeg_destroy_compress(&dstinfo);
+
+	(void)libjpeg->jpeg_finish_decompress(&srcinfo);
+	libjpeg->jpeg_destroy_decompress(&srcinfo);
+	return true;
+}
@@ -6,11 +6,19 @@ namespace kr
 {
 	namespace backend
 	{
+		class RowReader;
+
 		class Jpeg
 		{
 		public:
 			static bool load(KrbImageCallback* callback, KrbFile* file) noexcept;
+			static KrbImageDecoder* createDecoder(KrbImageCallback* callback) noexcept;
+			// nullptr if the file cannot seek to the rows, the file is left anywhere
+			static RowReader* openRows(KrbFile* file, KrbImageInfo* info) noexcept;
+			// the header only, the file is left anywhere
+			static bool probe(KrbFile* file, KrbImageInfo* info) noexcept;
 			static bool save(const KrbImageSaveInfo* info, KrbFile* file) noexcept;
+			static bool transform(const KrbJpegTransform* transform, KrbFile* dest, KrbFile* src) noexcept;
 		};
 	}
 }
@@ -1,5 +1,13 @@
 #include "kpng.h"
+#include "pngfilter.h"
+#include "inflate.h"
+#include "simd.h"
+#include "util.h"
 #include <assert.h>
+#include <memory.h>
+#include "parallel.h"
+#include <vector>
+#include <memory>
 
 extern "C" {
 #include "pnglibconf.h"
@@ -19,6 +27,9 @@ KRL_IMPORT(png_get_io_ptr)
 KRL_IMPORT(png_get_IHDR)
 KRL_IMPORT(png_read_update_info)
 KRL_IMPORT(png_read_image)
+KRL_IMPORT(png_read_rows)
+KRL_IMPORT(png_read_row)
+KRL_IMPORT(png_set_interlace_handling)
 KRL_IMPORT(png_set_gray_to_rgb)
 KRL_IMPORT(png_set_expand)
 KRL_IMPORT(png_set_bgr)
@@ -26,11 +37,878 @@ KRL_IMPORT(png_set_strip_16)
 KRL_IMPORT(png_set_packing)
 KRL_IMPORT(png_get_rowbytes)
 KRL_IMPORT(png_set_longjmp_fn)
+KRL_IMPORT(png_set_progressive_read_fn)
+KRL_IMPORT(png_get_progressive_ptr)
+KRL_IMPORT(png_process_data)
+KRL_IMPORT(png_progressive_combine_row)
+KRL_IMPORT(png_get_channels)
+KRL_IMPORT(png_error)
 KRL_END()
 
+#include "zlib_contrib/zlib_link.h"
+#include "imagedecoder.h"
+#include <new>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	constexpr uint8_t PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	constexpr uint32_t PNG_MAX_CHUNK_SIZE = 0x7fffffff;
+
+	// raw data size of one band, same as the pigz block size
+	constexpr size_t PNG_BAND_BYTES = 128 * 1024;
+
+	// private chunk: ancillary, private, unsafe to copy
+	// [u8 version][u8 flags][u16 reserved][u32 rowsPerBand][u32 bandCount][u32 offset]...
+	// offset is the start of the raw deflate data of the band in the concatenated IDAT data
+	// every band ends at a flush point and does not refer to the previous band
+	constexpr uint32_t PNG_BAND_INDEX_CHUNK = "krBI"_sig;
+	constexpr uint8_t PNG_BAND_INDEX_VERSION = 1;
+	constexpr uint8_t PNG_BAND_INDEX_FILTER_RESET = 0x1; // the first row of every band is filtered with None or Sub
+	constexpr size_t PNG_BAND_INDEX_HEADER_SIZE = 12;
+
+	inline void putBE32(uint8_t* dest, uint32_t value) noexcept
+	{
+		dest[0] = (uint8_t)(value >> 24);
+		dest[1] = (uint8_t)(value >> 16);
+		dest[2] = (uint8_t)(value >> 8);
+		dest[3] = (uint8_t)value;
+	}
+
+	struct PngWriteFormat
+	{
+		uint8_t colorType;
+		uint8_t bpp; // bytes per pixel in the PNG row
+		void (*convert)(uint8_t* dest, const uint8_t* src, uint32_t width);
+	};
+
+	template <size_t SIZE>
+	void convertCopy(uint8_t* dest, const uint8_t* src, uint32_t width) noexcept
+	{
+		memcpy(dest, src, width * SIZE);
+	}
+
+	// offsets of the channels in the source pixel, A < 0 means no alpha
+	template <int R, int G, int B, int A, size_t SIZE>
+	void convertBytes(uint8_t* dest, const uint8_t* src, uint32_t width) noexcept
+	{
+		const uint8_t* src_end = src + width * SIZE;
+		while (src != src_end)
+		{
+			*dest++ = src[R];
+			*dest++ = src[G];
+			*dest++ = src[B];
+			if (A >= 0) *dest++ = src[A];
+			src += SIZE;
+		}
+	}
+
+	void convertR5G6B5(uint8_t* dest, const uint8_t* src, uint32_t width) noexcept
+	{
+		const uint16_t* src_ptr = (const uint16_t*)src;
+		const uint16_t* src_end = src_ptr + width;
+		while (src_ptr != src_end)
+		{
+			uint16_t v = *src_ptr++;
+			uint8_t r = (v >> 11) & 0x1f;
+			uint8_t g = (v >> 5) & 0x3f;
+			uint8_t b = v & 0x1f;
+			*dest++ = (r << 3) | (r >> 2);
+			*dest++ = (g << 2) | (g >> 4);
+			*dest++ = (b << 3) | (b >> 2);
+		}
+	}
+
+	template <bool ALPHA>
+	void convertRGB5(uint8_t* dest, const uint8_t* src, uint32_t width) noexcept
+	{
+		const uint16_t* src_ptr = (const uint16_t*)src;
+		const uint16_t* src_end = src_ptr + width;
+		while (src_ptr != src_end)
+		{
+			uint16_t v = *src_ptr++;
+			uint8_t r = (v >> 10) & 0x1f;
+			uint8_t g = (v >> 5) & 0x1f;
+			uint8_t b = v & 0x1f;
+			*dest++ = (r << 3) | (r >> 2);
+			*dest++ = (g << 3) | (g >> 2);
+			*dest++ = (b << 3) | (b >> 2);
+			if (ALPHA) *dest++ = (v & 0x8000) ? 0xff : 0;
+		}
+	}
+
+	void convertARGB4(uint8_t* dest, const uint8_t* src, uint32_t width) noexcept
+	{
+		const uint16_t* src_ptr = (const uint16_t*)src;
+		const uint16_t* src_end = src_ptr + width;
+		while (src_ptr != src_end)
+		{
+			uint16_t v = *src_ptr++;
+			*dest++ = ((v >> 8) & 0xf) * 0x11;
+			*dest++ = ((v >> 4) & 0xf) * 0x11;
+			*dest++ = (v & 0xf) * 0x11;
+			*dest++ = (v >> 12) * 0x11;
+		}
+	}
+
+	bool getWriteFormat(kr_pixelformat_t pixelformat, PngWriteFormat* out) noexcept
+	{
+		switch (pixelformat)
+		{
+		case PixelFormatIndex: *out = { PNG_COLOR_TYPE_PALETTE, 1, convertCopy<1> }; return true;
+		case PixelFormatA8: *out = { PNG_COLOR_TYPE_GRAY, 1, convertCopy<1> }; return true;
+		case PixelFormatR5G6B5: *out = { PNG_COLOR_TYPE_RGB, 3, convertR5G6B5 }; return true;
+		case PixelFormatX1RGB5: *out = { PNG_COLOR_TYPE_RGB, 3, convertRGB5<false> }; return true;
+		case PixelFormatA1RGB5: *out = { PNG_COLOR_TYPE_RGB_ALPHA, 4, convertRGB5<true> }; return true;
+		case PixelFormatARGB4: *out = { PNG_COLOR_TYPE_RGB_ALPHA, 4, convertARGB4 }; return true;
+		case PixelFormatRGB8: *out = { PNG_COLOR_TYPE_RGB, 3, convertBytes<2, 1, 0, -1, 3> }; return true;
+		case PixelFormatXRGB8: *out = { PNG_COLOR_TYPE_RGB, 3, convertBytes<2, 1, 0, -1, 4> }; return true;
+		case PixelFormatARGB8: *out = { PNG_COLOR_TYPE_RGB_ALPHA, 4, convertBytes<2, 1, 0, 3, 4> }; return true;
+		case PixelFormatBGR8: *out = { PNG_COLOR_TYPE_RGB, 3, convertCopy<3> }; return true;
+		case PixelFormatXBGR8: *out = { PNG_COLOR_TYPE_RGB, 3, convertBytes<0, 1, 2, -1, 4> }; return true;
+		case PixelFormatABGR8: *out = { PNG_COLOR_TYPE_RGB_ALPHA, 4, convertCopy<4> }; return true;
+		default: return false;
+		}
+	}
+
+	struct PngPresetParams
+	{
+		int level;
+		int strategy;
+		int memLevel;
+		uint32_t filterMask;
+	};
+
+	constexpr uint32_t PNG_FILTER_ALL = (1 << PngFilterCount) - 1;
+	constexpr uint32_t PNG_FILTER_NO_PRIOR = (1 << PngFilterNone) | (1 << PngFilterSub);
+
+	inline uint32_t ctz(uint32_t mask) noexcept
+	{
+		uint32_t n = 0;
+		while (!(mask & 1))
+		{
+			mask >>= 1;
+			n++;
+		}
+		return n;
+	}
+
+	const PngPresetParams pngPresets[] = {
+		{ 0, Z_DEFAULT_STRATEGY, 8, 1 << PngFilterNone }, // PngPresetStore
+		{ 1, Z_RLE, 8, (1 << PngFilterNone) | (1 << PngFilterSub) | (1 << PngFilterUp) }, // PngPresetRle
+		{ 1, Z_FILTERED, 8, (1 << PngFilterNone) | (1 << PngFilterSub) | (1 << PngFilterUp) }, // PngPresetFast
+		{ 6, Z_FILTERED, 8, PNG_FILTER_ALL }, // PngPresetDefault
+		{ 9, Z_FILTERED, 9, PNG_FILTER_ALL }, // PngPresetMax
+	};
+
+	void writeChunk(const ZLib* zlib, KrbFile* file, uint32_t type, const void* data, size_t size) noexcept
+	{
+		uint8_t header[8];
+		putBE32(header, (uint32_t)size);
+		memcpy(header + 4, &type, 4);
+		uLong crc = zlib->crc32(0, header + 4, 4);
+		if (size != 0) crc = zlib->crc32(crc, (const Bytef*)data, (uInt)size);
+
+		uint8_t footer[4];
+		putBE32(footer, (uint32_t)crc);
+		file->write(header, sizeof(header));
+		if (size != 0) file->write(data, size);
+		file->write(footer, sizeof(footer));
+	}
+
+	// filters and deflates row bands independently, pigz-style
+	// each band is a raw deflate stream ending with a sync flush, so they can be concatenated
+	class PngBandEncoder
+	{
+	public:
+		struct Band
+		{
+			std::vector<uint8_t> data;
+			uLong adler;
+			size_t rawSize;
+			bool ok;
+		};
+
+		PngBandEncoder(const ZLib* zlib, const KrbImageSaveInfo* info, const PngWriteFormat& format, const PngPresetParams& params) noexcept
+			:m_zlib(zlib), m_info(info), m_format(format), m_params(params)
+		{
+			m_rowBytes = (size_t)info->width * format.bpp;
+			size_t rows = PNG_BAND_BYTES / (m_rowBytes + 1);
+			m_rowsPerBand = rows == 0 ? 1 : (uint32_t)rows;
+			m_bandCount = (info->height + m_rowsPerBand - 1) / m_rowsPerBand;
+		}
+
+		bool run() noexcept
+		{
+			try
+			{
+				m_bands.resize(m_bandCount);
+			}
+			catch (...)
+			{
+				return false;
+			}
+
+			parallelFor(m_bandCount, [this](uint32_t index) {
+				try
+				{
+					m_bands[index].ok = encodeBand(index);
+				}
+				catch (...)
+				{
+					m_bands[index].ok = false;
+				}
+			});
+
+			for (Band& band : m_bands)
+			{
+				if (!band.ok) return false;
+			}
+			return true;
+		}
+
+		// band offsets for the parallel decoder, must be written before IDAT
+		void writeIndex(KrbFile* file) noexcept
+		{
+			if (m_bandCount <= 1) return;
+
+			std::vector<uint8_t> index(PNG_BAND_INDEX_HEADER_SIZE + (size_t)m_bandCount * 4);
+			uint8_t* ptr = index.data();
+			ptr[0] = PNG_BAND_INDEX_VERSION;
+			ptr[1] = PNG_BAND_INDEX_FILTER_RESET;
+			ptr[2] = 0;
+			ptr[3] = 0;
+			putBE32(ptr + 4, m_rowsPerBand);
+			putBE32(ptr + 8, m_bandCount);
+			ptr += PNG_BAND_INDEX_HEADER_SIZE;
+
+			uint32_t offset = 2; // zlib header
+			for (Band& band : m_bands)
+			{
+				putBE32(ptr, offset);
+				ptr += 4;
+				offset += (uint32_t)band.data.size();
+			}
+			writeChunk(m_zlib, file, PNG_BAND_INDEX_CHUNK, index.data(), index.size());
+		}
+
+		void write(KrbFile* file) noexcept
+		{
+			// zlib header with the level hint
+			uint8_t header[2] = { 0x78, 0x9c };
+			if (m_params.level <= 1) header[1] = 0x01;
+			else if (m_params.level >= 7) header[1] = 0xda;
+
+			uLong adler = m_zlib->adler32(0, nullptr, 0);
+			for (uint32_t i = 0; i < m_bandCount; i++)
+			{
+				Band& band = m_bands[i];
+				adler = m_zlib->adler32_combine(adler, band.adler, (z_off_t)band.rawSize);
+				if (i == 0)
+				{
+					band.data.insert(band.data.begin(), header, header + 2);
+				}
+				if (i == m_bandCount - 1)
+				{
+					uint8_t footer[4];
+					putBE32(footer, (uint32_t)adler);
+					band.data.insert(band.data.end(), footer, footer + 4);
+				}
+				writeChunk(m_zlib, file, "IDAT"_sig, band.data.data(), band.data.size());
+			}
+		}
+
+	private:
+		const uint8_t* getSourceRow(uint32_t y) const noexcept
+		{
+			return (const uint8_t*)m_info->data + (size_t)y * m_info->pitchBytes;
+		}
+
+		bool encodeBand(uint32_t index) noexcept(false)
+		{
+			Band& band = m_bands[index];
+			uint32_t y = index * m_rowsPerBand;
+			uint32_t yEnd = y + m_rowsPerBand;
+			if (yEnd > m_info->height) yEnd = m_info->height;
+			bool last = yEnd == m_info->height;
+
+			size_t bpp = m_format.bpp;
+			size_t lineBytes = PNG_ROW_PADDING + m_rowBytes;
+			std::vector<uint8_t> lines(lineBytes * 2, 0);
+			uint8_t* prior = lines.data() + PNG_ROW_PADDING;
+			uint8_t* row = prior + lineBytes;
+			if (y != 0) m_format.convert(prior, getSourceRow(y - 1), m_info->width);
+
+			std::vector<uint8_t> filtered((m_rowBytes + 1) * (yEnd - y));
+			uint8_t* out = filtered.data();
+			uint32_t mask = m_params.filterMask;
+			if (m_format.colorType == PNG_COLOR_TYPE_PALETTE) mask = 1 << PngFilterNone;
+			// the first row of a band must not refer to the previous band
+			uint32_t rowMask = mask & PNG_FILTER_NO_PRIOR;
+			if (rowMask == 0) rowMask = 1 << PngFilterNone;
+			if (y == 0) rowMask = mask;
+			for (; y != yEnd; y++)
+			{
+				m_format.convert(row, getSourceRow(y), m_info->width);
+				PngFilter filter = (rowMask & (rowMask - 1)) == 0 ? (PngFilter)ctz(rowMask) : PngFilterer::choose(row, prior, m_rowBytes, bpp, rowMask);
+				rowMask = mask;
+				*out++ = filter;
+				PngFilterer::filter(filter, out, row, prior, m_rowBytes, bpp);
+				out += m_rowBytes;
+				std::swap(row, prior);
+			}
+
+			band.rawSize = filtered.size();
+			band.adler = m_zlib->adler32(m_zlib->adler32(0, nullptr, 0), filtered.data(), (uInt)filtered.size());
+
+			z_stream zs;
+			memset(&zs, 0, sizeof(zs));
+			if (m_zlib->deflateInit2(&zs, m_params.level, Z_DEFLATED, -MAX_WBITS, m_params.memLevel, m_params.strategy) != Z_OK)
+			{
+				return false;
+			}
+			finally{
+				m_zlib->deflateEnd(&zs);
+			};
+
+			// sync flush appends an empty stored block
+			band.data.resize(m_zlib->deflateBound(&zs, (uLong)filtered.size()) + 16);
+			zs.next_in = filtered.data();
+			zs.avail_in = (uInt)filtered.size();
+			zs.next_out = band.data.data();
+			zs.avail_out = (uInt)band.data.size();
+			int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+			for (;;)
+			{
+				int res = m_zlib->deflate(&zs, flush);
+				if (res == Z_STREAM_ERROR) return false;
+				if (res == Z_STREAM_END) break;
+				if (zs.avail_out != 0 && flush == Z_SYNC_FLUSH) break;
+
+				size_t used = band.data.size() - zs.avail_out;
+				band.data.resize(band.data.size() * 2);
+				zs.next_out = band.data.data() + used;
+				zs.avail_out = (uInt)(band.data.size() - used);
+			}
+			band.data.resize(band.data.size() - zs.avail_out);
+			return true;
+		}
+
+		const ZLib* const m_zlib;
+		const KrbImageSaveInfo* const m_info;
+		const PngWriteFormat m_format;
+		const PngPresetParams m_params;
+		size_t m_rowBytes;
+		uint32_t m_rowsPerBand;
+		uint32_t m_bandCount;
+		std::vector<Band> m_bands;
+	};
+}
+
+
+namespace
+{
+	inline uint32_t getBE32(const uint8_t* src) noexcept
+	{
+		return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+	}
+
+	// channel offsets of the output pixel, A < 0 means no alpha, X is filled with 0xff
+	template <int R, int G, int B, int A, size_t SIZE>
+	struct PngPixelLayout
+	{
+		static constexpr size_t size = SIZE;
+
+		static void write(uint8_t* dest, uint8_t r, uint8_t g, uint8_t b, uint8_t a) noexcept
+		{
+			dest[R] = r;
+			dest[G] = g;
+			dest[B] = b;
+			if (A >= 0) dest[A < 0 ? 0 : A] = a;
+			else if (SIZE == 4) dest[3] = 0xff;
+		}
+	};
+
+	using LayoutRGB8 = PngPixelLayout<2, 1, 0, -1, 3>;
+	using LayoutXRGB8 = PngPixelLayout<2, 1, 0, -1, 4>;
+	using LayoutARGB8 = PngPixelLayout<2, 1, 0, 3, 4>;
+	using LayoutBGR8 = PngPixelLayout<0, 1, 2, -1, 3>;
+	using LayoutXBGR8 = PngPixelLayout<0, 1, 2, -1, 4>;
+	using LayoutABGR8 = PngPixelLayout<0, 1, 2, 3, 4>;
+
+	typedef void (*PngRowConvert)(uint8_t* dest, const uint8_t* src, uint32_t width, const uint8_t* lut);
+
+	// gray and palette, lut has 256 output pixels with the stride of 4
+	template <size_t SIZE>
+	void convertLut(uint8_t* dest, const uint8_t* src, uint32_t width, const uint8_t* lut) noexcept
+	{
+		const uint8_t* src_end = src + width;
+		while (src != src_end)
+		{
+			memcpy(dest, lut + *src++ * 4, SIZE);
+			dest += SIZE;
+		}
+	}
+
+	template <size_t SIZE>
+	void convertCopyRow(uint8_t* dest, const uint8_t* src, uint32_t width, const uint8_t* lut) noexcept
+	{
+		memcpy(dest, src, width * SIZE);
+	}
+
+	// RGBA to BGRA, the alpha is kept for XRGB8 too
+	void convertSwapRGBA(uint8_t* dest, const uint8_t* src, uint32_t width, const uint8_t* lut) noexcept
+	{
+		uint32_t i = 0;
+#ifdef KRB_SSE2
+		__m128i green = _mm_set1_epi32(0xff00ff00);
+		__m128i red = _mm_set1_epi32(0x000000ff);
+		for (; i + 4 <= width; i += 4)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)(src + i * 4));
+			__m128i ga = _mm_and_si128(x, green);
+			__m128i rb = _mm_andnot_si128(green, x);
+			__m128i br = _mm_or_si128(_mm_srli_epi32(rb, 16), _mm_and_si128(_mm_slli_epi32(rb, 16), _mm_slli_epi32(red, 16)));
+			_mm_storeu_si128((__m128i*)(dest + i * 4), _mm_or_si128(ga, br));
+		}
+#endif
+		for (; i < width; i++)
+		{
+			const uint8_t* s = src + i * 4;
+			uint8_t* d = dest + i * 4;
+			d[0] = s[2];
+			d[1] = s[1];
+			d[2] = s[0];
+			d[3] = s[3];
+		}
+	}
+
+	// SRC is the PNG bytes per pixel: 2 gray alpha, 3 RGB, 4 RGBA
+	template <size_t SRC, typename DEST>
+	void convertPixels(uint8_t* dest, const uint8_t* src, uint32_t width, const uint8_t* lut) noexcept
+	{
+		const uint8_t* src_end = src + width * SRC;
+		while (src != src_end)
+		{
+			if (SRC == 2) DEST::write(dest, src[0], src[0], src[0], src[1]);
+			else DEST::write(dest, src[0], src[1], src[2], SRC == 4 ? src[3] : 0xff);
+			src += SRC;
+			dest += DEST::size;
+		}
+	}
+
+	template <typename DEST>
+	PngRowConvert getPixelConvert(uint8_t colorType) noexcept
+	{
+		switch (colorType)
+		{
+		case PNG_COLOR_TYPE_GRAY_ALPHA: return convertPixels<2, DEST>;
+		case PNG_COLOR_TYPE_RGB: return convertPixels<3, DEST>;
+		default: return convertPixels<4, DEST>;
+		}
+	}
+
+	template <typename DEST>
+	void fillLut(uint8_t* lut, const uint8_t* rgba) noexcept
+	{
+		for (size_t i = 0; i < 256; i++)
+		{
+			const uint8_t* color = rgba + i * 4;
+			DEST::write(lut + i * 4, color[0], color[1], color[2], color[3]);
+		}
+	}
+
+	// reads the 8-bit non-interlaced PNG files in memory, for the decoders without libpng
+	class PngReader
+	{
+	public:
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint8_t colorType = 0;
+		uint8_t bpp = 0; // bytes per pixel in the PNG row
+		size_t rowBytes = 0;
+		bool hasTransparency = false;
+		uint8_t palette[256 * 4]; // RGBA
+		std::vector<uint8_t> bandIndex; // the body of the band index chunk
+		std::vector<uint8_t> idat;
+
+		// output
+		kr_pixelformat_t pixelformat = PixelFormatInvalid;
+		uint8_t outSize = 0;
+		PngRowConvert convert = nullptr;
+		uint8_t lut[256 * 4];
+
+		// signature, IHDR, and the band index chunk if it is the next
+		// false if the file is not supported
+		bool readHeader(KrbFile* file) noexcept(false)
+		{
+			uint8_t header[8 + 25 + 8];
+			if (file->read(header, sizeof(header)) != sizeof(header)) return false;
+			if (memcmp(header, PNG_SIGNATURE, sizeof(PNG_SIGNATURE)) != 0) return false;
+			const uint8_t* ihdr = header + 8;
+			if (getBE32(ihdr) != 13 || memcmp(ihdr + 4, "IHDR", 4) != 0) return false;
+
+			width = getBE32(ihdr + 8);
+			height = getBE32(ihdr + 12);
+			uint8_t bitDepth = ihdr[16];
+			colorType = ihdr[17];
+			uint8_t interlace = ihdr[20];
+			if (bitDepth != 8 || interlace != 0 || width == 0 || height == 0) return false;
+			switch (colorType)
+			{
+			case PNG_COLOR_TYPE_GRAY: bpp = 1; break;
+			case PNG_COLOR_TYPE_GRAY_ALPHA: bpp = 2; break;
+			case PNG_COLOR_TYPE_RGB: bpp = 3; break;
+			case PNG_COLOR_TYPE_RGB_ALPHA: bpp = 4; break;
+			case PNG_COLOR_TYPE_PALETTE: bpp = 1; break;
+			default: return false;
+			}
+			rowBytes = (size_t)width * bpp;
+
+			memcpy(m_pending, header + 33, 8);
+			m_hasPending = true;
+			if (memcmp(m_pending + 4, &PNG_BAND_INDEX_CHUNK, 4) == 0)
+			{
+				// the length must match the band count of the height before anything is allocated
+				m_hasPending = false;
+				uint32_t length = getBE32(m_pending);
+				if (length > PNG_MAX_CHUNK_SIZE || length < PNG_BAND_INDEX_HEADER_SIZE) return false;
+				uint8_t indexHeader[PNG_BAND_INDEX_HEADER_SIZE];
+				if (file->read(indexHeader, sizeof(indexHeader)) != sizeof(indexHeader)) return false;
+				uint32_t rowsPerBand = getBE32(indexHeader + 4);
+				if (rowsPerBand == 0) return false;
+				uint64_t bandCount = ((uint64_t)height + rowsPerBand - 1) / rowsPerBand;
+				if (length != PNG_BAND_INDEX_HEADER_SIZE + bandCount * 4) return false;
+				bandIndex.resize(length);
+				memcpy(bandIndex.data(), indexHeader, sizeof(indexHeader));
+				size_t rest = length - sizeof(indexHeader);
+				if (file->read(bandIndex.data() + sizeof(indexHeader), rest) != rest) return false;
+				file->seek_cur(4); // crc
+			}
+			return true;
+		}
+
+		// collects the palette and the whole IDAT data until IEND
+		bool readChunks(KrbFile* file) noexcept(false)
+		{
+			for (size_t i = 0; i < 256; i++)
+			{
+				palette[i * 4 + 0] = palette[i * 4 + 1] = palette[i * 4 + 2] = (uint8_t)i;
+				palette[i * 4 + 3] = 0xff;
+			}
+			for (;;)
+			{
+				uint8_t chunk[8];
+				if (m_hasPending)
+				{
+					memcpy(chunk, m_pending, sizeof(chunk));
+					m_hasPending = false;
+				}
+				else if (file->read(chunk, sizeof(chunk)) != sizeof(chunk)) return false;
+				uint32_t size = getBE32(chunk);
+				uint32_t type;
+				memcpy(&type, chunk + 4, 4);
+				if (type == "IEND"_sig) break;
+				if (type == "IDAT"_sig)
+				{
+					size_t offset = idat.size();
+					idat.resize(offset + size);
+					if (file->read(idat.data() + offset, size) != size) return false;
+				}
+				else if (type == "tRNS"_sig && colorType != PNG_COLOR_TYPE_PALETTE)
+				{
+					return false; // color key, left to libpng
+				}
+				else if (type == "PLTE"_sig || type == "tRNS"_sig)
+				{
+					uint8_t data[256 * 3];
+					if (size > sizeof(data)) return false;
+					if (file->read(data, size) != size) return false;
+					if (type == "PLTE"_sig)
+					{
+						for (uint32_t i = 0; i < size / 3; i++)
+						{
+							memcpy(palette + i * 4, data + i * 3, 3);
+						}
+					}
+					else
+					{
+						if (size > 256) return false;
+						for (uint32_t i = 0; i < size; i++)
+						{
+							palette[i * 4 + 3] = data[i];
+						}
+						hasTransparency = true;
+					}
+				}
+				else
+				{
+					file->seek_cur(size);
+				}
+				file->seek_cur(4); // crc
+			}
+			return !idat.empty();
+		}
+
+		// RGB8 or ARGB8 if the request is not supported, same as the libpng path
+		void setOutputFormat(kr_pixelformat_t request) noexcept
+		{
+			bool alpha = colorType == PNG_COLOR_TYPE_GRAY_ALPHA || colorType == PNG_COLOR_TYPE_RGB_ALPHA || hasTransparency;
+			switch (request)
+			{
+			case PixelFormatRGB8: case PixelFormatXRGB8: case PixelFormatARGB8:
+			case PixelFormatBGR8: case PixelFormatXBGR8: case PixelFormatABGR8:
+				pixelformat = request;
+				break;
+			default:
+				pixelformat = alpha ? PixelFormatARGB8 : PixelFormatRGB8;
+				break;
+			}
+
+			switch (pixelformat)
+			{
+			case PixelFormatRGB8: setLayout<LayoutRGB8>(); break;
+			case PixelFormatXRGB8: setLayout<LayoutXRGB8>(); break;
+			case PixelFormatARGB8: setLayout<LayoutARGB8>(); break;
+			case PixelFormatBGR8: setLayout<LayoutBGR8>(); break;
+			case PixelFormatXBGR8: setLayout<LayoutXBGR8>(); break;
+			default: setLayout<LayoutABGR8>(); break;
+			}
+
+			// same layout or the byte swap
+			if (colorType == PNG_COLOR_TYPE_RGB && pixelformat == PixelFormatBGR8) convert = convertCopyRow<3>;
+			if (colorType == PNG_COLOR_TYPE_RGB_ALPHA)
+			{
+				if (pixelformat == PixelFormatABGR8 || pixelformat == PixelFormatXBGR8) convert = convertCopyRow<4>;
+				if (pixelformat == PixelFormatARGB8 || pixelformat == PixelFormatXRGB8) convert = convertSwapRGBA;
+			}
+		}
+
+	private:
+		template <typename DEST>
+		void setLayout() noexcept
+		{
+			outSize = (uint8_t)DEST::size;
+			if (colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_PALETTE)
+			{
+				fillLut<DEST>(lut, palette);
+				convert = DEST::size == 4 ? convertLut<4> : convertLut<3>;
+			}
+			else
+			{
+				convert = getPixelConvert<DEST>(colorType);
+			}
+		}
+
+		uint8_t m_pending[8]; // the chunk header after IHDR
+		bool m_hasPending = false;
+	};
+
+	class PngDecoderBase
+	{
+	public:
+		enum class Result
+		{
+			Unsupported, // the file position is restored
+			Loaded,
+			Failed,
+		};
+
+	protected:
+		PngDecoderBase(PngReader& reader) noexcept
+			:m_reader(reader)
+		{
+		}
+
+		// rowByRow for the decoders writing the rows in order
+		bool start(KrbImageCallback* callback, bool rowByRow) noexcept
+		{
+			KrbImageInfo imginfo;
+			imginfo.width = m_reader.width;
+			imginfo.height = m_reader.height;
+			imginfo.pixelformat = m_reader.pixelformat;
+			imginfo.pitchBytes = m_reader.width * m_reader.outSize;
+			rowByRow = rowByRow && callback->row != nullptr;
+			imginfo.rowByRow = rowByRow;
+			m_dest = (uint8_t*)callback->start(callback, &imginfo);
+			m_pitchBytes = imginfo.pitchBytes;
+			if (rowByRow) m_callback = callback;
+			return m_dest != nullptr;
+		}
+
+		// unfilters the rows in place and writes them to the output
+		// prior is the unfiltered previous row or zeros
+		bool unfilterRows(uint8_t* filtered, const uint8_t* prior, uint32_t y, uint32_t yEnd, uint32_t firstRowMask) noexcept
+		{
+			const PngReader& reader = m_reader;
+			uint32_t mask = firstRowMask;
+			for (; y != yEnd; y++)
+			{
+				uint8_t filter = *filtered++;
+				if (filter >= PngFilterCount) return false;
+				if (!(mask & (1 << filter))) return false;
+				mask = PNG_FILTER_ALL;
+
+				uint8_t* dest = m_callback ? m_callback->row(m_callback, y) : m_dest + (size_t)y * m_pitchBytes;
+				if (!dest) return false;
+				PngFilterer::unfilter((PngFilter)filter, filtered, prior, reader.rowBytes, reader.bpp);
+				reader.convert(dest, filtered, reader.width, reader.lut);
+				prior = filtered;
+				filtered += reader.rowBytes;
+			}
+			return true;
+		}
+
+		PngReader& m_reader;
+		uint8_t* m_dest = nullptr;
+		uint32_t m_pitchBytes = 0;
+		KrbImageCallback* m_callback = nullptr; // the row output
+	};
+
+	// inflates the whole IDAT data at once, then unfilters it to the output
+	class PngDirectDecoder :public PngDecoderBase
+	{
+	public:
+		PngDirectDecoder(PngReader& reader) noexcept
+			:PngDecoderBase(reader)
+		{
+		}
+
+		Result decode(KrbImageCallback* callback) noexcept(false)
+		{
+			const PngReader& reader = m_reader;
+			size_t filteredSize = (reader.rowBytes + 1) * reader.height;
+			std::unique_ptr<uint8_t[]> filtered(new uint8_t[filteredSize]);
+			Inflater inflater(reader.idat.data(), reader.idat.size());
+			if (!inflater.readZlibHeader()) return Result::Failed;
+			if (!start(callback, true)) return Result::Failed;
+			if (!inflater.inflate(filtered.get(), filteredSize)) return Result::Failed;
+
+			std::vector<uint8_t> zeros(reader.rowBytes, 0);
+			if (!unfilterRows(filtered.get(), zeros.data(), 0, reader.height, PNG_FILTER_ALL)) return Result::Failed;
+			return Result::Loaded;
+		}
+	};
+
+	// the PNG files with the band index chunk, inflates and unfilters the bands concurrently
+	class PngBandDecoder :public PngDecoderBase
+	{
+	public:
+		PngBandDecoder(PngReader& reader) noexcept
+			:PngDecoderBase(reader)
+		{
+		}
+
+		Result decode(KrbImageCallback* callback) noexcept(false)
+		{
+			if (!readIndex()) return Result::Failed;
+			if (!start(callback, false)) return Result::Failed;
+
+			std::vector<uint8_t> results(m_bandCount, 0);
+			parallelFor(m_bandCount, [&](uint32_t index) {
+				try
+				{
+					results[index] = decodeBand(index);
+				}
+				catch (...)
+				{
+				}
+			});
+			for (uint8_t ok : results)
+			{
+				if (!ok) return Result::Failed;
+			}
+			return Result::Loaded;
+		}
+
+	private:
+		bool readIndex() noexcept(false)
+		{
+			const std::vector<uint8_t>& index = m_reader.bandIndex;
+			if (index.size() < PNG_BAND_INDEX_HEADER_SIZE) return false;
+			if (index[0] != PNG_BAND_INDEX_VERSION) return false;
+			if (!(index[1] & PNG_BAND_INDEX_FILTER_RESET)) return false;
+			m_rowsPerBand = getBE32(&index[4]);
+			m_bandCount = getBE32(&index[8]);
+			if (m_rowsPerBand == 0) return false;
+			if (m_bandCount != ((uint64_t)m_reader.height + m_rowsPerBand - 1) / m_rowsPerBand) return false;
+			if (index.size() != PNG_BAND_INDEX_HEADER_SIZE + (size_t)m_bandCount * 4) return false;
+			m_offsets.resize(m_bandCount + 1);
+			for (uint32_t i = 0; i < m_bandCount; i++)
+			{
+				m_offsets[i] = getBE32(&index[PNG_BAND_INDEX_HEADER_SIZE + i * 4]);
+			}
+
+			// the last band ends before adler32
+			if (m_reader.idat.size() < 6) return false;
+			m_offsets[m_bandCount] = (uint32_t)(m_reader.idat.size() - 4);
+			for (uint32_t i = 0; i < m_bandCount; i++)
+			{
+				if (m_offsets[i] >= m_offsets[i + 1]) return false;
+			}
+			return true;
+		}
+
+		bool decodeBand(uint32_t index) noexcept(false)
+		{
+			const PngReader& reader = m_reader;
+			uint32_t y = index * m_rowsPerBand;
+			uint32_t yEnd = y + m_rowsPerBand;
+			if (yEnd > reader.height) yEnd = reader.height;
+
+			size_t filteredSize = (reader.rowBytes + 1) * (yEnd - y);
+			std::unique_ptr<uint8_t[]> filtered(new uint8_t[filteredSize]);
+			Inflater inflater(reader.idat.data() + m_offsets[index], m_offsets[index + 1] - m_offsets[index]);
+			if (!inflater.inflate(filtered.get(), filteredSize)) return false;
+
+			std::vector<uint8_t> zeros(reader.rowBytes, 0);
+			uint32_t mask = PNG_FILTER_NO_PRIOR;
+			if (index == 0) mask = PNG_FILTER_ALL;
+			return unfilterRows(filtered.get(), zeros.data(), y, yEnd, mask);
+		}
+
+		uint32_t m_rowsPerBand = 0;
+		uint32_t m_bandCount = 0;
+		std::vector<uint32_t> m_offsets;
+	};
+
+	// the banded files always, the others with ImageFlagBuiltinPng
+	PngDecoderBase::Result loadBuiltin(KrbImageCallback* callback, KrbFile* file) noexcept
+	{
+		try
+		{
+			uint64_t start = file->tell();
+			PngReader reader;
+			bool supported = reader.readHeader(file);
+			if (supported && reader.bandIndex.empty() && !(callback->flags & ImageFlagBuiltinPng)) supported = false;
+			if (supported) supported = reader.readChunks(file);
+			if (!supported)
+			{
+				file->seek_set(start);
+				return PngDecoderBase::Result::Unsupported;
+			}
+			reader.setOutputFormat(callback->requestFormat);
+			if (!reader.bandIndex.empty()) return PngBandDecoder(reader).decode(callback);
+			return PngDirectDecoder(reader).decode(callback);
+		}
+		catch (...)
+		{
+			return PngDecoderBase::Result::Failed;
+		}
+	}
+}
 
 bool kr::backend::Png::load(KrbImageCallback* callback, KrbFile * file) noexcept
 {
+	switch (loadBuiltin(callback, file))
+	{
+	case PngDecoderBase::Result::Loaded: return true;
+	case PngDecoderBase::Result::Failed: return false;
+	default: break;
+	}
+
 	KRL_USING(LibPng, libpng, false);
 
 	png_infop				info_ptr;
@@ -112,6 +990,13 @@ bool kr::backend::Png::load(KrbImageCallback* callback, KrbFile * file) noexcept
 	if (bit_depth == 16)	libpng->png_set_strip_16(png_ptr);
 	if (bit_depth < 8)		libpng->png_set_packing(png_ptr);
 
+	// read the Adam7 passes one by one to report them
+	int passes = 1;
+	if (interlace_type != PNG_INTERLACE_NONE && callback->progress)
+	{
+		passes = libpng->png_set_interlace_handling(png_ptr);
+	}
+
 	// Update the PNGLibLoader...
 
 	libpng->png_read_update_info(png_ptr, info_ptr);
@@ -134,8 +1019,23 @@ bool kr::backend::Png::load(KrbImageCallback* callback, KrbFile * file) noexcept
 		assert(!"Not implemented Yet");
 		return false;
 	}
+	bool rowByRow = callback->row != nullptr && interlace_type == PNG_INTERLACE_NONE;
+	imginfo.rowByRow = rowByRow;
 	uint8_t* surf = (uint8_t*)callback->start(callback, &imginfo);
-	if (surf)
+	if (surf && rowByRow)
+	{
+		for (uint32_t y = 0; y < imginfo.height; y++)
+		{
+			png_bytep row = callback->row(callback, y);
+			if (row == nullptr)
+			{
+				libpng->png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)nullptr);
+				return false;
+			}
+			libpng->png_read_row(png_ptr, row, nullptr);
+		}
+	}
+	else if (surf)
 	{
 		uint32_t H = imginfo.height;
 		png_bytep* row_pointers = new png_bytep[H];
@@ -146,7 +1046,19 @@ bool kr::backend::Png::load(KrbImageCallback* callback, KrbFile * file) noexcept
 			*p++ = surf;
 			surf += imginfo.pitchBytes;
 		}
-		libpng->png_read_image(png_ptr, row_pointers);
+		if (passes > 1)
+		{
+			// the display rows get the rectangle effect, every pass fills the whole image
+			for (int pass = 1; pass <= passes; pass++)
+			{
+				libpng->png_read_rows(png_ptr, nullptr, row_pointers, H);
+				callback->progress(callback, pass, pass == passes);
+			}
+		}
+		else
+		{
+			libpng->png_read_image(png_ptr, row_pointers);
+		}
 		delete [] row_pointers;
 	}
 
@@ -154,8 +1066,216 @@ bool kr::backend::Png::load(KrbImageCallback* callback, KrbFile * file) noexcept
 	libpng->png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)nullptr);
 	return true;
 }
+namespace
+{
+	// libpng progressive reader, png_process_data() takes every fed byte
+	class PngDecoder :public KrbImageDecoder
+	{
+	public:
+		PngDecoder(KrbImageCallback* callback) noexcept
+			:KrbImageDecoder(callback)
+		{
+		}
+		~PngDecoder() noexcept override
+		{
+			KRL_USING(LibPng, libpng,);
+			if (m_png) libpng->png_destroy_read_struct(&m_png, &m_info, (png_infopp)nullptr);
+		}
+
+		kr_decodestatus_t poll() noexcept override
+		{
+			KRL_USING(LibPng, libpng, DecodeStatusFailed);
+			if (m_failed) return DecodeStatusFailed;
+			if (m_done) return DecodeStatusDone;
+			if (m_png == nullptr)
+			{
+				m_png = libpng->png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+				if (m_png == nullptr) return fail();
+				m_info = libpng->png_create_info_struct(m_png);
+				if (m_info == nullptr) return fail();
+				libpng->png_set_progressive_read_fn(m_png, this, onInfo, onRow, onEnd);
+			}
+			if (setjmp((*libpng->png_set_longjmp_fn((m_png), longjmp, (sizeof(jmp_buf))))))
+			{
+				return fail();
+			}
+			if (available() != 0)
+			{
+				libpng->png_process_data(m_png, m_info, (png_bytep)peek(), available());
+				consume(available());
+			}
+			if (m_done) return DecodeStatusDone;
+			return needMore();
+		}
+
+	private:
+		kr_decodestatus_t fail() noexcept
+		{
+			m_failed = true;
+			return DecodeStatusFailed;
+		}
+
+		// same transforms with Png::load, png_error() jumps out of the callbacks
+		static void onInfo(png_structp png_ptr, png_infop info_ptr)
+		{
+			KRL_USING(LibPng, libpng,);
+			PngDecoder* decoder = (PngDecoder*)libpng->png_get_progressive_ptr(png_ptr);
+
+			KrbImageInfo imginfo;
+			int bit_depth, color_type, interlace_type;
+			libpng->png_get_IHDR(png_ptr, info_ptr, &imginfo.width, &imginfo.height, &bit_depth, &color_type,
+				&interlace_type, nullptr, nullptr);
+			switch (color_type)
+			{
+			case PNG_COLOR_TYPE_GRAY:
+			case PNG_COLOR_TYPE_GRAY_ALPHA:
+				libpng->png_set_gray_to_rgb(png_ptr);
+				libpng->png_set_expand(png_ptr);
+				break;
+			case PNG_COLOR_TYPE_PALETTE:
+				libpng->png_set_expand(png_ptr);
+				break;
+			}
+			libpng->png_set_bgr(png_ptr);
+			if (bit_depth == 16)	libpng->png_set_strip_16(png_ptr);
+			if (bit_depth < 8)		libpng->png_set_packing(png_ptr);
+			decoder->m_interlaced = libpng->png_set_interlace_handling(png_ptr) > 1;
+			libpng->png_read_update_info(png_ptr, info_ptr);
+			decoder->m_rowByRow = decoder->m_callback->row != nullptr && !decoder->m_interlaced;
+			imginfo.rowByRow = decoder->m_rowByRow;
+
+			imginfo.pixelformat = libpng->png_get_channels(png_ptr, info_ptr) == 4 ? PixelFormatARGB8 : PixelFormatRGB8;
+			decoder->m_rowBytes = libpng->png_get_rowbytes(png_ptr, info_ptr);
+			imginfo.pitchBytes = (uint32_t)decoder->m_rowBytes;
+			decoder->m_dest = (uint8_t*)decoder->m_callback->start(decoder->m_callback, &imginfo);
+			if (decoder->m_dest == nullptr) libpng->png_error(png_ptr, "start failed");
+			decoder->m_pitchBytes = imginfo.pitchBytes;
+		}
+
+		static void onRow(png_structp png_ptr, png_bytep new_row, png_uint_32 row_num, int pass)
+		{
+			KRL_USING(LibPng, libpng,);
+			PngDecoder* decoder = (PngDecoder*)libpng->png_get_progressive_ptr(png_ptr);
+			if (new_row == nullptr) return;
+			if (decoder->m_rowByRow)
+			{
+				uint8_t* row = decoder->m_callback->row(decoder->m_callback, row_num);
+				if (row == nullptr) libpng->png_error(png_ptr, "row failed");
+				memcpy(row, new_row, decoder->m_rowBytes);
+				return;
+			}
+			uint8_t* dest = decoder->m_dest + (size_t)row_num * decoder->m_pitchBytes;
+			if (decoder->m_interlaced) libpng->png_progressive_combine_row(png_ptr, dest, new_row);
+			else memcpy(dest, new_row, decoder->m_rowBytes);
+		}
+
+		static void onEnd(png_structp png_ptr, png_infop info_ptr)
+		{
+			KRL_USING(LibPng, libpng,);
+			PngDecoder* decoder = (PngDecoder*)libpng->png_get_progressive_ptr(png_ptr);
+			decoder->m_done = true;
+		}
+
+		png_structp m_png = nullptr;
+		png_infop m_info = nullptr;
+		bool m_done = false;
+		bool m_failed = false;
+		bool m_interlaced = false;
+		bool m_rowByRow = false;
+		uint8_t* m_dest = nullptr;
+		uint32_t m_pitchBytes = 0;
+		size_t m_rowBytes = 0;
+	};
+}
+
+KrbImageDecoder* kr::backend::Png::createDecoder(KrbImageCallback* callback) noexcept
+{
+	return new(std::nothrow) PngDecoder(callback);
+}
+bool kr::backend::Png::probe(KrbFile* file, KrbImageInfo* info) noexcept
+{
+	uint8_t header[8 + 25];
+	if (file->read(header, sizeof(header)) != sizeof(header)) return false;
+	if (memcmp(header, PNG_SIGNATURE, sizeof(PNG_SIGNATURE)) != 0) return false;
+	const uint8_t* ihdr = header + 8;
+	if (getBE32(ihdr) != 13 || memcmp(ihdr + 4, "IHDR", 4) != 0) return false;
+	info->width = getBE32(ihdr + 8);
+	info->height = getBE32(ihdr + 12);
+	if (info->width == 0 || info->height == 0) return false;
+
+	// the gray and palette files get the alpha of tRNS by the expansion, the chunk headers up to IDAT
+	uint8_t colorType = ihdr[17];
+	bool alpha = colorType == PNG_COLOR_TYPE_GRAY_ALPHA || colorType == PNG_COLOR_TYPE_RGB_ALPHA;
+	if (colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_PALETTE)
+	{
+		for (;;)
+		{
+			uint8_t chunk[8];
+			if (file->read(chunk, sizeof(chunk)) != sizeof(chunk)) return false;
+			uint32_t type;
+			memcpy(&type, chunk + 4, 4);
+			if (type == "IDAT"_sig || type == "IEND"_sig) break;
+			if (type == "tRNS"_sig)
+			{
+				alpha = true;
+				break;
+			}
+			file->seek_cur((uint64_t)getBE32(chunk) + 4);
+		}
+	}
+	info->pixelformat = alpha ? PixelFormatARGB8 : PixelFormatRGB8;
+	info->pitchBytes = info->width * (alpha ? 4 : 3);
+	return true;
+}
 bool kr::backend::Png::save(const KrbImageSaveInfo* info, KrbFile* file) noexcept
 {
-	assert(!"Not Implemented Yet");
-	return false;
+	KRL_USING(ZLib, zlib, false);
+
+	PngWriteFormat format;
+	if (!getWriteFormat(info->pixelformat, &format))
+	{
+		assert(!"unsupported format");
+		return false;
+	}
+	if (info->width == 0 || info->height == 0) return false;
+	if ((unsigned)info->pngPreset > PngPresetMax) return false;
+	if (format.colorType == PNG_COLOR_TYPE_PALETTE && !info->palette) return false;
+
+	PngBandEncoder encoder(zlib, info, format, pngPresets[info->pngPreset]);
+	if (!encoder.run()) return false;
+
+	file->write(PNG_SIGNATURE, sizeof(PNG_SIGNATURE));
+
+	uint8_t ihdr[13];
+	putBE32(ihdr, info->width);
+	putBE32(ihdr + 4, info->height);
+	ihdr[8] = 8; // bit depth
+	ihdr[9] = format.colorType;
+	ihdr[10] = 0; // compression
+	ihdr[11] = 0; // filter
+	ihdr[12] = 0; // interlace
+	writeChunk(zlib, file, "IHDR"_sig, ihdr, sizeof(ihdr));
+	encoder.writeIndex(file);
+
+	if (format.colorType == PNG_COLOR_TYPE_PALETTE)
+	{
+		uint8_t plte[256 * 3];
+		uint8_t trns[256];
+		size_t trnsCount = 0;
+		for (size_t i = 0; i < 256; i++)
+		{
+			uint32_t color = info->palette->color[i];
+			plte[i * 3 + 0] = (uint8_t)(color >> 16);
+			plte[i * 3 + 1] = (uint8_t)(color >> 8);
+			plte[i * 3 + 2] = (uint8_t)color;
+			trns[i] = (uint8_t)(color >> 24);
+			if (trns[i] != 0xff) trnsCount = i + 1;
+		}
+		writeChunk(zlib, file, "PLTE"_sig, plte, sizeof(plte));
+		if (trnsCount != 0) writeChunk(zlib, file, "tRNS"_sig, trns, trnsCount);
+	}
+
+	encoder.write(file);
+	writeChunk(zlib, file, "IEND"_sig, nullptr, 0);
+	return true;
 }
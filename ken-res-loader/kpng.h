@@ -11,6 +11,9 @@ namespace kr
 		{
 		public:
 			static bool load(KrbImageCallback* callback, KrbFile* file) noexcept;
+			static KrbImageDecoder* createDecoder(KrbImageCallback* callback) noexcept;
+			// the header only, the file is left anywhere
+			static bool probe(KrbFile* file, KrbImageInfo* info) noexcept;
 			static bool save(const KrbImageSaveInfo* info, KrbFile* file) noexcept;
 		};
 	}
@@ -178,6 +178,64 @@ bool backend::Zip::load(KrbCompressCallback* callback, KrbFile* file) noexcept
 	unzClose(unzipper.m_file);
 	return true;
 }
+bool backend::Zip::probe(KrbFile* file, uint64_t* entries) noexcept
+{
+	constexpr uint32_t EOCD_SIZE = 22;
+	constexpr uint32_t ZIP64_LOCATOR_SIZE = 20;
+	constexpr uint32_t MAX_COMMENT = 0xffff;
+
+	file->seek_end(0);
+	uint64_t size = file->tell();
+	if (size < EOCD_SIZE) return false;
+
+	// the record without the comment first, then the window of the longest comment
+	std::vector<uint8_t> tail;
+	uint64_t eocd = (uint64_t)-1;
+	try
+	{
+		for (uint64_t window : { (uint64_t)EOCD_SIZE, (uint64_t)EOCD_SIZE + MAX_COMMENT })
+		{
+			if (window > size) window = size;
+			tail.resize((size_t)window);
+			file->seek_set(size - window);
+			if (file->read(tail.data(), tail.size()) != tail.size()) return false;
+			for (size_t i = tail.size() - EOCD_SIZE + 1; i-- > 0;)
+			{
+				if (tail[i] == 'P' && memcmp(&tail[i], "PK\5\6", 4) == 0)
+				{
+					eocd = size - window + i;
+					break;
+				}
+			}
+			if (eocd != (uint64_t)-1 || window == size) break;
+		}
+	}
+	catch (...)
+	{
+		return false;
+	}
+	if (eocd == (uint64_t)-1) return false;
+	const uint8_t* record = &tail[(size_t)(eocd - (size - tail.size()))];
+	uint16_t count;
+	memcpy(&count, record + 10, 2);
+	*entries = count;
+	if (count != 0xffff) return true;
+
+	// ZIP64, the locator is right before the record
+	if (eocd < ZIP64_LOCATOR_SIZE) return false;
+	uint8_t locator[ZIP64_LOCATOR_SIZE];
+	file->seek_set(eocd - ZIP64_LOCATOR_SIZE);
+	if (file->read(locator, sizeof(locator)) != sizeof(locator)) return false;
+	if (memcmp(locator, "PK\6\7", 4) != 0) return false;
+	uint64_t offset;
+	memcpy(&offset, locator + 8, 8);
+	uint8_t record64[40];
+	file->seek_set(offset);
+	if (file->read(record64, sizeof(record64)) != sizeof(record64)) return false;
+	if (memcmp(record64, "PK\6\6", 4) != 0) return false;
+	memcpy(entries, record64 + 32, 8);
+	return true;
+}
 
 
 static voidpf ZCALLBACK fopen64_file_func_16(voidpf opaque, const void* filename, int mode)
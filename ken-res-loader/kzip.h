@@ -10,6 +10,8 @@ namespace kr
 		{
 		public:
 			static bool load(KrbCompressCallback* callback, KrbFile* file) noexcept;
+			// the entry count of the end of central directory record, the file is left anywhere
+			static bool probe(KrbFile* file, uint64_t* entries) noexcept;
 			// static bool save(const KrbImageSaveInfo* info, KrbFile* file) noexcept;
 		};
 	}
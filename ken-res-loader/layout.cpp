@@ -0,0 +1,265 @@
+#include "layout.h"
+#include "mipmap.h"
+#include "simd.h"
+
+#include <string.h>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	// the channel count and the bytes of a channel
+	bool getChannels(kr_pixelformat_t pixelformat, uint32_t* channels, uint32_t* channelBytes) noexcept
+	{
+		switch (pixelformat)
+		{
+		case PixelFormatIndex:
+		case PixelFormatA8:
+			*channels = 1; *channelBytes = 1; return true;
+		case PixelFormatR5G6B5:
+		case PixelFormatX1RGB5:
+		case PixelFormatA1RGB5:
+		case PixelFormatARGB4:
+			*channels = 1; *channelBytes = 2; return true; // packed
+		case PixelFormatRGB8:
+		case PixelFormatBGR8:
+			*channels = 3; *channelBytes = 1; return true;
+		case PixelFormatXRGB8:
+		case PixelFormatARGB8:
+		case PixelFormatXBGR8:
+		case PixelFormatABGR8:
+			*channels = 4; *channelBytes = 1; return true;
+		case PixelFormatRGBA16F:
+			*channels = 4; *channelBytes = 2; return true;
+		case PixelFormatRGBA32F:
+			*channels = 4; *channelBytes = 4; return true;
+		default:
+			return false;
+		}
+	}
+
+	inline uint32_t log2Ceil(uint32_t size) noexcept
+	{
+		uint32_t bits = 0;
+		while ((1u << bits) < size) bits++;
+		return bits;
+	}
+
+	// x and y interleaved in the low bits, the rest of the longer axis above them
+	void buildMorton(std::vector<uint32_t>& table, uint32_t size, uint32_t shift, uint32_t sharedBits) noexcept(false)
+	{
+		table.resize(size);
+		for (uint32_t v = 0; v < size; v++)
+		{
+			uint32_t index = 0;
+			for (uint32_t bit = 0; bit < sharedBits; bit++)
+			{
+				index |= ((v >> bit) & 1) << (bit * 2 + shift);
+			}
+			table[v] = index | ((v >> sharedBits) << (sharedBits * 2));
+		}
+	}
+
+	// 16 pixels of 4 bytes to 4 planes
+	void splitRow4(uint8_t* const planes[4], const uint8_t* src, uint32_t width) noexcept
+	{
+		uint32_t x = 0;
+#ifdef KRB_SSE2
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(src + x * 4));
+			__m128i b = _mm_loadu_si128((const __m128i*)(src + x * 4 + 16));
+			__m128i c = _mm_loadu_si128((const __m128i*)(src + x * 4 + 32));
+			__m128i d = _mm_loadu_si128((const __m128i*)(src + x * 4 + 48));
+			__m128i u0 = _mm_unpacklo_epi8(a, b);
+			__m128i u1 = _mm_unpackhi_epi8(a, b);
+			__m128i u2 = _mm_unpacklo_epi8(c, d);
+			__m128i u3 = _mm_unpackhi_epi8(c, d);
+			__m128i v0 = _mm_unpacklo_epi8(u0, u1);
+			__m128i v1 = _mm_unpackhi_epi8(u0, u1);
+			__m128i v2 = _mm_unpacklo_epi8(u2, u3);
+			__m128i v3 = _mm_unpackhi_epi8(u2, u3);
+			__m128i w0 = _mm_unpacklo_epi8(v0, v1);
+			__m128i w1 = _mm_unpackhi_epi8(v0, v1);
+			__m128i w2 = _mm_unpacklo_epi8(v2, v3);
+			__m128i w3 = _mm_unpackhi_epi8(v2, v3);
+			_mm_storeu_si128((__m128i*)(planes[0] + x), _mm_unpacklo_epi64(w0, w2));
+			_mm_storeu_si128((__m128i*)(planes[1] + x), _mm_unpackhi_epi64(w0, w2));
+			_mm_storeu_si128((__m128i*)(planes[2] + x), _mm_unpacklo_epi64(w1, w3));
+			_mm_storeu_si128((__m128i*)(planes[3] + x), _mm_unpackhi_epi64(w1, w3));
+		}
+#endif
+		for (; x < width; x++)
+		{
+			planes[0][x] = src[x * 4];
+			planes[1][x] = src[x * 4 + 1];
+			planes[2][x] = src[x * 4 + 2];
+			planes[3][x] = src[x * 4 + 3];
+		}
+	}
+
+	void splitRowFloat(uint8_t* const planes[4], const uint8_t* src, uint32_t width) noexcept
+	{
+		uint32_t x = 0;
+#ifdef KRB_SSE2
+		for (; x + 4 <= width; x += 4)
+		{
+			__m128 p0 = _mm_loadu_ps((const float*)src + x * 4);
+			__m128 p1 = _mm_loadu_ps((const float*)src + x * 4 + 4);
+			__m128 p2 = _mm_loadu_ps((const float*)src + x * 4 + 8);
+			__m128 p3 = _mm_loadu_ps((const float*)src + x * 4 + 12);
+			_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+			_mm_storeu_ps((float*)planes[0] + x, p0);
+			_mm_storeu_ps((float*)planes[1] + x, p1);
+			_mm_storeu_ps((float*)planes[2] + x, p2);
+			_mm_storeu_ps((float*)planes[3] + x, p3);
+		}
+#endif
+		for (; x < width; x++)
+		{
+			for (int c = 0; c < 4; c++) memcpy(planes[c] + x * 4, src + x * 16 + c * 4, 4);
+		}
+	}
+}
+
+bool ImageLayout::isSupported(kr_imagelayout_t layout, kr_pixelformat_t pixelformat) noexcept
+{
+	uint32_t channels, channelBytes;
+	if (layout == ImageLayoutLinear) return true;
+	if (layout != ImageLayoutMorton && layout != ImageLayoutTiled4x4 && layout != ImageLayoutPlanar) return false;
+	return getChannels(pixelformat, &channels, &channelBytes);
+}
+size_t ImageLayout::getImageBytes(const KrbImageInfo* info) noexcept
+{
+	uint32_t channels, channelBytes;
+	switch (info->layout)
+	{
+	case ImageLayoutMorton:
+		return (size_t)info->pitchBytes * ((size_t)1 << log2Ceil(info->height));
+	case ImageLayoutTiled4x4:
+		return (size_t)info->pitchBytes * ((info->height + 3) / 4);
+	case ImageLayoutPlanar:
+		if (!getChannels(info->pixelformat, &channels, &channelBytes)) return 0;
+		return (size_t)info->pitchBytes * info->height * channels;
+	default:
+		return (size_t)info->pitchBytes * Mipmap::getLevelRows(info->pixelformat, info->height) + (size_t)info->chromaPitchBytes * info->chromaHeight * 2;
+	}
+}
+bool ImageLayout::init(KrbImageInfo* info) noexcept
+{
+	uint32_t channelBytes;
+	if (!getChannels(info->pixelformat, &m_channels, &channelBytes)) return false;
+	m_layout = info->layout;
+	m_width = info->width;
+	m_height = info->height;
+	m_pixelBytes = m_channels * channelBytes;
+	switch (m_layout)
+	{
+	case ImageLayoutMorton:
+	{
+		uint32_t bitsX = log2Ceil(m_width);
+		uint32_t bitsY = log2Ceil(m_height);
+		uint32_t shared = bitsX < bitsY ? bitsX : bitsY;
+		try
+		{
+			buildMorton(m_mortonX, m_width, 0, shared);
+			buildMorton(m_mortonY, m_height, 1, shared);
+		}
+		catch (...)
+		{
+			return false;
+		}
+		// a band fills whole 2^n x 2^n blocks of the index range
+		m_bandRows = 1u << (shared < 3 ? shared : 3);
+		m_pitchBytes = (1u << bitsX) * m_pixelBytes;
+		break;
+	}
+	case ImageLayoutTiled4x4:
+		m_bandRows = 4;
+		m_pitchBytes = (m_width + 3) / 4 * 16 * m_pixelBytes;
+		break;
+	case ImageLayoutPlanar:
+		m_bandRows = 1;
+		m_pitchBytes = m_width * channelBytes;
+		break;
+	default:
+		return false;
+	}
+	info->pitchBytes = m_pitchBytes;
+	return true;
+}
+void ImageLayout::writeBand(uint8_t* dest, const uint8_t* src, size_t srcPitch, uint32_t y, uint32_t rows) const noexcept
+{
+	const uint32_t size = m_pixelBytes;
+	switch (m_layout)
+	{
+	case ImageLayoutMorton:
+	{
+		// block by block, the writes of a block stay in its index range
+		uint32_t block = m_bandRows;
+		for (uint32_t bx = 0; bx < m_width; bx += block)
+		{
+			uint32_t xEnd = bx + block < m_width ? bx + block : m_width;
+			for (uint32_t dy = 0; dy < rows; dy++)
+			{
+				const uint8_t* line = src + srcPitch * dy;
+				uint32_t rowIndex = m_mortonY[y + dy];
+				if (size == 4)
+				{
+					for (uint32_t x = bx; x < xEnd; x++)
+					{
+						memcpy(dest + (size_t)(m_mortonX[x] | rowIndex) * 4, line + (size_t)x * 4, 4);
+					}
+					continue;
+				}
+				for (uint32_t x = bx; x < xEnd; x++)
+				{
+					memcpy(dest + (size_t)(m_mortonX[x] | rowIndex) * size, line + (size_t)x * size, size);
+				}
+			}
+		}
+		break;
+	}
+	case ImageLayoutTiled4x4:
+	{
+		uint8_t* tileRow = dest + (size_t)m_pitchBytes * (y / 4);
+		for (uint32_t tx = 0; tx * 4 < m_width; tx++)
+		{
+			uint32_t count = m_width - tx * 4 < 4 ? m_width - tx * 4 : 4;
+			uint8_t* tile = tileRow + (size_t)tx * 16 * size;
+			for (uint32_t dy = 0; dy < rows; dy++)
+			{
+				memcpy(tile + (size_t)dy * 4 * size, src + srcPitch * dy + (size_t)tx * 4 * size, (size_t)count * size);
+			}
+		}
+		break;
+	}
+	case ImageLayoutPlanar:
+	{
+		size_t planeBytes = (size_t)m_pitchBytes * m_height;
+		uint32_t channelBytes = size / m_channels;
+		for (uint32_t dy = 0; dy < rows; dy++)
+		{
+			const uint8_t* line = src + srcPitch * dy;
+			uint8_t* planes[4];
+			for (uint32_t c = 0; c < m_channels; c++) planes[c] = dest + planeBytes * c + (size_t)m_pitchBytes * (y + dy);
+			if (m_channels == 4 && channelBytes == 1) splitRow4(planes, line, m_width);
+			else if (m_channels == 4 && channelBytes == 4) splitRowFloat(planes, line, m_width);
+			else
+			{
+				for (uint32_t x = 0; x < m_width; x++)
+				{
+					for (uint32_t c = 0; c < m_channels; c++)
+					{
+						memcpy(planes[c] + (size_t)x * channelBytes, line + (size_t)x * size + c * channelBytes, channelBytes);
+					}
+				}
+			}
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
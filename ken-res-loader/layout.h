@@ -0,0 +1,42 @@
+#pragma once
+
+#include "include/image.h"
+
+#include <vector>
+
+namespace kr
+{
+	namespace backend
+	{
+		// writes the rows to the arrangements of kr_imagelayout_t, a band of rows at a time
+		class ImageLayout
+		{
+		public:
+			// the formats with whole-byte pixels, the block and YCbCr formats are linear only
+			static bool isSupported(kr_imagelayout_t layout, kr_pixelformat_t pixelformat) noexcept;
+			// the buffer size of the first level
+			static size_t getImageBytes(const KrbImageInfo* info) noexcept;
+
+			// sets layout and pitchBytes of info
+			bool init(KrbImageInfo* info) noexcept;
+			// the rows to gather before writeBand, the last band can be shorter
+			uint32_t getBandRows() const noexcept
+			{
+				return m_bandRows;
+			}
+			// the band of the rows from y, y is a multiple of getBandRows
+			void writeBand(uint8_t* dest, const uint8_t* src, size_t srcPitch, uint32_t y, uint32_t rows) const noexcept;
+
+		private:
+			kr_imagelayout_t m_layout = ImageLayoutLinear;
+			uint32_t m_width = 0;
+			uint32_t m_height = 0;
+			uint32_t m_pitchBytes = 0;
+			uint32_t m_pixelBytes = 0;
+			uint32_t m_channels = 0;
+			uint32_t m_bandRows = 1;
+			std::vector<uint32_t> m_mortonX; // the index bits of x and y
+			std::vector<uint32_t> m_mortonY;
+		};
+	}
+}
@@ -0,0 +1,373 @@
+#include "lazyimage.h"
+#include "imagedecoder.h"
+#include "kpng.h"
+#include "jpeg.h"
+#include "tga.h"
+#include "bmp.h"
+
+#include <string.h>
+#include <new>
+
+#ifdef _MSC_VER
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace kr;
+
+namespace
+{
+	constexpr size_t BAND_BYTES = 64 << 10; // the bands of the files without their own
+	constexpr size_t FEED_BYTES = 64 << 10; // the rows past the asked ones are bounded by a chunk
+
+	size_t getPageSize() noexcept
+	{
+#ifdef _MSC_VER
+		SYSTEM_INFO system;
+		GetSystemInfo(&system);
+		return system.dwPageSize;
+#else
+		return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+	}
+
+	// the address range costs no memory until the pages are committed and touched
+	uint8_t* reserveMemory(size_t size) noexcept
+	{
+#ifdef _MSC_VER
+		return (uint8_t*)VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_READWRITE);
+#else
+		void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		return data == MAP_FAILED ? nullptr : (uint8_t*)data;
+#endif
+	}
+	bool commitMemory(uint8_t* data, size_t size) noexcept
+	{
+#ifdef _MSC_VER
+		return VirtualAlloc(data, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+		return true; // the pages come on the first write
+#endif
+	}
+	// the whole pages of the range
+	void decommitMemory(uint8_t* data, size_t size) noexcept
+	{
+#ifdef _MSC_VER
+		VirtualFree(data, size, MEM_DECOMMIT);
+#else
+		madvise(data, size, MADV_DONTNEED);
+#endif
+	}
+	void freeMemory(uint8_t* data, size_t size) noexcept
+	{
+#ifdef _MSC_VER
+		VirtualFree(data, 0, MEM_RELEASE);
+#else
+		munmap(data, size);
+#endif
+	}
+}
+
+KrbImage::RowSink::RowSink(KrbImage* image) noexcept
+	:m_image(image)
+{
+	start = [](KrbImageCallback* _this, KrbImageInfo* info)->void* {
+		KrbImage* image = static_cast<RowSink*>(_this)->m_image;
+		if (image->m_started)
+		{
+			// the restarts read the same header
+			if (info->width != image->info.width || info->height != image->info.height || info->pixelformat != image->info.pixelformat) return nullptr;
+			info->pitchBytes = image->info.pitchBytes;
+		}
+		else
+		{
+			image->info = *info;
+			if (!image->reserve()) return nullptr;
+			image->m_started = true;
+		}
+		// the decoders without the row output write anywhere in the image
+		if (!info->rowByRow && !commitMemory(image->m_pixels, image->m_reservedBytes)) return nullptr;
+		return image->m_pixels;
+	};
+	row = [](KrbImageCallback* _this, uint32_t y)->uint8_t* {
+		return static_cast<RowSink*>(_this)->m_image->getRow(y);
+	};
+	palette = &image->palette;
+}
+
+KrbImage::KrbImage(KrbFile* file) noexcept
+	:m_file(file), m_sink(this)
+{
+}
+KrbImage::~KrbImage() noexcept
+{
+	delete m_decoder;
+	if (m_pixels) freeMemory(m_pixels, m_reservedBytes);
+}
+KrbImage* KrbImage::open(KrbExtension extension, KrbFile* file) noexcept
+{
+	KrbImage* image = new(std::nothrow) KrbImage(file);
+	if (!image) return nullptr;
+	image->m_fileStart = file->tell();
+	image->m_extension = extension;
+
+	backend::RowReader* reader = nullptr;
+	switch (extension)
+	{
+	case KrbExtension::ImagePng:
+		break;
+	case KrbExtension::ImageJpeg:
+	case KrbExtension::ImageJpg:
+		reader = backend::Jpeg::openRows(file, &image->info);
+		break;
+	case KrbExtension::ImageTga:
+		reader = backend::Tga::openRows(file, &image->info, &image->palette);
+		break;
+	case KrbExtension::ImageBmp:
+		reader = backend::Bmp::openRows(file, &image->info, &image->palette);
+		break;
+	default:
+		delete image;
+		return nullptr;
+	}
+	if (reader)
+	{
+		image->m_reader.reset(reader);
+		if (!image->reserve())
+		{
+			delete image;
+			return nullptr;
+		}
+		return image;
+	}
+
+	// the rows decoded with the header are kept
+	image->m_storeFrom = 0;
+	if (image->restart())
+	{
+		while (!image->m_started && image->step())
+		{
+		}
+	}
+	image->m_storeFrom = UINT32_MAX;
+	if (!image->m_started)
+	{
+		delete image;
+		return nullptr;
+	}
+	return image;
+}
+const uint8_t* KrbImage::lockRows(uint32_t y0, uint32_t y1) noexcept
+{
+	if (y0 >= y1 || y1 > info.height) return nullptr;
+	uint32_t band0 = y0 / m_bandRows;
+	uint32_t band1 = (y1 - 1) / m_bandRows + 1;
+	const size_t pitch = info.pitchBytes;
+	if (m_reader)
+	{
+		uint32_t band = band0;
+		while (band < band1)
+		{
+			if (isDecoded(band))
+			{
+				band++;
+				continue;
+			}
+			// the missing bands in a row at once
+			uint32_t end = band;
+			while (end < band1 && !isDecoded(end)) end++;
+			bool ok = true;
+			for (uint32_t i = band; ok && i < end; i++) ok = commitBand(i);
+			uint32_t y = band * m_bandRows;
+			ok = ok && m_reader->read(m_pixels + pitch * y, pitch, y, getBandEnd(end - 1));
+			for (uint32_t i = band; i < end; i++)
+			{
+				if (ok) m_bands[i].rowsStored = getBandEnd(i) - i * m_bandRows;
+				else releaseBand(i);
+			}
+			if (!ok) return nullptr;
+			band = end;
+		}
+	}
+	else if (!decodeSequential(band0, band1))
+	{
+		return nullptr;
+	}
+	for (uint32_t band = band0; band < band1; band++) m_bands[band].locks++;
+	return m_pixels + pitch * y0;
+}
+void KrbImage::unlockRows(uint32_t y0, uint32_t y1) noexcept
+{
+	if (y0 >= y1 || y1 > info.height) return;
+	uint32_t band1 = (y1 - 1) / m_bandRows + 1;
+	for (uint32_t band = y0 / m_bandRows; band < band1; band++)
+	{
+		Band& b = m_bands[band];
+		if (b.locks == 0) continue;
+		if (--b.locks == 0) releaseBand(band);
+	}
+}
+
+bool KrbImage::reserve() noexcept
+{
+	if (info.width == 0 || info.height == 0 || info.pitchBytes == 0) return false;
+	uint64_t size = (uint64_t)info.pitchBytes * info.height;
+	if (size > SIZE_MAX) return false;
+	m_reservedBytes = (size_t)size;
+	m_bandRows = m_reader ? m_reader->getBandRows() : 1;
+	if (m_bandRows == 1) m_bandRows = (uint32_t)(BAND_BYTES / info.pitchBytes);
+	if (m_bandRows == 0) m_bandRows = 1;
+	try
+	{
+		m_bands.resize((info.height - 1) / m_bandRows + 1);
+		m_scratch.resize(info.pitchBytes);
+	}
+	catch (...)
+	{
+		return false;
+	}
+	m_pixels = reserveMemory(m_reservedBytes);
+	return m_pixels != nullptr;
+}
+uint32_t KrbImage::getBandEnd(uint32_t band) const noexcept
+{
+	uint64_t end = (uint64_t)(band + 1) * m_bandRows;
+	return end < info.height ? (uint32_t)end : info.height;
+}
+bool KrbImage::isDecoded(uint32_t band) const noexcept
+{
+	return m_bands[band].rowsStored == getBandEnd(band) - band * m_bandRows;
+}
+bool KrbImage::commitBand(uint32_t band) noexcept
+{
+	size_t begin = (size_t)info.pitchBytes * band * m_bandRows;
+	size_t end = (size_t)info.pitchBytes * getBandEnd(band);
+	return commitMemory(m_pixels + begin, end - begin);
+}
+void KrbImage::releaseBand(uint32_t band) noexcept
+{
+	m_bands[band].rowsStored = 0;
+
+	// the pages shared with the bands that have rows stay, the empty neighbors within a page join
+	static const size_t pageSize = getPageSize();
+	const size_t bandBytes = (size_t)info.pitchBytes * m_bandRows;
+	const uint32_t count = (uint32_t)m_bands.size();
+	uint32_t first = band;
+	while (first > 0 && m_bands[first - 1].rowsStored == 0 && (band - first) * bandBytes < pageSize) first--;
+	uint32_t last = band + 1;
+	while (last < count && m_bands[last].rowsStored == 0 && (last - band - 1) * bandBytes < pageSize) last++;
+	size_t begin = bandBytes * first;
+	size_t end = last == count ? m_reservedBytes : bandBytes * last;
+	begin = (begin + pageSize - 1) / pageSize * pageSize;
+	end = last == count ? (end + pageSize - 1) / pageSize * pageSize : end / pageSize * pageSize;
+	if (begin < end) decommitMemory(m_pixels + begin, end - begin);
+}
+
+bool KrbImage::restart() noexcept
+{
+	delete m_decoder;
+	m_decoder = krb_image_decoder_create(m_extension, &m_sink);
+	if (!m_decoder) return false;
+	try
+	{
+		m_feed.resize(FEED_BYTES);
+	}
+	catch (...)
+	{
+		return false;
+	}
+	m_filePos = m_fileStart;
+	m_inputEnd = false;
+	m_decoderDone = false;
+	m_nextRow = 0;
+	for (uint32_t band = 0; band < (uint32_t)m_bands.size(); band++)
+	{
+		if (m_bands[band].rowsStored != 0 && !isDecoded(band)) releaseBand(band);
+	}
+	return true;
+}
+bool KrbImage::step() noexcept
+{
+	if (m_decoderDone) return false;
+	if (!m_inputEnd)
+	{
+		m_file->seek_set(m_filePos);
+		size_t size = m_file->read(m_feed.data(), m_feed.size());
+		m_filePos += size;
+		if (size == 0)
+		{
+			m_inputEnd = true;
+			m_decoder->finish();
+		}
+		else if (!m_decoder->feed(m_feed.data(), size))
+		{
+			m_decoderDone = true;
+			return false;
+		}
+	}
+	if (m_decoder->poll() == DecodeStatusNeedMore) return true;
+	m_decoderDone = true;
+	return false;
+}
+bool KrbImage::decodeSequential(uint32_t band0, uint32_t band1) noexcept
+{
+	auto complete = [&]() {
+		for (uint32_t band = band0; band < band1; band++)
+		{
+			if (!isDecoded(band)) return false;
+		}
+		return true;
+	};
+	if (complete()) return true;
+
+	if (!info.rowByRow)
+	{
+		// the whole image, start commits it
+		if (m_decoderDone && !restart()) return false;
+		while (step())
+		{
+		}
+		if (m_decoder->poll() != DecodeStatusDone) return false;
+		for (uint32_t band = 0; band < (uint32_t)m_bands.size(); band++) m_bands[band].rowsStored = getBandEnd(band) - band * m_bandRows;
+		return true;
+	}
+
+	// continues if the decoder has not passed the missing rows
+	uint32_t first = UINT32_MAX;
+	bool again = m_decoderDone;
+	for (uint32_t band = band0; band < band1; band++)
+	{
+		if (isDecoded(band)) continue;
+		if (first == UINT32_MAX) first = band;
+		uint32_t start = band * m_bandRows;
+		uint32_t passed = m_nextRow < getBandEnd(band) ? m_nextRow : getBandEnd(band);
+		if (start < m_nextRow && m_bands[band].rowsStored != passed - start) again = true;
+	}
+	if (again && !restart()) return false;
+
+	m_storeFrom = first * m_bandRows;
+	while (!complete() && step())
+	{
+	}
+	m_storeFrom = UINT32_MAX;
+	return complete();
+}
+uint8_t* KrbImage::getRow(uint32_t y) noexcept
+{
+	m_nextRow = y + 1;
+	uint32_t band = y / m_bandRows;
+	Band& b = m_bands[band];
+	if (isDecoded(band)) return m_scratch.data();
+	if (y < m_storeFrom || b.rowsStored != y - band * m_bandRows)
+	{
+		// a band with a gap is dropped
+		if (b.rowsStored != 0) releaseBand(band);
+		return m_scratch.data();
+	}
+	if (b.rowsStored == 0 && !commitBand(band)) return m_scratch.data();
+	b.rowsStored++;
+	return m_pixels + (size_t)info.pitchBytes * y;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "include/common.h"
+#include "include/image.h"
+
+#include <memory>
+#include <vector>
+
+namespace kr
+{
+	namespace backend
+	{
+		// the files that can decode any band without the rows before it
+		class RowReader
+		{
+		public:
+			virtual ~RowReader() noexcept = default;
+
+			// the bands start at the multiples of it, 1 if any row can start one
+			virtual uint32_t getBandRows() const noexcept = 0;
+			// the rows [y0, y1) of whole bands, the last band can be shorter
+			virtual bool read(uint8_t* dest, size_t pitch, uint32_t y0, uint32_t y1) noexcept = 0;
+		};
+	}
+
+	class KrbImage
+	{
+	public:
+		KrbImage(KrbFile* file) noexcept;
+		~KrbImage() noexcept;
+
+		static KrbImage* open(KrbExtension extension, KrbFile* file) noexcept;
+
+		const uint8_t* lockRows(uint32_t y0, uint32_t y1) noexcept;
+		void unlockRows(uint32_t y0, uint32_t y1) noexcept;
+
+		KrbImageInfo info;
+		KrbImagePalette palette = {};
+
+	private:
+		struct Band
+		{
+			uint32_t locks = 0;
+			uint32_t rowsStored = 0; // in order from the band start, the band is decoded when it is full
+		};
+
+		// the sequential decoding, the rows of the bands that are not asked for go to m_scratch
+		class RowSink :public KrbImageCallback
+		{
+		public:
+			RowSink(KrbImage* image) noexcept;
+			KrbImage* const m_image;
+		};
+
+		bool reserve() noexcept;
+		uint32_t getBandEnd(uint32_t band) const noexcept;
+		bool isDecoded(uint32_t band) const noexcept;
+		bool commitBand(uint32_t band) noexcept;
+		// drops the rows of the band and releases the pages that no other band uses
+		void releaseBand(uint32_t band) noexcept;
+
+		bool restart() noexcept;
+		// feeds a chunk of the file, false when the decoder stops
+		bool step() noexcept;
+		bool decodeSequential(uint32_t band0, uint32_t band1) noexcept;
+		uint8_t* getRow(uint32_t y) noexcept;
+
+		KrbFile* const m_file;
+		uint64_t m_fileStart = 0;
+		KrbExtension m_extension = KrbExtension::Invalid;
+		std::unique_ptr<backend::RowReader> m_reader;
+
+		uint8_t* m_pixels = nullptr; // reserved for the whole image, the bands are committed on demand
+		size_t m_reservedBytes = 0;
+		uint32_t m_bandRows = 1;
+		std::vector<Band> m_bands;
+
+		RowSink m_sink;
+		KrbImageDecoder* m_decoder = nullptr;
+		uint64_t m_filePos = 0; // the bytes fed to the decoder
+		bool m_started = false;
+		bool m_inputEnd = false;
+		bool m_decoderDone = false;
+		uint32_t m_nextRow = 0; // the rows come in order, the checkpoint of the decoder
+		uint32_t m_storeFrom = UINT32_MAX; // the rows before it are not kept
+		std::vector<uint8_t> m_scratch;
+		std::vector<uint8_t> m_feed;
+	};
+}
@@ -0,0 +1,252 @@
+#include "mipmap.h"
+#include "layout.h"
+#include "resample.h"
+#include "bcn.h"
+#include "parallel.h"
+#include "simd.h"
+
+#include <atomic>
+#include <vector>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	constexpr uint32_t BAND_ROWS = 32; // destination rows per parallel job
+
+	inline uint32_t levelSize(uint32_t size, uint32_t level) noexcept
+	{
+		size >>= level;
+		return size ? size : 1;
+	}
+
+	// 2x2 average of 8-bit channels, rounded
+	void boxRow(uint8_t* dest, const uint8_t* row0, const uint8_t* row1, uint32_t width, uint32_t size) noexcept
+	{
+		uint32_t x = 0;
+		if (size == 4)
+		{
+#ifdef KRB_AVX2
+			const __m256i zero256 = _mm256_setzero_si256();
+			const __m256i round256 = _mm256_set1_epi16(2);
+			for (; x + 8 <= width; x += 8)
+			{
+				__m256i s[2];
+				for (int i = 0; i < 2; i++)
+				{
+					__m256i a = _mm256_loadu_si256((const __m256i*)(row0 + x * 8 + i * 32));
+					__m256i b = _mm256_loadu_si256((const __m256i*)(row1 + x * 8 + i * 32));
+					__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero256), _mm256_unpacklo_epi8(b, zero256));
+					__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero256), _mm256_unpackhi_epi8(b, zero256));
+					__m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+					s[i] = _mm256_srli_epi16(_mm256_add_epi16(sum, round256), 2);
+				}
+				// the lanes are [0 1 4 5] [2 3 6 7] in 64-bit units
+				__m256i packed = _mm256_packus_epi16(s[0], s[1]);
+				_mm256_storeu_si256((__m256i*)(dest + x * 4), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+			}
+#endif
+#ifdef KRB_SSE2
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i round = _mm_set1_epi16(2);
+			for (; x + 4 <= width; x += 4)
+			{
+				__m128i s[2];
+				for (int i = 0; i < 2; i++)
+				{
+					__m128i a = _mm_loadu_si128((const __m128i*)(row0 + x * 8 + i * 16));
+					__m128i b = _mm_loadu_si128((const __m128i*)(row1 + x * 8 + i * 16));
+					// vertical sums of the pixels [0 1] and [2 3], then the horizontal pairs
+					__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+					__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+					__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+					s[i] = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+				}
+				_mm_storeu_si128((__m128i*)(dest + x * 4), _mm_packus_epi16(s[0], s[1]));
+			}
+#endif
+		}
+		for (; x < width; x++)
+		{
+			const uint8_t* a = row0 + x * 2 * size;
+			const uint8_t* b = row1 + x * 2 * size;
+			for (uint32_t c = 0; c < size; c++)
+			{
+				dest[x * size + c] = (uint8_t)((a[c] + a[c + size] + b[c] + b[c + size] + 2) >> 2);
+			}
+		}
+	}
+
+	struct Level
+	{
+		uint8_t* data;
+		size_t pitch;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	bool generateLevel(const RowConverter& converter, const Level& src, const Level& dest, kr_imagefilter_t filter) noexcept
+	{
+		uint32_t bandCount = (dest.height + BAND_ROWS - 1) / BAND_ROWS;
+
+		if (filter == ImageFilterBox && converter.isPlain() && src.width >= 2 && src.height >= 2)
+		{
+			parallelFor(bandCount, [&](uint32_t band) {
+				uint32_t end = (band + 1) * BAND_ROWS;
+				if (end > dest.height) end = dest.height;
+				for (uint32_t y = band * BAND_ROWS; y < end; y++)
+				{
+					const uint8_t* row0 = src.data + src.pitch * y * 2;
+					boxRow(dest.data + dest.pitch * y, row0, row0 + src.pitch, dest.width, converter.format().size);
+				}
+			});
+			return true;
+		}
+
+		std::vector<ResampleTap> xTaps;
+		std::vector<ResampleTap> yTaps;
+		uint32_t xCount;
+		uint32_t yCount;
+		try
+		{
+			xCount = buildResampleTaps(xTaps, filter, src.width, dest.width);
+			yCount = buildResampleTaps(yTaps, filter, src.height, dest.height);
+		}
+		catch (...)
+		{
+			return false;
+		}
+
+		std::atomic<bool> ok(true);
+		parallelFor(bandCount, [&](uint32_t band) {
+			try
+			{
+				uint32_t begin = band * BAND_ROWS;
+				uint32_t end = begin + BAND_ROWS;
+				if (end > dest.height) end = dest.height;
+
+				// source rows used by the band
+				uint32_t first = UINT32_MAX;
+				uint32_t last = 0;
+				for (size_t i = (size_t)begin * yCount; i < (size_t)end * yCount; i++)
+				{
+					if (yTaps[i].index < first) first = yTaps[i].index;
+					if (yTaps[i].index > last) last = yTaps[i].index;
+				}
+
+				size_t rowFloats = (size_t)dest.width * 4;
+				std::vector<float> line((size_t)src.width * 4);
+				std::vector<float> rows(rowFloats * (last - first + 1));
+				std::vector<float> out(rowFloats);
+				std::vector<const float*> pointers(yCount);
+
+				for (uint32_t y = first; y <= last; y++)
+				{
+					converter.load(line.data(), src.data + src.pitch * y, src.width);
+					resampleRow(rows.data() + rowFloats * (y - first), line.data(), xTaps.data(), xCount, dest.width);
+				}
+				for (uint32_t y = begin; y < end; y++)
+				{
+					const ResampleTap* taps = &yTaps[(size_t)y * yCount];
+					for (uint32_t k = 0; k < yCount; k++)
+					{
+						pointers[k] = rows.data() + rowFloats * (taps[k].index - first);
+					}
+					combineRows(out.data(), pointers.data(), taps, yCount, rowFloats);
+					converter.store(dest.data + dest.pitch * y, out.data(), dest.width);
+				}
+			}
+			catch (...)
+			{
+				ok = false;
+			}
+		});
+		return ok;
+	}
+}
+
+uint32_t Mipmap::getLevelCount(kr_pixelformat_t pixelformat, uint32_t width, uint32_t height) noexcept
+{
+	ResampleFormat format;
+	if (!ResampleFormat::get(pixelformat, &format)) return 1;
+
+	uint32_t count = 1;
+	while (width > 1 || height > 1)
+	{
+		width >>= 1;
+		height >>= 1;
+		count++;
+	}
+	return count;
+}
+size_t Mipmap::getLevelOffset(const KrbImageInfo* info, uint32_t level) noexcept
+{
+	if (level == 0) return 0;
+
+	// the chroma planes and the layout padding belong to the first level
+	size_t offset = ImageLayout::getImageBytes(info);
+	for (uint32_t i = 1; i < level; i++)
+	{
+		offset += (size_t)getLevelPitch(info->pixelformat, levelSize(info->width, i)) * getLevelRows(info->pixelformat, levelSize(info->height, i));
+	}
+	return offset;
+}
+uint32_t Mipmap::getLevelPitch(kr_pixelformat_t pixelformat, uint32_t width) noexcept
+{
+	uint32_t blockBytes = BcEncoder::getBlockBytes(pixelformat);
+	if (blockBytes != 0) return (width + 3) / 4 * blockBytes;
+	switch (pixelformat)
+	{
+	case PixelFormatIndex:
+	case PixelFormatA8:
+		return width;
+	case PixelFormatR5G6B5:
+	case PixelFormatX1RGB5:
+	case PixelFormatA1RGB5:
+	case PixelFormatARGB4:
+		return width * 2;
+	case PixelFormatRGB8:
+	case PixelFormatBGR8:
+		return width * 3;
+	case PixelFormatXRGB8:
+	case PixelFormatARGB8:
+	case PixelFormatXBGR8:
+	case PixelFormatABGR8:
+		return width * 4;
+	case PixelFormatRGBA16F:
+		return width * 8;
+	case PixelFormatRGBA32F:
+		return width * 16;
+	default:
+		return 0;
+	}
+}
+uint32_t Mipmap::getLevelRows(kr_pixelformat_t pixelformat, uint32_t height) noexcept
+{
+	if (BcEncoder::getBlockBytes(pixelformat) != 0) return (height + 3) / 4;
+	return height;
+}
+bool Mipmap::generate(const KrbImageInfo* info, void* buffer, kr_imagefilter_t filter, uint32_t flags) noexcept
+{
+	if (filter == ImageFilterNone || info->mipLevels <= 1) return true;
+	if (info->mipLevels > getLevelCount(info->pixelformat, info->width, info->height)) return false;
+
+	ResampleFormat format;
+	ResampleFormat::get(info->pixelformat, &format);
+	RowConverter converter(format, flags);
+
+	uint8_t* base = (uint8_t*)buffer;
+	Level src = { base, info->pitchBytes, info->width, info->height };
+	for (uint32_t level = 1; level < info->mipLevels; level++)
+	{
+		Level dest;
+		dest.data = base + getLevelOffset(info, level);
+		dest.width = levelSize(info->width, level);
+		dest.height = levelSize(info->height, level);
+		dest.pitch = (size_t)dest.width * format.size;
+		if (!generateLevel(converter, src, dest, filter)) return false;
+		src = dest;
+	}
+	return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "include/image.h"
+
+namespace kr
+{
+	namespace backend
+	{
+		// mip chain generation in the load output buffer
+		class Mipmap
+		{
+		public:
+			// 1 if the format cannot be filtered
+			static uint32_t getLevelCount(kr_pixelformat_t pixelformat, uint32_t width, uint32_t height) noexcept;
+			static size_t getLevelOffset(const KrbImageInfo* info, uint32_t level) noexcept;
+			// tight pitch and the row count of a level, block rows for the block formats, 0 pitch for the planar formats
+			static uint32_t getLevelPitch(kr_pixelformat_t pixelformat, uint32_t width) noexcept;
+			static uint32_t getLevelRows(kr_pixelformat_t pixelformat, uint32_t height) noexcept;
+
+			// fills the levels after the first one, flags are kr_imageflag_t
+			static bool generate(const KrbImageInfo* info, void* buffer, kr_imagefilter_t filter, uint32_t flags) noexcept;
+		};
+	}
+}
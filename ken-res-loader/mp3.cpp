@@ -0,0 +1,298 @@
+#include "mp3.h"
+#include "openmp3/src/tables.h"
+#include "util.h"
+
+#include <string.h>
+#include <new>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	constexpr size_t SYNC_SEARCH_BYTES = 64 << 10; // the junk before the first frame
+	constexpr size_t SYNC_CHUNK = 1024;
+	constexpr uint32_t INDEX_VERSION = 1;
+
+	inline uint32_t getBE32(const uint8_t* data) noexcept
+	{
+		return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+	}
+
+	struct FrameHeader
+	{
+		uint32_t version; // OpenMP3::Version
+		uint32_t sampleRate;
+		uint32_t bitRate;
+		uint32_t samplesPerFrame;
+		uint32_t frameBytes;
+		bool mono;
+		bool crc;
+
+		// Layer III without the free format
+		bool parse(uint32_t word) noexcept
+		{
+			if ((word & 0xffe00000) != 0xffe00000) return false;
+			version = (word >> 19) & 3;
+			uint32_t layer = (word >> 17) & 3;
+			uint32_t bitRateIndex = (word >> 12) & 15;
+			uint32_t sampleRateIndex = (word >> 10) & 3;
+			if (version == OpenMP3::kVersionReserved || layer != OpenMP3::kLayer3) return false;
+			if (bitRateIndex == 0 || bitRateIndex == 15 || sampleRateIndex == 3) return false;
+			const OpenMP3::VersionInfo& info = OpenMP3::kVersions[version];
+			bitRate = info.kBitRates[layer - 1][bitRateIndex];
+			sampleRate = info.kSampleRates[sampleRateIndex];
+			samplesPerFrame = info.kSamplesPerFrame[layer - 1];
+			frameBytes = samplesPerFrame / 8 * bitRate / sampleRate + ((word >> 9) & 1);
+			mono = ((word >> 6) & 3) == OpenMP3::kModeMono;
+			crc = ((word >> 16) & 1) == 0;
+			return true;
+		}
+		uint32_t getSideInfoBytes() const noexcept
+		{
+			if (version == OpenMP3::kVersionMPEG1) return mono ? 17 : 32;
+			return mono ? 9 : 17;
+		}
+		uint32_t getMainDataBytes() const noexcept
+		{
+			uint32_t used = 4 + (crc ? 2 : 0) + getSideInfoBytes();
+			return frameBytes > used ? frameBytes - used : 0;
+		}
+	};
+
+	// the position after the ID3v2 tags at the start
+	uint64_t skipId3(KrbFile* file) noexcept
+	{
+		uint64_t pos = file->tell();
+		for (;;)
+		{
+			uint8_t tag[10];
+			file->seek_set(pos);
+			if (file->read(tag, sizeof(tag)) != sizeof(tag) || memcmp(tag, "ID3", 3) != 0) return pos;
+			if ((tag[6] | tag[7] | tag[8] | tag[9]) & 0x80) return pos;
+			uint32_t size = ((uint32_t)tag[6] << 21) | ((uint32_t)tag[7] << 14) | ((uint32_t)tag[8] << 7) | tag[9];
+			pos += sizeof(tag) + size + ((tag[5] & 0x10) ? 10 : 0); // the footer
+		}
+	}
+
+	// a header that the next frame follows with the same version and rate
+	bool isFrameAt(KrbFile* file, uint64_t pos, uint32_t word, FrameHeader* header) noexcept
+	{
+		if (!header->parse(word)) return false;
+		uint8_t next[4];
+		file->seek_set(pos + header->frameBytes);
+		if (file->read(next, sizeof(next)) != sizeof(next)) return true; // the only frame
+		FrameHeader nextHeader;
+		if (!nextHeader.parse(getBE32(next))) return false;
+		return nextHeader.version == header->version && nextHeader.sampleRate == header->sampleRate;
+	}
+}
+
+bool Mp3::isFrameHeader(uint32_t word) noexcept
+{
+	FrameHeader header;
+	return header.parse(word);
+}
+uint64_t Mp3::getSamples(KrbFile* file, const Mp3Header& header) noexcept
+{
+	if (header.frames != 0) return header.frames * header.samplesPerFrame;
+
+	// CBR, the bytes up to the ID3v1 tag at the end
+	file->seek_end(0);
+	uint64_t end = file->tell();
+	uint8_t tag[3];
+	if (end >= header.firstFrame + 128)
+	{
+		file->seek_set(end - 128);
+		if (file->read(tag, sizeof(tag)) == sizeof(tag) && memcmp(tag, "TAG", 3) == 0) end -= 128;
+	}
+	uint64_t start = header.firstFrame + (header.infoFrame ? header.frameBytes : 0);
+	uint64_t bytes = end > start ? end - start : 0;
+	return bytes * 8 * header.sampleRate / header.bitRate;
+}
+bool Mp3::readHeader(KrbFile* file, Mp3Header* header) noexcept
+{
+	uint64_t pos = skipId3(file);
+
+	// the sync search reads the chunks, the chunks overlap by the header bytes
+	FrameHeader frame;
+	uint8_t chunk[SYNC_CHUNK];
+	uint64_t end = pos + SYNC_SEARCH_BYTES;
+	bool found = false;
+	while (!found && pos < end)
+	{
+		file->seek_set(pos);
+		size_t size = file->read(chunk, sizeof(chunk));
+		if (size < 4) return false;
+		size_t i = 0;
+		for (; i + 4 <= size; i++)
+		{
+			const uint8_t* sync = (const uint8_t*)memchr(chunk + i, 0xff, size - 3 - i);
+			if (!sync) break;
+			i = sync - chunk;
+			if ((sync[1] & 0xe0) != 0xe0) continue;
+			if (isFrameAt(file, pos + i, getBE32(sync), &frame))
+			{
+				found = true;
+				break;
+			}
+		}
+		if (!found) pos += size - 3;
+		else pos += i;
+		if (size < sizeof(chunk) && !found) return false;
+	}
+	if (!found) return false;
+
+	header->firstFrame = pos;
+	header->frameBytes = frame.frameBytes;
+	header->sampleRate = frame.sampleRate;
+	header->channels = frame.mono ? 1 : 2;
+	header->samplesPerFrame = frame.samplesPerFrame;
+	header->bitRate = frame.bitRate;
+	header->infoFrame = false;
+	header->frames = 0;
+
+	// Xing or Info after the side info, VBRI at 32 bytes after the header
+	uint8_t data[64];
+	size_t dataBytes = frame.frameBytes < sizeof(data) ? frame.frameBytes : sizeof(data);
+	file->seek_set(pos);
+	if (file->read(data, dataBytes) != dataBytes) return true;
+	size_t xing = 4 + frame.getSideInfoBytes();
+	if (xing + 8 <= dataBytes && (memcmp(data + xing, "Xing", 4) == 0 || memcmp(data + xing, "Info", 4) == 0))
+	{
+		header->infoFrame = true;
+		uint32_t flags = getBE32(data + xing + 4);
+		if ((flags & 1) && xing + 12 <= dataBytes) header->frames = getBE32(data + xing + 8);
+	}
+	else if (36 + 18 <= dataBytes && memcmp(data + 36, "VBRI", 4) == 0)
+	{
+		header->infoFrame = true;
+		header->frames = getBE32(data + 36 + 14);
+	}
+	return true;
+}
+
+KrbMp3Index* KrbMp3Index::build(KrbFile* file) noexcept
+{
+	Mp3Header header;
+	if (!Mp3::readHeader(file, &header)) return nullptr;
+	KrbMp3Index* index = new(std::nothrow) KrbMp3Index;
+	if (!index) return nullptr;
+	index->sampleRate = header.sampleRate;
+	index->channels = header.channels;
+	index->samplesPerFrame = header.samplesPerFrame;
+
+	// the headers until a frame of another version or rate, the ID3v1 tag or the end
+	std::vector<uint16_t> mainDataBegin;
+	std::vector<uint32_t> mainDataBytes;
+	uint64_t pos = header.firstFrame + (header.infoFrame ? header.frameBytes : 0);
+	uint32_t version = 0;
+	try
+	{
+		for (;;)
+		{
+			uint8_t data[8];
+			file->seek_set(pos);
+			size_t size = file->read(data, sizeof(data));
+			FrameHeader frame;
+			if (size < 6 || !frame.parse(getBE32(data))) break;
+			if (index->offsets.empty()) version = frame.version;
+			if (frame.version != version || frame.sampleRate != header.sampleRate) break;
+			const uint8_t* side = data + (frame.crc ? 6 : 4);
+			if (side + 2 > data + size) break;
+			// 9 bits of MPEG1, 8 bits of MPEG2
+			uint16_t begin = version == OpenMP3::kVersionMPEG1 ? (side[0] << 1) | (side[1] >> 7) : side[0];
+			index->offsets.push_back(pos);
+			mainDataBegin.push_back(begin);
+			mainDataBytes.push_back(frame.getMainDataBytes());
+			pos += frame.frameBytes;
+		}
+		index->offsets.push_back(pos);
+
+		const size_t frames = mainDataBegin.size();
+		index->preroll.resize(frames);
+		for (size_t k = 1; k < frames; k++)
+		{
+			// the frames before k - 1 that hold its reservoir bytes
+			uint32_t need = mainDataBegin[k - 1];
+			size_t i = k - 1;
+			while (need > 0 && i > 0)
+			{
+				i--;
+				need = need > mainDataBytes[i] ? need - mainDataBytes[i] : 0;
+			}
+			size_t preroll = k - i;
+			index->preroll[k] = (uint8_t)(preroll < UINT8_MAX ? preroll : UINT8_MAX);
+		}
+	}
+	catch (...)
+	{
+		delete index;
+		return nullptr;
+	}
+	if (index->preroll.empty())
+	{
+		delete index;
+		return nullptr;
+	}
+	return index;
+}
+KrbMp3Index* KrbMp3Index::load(KrbFile* file) noexcept
+{
+	uint32_t head[6];
+	uint64_t start;
+	if (file->read(head, sizeof(head)) != sizeof(head) || head[0] != "MP3X"_sig || head[1] != INDEX_VERSION) return nullptr;
+	if (file->read(&start, sizeof(start)) != sizeof(start)) return nullptr;
+	uint32_t frames = head[5];
+	if (frames == 0 || head[2] == 0 || head[4] == 0) return nullptr;
+
+	KrbMp3Index* index = new(std::nothrow) KrbMp3Index;
+	if (!index) return nullptr;
+	index->sampleRate = head[2];
+	index->channels = head[3];
+	index->samplesPerFrame = head[4];
+	try
+	{
+		// the frame sizes, then the prerolls
+		std::vector<uint16_t> sizes(frames);
+		index->preroll.resize(frames);
+		index->offsets.resize((size_t)frames + 1);
+		if (file->read(sizes.data(), frames * sizeof(uint16_t)) != frames * sizeof(uint16_t) ||
+			file->read(index->preroll.data(), frames) != frames)
+		{
+			delete index;
+			return nullptr;
+		}
+		index->offsets[0] = start;
+		for (uint32_t i = 0; i < frames; i++) index->offsets[i + 1] = index->offsets[i] + sizes[i];
+	}
+	catch (...)
+	{
+		delete index;
+		return nullptr;
+	}
+	return index;
+}
+bool KrbMp3Index::save(KrbFile* file) const noexcept
+{
+	const uint32_t frames = (uint32_t)preroll.size();
+	uint32_t head[6] = { "MP3X"_sig, INDEX_VERSION, sampleRate, channels, samplesPerFrame, frames };
+	file->write(head, sizeof(head));
+	file->write(&offsets[0], sizeof(offsets[0]));
+	try
+	{
+		std::vector<uint16_t> sizes(frames);
+		for (uint32_t i = 0; i < frames; i++) sizes[i] = (uint16_t)(offsets[i + 1] - offsets[i]);
+		file->write(sizes.data(), frames * sizeof(uint16_t));
+	}
+	catch (...)
+	{
+		return false;
+	}
+	file->write(preroll.data(), frames);
+	return true;
+}
+uint64_t KrbMp3Index::getFrames() const noexcept
+{
+	return preroll.size();
+}
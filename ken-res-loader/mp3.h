@@ -0,0 +1,55 @@
+#pragma once
+
+#include "include/common.h"
+
+#include <vector>
+
+namespace kr
+{
+	namespace backend
+	{
+		// the first frame of the stream and the Xing, Info or VBRI header in it
+		struct Mp3Header
+		{
+			uint64_t firstFrame; // the position of the first frame, after the ID3v2 tags
+			uint32_t frameBytes; // the first frame
+			uint32_t sampleRate;
+			uint32_t channels;
+			uint32_t samplesPerFrame;
+			uint32_t bitRate; // bits per second of the first frame
+
+			bool infoFrame; // the first frame is the Xing, Info or VBRI header, it has no audio
+			uint64_t frames; // the audio frames of the header, 0 if it is not there or has no count
+		};
+
+		class Mp3
+		{
+		public:
+			// Layer III only, the file is left anywhere
+			static bool readHeader(KrbFile* file, Mp3Header* header) noexcept;
+			// the first 4 bytes of a Layer III frame, big-endian
+			static bool isFrameHeader(uint32_t word) noexcept;
+			// the count of the header, or by the bitrate of the first frame up to the ID3v1 tag at the end
+			static uint64_t getSamples(KrbFile* file, const Mp3Header& header) noexcept;
+		};
+	}
+
+	// the frames of the headers, no frame is decoded to build it
+	class KrbMp3Index
+	{
+	public:
+		// from the position of the file, the frames after the Xing, Info or VBRI frame
+		static KrbMp3Index* build(KrbFile* file) noexcept;
+		static KrbMp3Index* load(KrbFile* file) noexcept;
+		bool save(KrbFile* file) const noexcept;
+
+		uint64_t getFrames() const noexcept;
+
+		uint32_t sampleRate = 0;
+		uint32_t channels = 0;
+		uint32_t samplesPerFrame = 0;
+		std::vector<uint64_t> offsets; // the frames and the end of the last one
+		// the frames to decode before one, the reservoir bytes of the frame before it and the frame before it for the overlap
+		std::vector<uint8_t> preroll;
+	};
+}
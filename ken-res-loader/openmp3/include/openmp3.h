@@ -56,9 +56,7 @@ namespace OpenMP3
 
 	class Library;
 
-	class Iterator;					//iterate an in memory mp3 file
-
-	//TODO class StreamIterator;	//has internal buffer, used for real-time streaming
+	class Iterator;					//iterate the frames of a file through an internal buffer
 
 	class Decoder;
 
@@ -80,6 +78,8 @@ namespace OpenMP3
 
 	typedef UInt32 UInt;
 
+	typedef unsigned long long UInt64;
+
 
 	typedef float Float32;
 
@@ -116,20 +116,39 @@ public:
 
 	//lifetime
 
-	Iterator(const Library & library, kr::KrbFile * file);
+	Iterator(const Library & library, kr::KrbFile * file);		//starts at the position of the file
 
 
 
 	//access
 
-	Result GetNext(Frame & frame);
+	Result GetNext(Frame & frame);			//the frame points into the buffer until the next call of GetNext or Seek
+
+	void Seek(UInt64 position);				//the file position of a frame header or of junk before one
+
+	UInt64 GetPosition() const;				//the file position after the last frame
 
 
 private:
 
 	struct Private;
+
+	enum
+	{
+		kBufferSize = 16 << 10,				//frames are up to 1441 bytes, the buffer holds several and the next header
+	};
 	
 	kr::KrbFile* m_file;
+
+	UInt8 m_buffer[kBufferSize];
+
+	UInt64 m_buffer_pos;		//the file position of m_buffer[0]
+
+	UInt m_begin;				//the next byte to parse
+
+	UInt m_end;					//the bytes read into the buffer
+
+	UInt32 m_locked;			//the header bits of the frames found so far, 0 until the first frame is validated
 };
 
 
@@ -246,6 +265,8 @@ private:
 
 	Float32 m_sbs_v_vec[2][1024];
 
+	UInt m_sbs_v_pos[2];
+
 
 	const UInt8 * m_stream_ptr;
 
@@ -266,7 +287,6 @@ public:
 	//lifetime
 
 	Frame();
-	~Frame();
 
 
 
@@ -304,9 +324,9 @@ private:
 
 	UInt8 m_mode_extension;
 
-	UInt8 * m_ptr;		//pointer to data area
+	const UInt8 * m_ptr;		//pointer to data area, into the buffer of the iterator
 
-	UInt m_datasize;			//size of whole frame, minus headerword + check
+	UInt m_datasize;			//size of whole frame, minus headerword + crc
 
 	UInt m_length;				//for Info frame skipping
 
@@ -67,6 +67,8 @@ void OpenMP3::Decoder::Reset()
 
 	MemClear(m_sbs_v_vec, sizeof(m_sbs_v_vec));
 
+	MemClear(m_sbs_v_pos, sizeof(m_sbs_v_pos));
+
 	//hsynth_init = synth_init = 1;
 }
 
@@ -139,9 +141,9 @@ bool OpenMP3::Decoder::Private::ReadSideInfo(Decoder & self, const Frame & frame
 	GetSideBits(mono ? 5 : 3, ptr, idx);	//skip private bits
 
 												//scale factor selection information
-	for (auto & channel : sideinfo.channels)
+	for (UInt ch = 0; ch < nch; ch++)
 	{
-		for (unsigned & scfsi: channel.scfsi)
+		for (unsigned & scfsi: sideinfo.channels[ch].scfsi)
 		{
 			scfsi = GetSideBits(1, ptr, idx);
 		}
@@ -149,8 +151,10 @@ bool OpenMP3::Decoder::Private::ReadSideInfo(Decoder & self, const Frame & frame
 
 	for (auto & granules : sideinfo.granules)
 	{
-		for (auto & granule : granules)
+		for (UInt ch = 0; ch < nch; ch++)
 		{
+			auto & granule = granules[ch];
+
 			granule.part2_3_length = GetSideBits(12, ptr, idx);
 
 			granule.big_values = GetSideBits(9, ptr, idx);
@@ -420,7 +424,7 @@ void OpenMP3::Decoder::Private::DecodeFrame(Decoder & self, const Frame & header
 
 			FrequencyInversion(granule.is);
 
-			SubbandSynthesis(data, granule.is, v_vec[0], out[0] + (576 * gr));
+			SubbandSynthesis(data, granule.is, v_vec[0], self.m_sbs_v_pos[0], out[0] + (576 * gr));
 		}
 
 		memcpy(out[1], out[0], 1152 * sizeof(Float32));
@@ -454,7 +458,7 @@ void OpenMP3::Decoder::Private::DecodeFrame(Decoder & self, const Frame & header
 
 				FrequencyInversion(granule.is);
 
-				SubbandSynthesis(data, granule.is, v_vec[ch], out[ch] + (576 * gr));
+				SubbandSynthesis(data, granule.is, v_vec[ch], self.m_sbs_v_pos[ch], out[ch] + (576 * gr));
 			}
 		}
 	}
@@ -63,7 +63,9 @@ OpenMP3::UInt OpenMP3::ReadHuffman(Reservoir & br, UInt sfreq, FrameData::Granul
 	{
 		region_1_start = kScaleFactorBandIndices[sfreq].l[granule.region0_count + 1];
 		
-		region_2_start = kScaleFactorBandIndices[sfreq].l[granule.region0_count + granule.region1_count + 2];
+		//the counts can point past the last band, l[22] is the end of the granule
+
+		region_2_start = kScaleFactorBandIndices[sfreq].l[Min(granule.region0_count + granule.region1_count + 2, 22)];
 	}
 
 	/* Read big_values using tables according to region_x_start */
@@ -10,29 +10,90 @@ using namespace kr;
 
 struct OpenMP3::Iterator::Private
 {
-	static size_t GetPosition(const Iterator & itr)
+	static const UInt32 kLockMask = 0xfffe0c00;		//sync, version, layer and sample rate
+
+	static UInt32 ReadWord(const UInt8 * ptr)
+	{
+		return (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | (ptr[3] << 0);
+	}
+
+	//the bytes from m_begin, fewer at the end of the file
+	static UInt Fill(Iterator & itr, UInt bytes)
+	{
+		UInt available = itr.m_end - itr.m_begin;
+		if (available >= bytes) return available;
+
+		if (itr.m_begin)
+		{
+			memmove(itr.m_buffer, itr.m_buffer + itr.m_begin, available);
+			itr.m_buffer_pos += itr.m_begin;
+			itr.m_begin = 0;
+			itr.m_end = available;
+		}
+		itr.m_file->seek_set(itr.m_buffer_pos + itr.m_end);
+		itr.m_end += (UInt)itr.m_file->read(itr.m_buffer + itr.m_end, kBufferSize - itr.m_end);
+		return itr.m_end - itr.m_begin;
+	}
+
+	static void Skip(Iterator & itr, UInt64 bytes)
+	{
+		if (bytes <= itr.m_end - itr.m_begin)
+		{
+			itr.m_begin += (UInt)bytes;
+			return;
+		}
+		itr.m_buffer_pos += itr.m_begin + bytes;
+		itr.m_begin = itr.m_end = 0;
+	}
+
+	//Layer III without the free format, 0 if the header is invalid
+	static UInt GetFrameSize(UInt32 word)
 	{
-		return (size_t)itr.m_file->tell();
+		if ((word & 0xffe00000) != 0xffe00000) return 0;
+
+		Version version = Version((word & 0x00180000) >> 19);
+		Layer layer = Layer((word & 0x00060000) >> 17);
+		UInt bitrate_index = (word & 0x0000f000) >> 12;
+		UInt sr_index = (word & 0x00000c00) >> 10;
+		UInt padding_bit = (word & 0x00000200) >> 9;
+
+		if (version == kVersionReserved || layer != kLayer3) return 0;
+		if (bitrate_index == 0 || bitrate_index > 14 || sr_index > 2) return 0;
+
+		const VersionInfo & info = kVersions[version];
+		return (info.kSamplesPerFrame[layer - 1] / 8 * info.kBitRates[layer - 1][bitrate_index]) / info.kSampleRates[sr_index] + padding_bit;
 	}
 
-	template <class TYPE> static const TYPE Read(Iterator & itr)
+	static void SetHeader(Frame & frame, UInt32 word)
 	{
-		TYPE type;
-		size_t readed = itr.m_file->read(&type, sizeof(TYPE));
-		if (readed != sizeof(TYPE)) type = 0;
-		return type;
+		frame.m_version = Version((word & 0x00180000) >> 19);
+		frame.m_layer = Layer((word & 0x00060000) >> 17);
+		frame.m_bitrate_index = (word & 0x0000f000) >> 12;
+		frame.m_sr_index = (word & 0x00000c00) >> 10;
+		frame.m_mode = OpenMP3::Mode((word & 0x000000c0) >> 6);
+		frame.m_mode_extension = (word & 0x00000030) >> 4;
+		frame.m_length = kVersions[frame.m_version].kSamplesPerFrame[frame.m_layer - 1];
 	}
 
-	static UInt32 ReadWord(Iterator & itr)	//TODO optimise
+	//the ID3v2 tag by its size, false if there is none
+	static bool SkipId3(Iterator & itr, const UInt8 * ptr, UInt available)
 	{
-		UInt32 word = Read<UInt32>(itr);
+		if (available < 10 || memcmp(ptr, "ID3", 3) != 0) return false;
+		if ((ptr[6] | ptr[7] | ptr[8] | ptr[9]) & 0x80) return false;
+
+		UInt size = (ptr[6] << 21) | (ptr[7] << 14) | (ptr[8] << 7) | ptr[9];
+		Skip(itr, 10 + (UInt64)size + ((ptr[5] & 0x10) ? 10 : 0));	//the footer
+		return true;
+	}
 
-		uint8_t b1 = (uint8_t)(word);
-		uint8_t b2 = (uint8_t)(word>>8);
-		uint8_t b3 = (uint8_t)(word>>16);
-		uint8_t b4 = (uint8_t)(word>>24);
+	//a header of the same stream, a tag or the end after a frame found by a new sync
+	static bool IsFollowed(const UInt8 * ptr, UInt available, UInt32 word)
+	{
+		if (available < 4) return true;
+		if (memcmp(ptr, "TAG", 3) == 0 || memcmp(ptr, "ID3", 3) == 0) return true;
 
-		return (b1 << 24) | (b2 << 16) | (b3 << 8) | (b4 << 0);
+		UInt32 next = ReadWord(ptr);
+		return (next & kLockMask) == (word & kLockMask) && GetFrameSize(next) != 0;
 	}
 };
 
@@ -58,14 +119,9 @@ struct OpenMP3::Frame::Private
 //
 
 OpenMP3::Frame::Frame()
-	: m_ptr(0)
 {
 	MemClear(this, sizeof(Frame));
 }
-OpenMP3::Frame::~Frame()
-{
-	free(m_ptr);
-}
 
 OpenMP3::UInt OpenMP3::Frame::GetBitRate() const
 {
@@ -101,101 +157,87 @@ void OpenMP3::Frame::SkipFirst() noexcept
 //
 
 OpenMP3::Iterator::Iterator(const Library & library, KrbFile* file)
-	: m_file(file)
+	: m_file(file), m_buffer_pos(file->tell()), m_begin(0), m_end(0), m_locked(0)
 {
 }
 
 OpenMP3::Result OpenMP3::Iterator::GetNext(Frame & frame)
 {
-	if (frame.m_ptr)
-	{
-		free(frame.m_ptr);
-		frame.m_ptr = 0;
-	}
+	frame.m_ptr = 0;
 
-	//find next frame
+	//find next frame, a header right after the last frame of the stream is taken without the check of the next one
 
-	UInt32 word = Private::ReadWord(*this);
-
-	// if ((word & 0xffe00000) != 0xffe00000) return kResultInvalidFrame;
-	while ((word & 0xffe00000) != 0xffe00000)
+	bool resync = false;
+	for (;;)
 	{
-		m_file->seek_cur(-3);
-
-		word = Private::ReadWord(*this);
-	}
-	
-
-
-	//extract values
+		UInt available = Private::Fill(*this, 10);
+		if (available < 4) return kResultEofAtFrameHeader;
 
-	frame.m_version = Version((word & 0x001c0000) >> 19);
+		const UInt8 * ptr = m_buffer + m_begin;
 
-	frame.m_layer = Layer((word & 0x00060000) >> 17);
-
-	UInt protection_bit = (word & 0x00010000) >> 16;
-
-	frame.m_bitrate_index = (word & 0x0000f000) >> 12;
-
-	frame.m_sr_index = (word & 0x00000c00) >> 10;
-
-	UInt padding_bit = (word & 0x00000200) >> 9;
-
-	//UInt8 private_bit = (word & 0x00000100) >> 8;
-
-	frame.m_mode = OpenMP3::Mode((word & 0x000000c0) >> 6);
-
-	frame.m_mode_extension = (word & 0x00000030) >> 4;
-
-	//UInt8 copyright = (word & 0x00000008) >> 3;
-
-	//UInt8 original_or_copy = (word & 0x00000004) >> 2;
+		if (Private::SkipId3(*this, ptr, available))
+		{
+			resync = true;
+			continue;
+		}
 
-	//UInt8 emphasis = (word & 0x00000003) >> 0;
+		if (ptr[0] != 0xff || (ptr[1] & 0xe0) != 0xe0)
+		{
+			const UInt8 * sync = (const UInt8 *)memchr(ptr + 1, 0xff, available - 1);
+			m_begin = sync ? UInt(sync - m_buffer) : m_end;
+			resync = true;
+			continue;
+		}
 
+		UInt32 word = Private::ReadWord(ptr);
+		UInt framesize = Private::GetFrameSize(word);
+		if (!framesize)
+		{
+			m_begin++;
+			resync = true;
+			continue;
+		}
 
-	
-	//check for invalid values
+		bool check = resync || (word & Private::kLockMask) != m_locked;
+		available = Private::Fill(*this, framesize + 4);
+		ptr = m_buffer + m_begin;
+		if (available < framesize) return kResultEofAtFrameData;
+		if (check && !Private::IsFollowed(ptr + framesize, available - framesize, word))
+		{
+			m_begin++;
+			resync = true;
+			continue;
+		}
 
-	if (frame.m_version == kVersionReserved) return kResultInvalidVersion;
+		m_locked = word & Private::kLockMask;
 
-	if (frame.m_bitrate_index == 0 || frame.m_bitrate_index > 14) return kResultInvalidBitRates;
+		Private::SetHeader(frame, word);
 
-	if (frame.m_sr_index > 2) return kResultInvalidSampleRates;
+		UInt protection_bit = (word & 0x00010000) >> 16;
+		UInt header_size = protection_bit ? 4 : 6;		//the headerword and the crc
 
-	if (frame.m_layer == kLayerReserved) return kResultInvalidLayer;
+		frame.m_ptr = ptr + header_size;
+		frame.m_datasize = framesize - header_size;
 
-	
-	//skip to end of frame
+		m_begin += framesize;
+		return kResultOk;
+	}
+}
 
-	if (!protection_bit)
+void OpenMP3::Iterator::Seek(UInt64 position)
+{
+	if (position >= m_buffer_pos && position <= m_buffer_pos + m_end)
 	{
-		m_file->seek_cur(2);
+		m_begin = UInt(position - m_buffer_pos);
 	}
+	else
+	{
+		m_buffer_pos = position;
+		m_begin = m_end = 0;
+	}
+}
 
-	
-	//bool mono = header.mode == kModeMono;
-
-	//UInt nch = (mono ? 1 : 2);
-
-	//m_ptr += sideinfo_size;
-
-	frame.m_length = kVersions[frame.m_version].kSamplesPerFrame[frame.m_layer-1];
-	
-	UInt framesize = (frame.GetLength() / 8 * frame.GetBitRate()) / frame.GetSampleRate() + padding_bit;
-
-	framesize -= 4;	//total framesize includes headerword
-	
-	if (frame.m_ptr) free(frame.m_ptr);
-	frame.m_ptr = (UInt8*)malloc(framesize);
-	m_file->read(frame.m_ptr, framesize);
-
-	frame.m_datasize = framesize - (protection_bit ? 0 : 2);
-
-	//correct solution is to actually read ancillary data after huffman table
-	//but exact ancillary position is difficult to deduce with current implementation
-	//solution: refactor ReadMain code?
-	
-	// UInt main_data_begin = ((frame.m_ptr[1] & 0x80) << 1) | frame.m_ptr[0];
-	return kResultOk;
+OpenMP3::UInt64 OpenMP3::Iterator::GetPosition() const
+{
+	return m_buffer_pos + m_begin;
 }
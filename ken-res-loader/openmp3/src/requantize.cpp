@@ -196,9 +196,10 @@ void OpenMP3::RequantizeLong(FrameData::Granule & granule, UInt is_pos, UInt sfb
 	
 	float sf_mult = granule.scalefac_scale ? 1.0f : 0.5f;
 	
-	float pf_x_pt = granule.preflag * kPreTab[sfb];
-	
-	Float64 tmp1 = pow(2.0, -(sf_mult *(granule.scalefac_l[sfb] + pf_x_pt)));
+	//the band 21 has no scale factor
+	float pf_x_pt = sfb < 21 ? granule.preflag * kPreTab[sfb] : 0.0f;
+
+	Float64 tmp1 = sfb < 21 ? pow(2.0, -(sf_mult *(granule.scalefac_l[sfb] + pf_x_pt))) : 1.0;
 	
 	Float64 tmp2 = pow(2.0, 0.25 * (granule.global_gain - 210.0));
 
@@ -225,7 +226,8 @@ void OpenMP3::RequantizeShort(FrameData::Granule & granule, UInt is_pos, UInt sf
 
 	Float32 sf_mult = granule.scalefac_scale ? 1.0f : 0.5f;
 
-	Float64 tmp1 = pow(2.0, -(sf_mult * granule.scalefac_s[sfb][win]));
+	//the band 12 has no scale factor
+	Float64 tmp1 = sfb < 12 ? pow(2.0, -(sf_mult * granule.scalefac_s[sfb][win])) : 1.0;
 
 	Float64 tmp2 = pow(2.0, 0.25 * (granule.global_gain - 210.0f - 8.0f * granule.subblock_gain[win]));
 
@@ -2,6 +2,7 @@
 
 #include "types.h"
 #include "tables.h"
+#include "../../simd.h"
 
 
 
@@ -12,15 +13,250 @@
 namespace OpenMP3
 {
 
-	void IMDCT_Win(UInt blocktype, const Float32 in[18], Float32 out[36]);
-
-
 	extern const Float32 kCS[8];
 
 	extern const Float32 kCa[8];
 
 	extern const Float32 kSynthDtbl[512];
 
+
+	//1 / (2 cos((2k + 1) * pi / 2N)) of the odd halves, N = 32, 16, 8, 4 and 2 one after another
+	struct DctFactors
+	{
+		DctFactors()
+		{
+			Float32 * factor = values;
+
+			for (UInt n = 32; n > 1; n >>= 1) for (UInt k = 0; k < n / 2; k++) *factor++ = Float32(0.5 / cos(Float64(2 * k + 1) * C_PI / (2.0 * n)));
+		}
+
+		Float32 values[31];
+	};
+
+	//DCT-II, X[n] = sum cos((2k + 1) * n * pi / 2N) * s[k], by the even and the odd halves of Lee
+	template <UInt N> FORCEINLINE void Dct(const Float32 * in, Float32 * out, const Float32 * factors)
+	{
+		Float32 even[N / 2], odd[N / 2], even_out[N / 2], odd_out[N / 2];
+
+		for (UInt k = 0; k < N / 2; k++)
+		{
+			even[k] = in[k] + in[N - 1 - k];
+
+			odd[k] = (in[k] - in[N - 1 - k]) * factors[k];
+		}
+
+		Dct<N / 2>(even, even_out, factors + N / 2);
+
+		Dct<N / 2>(odd, odd_out, factors + N / 2);
+
+		for (UInt m = 0; m < N / 2 - 1; m++)
+		{
+			out[2 * m] = even_out[m];
+
+			out[2 * m + 1] = odd_out[m] + odd_out[m + 1];
+		}
+
+		out[N - 2] = even_out[N / 2 - 1];
+
+		out[N - 1] = odd_out[N / 2 - 1];
+	}
+
+	template <> FORCEINLINE void Dct<1>(const Float32 * in, Float32 * out, const Float32 *)
+	{
+		out[0] = in[0];
+	}
+
+
+#ifdef KRB_SSE2
+	//4 subbands in the lanes, the IMDCT is the same code as for one subband
+	struct Lanes
+	{
+		Lanes() = default;
+
+		explicit Lanes(__m128 v) : v(v) {}
+
+		Lanes operator+(Lanes b) const { return Lanes(_mm_add_ps(v, b.v)); }
+
+		Lanes operator-(Lanes b) const { return Lanes(_mm_sub_ps(v, b.v)); }
+
+		Lanes operator*(Float32 f) const { return Lanes(_mm_mul_ps(v, _mm_set1_ps(f))); }
+
+		__m128 v;
+	};
+#endif
+
+	//the IMDCT is a DCT-IV of N / 2 with the outputs mirrored, the signs of the mirror are in the windows
+	struct ImdctTables
+	{
+		ImdctTables()
+		{
+			for (UInt m = 0; m < 18; m++) twiddle18[m] = Float32(2.0 * cos(C_PI * (2 * m + 1) / 72.0));
+
+			for (UInt m = 0; m < 9; m++) for (UInt k = 0; k < 9; k++) dct4_9[m][k] = Float32(cos(C_PI * (2 * k + 1) * (2 * m + 1) / 36.0));
+
+			for (UInt m = 0; m < 18; m++) last18[m] = Float32(cos(C_PI * (2 * m + 1) * 35 / 72.0));
+
+			for (UInt n = 0; n < 9; n++) for (UInt k = 0; k < 4; k++) dct9[n][k] = Float32(cos(C_PI * (2 * k + 1) * n / 18.0));
+
+			for (UInt n = 0; n < 9; n += 2) dct9[n][4] = Float32(cos(C_PI * 9 * n / 18.0));
+
+			for (UInt k = 0; k < 6; k++) for (UInt m = 0; m < 6; m++) dct6[k][m] = Float32(cos(C_PI / 6.0 * (m + 0.5) * (k + 0.5)));
+
+			//long windows, out[p] = y[p + 9], -y[26 - p] and -y[p - 27]
+
+			for (UInt p = 0; p < 36; p++)
+			{
+				Float64 sign = p < 9 ? 1.0 : -1.0;
+
+				Float64 sine36 = sin((C_PI / 36.0) * (p + 0.5));
+
+				window36[0][p] = Float32(sign * sine36);
+
+				if (p < 18) window36[1][p] = Float32(sign * sine36);
+				else if (p < 24) window36[1][p] = Float32(sign);
+				else if (p < 30) window36[1][p] = Float32(sign * sin((C_PI / 12.0) * (p + 0.5 - 18.0)));
+				else window36[1][p] = 0.0f;
+
+				if (p < 6) window36[3][p] = 0.0f;
+				else if (p < 12) window36[3][p] = Float32(sign * sin((C_PI / 12.0) * (p + 0.5 - 6.0)));
+				else if (p < 18) window36[3][p] = Float32(sign);
+				else window36[3][p] = Float32(sign * sine36);
+
+				window36[2][p] = 0.0f;	//short blocks use window12
+			}
+
+			//short window, out[p] = y[p + 3], -y[8 - p] and -y[p - 9]
+
+			for (UInt p = 0; p < 12; p++) window12[p] = Float32((p < 3 ? 1.0 : -1.0) * sin((C_PI / 12.0) * (p + 0.5)));
+		}
+
+		Float32 twiddle18[18];		//2 cos((2m + 1) * pi / 72), the DCT-IV by a DCT-II
+
+		Float32 dct4_9[9][9];		//cos((2k + 1) * (2m + 1) * pi / 36), the odd half of the DCT-II of 18
+
+		Float32 last18[18];			//cos((2m + 1) * 35 * pi / 72), the last output of the DCT-IV of 18
+
+		Float32 dct9[9][5];			//cos((2k + 1) * n * pi / 18), the inputs k and 8 - k folded
+
+		Float32 dct6[6][6];			//the DCT-IV of the short blocks
+
+		Float32 window36[4][36];
+
+		Float32 window12[12];
+	};
+
+	//DCT-II of 9, the cosines of k and 8 - k are the same with the sign of n
+	template <typename T> FORCEINLINE void Dct9(const T in[9], T out[9], const ImdctTables & tables)
+	{
+		T sum[4], diff[4];
+
+		for (UInt k = 0; k < 4; k++)
+		{
+			sum[k] = in[k] + in[8 - k];
+
+			diff[k] = in[k] - in[8 - k];
+		}
+
+		for (UInt n = 0; n < 9; n += 2) out[n] = in[4] * tables.dct9[n][4] + sum[0] * tables.dct9[n][0] + sum[1] * tables.dct9[n][1] + sum[2] * tables.dct9[n][2] + sum[3] * tables.dct9[n][3];
+
+		for (UInt n = 1; n < 9; n += 2) out[n] = diff[0] * tables.dct9[n][0] + diff[1] * tables.dct9[n][1] + diff[2] * tables.dct9[n][2] + diff[3] * tables.dct9[n][3];
+	}
+
+	//DCT-II of 18, the even half is a DCT-II of 9 and the odd half a DCT-IV of 9, without the 1 / cos factors of Lee that lose precision
+	template <typename T> FORCEINLINE void Dct18(const T in[18], T out[18], const ImdctTables & tables)
+	{
+		T even[9], odd[9], even_out[9];
+
+		for (UInt k = 0; k < 9; k++)
+		{
+			even[k] = in[k] + in[17 - k];
+
+			odd[k] = in[k] - in[17 - k];
+		}
+
+		Dct9(even, even_out, tables);
+
+		for (UInt m = 0; m < 9; m++)
+		{
+			out[2 * m] = even_out[m];
+
+			out[2 * m + 1] = odd[0] * tables.dct4_9[m][0];
+
+			for (UInt k = 1; k < 9; k++) out[2 * m + 1] = out[2 * m + 1] + odd[k] * tables.dct4_9[m][k];
+		}
+	}
+
+	//Does inverse modified DCT and windowing
+	template <typename T> void IMDCT_Win(UInt blocktype, const T in[18], T out[36], const ImdctTables & tables)
+	{
+		if (blocktype == 2)	//3 short blocks, N = 12
+		{
+			T zero = in[0] - in[0];
+
+			for (UInt p = 0; p < 6; p++) out[p] = out[p + 30] = zero;
+
+			for (UInt p = 6; p < 30; p++) out[p] = zero;
+
+			for (UInt i = 0; i < 3; i++)
+			{
+				T y[6];
+
+				for (UInt k = 0; k < 6; k++)
+				{
+					y[k] = in[i] * tables.dct6[k][0];
+
+					for (UInt m = 1; m < 6; m++) y[k] = y[k] + in[i + 3 * m] * tables.dct6[k][m];
+				}
+
+				T * window_out = out + 6 * i + 6;
+
+				for (UInt p = 0; p < 3; p++) window_out[p] = window_out[p] + y[p + 3] * tables.window12[p];
+
+				for (UInt p = 3; p < 9; p++) window_out[p] = window_out[p] + y[8 - p] * tables.window12[p];
+
+				for (UInt p = 9; p < 12; p++) window_out[p] = window_out[p] + y[p - 9] * tables.window12[p];
+			}
+		}
+		else
+		{
+			//block_type != 2, N = 36, the DCT-IV of 18 by 2 cos(a) cos(b) = cos(a + b) + cos(a - b) on a DCT-II
+
+			T z[18], y[18];
+
+			for (UInt m = 0; m < 18; m++) z[m] = in[m] * tables.twiddle18[m];
+
+			Dct18(z, y, tables);
+
+			//y[k] = X[k] + X[k - 1], the error adds up so the second half goes down from X[17]
+
+			y[0] = y[0] * 0.5f;
+
+			for (UInt k = 1; k < 9; k++) y[k] = y[k] - y[k - 1];
+
+			T last = in[0] * tables.last18[0];
+
+			for (UInt m = 1; m < 18; m++) last = last + in[m] * tables.last18[m];
+
+			for (UInt k = 17; k > 9; k--)
+			{
+				T previous = y[k] - last;
+
+				y[k] = last;
+
+				last = previous;
+			}
+
+			y[9] = last;
+
+			const Float32 * window = tables.window36[blocktype];
+
+			for (UInt p = 0; p < 9; p++) out[p] = y[p + 9] * window[p];
+
+			for (UInt p = 9; p < 27; p++) out[p] = y[26 - p] * window[p];
+
+			for (UInt p = 27; p < 36; p++) out[p] = y[p - 27] * window[p];
+		}
+	}
 }
 
 void OpenMP3::Antialias(FrameData::Granule & granule)
@@ -65,6 +301,8 @@ void OpenMP3::Antialias(FrameData::Granule & granule)
 
 void OpenMP3::HybridSynthesis(FrameData::Granule & granule, Float32 store[32][18])
 {
+	static const ImdctTables tables;
+
 	auto & is = granule.is;
 
 	bool window_switching = granule.window_switching;
@@ -73,13 +311,21 @@ void OpenMP3::HybridSynthesis(FrameData::Granule & granule, Float32 store[32][18
 
 	bool mixed_block = granule.mixed_block;
 
-	Float32 rawout[36];
+	auto GetBlockType = [&](UInt sb) { return ((window_switching == 1) && mixed_block && (sb < 2)) ? 0 : block_type; };
+
+	//the subbands above the last nonzero line, after count1 the lines only move by the reorder, the antialias and the intensity stereo
+
+	UInt lines = 576;
 
-	for (UInt sb = 0; sb < 32; sb++) //Loop through all 32 subbands
+	while (lines > 0 && is[lines - 1] == 0.0f) lines--;
+
+	UInt sblimit = (lines + 17) / 18;
+
+	auto Synthesize = [&](UInt sb)
 	{
-		UInt blocktype = ((window_switching == 1) && mixed_block && (sb < 2)) ? 0 : block_type;
+		Float32 rawout[36];
 
-		IMDCT_Win(blocktype, is + (sb * 18), rawout);	//inverse modified DCT and windowing
+		IMDCT_Win(GetBlockType(sb), is + (sb * 18), rawout, tables);	//inverse modified DCT and windowing
 
 		for (UInt i = 0; i < 18; i++)	//Overlapp add with stored vector into main_data vector
 		{
@@ -87,153 +333,119 @@ void OpenMP3::HybridSynthesis(FrameData::Granule & granule, Float32 store[32][18
 
 			store[sb][i] = rawout[i + 18];
 		}
-	}
-}
-
-FORCEINLINE void OpenMP3::FrequencyInversion(Float32 is[576])
-{
-	for (UInt sb = 1; sb < 32; sb += 2) for (UInt i = 1; i < 18; i += 2) is[sb * 18 + i] = -is[sb * 18 + i];
-}
+	};
 
-void OpenMP3::SubbandSynthesis(const FrameData & data, const Float32 is[576], Float32 v_vec[1024], Float32 out[576])
-{
-	static float sbs_n_win[64][32];
+	UInt sb = 0;
 
-	static bool init = true;
+	if (GetBlockType(0) != block_type) for (; sb < 2 && sb < sblimit; sb++) Synthesize(sb);	//the long subbands of a mixed block
 
-	if (init)
+#ifdef KRB_SSE2
+	for (; sb + 4 <= sblimit; sb += 4)
 	{
-		for (UInt i = 0; i < 64; i++) for (UInt j = 0; j < 32; j++) sbs_n_win[i][j] = Float32(cos(Float64((16 + i) * (2 * j + 1)) * (C_PI / 64.0)));
-
-		init = false;
-	}
+		alignas(16) Float32 lanes[36][4];
 
-	Float32 u_vec[512], s_vec[32];
+		for (UInt j = 0; j < 4; j++) for (UInt i = 0; i < 18; i++) lanes[i][j] = is[(sb + j) * 18 + i];
 
-	for (UInt ss = 0; ss < 18; ss++)  //Loop through 18 samples in 32 subbands
-	{
-		for (UInt i = 1023; i > 63; i--)  v_vec[i] = v_vec[i - 64];	//Shift up the V vector 
+		Lanes in[18], rawout[36];
 
-		for (UInt i = 0; i < 32; i++) s_vec[i] = is[i * 18 + ss]; //Copy next 32 time samples to a temp vector
-
-		for (UInt i = 0; i < 64; i++) //Matrix multiply input with n_win[][] matrix
-		{ 
-			Float32 sum = 0.0;
-
-			for (UInt j = 0; j < 32; j++) sum += sbs_n_win[i][j] * s_vec[j];
-
-			v_vec[i] = sum;
-		}
+		for (UInt i = 0; i < 18; i++) in[i] = Lanes(_mm_load_ps(lanes[i]));
 
-		for (UInt i = 0; i < 8; i++)	//Build the U vector
-		{ 
-			for (UInt j = 0; j < 32; j++) // <<7 == *128
-			{ 
-				UInt i6 = i << 6;
+		IMDCT_Win(block_type, in, rawout, tables);
 
-				UInt i7 = i << 7;
+		for (UInt i = 0; i < 36; i++) _mm_store_ps(lanes[i], rawout[i].v);
 
-				u_vec[i6 + j] = v_vec[i7 + j];
+		for (UInt j = 0; j < 4; j++)
+		{
+			for (UInt i = 0; i < 18; i++)
+			{
+				is[(sb + j) * 18 + i] = lanes[i][j] + store[sb + j][i];
 
-				u_vec[i6 + j + 32] = v_vec[i7 + j + 96];
+				store[sb + j][i] = lanes[i + 18][j];
 			}
 		}
+	}
+#endif
 
-		for (UInt i = 0; i < 512; i++) u_vec[i] *= kSynthDtbl[i];	//Window by u_vec[i] with kSynthDtbl[i]
+	for (; sb < sblimit; sb++) Synthesize(sb);
 
-		for (UInt i = 0; i < 32; i++)
+	for (; sb < 32; sb++)	//the IMDCT of zeros is zero
+	{
+		for (UInt i = 0; i < 18; i++)
 		{
-			Float32 sum = 0.0;
-
-			for (UInt j = 0; j < 16; j++) sum += u_vec[(j << 5) + i];	//sum += u_vec[j*32 + i];
+			is[sb * 18 + i] = store[sb][i];
 
-			out[(32 * ss) + i] = sum;
+			store[sb][i] = 0.0f;
 		}
 	}
 }
 
-//Does inverse modified DCT and windowing
-void OpenMP3::IMDCT_Win(UInt blocktype, const Float32 in[18], Float32 out[36])
+FORCEINLINE void OpenMP3::FrequencyInversion(Float32 is[576])
 {
-	static Float32 imdct_win[4][36];
+	for (UInt sb = 1; sb < 32; sb += 2) for (UInt i = 1; i < 18; i += 2) is[sb * 18 + i] = -is[sb * 18 + i];
+}
+
+void OpenMP3::SubbandSynthesis(const FrameData & data, const Float32 is[576], Float32 v_vec[1024], UInt & v_pos, Float32 out[576])
+{
+	static const DctFactors factors;
+
+	Float32 s_vec[32], x_vec[32];
 
-	static Float32 cos_n12[6][12];
+	for (UInt ss = 0; ss < 18; ss++)  //Loop through 18 samples in 32 subbands
+	{
+		v_pos = (v_pos - 1) & 15;	//the oldest of the 16 slots of the V vector is replaced
 
-	static Float32 cos_n36[18][36];
+		for (UInt i = 0; i < 32; i++) s_vec[i] = is[i * 18 + ss]; //Copy next 32 time samples to a temp vector
 
-	static bool init = true;
+		Dct<32>(s_vec, x_vec, factors.values);
 
-	if (init)
-	{ 
-		for (UInt i = 0; i < 36; i++)  imdct_win[0][i] = Float32(sin((C_PI / 36.0) * (i + 0.5))); //0
-		for (UInt i = 0; i < 18; i++)  imdct_win[1][i] = Float32(sin((C_PI / 36.0) * (i + 0.5))); //1
-		for (UInt i = 18; i < 24; i++) imdct_win[1][i] = 1.0f;
-		for (UInt i = 24; i < 30; i++) imdct_win[1][i] = Float32(sin((C_PI / 12.0) * (i + 0.5 - 18.0)));
-		for (UInt i = 30; i < 36; i++) imdct_win[1][i] = 0.0f;
-		for (UInt i = 0; i < 12; i++)  imdct_win[2][i] = Float32(sin((C_PI / 12.0) * (i + 0.5))); //2
-		for (UInt i = 12; i < 36; i++) imdct_win[2][i] = 0.0f;
-		for (UInt i = 0; i < 6; i++)   imdct_win[3][i] = 0.0f; //3
-		for (UInt i = 6; i < 12; i++)  imdct_win[3][i] = Float32(sin((C_PI / 12.0) * (i + 0.5 - 6.0)));
-		for (UInt i = 12; i < 18; i++) imdct_win[3][i] = 1.0f;
-		for (UInt i = 18; i < 36; i++) imdct_win[3][i] = Float32(sin((C_PI / 36.0) * (i + 0.5)));
+		//V[i] = sum cos((16 + i) * (2k + 1) * pi / 64) * s[k] by the symmetries of the cosines
 
-		for (UInt p = 0; p < 12; p++) for (UInt m = 0; m < 6; m++) cos_n12[m][p] = Float32(cos(C_PI / 24 * (2 * p + 1 + 6) * (2 * m + 1)));
+		Float32 * v = v_vec + (v_pos << 6);
 
-		for (UInt p = 0; p < 36; p++) for (UInt m = 0; m < 18; m++)	cos_n36[m][p] = Float32(cos(C_PI / 72 * (2 * p + 1 + 18) * (2 * m + 1)));
+		for (UInt i = 0; i < 16; i++) v[i] = x_vec[16 + i];
 
-		init = false;
-	}
+		v[16] = 0.0f;
 
-	//MemClear(out, sizeof(Float32) * 36);
+		for (UInt i = 17; i < 48; i++) v[i] = -x_vec[48 - i];
 
-	for (UInt i = 0; i < 36; i++) out[i] = 0.0;
+		for (UInt i = 48; i < 64; i++) v[i] = -x_vec[i - 48];
 
-	const float * blocktype_imdct_win = imdct_win[blocktype];
+		//U is the first half of the even slots and the second half of the odd slots, windowed by kSynthDtbl and summed
 
-	if (blocktype == 2)	//3 short blocks, N = 12
-	{
-		const float * tin = in;
-		
-		for (UInt i = 0; i < 3; i++)
-		{
-			for (UInt p = 0; p < 12; p++)
-			{
-				Float32 sum = 0.0f;
+		const Float32 * u_vec[16];
 
-				for (UInt m = 0; m < 6; m++)		//N / 2
-				{
-					//sum += tin[i + 3 * m] * cos(C_PI / 24 * (2 * p + 1 + 6) * (2 * m + 1));
+		for (UInt t = 0; t < 16; t++) u_vec[t] = v_vec + (((v_pos + t) & 15) << 6) + ((t & 1) << 5);
 
-					sum += tin[i + 3 * m] * cos_n12[m][p];
-				}
+		Float32 * dest = out + (32 * ss);
 
-				out[6 * i + p + 6] += Float32(sum) * blocktype_imdct_win[p];
-			}
+		UInt i = 0;
+#ifdef KRB_AVX2
+		for (; i + 8 <= 32; i += 8)
+		{
+			__m256 sum = _mm256_setzero_ps();
+			for (UInt t = 0; t < 16; t++) sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(u_vec[t] + i), _mm256_loadu_ps(kSynthDtbl + (t << 5) + i)));
+			_mm256_storeu_ps(dest + i, sum);
 		}
-	}
-	else
-	{
-		//block_type != 2, N = 36
-
-		for (UInt p = 0; p < 36; p++)
+#endif
+#ifdef KRB_SSE2
+		for (; i + 4 <= 32; i += 4)
+		{
+			__m128 sum = _mm_setzero_ps();
+			for (UInt t = 0; t < 16; t++) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(u_vec[t] + i), _mm_loadu_ps(kSynthDtbl + (t << 5) + i)));
+			_mm_storeu_ps(dest + i, sum);
+		}
+#endif
+		for (; i < 32; i++)
 		{
 			Float32 sum = 0.0f;
 
-			for (UInt m = 0; m < 18; m++)	//N / 2
-			{
-				//sum += in[m] * cos(C_PI / 72 * (2 * p + 1 + 18) * (2 * m + 1));
+			for (UInt t = 0; t < 16; t++) sum += u_vec[t][i] * kSynthDtbl[(t << 5) + i];
 
-				sum += in[m] * cos_n36[m][p];
-			}
-
-			out[p] = Float32(sum) * blocktype_imdct_win[p];
+			dest[i] = sum;
 		}
 	}
 }
 
-
-
-
 //
 //data
 
@@ -17,6 +17,6 @@ namespace OpenMP3
 
 	void FrequencyInversion(Float32 is[576]);
 
-	void SubbandSynthesis(const FrameData & data, const Float32 is[576], Float32 v_vec[1024], Float32 output[576]);
+	void SubbandSynthesis(const FrameData & data, const Float32 is[576], Float32 v_vec[1024], UInt & v_pos, Float32 output[576]);	//v_vec is a ring of 16 slots from v_pos
 
 }
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#ifndef __EMSCRIPTEN__
+#include <thread>
+#endif
+
+namespace kr
+{
+	namespace backend
+	{
+		// calls func(index) for every index in [0, count), the calling thread also works
+		// falls back to the calling thread only if threads are not available
+		template <typename FUNC>
+		void parallelFor(uint32_t count, FUNC&& func) noexcept
+		{
+			std::atomic<uint32_t> next(0);
+			auto work = [&] {
+				for (;;)
+				{
+					uint32_t index = next++;
+					if (index >= count) break;
+					func(index);
+				}
+			};
+
+#ifndef __EMSCRIPTEN__
+			std::vector<std::thread> threads;
+			try
+			{
+				uint32_t threadCount = std::thread::hardware_concurrency();
+				if (threadCount > count) threadCount = count;
+				for (uint32_t i = 1; i < threadCount; i++)
+				{
+					threads.emplace_back(work);
+				}
+			}
+			catch (...)
+			{
+				// the current thread will do the rest
+			}
+			work();
+			for (std::thread& thread : threads)
+			{
+				thread.join();
+			}
+#else
+			work();
+#endif
+		}
+	}
+}
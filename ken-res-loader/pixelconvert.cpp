@@ -0,0 +1,439 @@
+#include "pixelconvert.h"
+#include "simd.h"
+
+#include <math.h>
+#include <string.h>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	struct ConvertTable
+	{
+		float toLinear[256];
+		float unorm[256];
+		uint16_t toLinearHalf[256];
+		uint16_t unormHalf[256];
+
+		ConvertTable() noexcept
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				float c = i / 255.f;
+				toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+				unorm[i] = c;
+				toLinearHalf[i] = floatToHalf(toLinear[i]);
+				unormHalf[i] = floatToHalf(c);
+			}
+		}
+	};
+
+	const ConvertTable& convertTable() noexcept
+	{
+		static const ConvertTable table;
+		return table;
+	}
+
+	// byte offsets of the channels, alpha < 0 is opaque
+	struct SourceLayout
+	{
+		uint32_t size;
+		uint32_t r, g, b;
+		int alpha;
+	};
+
+	bool getSourceLayout(kr_pixelformat_t pixelformat, SourceLayout* layout) noexcept
+	{
+		switch (pixelformat)
+		{
+		case PixelFormatRGB8: *layout = { 3, 2, 1, 0, -1 }; return true;
+		case PixelFormatXRGB8: *layout = { 4, 2, 1, 0, -1 }; return true;
+		case PixelFormatARGB8: *layout = { 4, 2, 1, 0, 3 }; return true;
+		case PixelFormatBGR8: *layout = { 3, 0, 1, 2, -1 }; return true;
+		case PixelFormatXBGR8: *layout = { 4, 0, 1, 2, -1 }; return true;
+		case PixelFormatABGR8: *layout = { 4, 0, 1, 2, 3 }; return true;
+		default: return false;
+		}
+	}
+
+	// (c * a + 127) / 255 rounded, the alpha byte is kept
+	void premultiplyRow(uint8_t* row, uint32_t width) noexcept
+	{
+		uint32_t x = 0;
+#ifdef KRB_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i alphaLane = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+		const __m128i half = _mm_set1_epi16(128);
+		for (; x + 4 <= width; x += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(row + x * 4));
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			__m128i alo = _mm_or_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff), alphaLane);
+			__m128i ahi = _mm_or_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff), alphaLane);
+			lo = _mm_add_epi16(_mm_mullo_epi16(lo, alo), half);
+			hi = _mm_add_epi16(_mm_mullo_epi16(hi, ahi), half);
+			lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+			_mm_storeu_si128((__m128i*)(row + x * 4), _mm_packus_epi16(lo, hi));
+		}
+#endif
+		for (; x < width; x++)
+		{
+			uint8_t* p = row + x * 4;
+			uint32_t a = p[3];
+			for (int c = 0; c < 3; c++)
+			{
+				uint32_t t = p[c] * a + 128;
+				p[c] = (uint8_t)((t + (t >> 8)) >> 8);
+			}
+		}
+	}
+
+	// 4 floats to 4 halfs
+	inline void storeHalf4(uint16_t* dest, const float* src) noexcept
+	{
+#ifdef KRB_AVX2
+		_mm_storel_epi64((__m128i*)dest, _mm_cvtps_ph(_mm_loadu_ps(src), _MM_FROUND_TO_NEAREST_INT));
+#else
+		for (int i = 0; i < 4; i++) dest[i] = floatToHalf(src[i]);
+#endif
+	}
+
+	inline void premultiplyPixel(float* p) noexcept
+	{
+#ifdef KRB_SSE2
+		__m128 v = _mm_loadu_ps(p);
+		__m128 a = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+		__m128 alphaLane = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+		_mm_storeu_ps(p, _mm_or_ps(_mm_and_ps(alphaLane, v), _mm_andnot_ps(alphaLane, _mm_mul_ps(v, a))));
+#else
+		p[0] *= p[3];
+		p[1] *= p[3];
+		p[2] *= p[3];
+#endif
+	}
+}
+
+uint16_t kr::backend::floatToHalf(float value) noexcept
+{
+	uint32_t f;
+	memcpy(&f, &value, 4);
+	uint32_t sign = (f >> 16) & 0x8000;
+	uint32_t abs = f & 0x7fffffff;
+	if (abs >= 0x7f800000) return (uint16_t)(sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0));
+	if (abs >= 0x477ff000) return (uint16_t)(sign | 0x7c00); // 65520 and above
+	if (abs < 0x38800000)
+	{
+		// subnormal, the unit is 2^-24
+		uint32_t shift = 126 - (abs >> 23);
+		if (shift > 25) return (uint16_t)sign;
+		uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+		uint32_t h = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (h & 1))) h++;
+		return (uint16_t)(sign | h);
+	}
+	uint32_t h = (abs - 0x38000000) >> 13;
+	uint32_t rest = abs & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+	return (uint16_t)(sign | h);
+}
+
+PixelConverter::PixelConverter(kr_pixelformat_t pixelformat, kr_pixelformat_t request, uint32_t flags, const KrbImagePalette* palette) noexcept
+	:m_source(pixelformat), m_premultiply((flags & ImageFlagPremultiplyAlpha) != 0), m_palette(palette)
+{
+	bool linear = (flags & ImageFlagSrgbToLinear) != 0;
+	kr_pixelformat_t floatFormat = request == PixelFormatRGBA16F ? PixelFormatRGBA16F : PixelFormatRGBA32F;
+	switch (pixelformat)
+	{
+	case PixelFormatIndex:
+	case PixelFormatRGB8:
+	case PixelFormatXRGB8:
+	case PixelFormatBGR8:
+	case PixelFormatXBGR8:
+		if (linear) m_dest = floatFormat;
+		break;
+	case PixelFormatARGB8:
+	case PixelFormatABGR8:
+		if (linear) m_dest = floatFormat;
+		else if (m_premultiply) m_dest = pixelformat;
+		break;
+	case PixelFormatRGBA32F:
+		// already linear, only the storage changes
+		if (linear && floatFormat == PixelFormatRGBA16F) m_dest = PixelFormatRGBA16F;
+		else if (m_premultiply) m_dest = PixelFormatRGBA32F;
+		break;
+	default:
+		break;
+	}
+	if (m_dest != PixelFormatInvalid && m_dest != m_source) convertTable();
+}
+void PixelConverter::convert(uint8_t* dest, const uint8_t* src, uint32_t width) const noexcept
+{
+	if (m_dest == PixelFormatInvalid) return;
+	if (m_source == PixelFormatRGBA32F)
+	{
+		float pixel[4];
+		for (uint32_t x = 0; x < width; x++)
+		{
+			memcpy(pixel, src + x * 16, 16);
+			if (m_premultiply) premultiplyPixel(pixel);
+			if (m_dest == PixelFormatRGBA16F) storeHalf4((uint16_t*)dest + x * 4, pixel);
+			else memcpy(dest + x * 16, pixel, 16);
+		}
+		return;
+	}
+	if (isInPlace())
+	{
+		if (dest != src) memcpy(dest, src, (size_t)width * 4);
+		premultiplyRow(dest, width);
+		return;
+	}
+
+	const ConvertTable& table = convertTable();
+	SourceLayout layout;
+	const uint8_t* pixels = src;
+	uint8_t indexed[4];
+	if (m_source == PixelFormatIndex) layout = { 4, 2, 1, 0, 3 };
+	else getSourceLayout(m_source, &layout);
+
+	bool half = m_dest == PixelFormatRGBA16F;
+	for (uint32_t x = 0; x < width; x++)
+	{
+		const uint8_t* p;
+		if (m_source == PixelFormatIndex)
+		{
+			// 0xAARRGGBB
+			uint32_t color = m_palette->color[pixels[x]];
+			indexed[0] = (uint8_t)color;
+			indexed[1] = (uint8_t)(color >> 8);
+			indexed[2] = (uint8_t)(color >> 16);
+			indexed[3] = (uint8_t)(color >> 24);
+			p = indexed;
+		}
+		else
+		{
+			p = pixels + x * layout.size;
+		}
+		uint8_t alpha = layout.alpha < 0 ? 255 : p[layout.alpha];
+
+		if (half && (!m_premultiply || alpha == 255))
+		{
+			uint16_t* out = (uint16_t*)dest + x * 4;
+			out[0] = table.toLinearHalf[p[layout.r]];
+			out[1] = table.toLinearHalf[p[layout.g]];
+			out[2] = table.toLinearHalf[p[layout.b]];
+			out[3] = table.unormHalf[alpha];
+			continue;
+		}
+
+		float pixel[4] = {
+			table.toLinear[p[layout.r]],
+			table.toLinear[p[layout.g]],
+			table.toLinear[p[layout.b]],
+			table.unorm[alpha],
+		};
+		if (m_premultiply) premultiplyPixel(pixel);
+		if (half) storeHalf4((uint16_t*)dest + x * 4, pixel);
+		else memcpy(dest + x * 16, pixel, 16);
+	}
+}
+
+bool PixelStatistics::init(kr_pixelformat_t pixelformat) noexcept
+{
+	switch (pixelformat)
+	{
+	case PixelFormatIndex:
+	case PixelFormatA8:
+	case PixelFormatRGB8:
+	case PixelFormatXRGB8:
+	case PixelFormatARGB8:
+	case PixelFormatBGR8:
+	case PixelFormatXBGR8:
+	case PixelFormatABGR8:
+	case PixelFormatRGBA32F:
+		m_format = pixelformat;
+		return true;
+	default:
+		return false;
+	}
+}
+void PixelStatistics::addRow(const uint8_t* row, uint32_t width) noexcept
+{
+	uint32_t x = 0;
+	uint8_t minAlpha = m_minAlpha;
+	uint8_t maxAlpha = m_maxAlpha;
+	bool partial = m_partialAlpha;
+	bool color = m_color;
+	switch (m_format)
+	{
+	case PixelFormatIndex:
+		for (; x < width; x++) m_used[row[x]] = true;
+		return;
+	case PixelFormatA8:
+	{
+#ifdef KRB_SSE2
+		__m128i vmin = _mm_set1_epi8(-1);
+		__m128i vmax = _mm_setzero_si128();
+		__m128i vpartial = _mm_setzero_si128();
+		const __m128i opaque = _mm_set1_epi8(-1);
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+			vmin = _mm_min_epu8(vmin, v);
+			vmax = _mm_max_epu8(vmax, v);
+			__m128i binary = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()), _mm_cmpeq_epi8(v, opaque));
+			vpartial = _mm_or_si128(vpartial, _mm_andnot_si128(binary, opaque));
+		}
+		alignas(16) uint8_t lanes[32];
+		_mm_store_si128((__m128i*)lanes, vmin);
+		_mm_store_si128((__m128i*)(lanes + 16), vmax);
+		for (int i = 0; i < 16; i++)
+		{
+			if (lanes[i] < minAlpha) minAlpha = lanes[i];
+			if (lanes[16 + i] > maxAlpha) maxAlpha = lanes[16 + i];
+		}
+		partial = partial || _mm_movemask_epi8(vpartial) != 0;
+#endif
+		for (; x < width; x++)
+		{
+			uint8_t a = row[x];
+			if (a < minAlpha) minAlpha = a;
+			if (a > maxAlpha) maxAlpha = a;
+			partial = partial || (a != 0 && a != 255);
+		}
+		break;
+	}
+	case PixelFormatXRGB8:
+	case PixelFormatARGB8:
+	case PixelFormatXBGR8:
+	case PixelFormatABGR8:
+	{
+		bool alpha = m_format == PixelFormatARGB8 || m_format == PixelFormatABGR8;
+#ifdef KRB_SSE2
+		// the alpha bytes go through the min/max with the color bytes masked to 255/0
+		const __m128i alphaMask = alpha ? _mm_set1_epi32((int)0xff000000) : _mm_setzero_si128();
+		const __m128i colorMask = _mm_set1_epi32(0x0000ffff);
+		const __m128i opaque = _mm_set1_epi8(-1);
+		__m128i vmin = opaque;
+		__m128i vmax = _mm_setzero_si128();
+		__m128i vpartial = _mm_setzero_si128();
+		__m128i vcolor = _mm_setzero_si128();
+		for (; x + 4 <= width; x += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(row + x * 4));
+			__m128i a = _mm_and_si128(v, alphaMask);
+			vmin = _mm_min_epu8(vmin, _mm_or_si128(a, _mm_andnot_si128(alphaMask, opaque)));
+			vmax = _mm_max_epu8(vmax, a);
+			__m128i binary = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()), _mm_cmpeq_epi8(v, opaque));
+			vpartial = _mm_or_si128(vpartial, _mm_andnot_si128(binary, alphaMask));
+			// c0 ^ c1 and c1 ^ c2 in the low 2 bytes
+			vcolor = _mm_or_si128(vcolor, _mm_and_si128(_mm_xor_si128(v, _mm_srli_epi32(v, 8)), colorMask));
+		}
+		alignas(16) uint8_t lanes[32];
+		_mm_store_si128((__m128i*)lanes, vmin);
+		_mm_store_si128((__m128i*)(lanes + 16), vmax);
+		for (int i = 3; i < 16; i += 4)
+		{
+			if (alpha && lanes[i] < minAlpha) minAlpha = lanes[i];
+			if (alpha && lanes[16 + i] > maxAlpha) maxAlpha = lanes[16 + i];
+		}
+		partial = partial || _mm_movemask_epi8(vpartial) != 0;
+		color = color || _mm_movemask_epi8(_mm_cmpeq_epi8(vcolor, _mm_setzero_si128())) != 0xffff;
+#endif
+		for (; x < width; x++)
+		{
+			const uint8_t* p = row + x * 4;
+			color = color || p[0] != p[1] || p[1] != p[2];
+			if (!alpha) continue;
+			uint8_t a = p[3];
+			if (a < minAlpha) minAlpha = a;
+			if (a > maxAlpha) maxAlpha = a;
+			partial = partial || (a != 0 && a != 255);
+		}
+		break;
+	}
+	case PixelFormatRGB8:
+	case PixelFormatBGR8:
+	{
+#ifdef KRB_SSE2
+		// 5 pixels per 16 bytes, the bytes 0, 3, 6, 9 and 12 must match the next 2
+		for (; !color && (size_t)x * 3 + 16 <= (size_t)width * 3; x += 5)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(row + x * 3));
+			__m128i same = _mm_and_si128(_mm_cmpeq_epi8(v, _mm_srli_si128(v, 1)), _mm_cmpeq_epi8(v, _mm_srli_si128(v, 2)));
+			color = (_mm_movemask_epi8(same) & 0x1249) != 0x1249;
+		}
+#endif
+		for (; !color && x < width; x++)
+		{
+			const uint8_t* p = row + x * 3;
+			color = p[0] != p[1] || p[1] != p[2];
+		}
+		break;
+	}
+	case PixelFormatRGBA32F:
+		for (; x < width; x++)
+		{
+			float p[4];
+			memcpy(p, row + (size_t)x * 16, 16);
+			color = color || p[0] != p[1] || p[1] != p[2];
+			float clamped = p[3] < 0.f ? 0.f : p[3] > 1.f ? 1.f : p[3];
+			uint8_t a = (uint8_t)(clamped * 255.f + 0.5f);
+			if (a < minAlpha) minAlpha = a;
+			if (a > maxAlpha) maxAlpha = a;
+			partial = partial || (p[3] > 0.f && p[3] < 1.f);
+		}
+		break;
+	default:
+		return;
+	}
+	m_minAlpha = minAlpha;
+	m_maxAlpha = maxAlpha;
+	m_partialAlpha = partial;
+	m_color = color;
+}
+void PixelStatistics::get(KrbImageInfo* info, const KrbImagePalette* palette) const noexcept
+{
+	uint8_t minAlpha = m_minAlpha;
+	uint8_t maxAlpha = m_maxAlpha;
+	bool partial = m_partialAlpha;
+	bool color = m_color;
+	switch (m_format)
+	{
+	case PixelFormatInvalid:
+		info->hasStatistics = false;
+		return;
+	case PixelFormatIndex:
+		for (int i = 0; i < 256; i++)
+		{
+			if (!m_used[i]) continue;
+			// 0xAARRGGBB
+			uint32_t c = palette->color[i];
+			uint8_t a = (uint8_t)(c >> 24);
+			if (a < minAlpha) minAlpha = a;
+			if (a > maxAlpha) maxAlpha = a;
+			partial = partial || (a != 0 && a != 255);
+			color = color || ((c ^ (c >> 8)) & 0xffff) != 0;
+		}
+		break;
+	case PixelFormatRGB8:
+	case PixelFormatXRGB8:
+	case PixelFormatBGR8:
+	case PixelFormatXBGR8:
+		minAlpha = maxAlpha = 255;
+		break;
+	default:
+		break;
+	}
+	if (minAlpha > maxAlpha) minAlpha = maxAlpha = 255; // no pixels
+	info->hasStatistics = true;
+	info->minAlpha = minAlpha;
+	info->maxAlpha = maxAlpha;
+	info->allOpaque = minAlpha == 255;
+	info->binaryAlpha = !partial;
+	info->grayscale = !color;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "include/image.h"
+
+namespace kr
+{
+	namespace backend
+	{
+		// premultiplied alpha and sRGB to linear on the decoded rows, flags are kr_imageflag_t
+		class PixelConverter
+		{
+		public:
+			// request picks RGBA16F for the linear output, RGBA32F otherwise
+			PixelConverter(kr_pixelformat_t pixelformat, kr_pixelformat_t request, uint32_t flags, const KrbImagePalette* palette) noexcept;
+
+			// PixelFormatInvalid if the rows are kept as is
+			kr_pixelformat_t destFormat() const noexcept
+			{
+				return m_dest;
+			}
+			// the rows are converted in place
+			bool isInPlace() const noexcept
+			{
+				return m_dest == m_source;
+			}
+
+			// dest can be src if isInPlace
+			void convert(uint8_t* dest, const uint8_t* src, uint32_t width) const noexcept;
+
+		private:
+			kr_pixelformat_t m_source;
+			kr_pixelformat_t m_dest = PixelFormatInvalid;
+			bool m_premultiply;
+			const KrbImagePalette* m_palette;
+		};
+
+		// alpha range and grayscale of the decoded rows
+		class PixelStatistics
+		{
+		public:
+			// false for the formats without statistics
+			bool init(kr_pixelformat_t pixelformat) noexcept;
+			void addRow(const uint8_t* row, uint32_t width) noexcept;
+			// fills the statistics of info, palette is for PixelFormatIndex
+			void get(KrbImageInfo* info, const KrbImagePalette* palette) const noexcept;
+
+		private:
+			kr_pixelformat_t m_format = PixelFormatInvalid;
+			uint8_t m_minAlpha = 255;
+			uint8_t m_maxAlpha = 0;
+			bool m_partialAlpha = false; // alpha other than 0 and 255
+			bool m_color = false; // R, G and B differ
+			bool m_used[256] = {}; // the palette entries
+		};
+
+		// round to nearest even, overflows to infinity
+		uint16_t floatToHalf(float value) noexcept;
+	}
+}
@@ -0,0 +1,294 @@
+#include "pngfilter.h"
+#include "simd.h"
+
+#include <stdlib.h>
+#include <memory.h>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) noexcept
+	{
+		int p = a + b - c;
+		int pa = abs(p - a);
+		int pb = abs(p - b);
+		int pc = abs(p - c);
+		if (pa <= pb && pa <= pc) return a;
+		if (pb <= pc) return b;
+		return c;
+	}
+
+	inline uint8_t predict(PngFilter filter, uint8_t a, uint8_t b, uint8_t c) noexcept
+	{
+		switch (filter)
+		{
+		case PngFilterSub: return a;
+		case PngFilterUp: return b;
+		case PngFilterAverage: return (uint8_t)((a + b) >> 1);
+		case PngFilterPaeth: return paeth(a, b, c);
+		default: return 0;
+		}
+	}
+
+	// signed residual cost, |(int8_t)r|
+	inline uint32_t cost(uint8_t r) noexcept
+	{
+		return r < 128 ? r : 256 - r;
+	}
+
+#ifdef KRB_SSE2
+	// on 16-bit lanes
+	inline __m128i paeth16SSE2(__m128i a, __m128i b, __m128i c, __m128i zero) noexcept
+	{
+		// pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|
+		__m128i sa = _mm_sub_epi16(b, c);
+		__m128i sb = _mm_sub_epi16(a, c);
+		__m128i sc = _mm_add_epi16(sa, sb);
+		__m128i pa = _mm_max_epi16(sa, _mm_sub_epi16(zero, sa));
+		__m128i pb = _mm_max_epi16(sb, _mm_sub_epi16(zero, sb));
+		__m128i pc = _mm_max_epi16(sc, _mm_sub_epi16(zero, sc));
+
+		__m128i notB = _mm_cmpgt_epi16(pb, pc);
+		__m128i bc = _mm_or_si128(_mm_andnot_si128(notB, b), _mm_and_si128(notB, c));
+		__m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+		return _mm_or_si128(_mm_andnot_si128(notA, a), _mm_and_si128(notA, bc));
+	}
+
+	inline __m128i paethSSE2(__m128i a, __m128i b, __m128i c, __m128i zero) noexcept
+	{
+		__m128i lo = paeth16SSE2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero), zero);
+		__m128i hi = paeth16SSE2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero), zero);
+		return _mm_packus_epi16(lo, hi);
+	}
+
+	inline __m128i averageSSE2(__m128i a, __m128i b) noexcept
+	{
+		// _mm_avg_epu8 rounds up
+		__m128i odd = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+		return _mm_sub_epi8(_mm_avg_epu8(a, b), odd);
+	}
+
+	inline __m128i costSSE2(__m128i residual, __m128i zero) noexcept
+	{
+		__m128i absolute = _mm_min_epu8(residual, _mm_sub_epi8(zero, residual));
+		return _mm_sad_epu8(absolute, zero);
+	}
+
+	template <size_t BPP>
+	inline __m128i loadPixel(const uint8_t* src) noexcept
+	{
+		uint32_t value = 0;
+		memcpy(&value, src, BPP);
+		return _mm_cvtsi32_si128((int)value);
+	}
+
+	template <size_t BPP>
+	inline void storePixel(uint8_t* dest, __m128i pixel) noexcept
+	{
+		uint32_t value = (uint32_t)_mm_cvtsi128_si32(pixel);
+		memcpy(dest, &value, BPP);
+	}
+
+	// the left pixel depends on the previous result, one pixel per step
+	template <size_t BPP>
+	void unfilterSubSSE2(uint8_t* row, size_t bytes) noexcept
+	{
+		__m128i a = _mm_setzero_si128();
+		for (size_t i = 0; i < bytes; i += BPP)
+		{
+			a = _mm_add_epi8(loadPixel<BPP>(row + i), a);
+			storePixel<BPP>(row + i, a);
+		}
+	}
+
+	// prefix sum of 4 pixels at once
+	template <>
+	void unfilterSubSSE2<4>(uint8_t* row, size_t bytes) noexcept
+	{
+		__m128i carry = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 16 <= bytes; i += 16)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+			x = _mm_add_epi8(x, carry);
+			_mm_storeu_si128((__m128i*)(row + i), x);
+			carry = _mm_shuffle_epi32(x, 0xff);
+		}
+		for (; i < bytes; i += 4)
+		{
+			carry = _mm_add_epi8(loadPixel<4>(row + i), carry);
+			storePixel<4>(row + i, carry);
+		}
+	}
+
+	template <size_t BPP>
+	void unfilterAverageSSE2(uint8_t* row, const uint8_t* prior, size_t bytes) noexcept
+	{
+		__m128i a = _mm_setzero_si128();
+		for (size_t i = 0; i < bytes; i += BPP)
+		{
+			__m128i b = loadPixel<BPP>(prior + i);
+			a = _mm_add_epi8(loadPixel<BPP>(row + i), averageSSE2(a, b));
+			storePixel<BPP>(row + i, a);
+		}
+	}
+
+	template <size_t BPP>
+	void unfilterPaethSSE2(uint8_t* row, const uint8_t* prior, size_t bytes) noexcept
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i a = zero;
+		__m128i c = zero;
+		for (size_t i = 0; i < bytes; i += BPP)
+		{
+			__m128i b = _mm_unpacklo_epi8(loadPixel<BPP>(prior + i), zero);
+			__m128i pred = paeth16SSE2(a, b, c, zero);
+			__m128i x = _mm_add_epi8(loadPixel<BPP>(row + i), _mm_packus_epi16(pred, pred));
+			storePixel<BPP>(row + i, x);
+			a = _mm_unpacklo_epi8(x, zero);
+			c = b;
+		}
+	}
+#endif
+}
+
+void PngFilterer::filter(PngFilter filter, uint8_t* dest, const uint8_t* row, const uint8_t* prior, size_t bytes, size_t bpp) noexcept
+{
+	size_t i = 0;
+	if (filter == PngFilterNone)
+	{
+		memcpy(dest, row, bytes);
+		return;
+	}
+#ifdef KRB_SSE2
+	__m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= bytes; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+		__m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+		__m128i b = _mm_loadu_si128((const __m128i*)(prior + i));
+		__m128i pred;
+		switch (filter)
+		{
+		case PngFilterSub: pred = a; break;
+		case PngFilterUp: pred = b; break;
+		case PngFilterAverage: pred = averageSSE2(a, b); break;
+		default:
+			pred = paethSSE2(a, b, _mm_loadu_si128((const __m128i*)(prior + i - bpp)), zero);
+			break;
+		}
+		_mm_storeu_si128((__m128i*)(dest + i), _mm_sub_epi8(x, pred));
+	}
+#endif
+	for (; i < bytes; i++)
+	{
+		dest[i] = (uint8_t)(row[i] - predict(filter, row[i - bpp], prior[i], prior[i - bpp]));
+	}
+}
+
+void PngFilterer::unfilter(PngFilter filter, uint8_t* row, const uint8_t* prior, size_t bytes, size_t bpp) noexcept
+{
+	size_t i = 0;
+	switch (filter)
+	{
+	case PngFilterNone:
+		break;
+	case PngFilterUp:
+#ifdef KRB_SSE2
+		for (; i + 16 <= bytes; i += 16)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(prior + i));
+			_mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, b));
+		}
+#endif
+		for (; i < bytes; i++) row[i] += prior[i];
+		break;
+	case PngFilterSub:
+#ifdef KRB_SSE2
+		if (bpp == 3) return unfilterSubSSE2<3>(row, bytes);
+		if (bpp == 4) return unfilterSubSSE2<4>(row, bytes);
+#endif
+		for (i = bpp; i < bytes; i++) row[i] += row[i - bpp];
+		break;
+	case PngFilterAverage:
+#ifdef KRB_SSE2
+		if (bpp == 3) return unfilterAverageSSE2<3>(row, prior, bytes);
+		if (bpp == 4) return unfilterAverageSSE2<4>(row, prior, bytes);
+#endif
+		for (; i < bpp && i < bytes; i++) row[i] += prior[i] >> 1;
+		for (; i < bytes; i++) row[i] += (uint8_t)((row[i - bpp] + prior[i]) >> 1);
+		break;
+	case PngFilterPaeth:
+#ifdef KRB_SSE2
+		if (bpp == 3) return unfilterPaethSSE2<3>(row, prior, bytes);
+		if (bpp == 4) return unfilterPaethSSE2<4>(row, prior, bytes);
+#endif
+		for (; i < bpp && i < bytes; i++) row[i] += prior[i];
+		for (; i < bytes; i++) row[i] += paeth(row[i - bpp], prior[i], prior[i - bpp]);
+		break;
+	default:
+		break;
+	}
+}
+
+PngFilter PngFilterer::choose(const uint8_t* row, const uint8_t* prior, size_t bytes, size_t bpp, uint32_t mask) noexcept
+{
+	uint64_t sums[PngFilterCount] = { 0, 0, 0, 0, 0 };
+	size_t i = 0;
+
+#ifdef KRB_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc[PngFilterCount] = { zero, zero, zero, zero, zero };
+	for (; i + 16 <= bytes; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+		__m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+		__m128i b = _mm_loadu_si128((const __m128i*)(prior + i));
+		__m128i c = _mm_loadu_si128((const __m128i*)(prior + i - bpp));
+		acc[PngFilterNone] = _mm_add_epi64(acc[PngFilterNone], costSSE2(x, zero));
+		acc[PngFilterSub] = _mm_add_epi64(acc[PngFilterSub], costSSE2(_mm_sub_epi8(x, a), zero));
+		acc[PngFilterUp] = _mm_add_epi64(acc[PngFilterUp], costSSE2(_mm_sub_epi8(x, b), zero));
+		acc[PngFilterAverage] = _mm_add_epi64(acc[PngFilterAverage], costSSE2(_mm_sub_epi8(x, averageSSE2(a, b)), zero));
+		if (mask & (1 << PngFilterPaeth))
+		{
+			acc[PngFilterPaeth] = _mm_add_epi64(acc[PngFilterPaeth], costSSE2(_mm_sub_epi8(x, paethSSE2(a, b, c, zero)), zero));
+		}
+	}
+	for (int f = 0; f < PngFilterCount; f++)
+	{
+		uint64_t lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, acc[f]);
+		sums[f] = lanes[0] + lanes[1];
+	}
+#endif
+	for (; i < bytes; i++)
+	{
+		uint8_t x = row[i];
+		uint8_t a = row[i - bpp];
+		uint8_t b = prior[i];
+		uint8_t c = prior[i - bpp];
+		sums[PngFilterNone] += cost(x);
+		sums[PngFilterSub] += cost((uint8_t)(x - a));
+		sums[PngFilterUp] += cost((uint8_t)(x - b));
+		sums[PngFilterAverage] += cost((uint8_t)(x - ((a + b) >> 1)));
+		sums[PngFilterPaeth] += cost((uint8_t)(x - paeth(a, b, c)));
+	}
+
+	PngFilter best = PngFilterNone;
+	uint64_t bestSum = UINT64_MAX;
+	for (int f = 0; f < PngFilterCount; f++)
+	{
+		if (!(mask & (1 << f))) continue;
+		if (sums[f] < bestSum)
+		{
+			bestSum = sums[f];
+			best = (PngFilter)f;
+		}
+	}
+	return best;
+}
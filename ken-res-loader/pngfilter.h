@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace kr
+{
+	namespace backend
+	{
+		enum PngFilter :uint8_t
+		{
+			PngFilterNone,
+			PngFilterSub,
+			PngFilterUp,
+			PngFilterAverage,
+			PngFilterPaeth,
+			PngFilterCount,
+		};
+
+		// rows given to filter and choose must have PNG_ROW_PADDING zero bytes before the data,
+		// row[-bpp] is read as the left pixel
+		constexpr size_t PNG_ROW_PADDING = 16;
+
+		class PngFilterer
+		{
+		public:
+			// writes the filtered bytes without the filter type byte
+			static void filter(PngFilter filter, uint8_t* dest, const uint8_t* row, const uint8_t* prior, size_t bytes, size_t bpp) noexcept;
+
+			// reverses the filter in place, the row needs no padding
+			static void unfilter(PngFilter filter, uint8_t* row, const uint8_t* prior, size_t bytes, size_t bpp) noexcept;
+
+			// minimum sum of absolute differences, the filters not in mask are skipped
+			static PngFilter choose(const uint8_t* row, const uint8_t* prior, size_t bytes, size_t bpp, uint32_t mask) noexcept;
+		};
+	}
+}
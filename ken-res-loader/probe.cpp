@@ -0,0 +1,163 @@
+#include "include/probe.h"
+#include "kpng.h"
+#include "jpeg.h"
+#include "tga.h"
+#include "bmp.h"
+#include "qoi.h"
+#include "kzip.h"
+#include "mp3.h"
+#include "wav.h"
+#include "util.h"
+
+#include <string.h>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	constexpr size_t OGG_TAIL_CHUNK = 4096; // the last page is searched backward by it
+	constexpr size_t OGG_TAIL_BYTES = 64 << 10;
+
+	// the file of the probes, counts the bytes read
+	struct CountingFile
+	{
+		KrbFile* file;
+		uint64_t bytesRead;
+	};
+
+	const KrbFileVFTable countingVftable = {
+		[](KrbFile* fp, const void* data, size_t size) {
+		},
+		[](KrbFile* fp, void* data, size_t size)->size_t {
+			CountingFile* file = (CountingFile*)fp->param;
+			size_t read = file->file->read(data, size);
+			file->bytesRead += read;
+			return read;
+		},
+		[](KrbFile* fp)->uint64_t {
+			return ((CountingFile*)fp->param)->file->tell();
+		},
+		[](KrbFile* fp, uint64_t pos) {
+			((CountingFile*)fp->param)->file->seek_set(pos);
+		},
+		[](KrbFile* fp, uint64_t pos) {
+			((CountingFile*)fp->param)->file->seek_cur(pos);
+		},
+		[](KrbFile* fp, uint64_t pos) {
+			((CountingFile*)fp->param)->file->seek_end(pos);
+		},
+		[](KrbFile* fp) {
+		},
+	};
+
+	inline uint64_t getLE64(const uint8_t* data) noexcept
+	{
+		uint64_t v;
+		memcpy(&v, data, 8);
+		return v;
+	}
+	inline uint32_t getLE32(const uint8_t* data) noexcept
+	{
+		uint32_t v;
+		memcpy(&v, data, 4);
+		return v;
+	}
+
+	// the identification header of the first page, the length by the granule of the last page
+	bool probeOgg(KrbFile* file, KrbSoundInfo* info) noexcept
+	{
+		uint8_t page[27 + 255];
+		if (file->read(page, 27) != 27 || memcmp(page, "OggS", 4) != 0) return false;
+		uint32_t segments = page[26];
+		if (file->read(page + 27, segments) != segments || segments == 0) return false;
+		uint32_t serial = getLE32(page + 14);
+
+		uint8_t id[30];
+		if (page[27] < sizeof(id) || file->read(id, sizeof(id)) != sizeof(id)) return false;
+		if (id[0] != 1 || memcmp(id + 1, "vorbis", 6) != 0) return false;
+		uint32_t channels = id[11];
+		uint32_t sampleRate = getLE32(id + 12);
+		if (channels == 0 || sampleRate == 0) return false;
+
+		file->seek_end(0);
+		uint64_t size = file->tell();
+		uint8_t tail[OGG_TAIL_CHUNK + 27];
+		uint64_t end = size;
+		uint64_t limit = size > OGG_TAIL_BYTES ? size - OGG_TAIL_BYTES : 0;
+		while (end > limit)
+		{
+			// the chunks overlap by a page header
+			uint64_t start = end > OGG_TAIL_CHUNK ? end - OGG_TAIL_CHUNK : 0;
+			size_t bytes = (size_t)((end + 27 < size ? end + 27 : size) - start);
+			file->seek_set(start);
+			if (file->read(tail, bytes) != bytes) return false;
+			for (size_t i = bytes < 27 ? 0 : bytes - 27 + 1; i-- > 0;)
+			{
+				if (memcmp(tail + i, "OggS", 4) != 0 || getLE32(tail + i + 14) != serial) continue;
+				uint64_t granule = getLE64(tail + i + 6);
+				if (granule == (uint64_t)-1) continue; // no packet ends in the page
+				Wav::setPcmFormat(info, channels, sampleRate, granule);
+				return true;
+			}
+			end = start;
+		}
+		return false;
+	}
+
+	bool probeMp3(KrbFile* file, KrbSoundInfo* info) noexcept
+	{
+		Mp3Header header;
+		if (!Mp3::readHeader(file, &header)) return false;
+		Wav::setPcmFormat(info, header.channels, header.sampleRate, Mp3::getSamples(file, header));
+		return true;
+	}
+}
+
+bool KEN_EXTERNAL kr::krb_probe(KrbExtension extension, KrbFile* file, KrbProbeInfo* info)
+{
+	uint64_t start = file->tell();
+	CountingFile counting = { file, 0 };
+	KrbFile probeFile;
+	probeFile.vftable = &countingVftable;
+	probeFile.param = &counting;
+	finally {
+		info->bytesRead = counting.bytesRead;
+		file->seek_set(start);
+	};
+
+	info->image = KrbImageInfo();
+	switch (extension)
+	{
+	case KrbExtension::ImagePng:
+		info->kind = ProbeKindImage;
+		return Png::probe(&probeFile, &info->image);
+	case KrbExtension::ImageJpeg:
+	case KrbExtension::ImageJpg:
+		info->kind = ProbeKindImage;
+		return Jpeg::probe(&probeFile, &info->image);
+	case KrbExtension::ImageTga:
+		info->kind = ProbeKindImage;
+		return Tga::probe(&probeFile, &info->image);
+	case KrbExtension::ImageBmp:
+		info->kind = ProbeKindImage;
+		return Bmp::probe(&probeFile, &info->image);
+	case KrbExtension::ImageQoi:
+		info->kind = ProbeKindImage;
+		return Qoi::probe(&probeFile, &info->image);
+	case KrbExtension::SoundWav:
+		info->kind = ProbeKindSound;
+		return Wav::readHeader(&probeFile, &info->sound);
+	case KrbExtension::SoundOgg:
+		info->kind = ProbeKindSound;
+		return probeOgg(&probeFile, &info->sound);
+	case KrbExtension::SoundMp3:
+		info->kind = ProbeKindSound;
+		return probeMp3(&probeFile, &info->sound);
+	case KrbExtension::CompressZip:
+		info->kind = ProbeKindCompress;
+		return Zip::probe(&probeFile, &info->entries);
+	default:
+		return false;
+	}
+}
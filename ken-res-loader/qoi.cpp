@@ -0,0 +1,464 @@
+#include "qoi.h"
+#include "util.h"
+
+#include <string.h>
+#include <vector>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	constexpr uint8_t QOI_OP_INDEX = 0x00;
+	constexpr uint8_t QOI_OP_DIFF = 0x40;
+	constexpr uint8_t QOI_OP_LUMA = 0x80;
+	constexpr uint8_t QOI_OP_RUN = 0xc0;
+	constexpr uint8_t QOI_OP_RGB = 0xfe;
+	constexpr uint8_t QOI_OP_RGBA = 0xff;
+	constexpr uint8_t QOI_MASK_2 = 0xc0;
+
+	constexpr size_t QOI_HEADER_SIZE = 14;
+	constexpr size_t QOI_MAX_OP = 5; // QOI_OP_RGBA
+	constexpr size_t BUFFER_SIZE = 64 * 1024;
+	constexpr uint32_t MAX_PIXELS = 400000000; // the limit of the reference implementation
+
+	static const uint8_t QOI_PADDING[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+	struct Rgba
+	{
+		uint8_t r, g, b, a;
+	};
+
+	inline uint32_t hash(const Rgba& px) noexcept
+	{
+		return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) & 63;
+	}
+	inline bool operator ==(const Rgba& a, const Rgba& b) noexcept
+	{
+		return memcmp(&a, &b, sizeof(Rgba)) == 0;
+	}
+
+	inline uint32_t getBE32(const uint8_t* src) noexcept
+	{
+		return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+	}
+	inline void putBE32(uint8_t* dest, uint32_t value) noexcept
+	{
+		dest[0] = (uint8_t)(value >> 24);
+		dest[1] = (uint8_t)(value >> 16);
+		dest[2] = (uint8_t)(value >> 8);
+		dest[3] = (uint8_t)value;
+	}
+
+	// channel offsets of the pixel, A < 0 means no alpha, X is filled with 0xff
+	template <int R, int G, int B, int A, size_t SIZE>
+	struct QoiPixelLayout
+	{
+		static constexpr size_t size = SIZE;
+
+		static void write(uint8_t* dest, const Rgba& px) noexcept
+		{
+			dest[R] = px.r;
+			dest[G] = px.g;
+			dest[B] = px.b;
+			if (A >= 0) dest[A < 0 ? 0 : A] = px.a;
+			else if (SIZE == 4) dest[3] = 0xff;
+		}
+		static Rgba read(const uint8_t* src) noexcept
+		{
+			return { src[R], src[G], src[B], A >= 0 ? src[A < 0 ? 0 : A] : (uint8_t)0xff };
+		}
+	};
+
+	using LayoutRGB8 = QoiPixelLayout<2, 1, 0, -1, 3>;
+	using LayoutXRGB8 = QoiPixelLayout<2, 1, 0, -1, 4>;
+	using LayoutARGB8 = QoiPixelLayout<2, 1, 0, 3, 4>;
+	using LayoutBGR8 = QoiPixelLayout<0, 1, 2, -1, 3>;
+	using LayoutXBGR8 = QoiPixelLayout<0, 1, 2, -1, 4>;
+	using LayoutABGR8 = QoiPixelLayout<0, 1, 2, 3, 4>;
+
+	class QoiDecoder
+	{
+	public:
+		QoiDecoder(KrbFile* file) noexcept
+			:m_file(file), m_buffer(BUFFER_SIZE), m_pos(0), m_end(0), m_run(0)
+		{
+			memset(m_index, 0, sizeof(m_index));
+			m_px = { 0, 0, 0, 255 };
+		}
+
+		bool readHeader(uint32_t* width, uint32_t* height, uint32_t* channels) noexcept
+		{
+			refill();
+			if (m_end - m_pos < QOI_HEADER_SIZE) return false;
+			const uint8_t* header = m_buffer.data() + m_pos;
+			if (memcmp(header, "qoif", 4) != 0) return false;
+			*width = getBE32(header + 4);
+			*height = getBE32(header + 8);
+			*channels = header[12];
+			m_pos += QOI_HEADER_SIZE;
+			if (*width == 0 || *height == 0 || *height > MAX_PIXELS / *width) return false;
+			return *channels == 3 || *channels == 4;
+		}
+
+		// the pixel state continues over the rows
+		template <typename Layout>
+		bool decodeRow(uint8_t* dest, uint32_t width) noexcept
+		{
+			// the state is kept in the locals, the stores to dest could alias the members
+			uint8_t* end = dest + width * Layout::size;
+			Rgba px = m_px;
+			uint32_t run = m_run;
+			size_t pos = m_pos;
+			bool ok = true;
+			while (dest != end)
+			{
+				if (run != 0)
+				{
+					// the run may continue from the previous row
+					uint32_t count = (uint32_t)((end - dest) / Layout::size);
+					if (count > run) count = run;
+					run -= count;
+					for (uint32_t i = 0; i < count; i++, dest += Layout::size) Layout::write(dest, px);
+					continue;
+				}
+
+				if (m_end - pos < QOI_MAX_OP)
+				{
+					m_pos = pos;
+					refill();
+					pos = m_pos;
+					if (pos == m_end)
+					{
+						ok = false;
+						break;
+					}
+				}
+				const uint8_t* src = m_buffer.data() + pos;
+				uint8_t op = src[0];
+				if (op == QOI_OP_RGB)
+				{
+					px.r = src[1];
+					px.g = src[2];
+					px.b = src[3];
+					pos += 4;
+				}
+				else if (op == QOI_OP_RGBA)
+				{
+					px.r = src[1];
+					px.g = src[2];
+					px.b = src[3];
+					px.a = src[4];
+					pos += 5;
+				}
+				else
+				{
+					switch (op & QOI_MASK_2)
+					{
+					case QOI_OP_INDEX:
+						px = m_index[op];
+						pos++;
+						Layout::write(dest, px);
+						dest += Layout::size;
+						continue; // already in the index
+					case QOI_OP_DIFF:
+						px.r += ((op >> 4) & 3) - 2;
+						px.g += ((op >> 2) & 3) - 2;
+						px.b += (op & 3) - 2;
+						pos++;
+						break;
+					case QOI_OP_LUMA:
+					{
+						int dg = (op & 0x3f) - 32;
+						px.r += dg - 8 + ((src[1] >> 4) & 0x0f);
+						px.g += dg;
+						px.b += dg - 8 + (src[1] & 0x0f);
+						pos += 2;
+						break;
+					}
+					default: // QOI_OP_RUN
+						run = op & 0x3f; // the rest of the run
+						pos++;
+						break;
+					}
+				}
+				// the ops past the end of the input read zeros, refill() checks the bounds
+				if (pos > m_end)
+				{
+					ok = false;
+					break;
+				}
+				m_index[hash(px)] = px;
+				Layout::write(dest, px);
+				dest += Layout::size;
+			}
+			m_px = px;
+			m_run = run;
+			m_pos = pos;
+			return ok;
+		}
+
+	private:
+		// keeps QOI_MAX_OP bytes readable after the data, the padding is zeros
+		void refill() noexcept
+		{
+			size_t left = m_end - m_pos;
+			memmove(m_buffer.data(), m_buffer.data() + m_pos, left);
+			m_pos = 0;
+			m_end = left + m_file->read(m_buffer.data() + left, BUFFER_SIZE - QOI_MAX_OP - left);
+			memset(m_buffer.data() + m_end, 0, QOI_MAX_OP);
+		}
+
+		KrbFile* const m_file;
+		std::vector<uint8_t> m_buffer;
+		size_t m_pos;
+		size_t m_end;
+		uint32_t m_run;
+		Rgba m_px;
+		Rgba m_index[64];
+	};
+
+	template <typename Layout>
+	bool decodeImage(QoiDecoder& decoder, KrbImageCallback* callback, uint8_t* buffer, const KrbImageInfo& info, bool rowByRow) noexcept
+	{
+		for (uint32_t y = 0; y < info.height; y++)
+		{
+			uint8_t* dest = rowByRow ? callback->row(callback, y) : buffer + (size_t)info.pitchBytes * y;
+			if (!dest) return false;
+			if (!decoder.decodeRow<Layout>(dest, info.width)) return false;
+		}
+		return true;
+	}
+
+	class QoiEncoder
+	{
+	public:
+		QoiEncoder(KrbFile* file) noexcept
+			:m_file(file), m_buffer(BUFFER_SIZE), m_pos(0), m_run(0)
+		{
+			memset(m_index, 0, sizeof(m_index));
+			m_prev = { 0, 0, 0, 255 };
+		}
+
+		void writeHeader(uint32_t width, uint32_t height, uint8_t channels) noexcept
+		{
+			uint8_t* dest = m_buffer.data();
+			memcpy(dest, "qoif", 4);
+			putBE32(dest + 4, width);
+			putBE32(dest + 8, height);
+			dest[12] = channels;
+			dest[13] = 0; // sRGB with linear alpha
+			m_pos = QOI_HEADER_SIZE;
+		}
+
+		template <typename Layout>
+		void encodeRow(const uint8_t* src, uint32_t width) noexcept
+		{
+			// the state is kept in the locals, the stores to the buffer could alias the members
+			const uint8_t* end = src + width * Layout::size;
+			Rgba prev = m_prev;
+			uint32_t run = m_run;
+			uint8_t* dest = m_buffer.data() + m_pos;
+			uint8_t* const limit = m_buffer.data() + BUFFER_SIZE - QOI_MAX_OP - 1; // an op and a run
+			for (; src != end; src += Layout::size)
+			{
+				// before every pixel, a run of 62 writes its op and skips the rest of the loop
+				if (dest >= limit)
+				{
+					m_pos = dest - m_buffer.data();
+					flush();
+					dest = m_buffer.data();
+				}
+				Rgba px = Layout::read(src);
+				if (px == prev)
+				{
+					if (++run == 62)
+					{
+						*dest++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+						run = 0;
+					}
+					continue;
+				}
+				if (run != 0)
+				{
+					*dest++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+					run = 0;
+				}
+
+				uint32_t h = hash(px);
+				if (m_index[h] == px)
+				{
+					*dest++ = (uint8_t)(QOI_OP_INDEX | h);
+				}
+				else
+				{
+					m_index[h] = px;
+					if (px.a == prev.a)
+					{
+						int8_t dr = (int8_t)(px.r - prev.r);
+						int8_t dg = (int8_t)(px.g - prev.g);
+						int8_t db = (int8_t)(px.b - prev.b);
+						int8_t drg = (int8_t)(dr - dg);
+						int8_t dbg = (int8_t)(db - dg);
+						if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+						{
+							*dest++ = (uint8_t)(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+						}
+						else if (drg >= -8 && drg <= 7 && dg >= -32 && dg <= 31 && dbg >= -8 && dbg <= 7)
+						{
+							dest[0] = (uint8_t)(QOI_OP_LUMA | (dg + 32));
+							dest[1] = (uint8_t)((drg + 8) << 4 | (dbg + 8));
+							dest += 2;
+						}
+						else
+						{
+							dest[0] = QOI_OP_RGB;
+							dest[1] = px.r;
+							dest[2] = px.g;
+							dest[3] = px.b;
+							dest += 4;
+						}
+					}
+					else
+					{
+						dest[0] = QOI_OP_RGBA;
+						dest[1] = px.r;
+						dest[2] = px.g;
+						dest[3] = px.b;
+						dest[4] = px.a;
+						dest += 5;
+					}
+				}
+				prev = px;
+			}
+			m_prev = prev;
+			m_run = run;
+			m_pos = dest - m_buffer.data();
+		}
+
+		void finish() noexcept
+		{
+			if (m_run != 0)
+			{
+				m_buffer[m_pos++] = (uint8_t)(QOI_OP_RUN | (m_run - 1));
+				m_run = 0;
+			}
+			if (BUFFER_SIZE - m_pos < sizeof(QOI_PADDING)) flush();
+			memcpy(m_buffer.data() + m_pos, QOI_PADDING, sizeof(QOI_PADDING));
+			m_pos += sizeof(QOI_PADDING);
+			flush();
+		}
+
+	private:
+		void flush() noexcept
+		{
+			m_file->write(m_buffer.data(), m_pos);
+			m_pos = 0;
+		}
+
+		KrbFile* const m_file;
+		std::vector<uint8_t> m_buffer;
+		size_t m_pos;
+		uint32_t m_run;
+		Rgba m_prev;
+		Rgba m_index[64];
+	};
+
+	template <typename Layout>
+	void encodeImage(QoiEncoder& encoder, const KrbImageSaveInfo* info) noexcept
+	{
+		const uint8_t* src = (const uint8_t*)info->data;
+		for (uint32_t y = 0; y < info->height; y++, src += info->pitchBytes)
+		{
+			encoder.encodeRow<Layout>(src, info->width);
+		}
+	}
+}
+
+bool Qoi::load(KrbImageCallback* callback, KrbFile* file) noexcept
+{
+	try
+	{
+		QoiDecoder decoder(file);
+		uint32_t width, height, channels;
+		if (!decoder.readHeader(&width, &height, &channels)) return false;
+
+		KrbImageInfo info;
+		info.width = width;
+		info.height = height;
+		switch (callback->requestFormat)
+		{
+		case PixelFormatRGB8: case PixelFormatXRGB8: case PixelFormatARGB8:
+		case PixelFormatBGR8: case PixelFormatXBGR8: case PixelFormatABGR8:
+			info.pixelformat = callback->requestFormat;
+			break;
+		default:
+			info.pixelformat = channels == 4 ? PixelFormatARGB8 : PixelFormatRGB8;
+			break;
+		}
+		bool packed = info.pixelformat == PixelFormatRGB8 || info.pixelformat == PixelFormatBGR8;
+		info.pitchBytes = width * (packed ? 3 : 4);
+		info.rowByRow = callback->row != nullptr;
+		bool rowByRow = info.rowByRow;
+
+		uint8_t* buffer = (uint8_t*)callback->start(callback, &info);
+		if (!buffer) return false;
+
+		switch (info.pixelformat)
+		{
+		case PixelFormatRGB8: return decodeImage<LayoutRGB8>(decoder, callback, buffer, info, rowByRow);
+		case PixelFormatXRGB8: return decodeImage<LayoutXRGB8>(decoder, callback, buffer, info, rowByRow);
+		case PixelFormatARGB8: return decodeImage<LayoutARGB8>(decoder, callback, buffer, info, rowByRow);
+		case PixelFormatBGR8: return decodeImage<LayoutBGR8>(decoder, callback, buffer, info, rowByRow);
+		case PixelFormatXBGR8: return decodeImage<LayoutXBGR8>(decoder, callback, buffer, info, rowByRow);
+		default: return decodeImage<LayoutABGR8>(decoder, callback, buffer, info, rowByRow);
+		}
+	}
+	catch (...)
+	{
+		return false;
+	}
+}
+bool Qoi::probe(KrbFile* file, KrbImageInfo* info) noexcept
+{
+	uint8_t header[QOI_HEADER_SIZE];
+	if (file->read(header, sizeof(header)) != sizeof(header)) return false;
+	if (memcmp(header, "qoif", 4) != 0) return false;
+	info->width = getBE32(header + 4);
+	info->height = getBE32(header + 8);
+	uint32_t channels = header[12];
+	if (info->width == 0 || info->height == 0 || info->height > MAX_PIXELS / info->width) return false;
+	if (channels != 3 && channels != 4) return false;
+	info->pixelformat = channels == 4 ? PixelFormatARGB8 : PixelFormatRGB8;
+	info->pitchBytes = info->width * channels;
+	return true;
+}
+bool Qoi::save(const KrbImageSaveInfo* info, KrbFile* file) noexcept
+{
+	if (info->width == 0 || info->height == 0 || info->height > MAX_PIXELS / info->width) return false;
+	try
+	{
+		void (*encode)(QoiEncoder& encoder, const KrbImageSaveInfo* info);
+		switch (info->pixelformat)
+		{
+		case PixelFormatRGB8: encode = encodeImage<LayoutRGB8>; break;
+		case PixelFormatXRGB8: encode = encodeImage<LayoutXRGB8>; break;
+		case PixelFormatARGB8: encode = encodeImage<LayoutARGB8>; break;
+		case PixelFormatBGR8: encode = encodeImage<LayoutBGR8>; break;
+		case PixelFormatXBGR8: encode = encodeImage<LayoutXBGR8>; break;
+		case PixelFormatABGR8: encode = encodeImage<LayoutABGR8>; break;
+		default: return false;
+		}
+
+		QoiEncoder encoder(file);
+		bool alpha = info->pixelformat == PixelFormatARGB8 || info->pixelformat == PixelFormatABGR8;
+		encoder.writeHeader(info->width, info->height, alpha ? 4 : 3);
+		encode(encoder, info);
+		encoder.finish();
+		return true;
+	}
+	catch (...)
+	{
+		return false;
+	}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "include/common.h"
+#include "include/image.h"
+
+namespace kr
+{
+	namespace backend
+	{
+		class Qoi
+		{
+		public:
+			static bool load(KrbImageCallback* callback, KrbFile* file) noexcept;
+			// the header only, the file is left anywhere
+			static bool probe(KrbFile* file, KrbImageInfo* info) noexcept;
+			static bool save(const KrbImageSaveInfo* info, KrbFile* file) noexcept;
+		};
+	}
+}
@@ -0,0 +1,398 @@
+#include "resample.h"
+#include "simd.h"
+
+#include <math.h>
+#include <memory.h>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	constexpr float PI = 3.14159265358979f;
+	constexpr float KAISER_ALPHA = 4.f;
+	constexpr uint32_t SRGB_STEPS = 8192;
+
+	struct SrgbTable
+	{
+		float toLinear[256];
+		uint8_t fromLinear[SRGB_STEPS + 1];
+
+		SrgbTable() noexcept
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				float c = i / 255.f;
+				toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			}
+			for (uint32_t i = 0; i <= SRGB_STEPS; i++)
+			{
+				float l = (float)i / SRGB_STEPS;
+				float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.f / 2.4f) - 0.055f;
+				fromLinear[i] = (uint8_t)(c * 255.f + 0.5f);
+			}
+		}
+	};
+
+	const SrgbTable& srgbTable() noexcept
+	{
+		static const SrgbTable table;
+		return table;
+	}
+
+	inline float sinc(float x) noexcept
+	{
+		if (x == 0.f) return 1.f;
+		x *= PI;
+		return sinf(x) / x;
+	}
+
+	// modified bessel function of the first kind, order 0
+	float bessel0(float x) noexcept
+	{
+		float sum = 1.f;
+		float term = 1.f;
+		float half = x * 0.5f;
+		for (int k = 1; k < 32; k++)
+		{
+			term *= (half / k) * (half / k);
+			sum += term;
+			if (term < sum * 1e-7f) break;
+		}
+		return sum;
+	}
+
+	// in destination pixels
+	float getRadius(kr_imagefilter_t filter) noexcept
+	{
+		switch (filter)
+		{
+		case ImageFilterBicubic: return 2.f;
+		case ImageFilterKaiser: return 3.f;
+		case ImageFilterLanczos: return 3.f;
+		default: return 0.5f;
+		}
+	}
+
+	float kernel(kr_imagefilter_t filter, float x) noexcept
+	{
+		x = fabsf(x);
+		float radius = getRadius(filter);
+		if (x >= radius) return 0.f;
+		switch (filter)
+		{
+		case ImageFilterBicubic:
+			// catmull-rom
+			if (x < 1.f) return (1.5f * x - 2.5f) * x * x + 1.f;
+			return ((-0.5f * x + 2.5f) * x - 4.f) * x + 2.f;
+		case ImageFilterKaiser:
+		{
+			float t = x / radius;
+			return sinc(x) * bessel0(KAISER_ALPHA * sqrtf(1.f - t * t)) / bessel0(KAISER_ALPHA);
+		}
+		case ImageFilterLanczos:
+			return sinc(x) * sinc(x / radius);
+		default:
+			return 1.f;
+		}
+	}
+}
+
+bool ResampleFormat::get(kr_pixelformat_t pixelformat, ResampleFormat* format) noexcept
+{
+	switch (pixelformat)
+	{
+	case PixelFormatA8: *format = { 1, 1, false, false }; return true;
+	case PixelFormatRGB8: case PixelFormatBGR8: *format = { 3, 3, false, false }; return true;
+	case PixelFormatXRGB8: case PixelFormatXBGR8: *format = { 4, 4, false, false }; return true;
+	case PixelFormatARGB8: case PixelFormatABGR8: *format = { 4, 4, true, false }; return true;
+	case PixelFormatRGBA32F: *format = { 16, 4, true, true }; return true;
+	default: return false;
+	}
+}
+
+uint32_t kr::backend::buildResampleTaps(std::vector<ResampleTap>& taps, kr_imagefilter_t filter, uint32_t src, uint32_t dest) noexcept(false)
+{
+	if (filter == ImageFilterBox && (dest == src / 2 || (src == 1 && dest == 1)))
+	{
+		taps.resize((size_t)dest * 2);
+		for (uint32_t i = 0; i < dest; i++)
+		{
+			taps[i * 2] = { 2 * i < src ? 2 * i : src - 1, 0.5f };
+			taps[i * 2 + 1] = { 2 * i + 1 < src ? 2 * i + 1 : src - 1, 0.5f };
+		}
+		return 2;
+	}
+
+	// the kernel is stretched for the reduction, not for the magnification
+	float scale = (float)src / dest;
+	float stretch = scale > 1.f ? scale : 1.f;
+	float support = getRadius(filter) * stretch;
+	uint32_t count = (uint32_t)ceilf(support) * 2 + 1;
+	taps.resize((size_t)dest * count);
+	for (uint32_t i = 0; i < dest; i++)
+	{
+		ResampleTap* tap = &taps[(size_t)i * count];
+		float center = (i + 0.5f) * scale;
+		int first = (int)floorf(center - support);
+		float sum = 0.f;
+		for (uint32_t k = 0; k < count; k++)
+		{
+			int j = first + (int)k;
+			float weight = kernel(filter, (j + 0.5f - center) / stretch);
+			if (j < 0) j = 0;
+			else if (j >= (int)src) j = (int)src - 1;
+			tap[k] = { (uint32_t)j, weight };
+			sum += weight;
+		}
+		if (sum == 0.f)
+		{
+			// the box between the pixel centers
+			tap[0] = { tap[count / 2].index, 1.f };
+			for (uint32_t k = 1; k < count; k++) tap[k] = { tap[0].index, 0.f };
+			continue;
+		}
+		for (uint32_t k = 0; k < count; k++)
+		{
+			tap[k].weight /= sum;
+		}
+	}
+	return count;
+}
+
+RowConverter::RowConverter(const ResampleFormat& format, uint32_t flags) noexcept
+	:m_format(format)
+{
+	m_srgb = (flags & ImageFlagFilterSrgb) && !format.isFloat && format.channels >= 3;
+	m_alphaWeighted = (flags & ImageFlagFilterAlphaWeighted) && format.alpha;
+	if (m_srgb) srgbTable();
+}
+void RowConverter::load(float* dest, const uint8_t* src, uint32_t width) const noexcept
+{
+	uint32_t x = 0;
+#ifdef KRB_SSE2
+	if (m_format.size == 4 && !m_srgb && !m_format.isFloat)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128 scale = _mm_set1_ps(1.f / 255.f);
+		const __m128 colorMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+		const __m128 alphaOne = _mm_set_ps(1.f, 0.f, 0.f, 0.f);
+		for (; x + 4 <= width; x += 4)
+		{
+			__m128i bytes = _mm_loadu_si128((const __m128i*)(src + x * 4));
+			__m128i lo = _mm_unpacklo_epi8(bytes, zero);
+			__m128i hi = _mm_unpackhi_epi8(bytes, zero);
+			__m128 pixels[4] = {
+				_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale),
+				_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale),
+				_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale),
+				_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale),
+			};
+			for (int i = 0; i < 4; i++)
+			{
+				__m128 pixel = pixels[i];
+				if (m_alphaWeighted)
+				{
+					// [a a a 1]
+					__m128 alpha = _mm_shuffle_ps(pixel, pixel, _MM_SHUFFLE(3, 3, 3, 3));
+					pixel = _mm_mul_ps(pixel, _mm_or_ps(_mm_and_ps(alpha, colorMask), alphaOne));
+				}
+				_mm_storeu_ps(dest + (x + i) * 4, pixel);
+			}
+		}
+	}
+#endif
+	const SrgbTable& table = srgbTable();
+	for (; x < width; x++)
+	{
+		float* out = dest + x * 4;
+		if (m_format.isFloat)
+		{
+			memcpy(out, src + x * 16, 16);
+		}
+		else
+		{
+			const uint8_t* in = src + x * m_format.size;
+			out[1] = out[2] = 0.f;
+			out[3] = 1.f;
+			for (uint32_t c = 0; c < m_format.channels; c++)
+			{
+				out[c] = m_srgb && c < 3 ? table.toLinear[in[c]] : in[c] * (1.f / 255.f);
+			}
+		}
+		if (m_alphaWeighted)
+		{
+			out[0] *= out[3];
+			out[1] *= out[3];
+			out[2] *= out[3];
+		}
+	}
+}
+void RowConverter::store(uint8_t* dest, float* src, uint32_t width) const noexcept
+{
+	const SrgbTable& table = srgbTable();
+	for (uint32_t x = 0; x < width; x++)
+	{
+		float* in = src + x * 4;
+		if (m_alphaWeighted && in[3] > 0.f)
+		{
+			float inverse = 1.f / in[3];
+			in[0] *= inverse;
+			in[1] *= inverse;
+			in[2] *= inverse;
+		}
+		if (m_format.isFloat)
+		{
+			memcpy(dest + x * 16, in, 16);
+			continue;
+		}
+
+		uint8_t* out = dest + x * m_format.size;
+		for (uint32_t c = 0; c < m_format.channels; c++)
+		{
+			// the sinc filters overshoot
+			float v = in[c];
+			if (v < 0.f) v = 0.f;
+			else if (v > 1.f) v = 1.f;
+			out[c] = m_srgb && c < 3 ? table.fromLinear[(uint32_t)(v * SRGB_STEPS + 0.5f)] : (uint8_t)(v * 255.f + 0.5f);
+		}
+	}
+}
+
+void kr::backend::resampleRow(float* dest, const float* src, const ResampleTap* taps, uint32_t tapCount, uint32_t width) noexcept
+{
+	for (uint32_t x = 0; x < width; x++, taps += tapCount)
+	{
+#ifdef KRB_SSE2
+		__m128 sum = _mm_setzero_ps();
+		for (uint32_t k = 0; k < tapCount; k++)
+		{
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(src + taps[k].index * 4), _mm_set1_ps(taps[k].weight)));
+		}
+		_mm_storeu_ps(dest + x * 4, sum);
+#else
+		float sum[4] = { 0.f, 0.f, 0.f, 0.f };
+		for (uint32_t k = 0; k < tapCount; k++)
+		{
+			const float* in = src + taps[k].index * 4;
+			for (int c = 0; c < 4; c++) sum[c] += in[c] * taps[k].weight;
+		}
+		memcpy(dest + x * 4, sum, sizeof(sum));
+#endif
+	}
+}
+void kr::backend::combineRows(float* dest, const float* const* rows, const ResampleTap* taps, uint32_t tapCount, size_t count) noexcept
+{
+	size_t i = 0;
+#ifdef KRB_AVX2
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 sum = _mm256_setzero_ps();
+		for (uint32_t k = 0; k < tapCount; k++)
+		{
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[k] + i), _mm256_set1_ps(taps[k].weight)));
+		}
+		_mm256_storeu_ps(dest + i, sum);
+	}
+#endif
+#ifdef KRB_SSE2
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 sum = _mm_setzero_ps();
+		for (uint32_t k = 0; k < tapCount; k++)
+		{
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i), _mm_set1_ps(taps[k].weight)));
+		}
+		_mm_storeu_ps(dest + i, sum);
+	}
+#endif
+	for (; i < count; i++)
+	{
+		float sum = 0.f;
+		for (uint32_t k = 0; k < tapCount; k++)
+		{
+			sum += rows[k][i] * taps[k].weight;
+		}
+		dest[i] = sum;
+	}
+}
+
+Resampler::Resampler(const ResampleFormat& format, uint32_t flags) noexcept
+	:m_converter(format, flags)
+{
+}
+bool Resampler::init(uint32_t srcWidth, uint32_t srcHeight, uint32_t destWidth, uint32_t destHeight,
+	kr_imagefilter_t filter, uint8_t* dest, size_t destPitch) noexcept
+{
+	m_srcWidth = srcWidth;
+	m_srcHeight = srcHeight;
+	m_destWidth = destWidth;
+	m_destHeight = destHeight;
+	m_dest = dest;
+	m_destPitch = destPitch;
+	m_srcY = 0;
+	m_destY = 0;
+	try
+	{
+		m_xCount = buildResampleTaps(m_xTaps, filter, srcWidth, destWidth);
+		m_yCount = buildResampleTaps(m_yTaps, filter, srcHeight, destHeight);
+
+		// the rows between the first and the last tap stay in the ring
+		m_ringSize = 1;
+		for (uint32_t y = 0; y < destHeight; y++)
+		{
+			const ResampleTap* taps = &m_yTaps[(size_t)y * m_yCount];
+			uint32_t window = taps[m_yCount - 1].index - taps[0].index + 1;
+			if (window > m_ringSize) m_ringSize = window;
+		}
+		m_line.resize((size_t)srcWidth * 4);
+		m_ring.resize((size_t)m_ringSize * destWidth * 4);
+		m_out.resize((size_t)destWidth * 4);
+		m_rows.resize(m_yCount);
+	}
+	catch (...)
+	{
+		return false;
+	}
+	return true;
+}
+bool Resampler::push(const uint8_t* row) noexcept
+{
+	if (m_srcY >= m_srcHeight) return false;
+	m_converter.load(m_line.data(), row, m_srcWidth);
+	resampleRow(ringRow(m_srcY), m_line.data(), m_xTaps.data(), m_xCount, m_destWidth);
+	m_srcY++;
+
+	// the tap indices increase, the last one is the lowest row
+	while (m_destY < m_destHeight)
+	{
+		const ResampleTap* taps = &m_yTaps[(size_t)m_destY * m_yCount];
+		if (taps[m_yCount - 1].index >= m_srcY) break;
+		for (uint32_t k = 0; k < m_yCount; k++)
+		{
+			m_rows[k] = ringRow(taps[k].index);
+		}
+		combineRows(m_out.data(), m_rows.data(), taps, m_yCount, m_out.size());
+		m_converter.store(m_dest + m_destPitch * m_destY, m_out.data(), m_destWidth);
+		m_destY++;
+	}
+	return true;
+}
+void Resampler::getTargetSize(uint32_t srcWidth, uint32_t srcHeight, uint32_t* width, uint32_t* height) noexcept
+{
+	if (*width == 0 && *height == 0)
+	{
+		*width = srcWidth;
+		*height = srcHeight;
+	}
+	else if (*width == 0)
+	{
+		*width = (uint32_t)(((uint64_t)srcWidth * *height + srcHeight / 2) / srcHeight);
+		if (*width == 0) *width = 1;
+	}
+	else if (*height == 0)
+	{
+		*height = (uint32_t)(((uint64_t)srcHeight * *width + srcWidth / 2) / srcWidth);
+		if (*height == 0) *height = 1;
+	}
+}
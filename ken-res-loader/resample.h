@@ -0,0 +1,111 @@
+#pragma once
+
+#include "include/image.h"
+
+#include <vector>
+
+namespace kr
+{
+	namespace backend
+	{
+		// the formats the filters can work on
+		struct ResampleFormat
+		{
+			uint32_t size; // bytes per pixel
+			uint32_t channels;
+			bool alpha; // the last channel is alpha
+			bool isFloat;
+
+			static bool get(kr_pixelformat_t pixelformat, ResampleFormat* format) noexcept;
+		};
+
+		struct ResampleTap
+		{
+			uint32_t index;
+			float weight;
+		};
+
+		// returns the tap count per destination pixel
+		// the box filter halving a size takes the 2 pixels like the reduction of D3DX, the last one of odd sizes is dropped
+		uint32_t buildResampleTaps(std::vector<ResampleTap>& taps, kr_imagefilter_t filter, uint32_t src, uint32_t dest) noexcept(false);
+
+		// 8-bit and float pixels to 4 floats per pixel and back, flags are kr_imageflag_t
+		class RowConverter
+		{
+		public:
+			RowConverter(const ResampleFormat& format, uint32_t flags) noexcept;
+
+			// to linear and alpha-weighted if requested
+			void load(float* dest, const uint8_t* src, uint32_t width) const noexcept;
+			// src is modified
+			void store(uint8_t* dest, float* src, uint32_t width) const noexcept;
+
+			// the filtering can work on the 8-bit values directly
+			bool isPlain() const noexcept
+			{
+				return !m_srgb && !m_alphaWeighted && !m_format.isFloat;
+			}
+
+			const ResampleFormat& format() const noexcept
+			{
+				return m_format;
+			}
+
+		private:
+			ResampleFormat m_format;
+			bool m_srgb;
+			bool m_alphaWeighted;
+		};
+
+		// horizontal pass, 4 floats per pixel
+		void resampleRow(float* dest, const float* src, const ResampleTap* taps, uint32_t tapCount, uint32_t width) noexcept;
+		// vertical pass, dest = sum of rows[k] * taps[k].weight
+		void combineRows(float* dest, const float* const* rows, const ResampleTap* taps, uint32_t tapCount, size_t count) noexcept;
+
+		// streaming separable resampler, the source rows come in order from the top
+		// the destination rows are written as soon as their source rows are pushed
+		class Resampler
+		{
+		public:
+			Resampler(const ResampleFormat& format, uint32_t flags) noexcept;
+
+			bool init(uint32_t srcWidth, uint32_t srcHeight, uint32_t destWidth, uint32_t destHeight,
+				kr_imagefilter_t filter, uint8_t* dest, size_t destPitch) noexcept;
+			bool push(const uint8_t* row) noexcept;
+			bool isComplete() const noexcept
+			{
+				return m_destY == m_destHeight;
+			}
+
+			// the size with 0 replaced by the aspect ratio of the source
+			static void getTargetSize(uint32_t srcWidth, uint32_t srcHeight, uint32_t* width, uint32_t* height) noexcept;
+
+		private:
+			float* ringRow(uint32_t y) noexcept
+			{
+				return m_ring.data() + (size_t)(y % m_ringSize) * m_destWidth * 4;
+			}
+
+			RowConverter m_converter;
+			uint32_t m_srcWidth = 0;
+			uint32_t m_srcHeight = 0;
+			uint32_t m_destWidth = 0;
+			uint32_t m_destHeight = 0;
+			uint8_t* m_dest = nullptr;
+			size_t m_destPitch = 0;
+
+			std::vector<ResampleTap> m_xTaps;
+			std::vector<ResampleTap> m_yTaps;
+			uint32_t m_xCount = 0;
+			uint32_t m_yCount = 0;
+
+			std::vector<float> m_line;
+			std::vector<float> m_ring; // horizontally resampled rows
+			uint32_t m_ringSize = 0;
+			std::vector<float> m_out;
+			std::vector<const float*> m_rows;
+			uint32_t m_srcY = 0;
+			uint32_t m_destY = 0;
+		};
+	}
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// SSE2 is the baseline of x64, AVX2 is used only when the compiler targets it
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KRB_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(KRB_SSE2) && defined(__AVX2__)
+#define KRB_AVX2
+#include <immintrin.h>
+#endif
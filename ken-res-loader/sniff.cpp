@@ -0,0 +1,99 @@
+#include "include/common.h"
+#include "mp3.h"
+
+#include <string.h>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	constexpr size_t SNIFF_BYTES = 64; // the signatures and the TGA header are in it
+
+	const uint8_t PNG_SIGNATURE[] = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
+	const uint8_t KTX2_SIGNATURE[] = { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, 0x0d, 0x0a, 0x1a, 0x0a };
+	const uint8_t SEVENZIP_SIGNATURE[] = { '7', 'z', 0xbc, 0xaf, 0x27, 0x1c };
+
+	inline uint32_t getLE32(const uint8_t* data) noexcept
+	{
+		uint32_t v;
+		memcpy(&v, data, 4);
+		return v;
+	}
+
+	bool startsWith(const uint8_t* data, size_t size, const void* signature, size_t bytes) noexcept
+	{
+		return size >= bytes && memcmp(data, signature, bytes) == 0;
+	}
+
+	// the header sizes of OS/2 and the Windows versions
+	bool isBmp(const uint8_t* data, size_t size) noexcept
+	{
+		if (!startsWith(data, size, "BM", 2) || size < 18) return false;
+		switch (getLE32(data + 14))
+		{
+		case 12: case 40: case 52: case 56: case 64: case 108: case 124:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// the fields the loader accepts, the color map fields are not checked
+	bool isTga(const uint8_t* data, size_t size) noexcept
+	{
+		if (size < 18) return false;
+		uint8_t idSize = data[0];
+		uint8_t imageType = data[2];
+		uint16_t xStart = data[8] | (data[9] << 8);
+		uint16_t yStart = data[10] | (data[11] << 8);
+		uint16_t width = data[12] | (data[13] << 8);
+		uint16_t height = data[14] | (data[15] << 8);
+		uint8_t bits = data[16];
+		uint8_t descriptor = data[17];
+		switch (imageType)
+		{
+		case 1: case 2: case 9: case 10:
+			break;
+		default:
+			return false;
+		}
+		if (idSize != 0 || xStart != 0 || yStart != 0) return false;
+		if (bits != 8 && bits != 16 && bits != 24 && bits != 32) return false;
+		return width != 0 && height != 0 && (descriptor & 0xc0) == 0;
+	}
+
+	KrbExtension sniffOgg(const uint8_t* data, size_t size) noexcept
+	{
+		// the first packet starts after the 27 bytes and the segment table of the first page
+		if (size < 27) return KrbExtension::Invalid;
+		size_t packet = 27 + (size_t)data[26];
+		if (packet > size) return KrbExtension::Invalid;
+		if (startsWith(data + packet, size - packet, "\x01vorbis", 7)) return KrbExtension::SoundOgg;
+		if (startsWith(data + packet, size - packet, "OpusHead", 8)) return KrbExtension::SoundOpus;
+		return KrbExtension::Invalid;
+	}
+}
+
+KrbExtension KEN_EXTERNAL kr::krb_sniff(KrbFile* file)
+{
+	uint8_t data[SNIFF_BYTES];
+	uint64_t start = file->tell();
+	size_t size = file->read(data, sizeof(data));
+	file->seek_set(start);
+
+	if (startsWith(data, size, PNG_SIGNATURE, sizeof(PNG_SIGNATURE))) return KrbExtension::ImagePng;
+	if (startsWith(data, size, "\xff\xd8\xff", 3)) return KrbExtension::ImageJpeg;
+	if (startsWith(data, size, "qoif", 4)) return KrbExtension::ImageQoi;
+	if (startsWith(data, size, "DDS ", 4)) return KrbExtension::ImageDds;
+	if (startsWith(data, size, KTX2_SIGNATURE, sizeof(KTX2_SIGNATURE))) return KrbExtension::ImageKtx2;
+	if (isBmp(data, size)) return KrbExtension::ImageBmp;
+	if (size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WAVE", 4) == 0) return KrbExtension::SoundWav;
+	if (startsWith(data, size, "OggS", 4)) return sniffOgg(data, size);
+	if (startsWith(data, size, "PK\x03\x04", 4) || startsWith(data, size, "PK\x05\x06", 4)) return KrbExtension::CompressZip;
+	if (startsWith(data, size, SEVENZIP_SIGNATURE, sizeof(SEVENZIP_SIGNATURE))) return KrbExtension::Compress7z;
+	if (startsWith(data, size, "ID3", 3)) return KrbExtension::SoundMp3;
+	if (size >= 4 && Mp3::isFrameHeader(((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3])) return KrbExtension::SoundMp3;
+	if (isTga(data, size)) return KrbExtension::ImageTga;
+	return KrbExtension::Invalid;
+}
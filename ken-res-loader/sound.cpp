@@ -1,32 +1,24 @@
 #include "include/sound.h"
+#include "soundstream.h"
+#include "mp3.h"
+#include "wav.h"
 #include <limits.h>
 
-#include <vorbis/codec.h>
-#include <vorbis/vorbisfile.h>
-#include "openmp3/openmp3.h"
-#include "readstream.h"
+#include "vorbis_link.h"
 #include "util.h"
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <math.h>
 #include <assert.h>
-
-#include "libloader.h"
-KRL_BEGIN(LibVorbis, L"libvorbisd.dll", L"libvorbis.dll")
-KRL_END()
-
-KRL_BEGIN(LibVorbisFile, L"libvorbisfiled.dll", L"libvorbisfile.dll")
-KRL_IMPORT(ov_time_total)
-KRL_IMPORT(ov_read)
-KRL_IMPORT(ov_info)
-KRL_IMPORT(ov_open_callbacks)
-KRL_IMPORT(ov_clear)
-KRL_END()
+#include <memory>
+#include <vector>
+#include <new>
 
 using namespace kr;
 
-constexpr uint16_t WAVE_FORMAT_TAG = 1;
+constexpr size_t MP3_CHUNK_FRAMES = 1152 * 64; // the frames past the estimate grow by it
+constexpr size_t MP3_FIRST_CHUNK_FRAMES = MP3_CHUNK_FRAMES * 16; // a wrong estimate does not allocate more
 
 namespace
 {
@@ -48,7 +40,7 @@ namespace
 
 		
 		KrbSoundInfo info;
-		info.format.formatTag = WAVE_FORMAT_TAG;
+		info.format.formatTag = kr::backend::WAVE_FORMAT_TAG;
 		info.format.channels = vi->channels;
 		info.format.bitsPerSample = 16;
 		info.format.blockAlign = info.format.channels * info.format.bitsPerSample / 8;
@@ -75,38 +67,85 @@ namespace
 		}
 		return true;
 	}
+	// one pass, the frames go to the buffer of start if the length is known and to the chunks otherwise
+	bool loadFromStream(KrbSoundCallback* callback, KrbSoundStream* stream) noexcept
+	{
+		KrbSoundInfo info = stream->info;
+		const size_t channels = info.format.channels;
+		const size_t blockAlign = info.format.blockAlign;
+		if (stream->exactLength)
+		{
+			short* dest = callback->start(callback, &info);
+			if (dest == nullptr) return false;
+			size_t frames = info.totalBytes / blockAlign;
+			size_t done = 0;
+			while (done < frames)
+			{
+				size_t read = stream->read(dest + done * channels, frames - done);
+				if (read == 0) break;
+				done += read;
+			}
+			memset(dest + done * channels, 0, (frames - done) * blockAlign);
+			return true;
+		}
+
+		// the first chunk takes the estimated length
+		std::vector<std::unique_ptr<short[]>> chunks;
+		std::vector<size_t> chunkFrames;
+		size_t total = 0;
+		size_t chunkSize = info.totalBytes / blockAlign + MP3_CHUNK_FRAMES;
+		if (chunkSize > MP3_FIRST_CHUNK_FRAMES) chunkSize = MP3_FIRST_CHUNK_FRAMES;
+		try
+		{
+			for (;;)
+			{
+				std::unique_ptr<short[]> owner(new(std::nothrow) short[chunkSize * channels]);
+				if (!owner) return false;
+				short* chunk = owner.get();
+				chunks.push_back(std::move(owner));
+				size_t done = 0;
+				while (done < chunkSize)
+				{
+					size_t read = stream->read(chunk + done * channels, chunkSize - done);
+					if (read == 0) break;
+					done += read;
+				}
+				chunkFrames.push_back(done);
+				total += done;
+				if (done < chunkSize) break;
+				chunkSize = MP3_CHUNK_FRAMES;
+			}
+		}
+		catch (...)
+		{
+			return false;
+		}
+
+		info.totalBytes = (uint32_t)(total * blockAlign);
+		info.duration = (double)total / info.format.samplesPerSec;
+		short* dest = callback->start(callback, &info);
+		if (dest == nullptr) return false;
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			memcpy(dest, chunks[i].get(), chunkFrames[i] * blockAlign);
+			dest += chunkFrames[i] * channels;
+		}
+		return true;
+	}
 }
 
 bool KEN_EXTERNAL kr::krb_load_sound(KrbExtension extension, KrbSoundCallback * callback, KrbFile* file)
 {
-	kr::backend::ReadStream is(file);
-
 	switch (extension)
 	{
 	case KrbExtension::SoundOpus:
-		break;
+		return false; // not supported yet
 	case KrbExtension::SoundOgg:
 	{
 		KRL_USING(LibVorbis, vorbis, false);
 		KRL_USING(LibVorbisFile, vorbisFile, false);
-		ov_callbacks callbacks = {
-			[](void* buffer, size_t elementSize, size_t elementCount, void* fp)->size_t {
-			return ((KrbFile*)fp)->read(buffer, elementSize * elementCount);
-		},
-			[](void* fp, ogg_int64_t offset, int whence)->int {
-				switch (whence)
-				{
-				case SEEK_SET: ((KrbFile*)fp)->seek_set(offset); break;
-				case SEEK_CUR: ((KrbFile*)fp)->seek_cur(offset); break;
-				case SEEK_END: ((KrbFile*)fp)->seek_end(offset); break;
-				}
-				return 0;
-			},
-			[](void* fp)->int { return 0; },
-			[](void* fp)->long { return (long)((KrbFile*)fp)->tell(); }
-		};
 		OggVorbis_File vf;
-		int res = vorbisFile->ov_open_callbacks((void*)file, &vf, nullptr, 0, callbacks);
+		int res = vorbisFile->ov_open_callbacks((void*)file, &vf, nullptr, 0, KRB_OV_CALLBACKS);
 		if (res < 0)
 		{
 			switch (res) ////ó
@@ -124,170 +163,19 @@ bool KEN_EXTERNAL kr::krb_load_sound(KrbExtension extension, KrbSoundCallback *
 		return ret;
 	}
 	case KrbExtension::SoundMp3:
-		try
-		{
-			uint64_t file_start_pos = file->tell();
-
-			OpenMP3::Library openmp3;
-			OpenMP3::Iterator itr(openmp3, file);
-
-			constexpr size_t SAMPLE_PER_FRAME = 1152;
-			OpenMP3::Frame frame;
-			bool mono = true;
-			uint32_t totalSampleCount = 0;
-			int maxSampleRate = 0;
-			OpenMP3::Result res;
-
-			{
-				bool first = false;
-				while (!(res = itr.GetNext(frame)))
-				{
-					if (!first)
-					{
-						first = true;
-						frame.SkipFirst();
-					}
-
-					totalSampleCount++;
-					if (mono&& frame.GetMode() != OpenMP3::kModeMono)
-					{
-						mono = false;
-					}
-					int sampleRate = frame.GetSampleRate();
-					if (sampleRate > maxSampleRate) maxSampleRate = sampleRate;
-				}
-				totalSampleCount *= SAMPLE_PER_FRAME;
-			}
-
-			file->seek_set(file_start_pos);
-
-
-			KrbSoundInfo info;
-			info.format.bitsPerSample = 16;
-			info.format.channels = mono ? 1 : 2;
-			info.format.samplesPerSec = maxSampleRate;
-			info.format.blockAlign = info.format.channels * info.format.bitsPerSample / 8;
-			info.duration = (double)totalSampleCount / maxSampleRate;
-			info.totalBytes = totalSampleCount * info.format.blockAlign;
-			short* dest = callback->start(callback, &info);
-
-			float readed[2][SAMPLE_PER_FRAME];
-			OpenMP3::Decoder decoder(openmp3);
-
-			if (mono)
-			{
-				bool first = false;
-				while (!(res = itr.GetNext(frame)))
-				{
-					if (!first)
-					{
-						first = true;
-						frame.SkipFirst();
-					}
-
-					int nsamples = decoder.ProcessFrame(frame, readed);
-					int sampleRate = frame.GetSampleRate();
-					if (sampleRate != maxSampleRate)
-					{
-						float* src = readed[0];
-						float* src_end = readed[0] + nsamples;
-						for (int i = 0; i < nsamples; i++)
-						{
-							int idx_v = i * sampleRate;
-							int idx = idx_v / maxSampleRate;
-							int idx_off = idx_v % maxSampleRate;
-
-							float res_f;
-							if (idx_off == 0)
-							{
-								res_f = src[idx];
-							}
-							else
-							{
-								float pos = (float)idx_off / maxSampleRate;
-								res_f = src[idx] * pos + src[idx + 1] * (1 - pos);
-							}
-							short sample = (short)lroundf(res_f * SHRT_MAX);
-							*dest++ = sample;
-							*dest++ = sample;
-						}
-					}
-					else
-					{
-						float* src = readed[0];
-						float* src_end = readed[0] + nsamples;
-						while (src != src_end)
-						{
-							*dest++ = (short)lroundf((*src++) * SHRT_MAX);
-						}
-					}
-				}
-			}
-			else
-			{
-				bool first = false;
-				while (!(res = itr.GetNext(frame)))
-				{
-					if (!first)
-					{
-						first = true;
-						frame.SkipFirst();
-					}
-
-					OpenMP3::UInt nsamples = decoder.ProcessFrame(frame, readed);
-					uint32_t rate = frame.GetSampleRate();
-					assert(rate == maxSampleRate);
-
-					float* src1 = readed[0];
-					float* src2 = readed[1];
-					float* src_end = readed[0] + nsamples;
-					if (frame.GetMode() == OpenMP3::kModeMono)
-					{
-						while (src1 != src_end)
-						{
-							*dest++ = (short)((*src1) * SHRT_MAX);
-							*dest++ = (short)((*src1++) * SHRT_MAX);
-						}
-					}
-					else
-					{
-						while (src1 != src_end)
-						{
-							*dest++ = (short)((*src1++) * SHRT_MAX);
-							*dest++ = (short)((*src2++) * SHRT_MAX);
-						}
-					}
-				}
-			}
-			return true;
-		}
-		catch (...)
-		{
-			return false;
-		}
+	{
+		std::unique_ptr<KrbSoundStream> stream(KrbSoundStream::open(extension, file));
+		if (!stream) return false;
+		return loadFromStream(callback, stream.get());
+	}
 	case KrbExtension::SoundWav:
 	{
-		if (!is.testSignature("RIFF"_sig)) return false;
-		uint32_t fullSize = is.read32();
-		if (!is.testSignature("WAVE"_sig)) return false;
-
-		uint32_t formatSize = is.findChunk("fmt "_sig);
-		if (formatSize == -1) return false;
-		if (formatSize < sizeof(KrbWaveFormat)) return false;
-
 		KrbSoundInfo info;
-		is.readStructure(&info.format, sizeof(info.format), formatSize);
-		if (info.format.formatTag != WAVE_FORMAT_TAG) return false;
-
-		uint32_t dataSize = is.findChunk("data"_sig);
-		if (dataSize == -1) return false;
-
-		info.totalBytes = dataSize;
-		info.duration = (double)dataSize / info.format.bytesPerSec;
+		if (!kr::backend::Wav::readHeader(file, &info)) return false;
 		short* buffer = callback->start(callback, &info);
 		if (buffer != nullptr)
 		{
-			file->read(buffer, dataSize);
+			file->read(buffer, info.totalBytes);
 		}
 		return true;
 	}
@@ -297,3 +185,47 @@ bool KEN_EXTERNAL kr::krb_load_sound(KrbExtension extension, KrbSoundCallback *
 	assert(!"Not supported yet");
 	return false;
 }
+bool KEN_EXTERNAL kr::krb_load_sound_auto(KrbSoundCallback* callback, KrbFile* file)
+{
+	return krb_load_sound(krb_sniff(file), callback, file);
+}
+KrbSoundStream* KEN_EXTERNAL kr::krb_sound_open(KrbExtension extension, KrbFile* file)
+{
+	return KrbSoundStream::open(extension, file);
+}
+const KrbSoundInfo* KEN_EXTERNAL kr::krb_sound_info(const KrbSoundStream* stream)
+{
+	return &stream->info;
+}
+size_t KEN_EXTERNAL kr::krb_sound_read(KrbSoundStream* stream, short* dest, size_t frames)
+{
+	return stream->read(dest, frames);
+}
+bool KEN_EXTERNAL kr::krb_sound_seek(KrbSoundStream* stream, uint64_t frame)
+{
+	return stream->seek(frame);
+}
+void KEN_EXTERNAL kr::krb_sound_close(KrbSoundStream* stream)
+{
+	delete stream;
+}
+KrbMp3Index* KEN_EXTERNAL kr::krb_mp3_index_build(KrbFile* file)
+{
+	return KrbMp3Index::build(file);
+}
+KrbMp3Index* KEN_EXTERNAL kr::krb_mp3_index_load(KrbFile* file)
+{
+	return KrbMp3Index::load(file);
+}
+bool KEN_EXTERNAL kr::krb_mp3_index_save(const KrbMp3Index* index, KrbFile* file)
+{
+	return index->save(file);
+}
+void KEN_EXTERNAL kr::krb_mp3_index_free(KrbMp3Index* index)
+{
+	delete index;
+}
+bool KEN_EXTERNAL kr::krb_sound_set_index(KrbSoundStream* stream, const KrbMp3Index* index)
+{
+	return stream->setIndex(index);
+}
@@ -0,0 +1,291 @@
+#include "soundstream.h"
+#include "vorbis_link.h"
+#include "openmp3/openmp3.h"
+#include "mp3.h"
+#include "wav.h"
+#include "util.h"
+
+#include <limits.h>
+#include <math.h>
+#include <new>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+	constexpr size_t OGG_READ_BYTES = 4096; // ov_read gives a packet at most per call
+	constexpr size_t MP3_FRAME_SAMPLES = 1152;
+
+	inline short toShort(float v) noexcept
+	{
+		if (v >= 1.f) return SHRT_MAX;
+		if (v <= -1.f) return -SHRT_MAX;
+		return (short)lroundf(v * SHRT_MAX);
+	}
+
+	class WavStream :public KrbSoundStream
+	{
+	public:
+		WavStream(KrbFile* file) noexcept
+			:m_file(file)
+		{
+		}
+
+		bool open() noexcept
+		{
+			if (!Wav::readHeader(m_file, &info)) return false;
+			m_dataStart = m_file->tell();
+			m_frames = info.totalBytes / info.format.blockAlign;
+			return true;
+		}
+
+		size_t read(short* dest, size_t frames) noexcept override
+		{
+			if (frames > m_frames - m_position) frames = (size_t)(m_frames - m_position);
+			if (frames == 0) return 0;
+			const size_t blockAlign = info.format.blockAlign;
+			m_file->seek_set(m_dataStart + m_position * blockAlign);
+			size_t read = m_file->read(dest, frames * blockAlign) / blockAlign;
+			m_position += read;
+			return read;
+		}
+		bool seek(uint64_t frame) noexcept override
+		{
+			if (frame > m_frames) return false;
+			m_position = frame;
+			return true;
+		}
+
+	private:
+		KrbFile* const m_file;
+		uint64_t m_dataStart = 0;
+		uint64_t m_frames = 0;
+		uint64_t m_position = 0;
+	};
+
+	class OggStream :public KrbSoundStream
+	{
+	public:
+		~OggStream() noexcept override
+		{
+			if (!m_opened) return;
+			KRL_USING(LibVorbisFile, vorbisFile, );
+			vorbisFile->ov_clear(&m_vf);
+		}
+
+		bool open(KrbFile* file) noexcept
+		{
+			KRL_USING(LibVorbis, vorbis, false);
+			KRL_USING(LibVorbisFile, vorbisFile, false);
+			if (vorbisFile->ov_open_callbacks((void*)file, &m_vf, nullptr, 0, KRB_OV_CALLBACKS) < 0) return false;
+			m_opened = true;
+
+			vorbis_info* vi = vorbisFile->ov_info(&m_vf, -1);
+			if (vi == nullptr || vi->channels <= 0) return false;
+			ogg_int64_t frames = vorbisFile->ov_pcm_total(&m_vf, -1);
+			if (frames < 0) return false;
+			Wav::setPcmFormat(&info, vi->channels, vi->rate, frames);
+			return true;
+		}
+
+		size_t read(short* dest, size_t frames) noexcept override
+		{
+			KRL_USING(LibVorbisFile, vorbisFile, 0);
+			const size_t blockAlign = info.format.blockAlign;
+			char* out = (char*)dest;
+			size_t left = frames * blockAlign;
+			while (left != 0)
+			{
+				int bitstream;
+				long readed = vorbisFile->ov_read(&m_vf, out, (int)(left < OGG_READ_BYTES ? left : OGG_READ_BYTES), 0, 2, 1, &bitstream);
+				if (readed == OV_HOLE) continue; // a gap in the data, the decoding goes on
+				if (readed <= 0) break;
+				out += readed;
+				left -= readed;
+			}
+			return (out - (char*)dest) / blockAlign;
+		}
+		bool seek(uint64_t frame) noexcept override
+		{
+			KRL_USING(LibVorbisFile, vorbisFile, false);
+			return vorbisFile->ov_pcm_seek(&m_vf, (ogg_int64_t)frame) == 0;
+		}
+
+	private:
+		OggVorbis_File m_vf;
+		bool m_opened = false;
+	};
+
+	class Mp3Stream :public KrbSoundStream
+	{
+	public:
+		Mp3Stream(KrbFile* file) noexcept
+			:m_file(file), m_iterator(m_library, file), m_decoder(m_library)
+		{
+		}
+
+		bool open() noexcept
+		{
+			Mp3Header header;
+			if (!Mp3::readHeader(m_file, &header)) return false;
+			Wav::setPcmFormat(&info, header.channels, header.sampleRate, Mp3::getSamples(m_file, header));
+			exactLength = header.frames != 0;
+			m_samplesPerFrame = header.samplesPerFrame;
+			m_dataStart = header.firstFrame + (header.infoFrame ? header.frameBytes : 0);
+			m_iterator.Seek(m_dataStart);
+			return true;
+		}
+
+		size_t read(short* dest, size_t frames) noexcept override
+		{
+			const bool stereo = info.format.channels == 2;
+			size_t done = 0;
+			while (done < frames)
+			{
+				if (m_pcmPos == m_pcmCount)
+				{
+					if (!decodeFrame()) break;
+					continue;
+				}
+				size_t count = m_pcmCount - m_pcmPos;
+				if (count > frames - done) count = frames - done;
+				const float* left = m_pcm[0] + m_pcmPos;
+				const float* right = m_frameMono ? left : m_pcm[1] + m_pcmPos;
+				if (stereo)
+				{
+					for (size_t i = 0; i < count; i++)
+					{
+						*dest++ = toShort(left[i]);
+						*dest++ = toShort(right[i]);
+					}
+				}
+				else
+				{
+					for (size_t i = 0; i < count; i++) *dest++ = toShort((left[i] + right[i]) * 0.5f);
+				}
+				m_pcmPos += count;
+				done += count;
+			}
+			return done;
+		}
+		bool seek(uint64_t frame) noexcept override
+		{
+			if (frame < m_frameStart || frame >= m_frameStart + m_pcmCount + m_samplesPerFrame)
+			{
+				// the index starts at the frame with the fewest frames to decode before, no index decodes again from the first frame to seek backward
+				if (m_index) jump(frame);
+				else if (frame < m_frameStart) restart();
+			}
+			while (frame > m_frameStart + m_pcmCount)
+			{
+				if (!decodeFrame()) return false;
+			}
+			m_pcmPos = (size_t)(frame - m_frameStart);
+			return true;
+		}
+
+		bool setIndex(const KrbMp3Index* index) noexcept override
+		{
+			if (index && (index->sampleRate != info.format.samplesPerSec || index->channels != info.format.channels ||
+				index->samplesPerFrame != m_samplesPerFrame || index->offsets[0] != m_dataStart)) return false;
+			m_index = index;
+			return true;
+		}
+
+	private:
+		void jump(uint64_t frame) noexcept
+		{
+			uint64_t target = frame / m_samplesPerFrame;
+			const uint64_t frames = m_index->getFrames();
+			if (target > frames) target = frames;
+			uint64_t first = target < frames ? target - m_index->preroll[(size_t)target] : target;
+			m_decoder.Reset();
+			m_iterator.Seek(m_index->offsets[(size_t)first]);
+			m_frameStart = first * m_samplesPerFrame;
+			m_pcmCount = 0;
+			m_pcmPos = 0;
+		}
+		void restart() noexcept
+		{
+			m_decoder.Reset();
+			m_iterator.Seek(m_dataStart);
+			m_frameStart = 0;
+			m_pcmCount = 0;
+			m_pcmPos = 0;
+		}
+		// the next frame after the current one, the frames without the reservoir data give silence
+		bool decodeFrame() noexcept
+		{
+			m_frameStart += m_pcmCount;
+			m_pcmCount = 0;
+			m_pcmPos = 0;
+			if (m_iterator.GetNext(m_frame) != OpenMP3::kResultOk) return false;
+			m_frameMono = m_frame.GetMode() == OpenMP3::kModeMono;
+			m_pcmCount = m_decoder.ProcessFrame(m_frame, m_pcm);
+			if (m_pcmCount == 0)
+			{
+				memset(m_pcm, 0, sizeof(m_pcm));
+				m_pcmCount = m_samplesPerFrame;
+			}
+			return true;
+		}
+
+		KrbFile* const m_file;
+		OpenMP3::Library m_library;
+		OpenMP3::Iterator m_iterator;
+		OpenMP3::Decoder m_decoder;
+		OpenMP3::Frame m_frame;
+		uint64_t m_dataStart = 0; // the first frame with samples
+		uint32_t m_samplesPerFrame = MP3_FRAME_SAMPLES;
+		const KrbMp3Index* m_index = nullptr;
+
+		float m_pcm[2][MP3_FRAME_SAMPLES];
+		bool m_frameMono = false;
+		uint64_t m_frameStart = 0; // the position of the first sample of m_pcm
+		size_t m_pcmCount = 0;
+		size_t m_pcmPos = 0;
+	};
+}
+
+bool KrbSoundStream::setIndex(const KrbMp3Index*) noexcept
+{
+	return false;
+}
+KrbSoundStream* KrbSoundStream::open(KrbExtension extension, KrbFile* file) noexcept
+{
+	KrbSoundStream* stream = nullptr;
+	bool opened = false;
+	switch (extension)
+	{
+	case KrbExtension::SoundWav:
+	{
+		WavStream* wav = new(std::nothrow) WavStream(file);
+		opened = wav && wav->open();
+		stream = wav;
+		break;
+	}
+	case KrbExtension::SoundOgg:
+	{
+		OggStream* ogg = new(std::nothrow) OggStream;
+		opened = ogg && ogg->open(file);
+		stream = ogg;
+		break;
+	}
+	case KrbExtension::SoundMp3:
+	{
+		Mp3Stream* mp3 = new(std::nothrow) Mp3Stream(file);
+		opened = mp3 && mp3->open();
+		stream = mp3;
+		break;
+	}
+	default:
+		return nullptr;
+	}
+	if (!opened)
+	{
+		delete stream;
+		return nullptr;
+	}
+	return stream;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "include/common.h"
+#include "include/sound.h"
+
+namespace kr
+{
+	class KrbMp3Index;
+
+	// the decoders that keep a frame or a chunk, the file is read on demand
+	class KrbSoundStream
+	{
+	public:
+		virtual ~KrbSoundStream() noexcept = default;
+
+		static KrbSoundStream* open(KrbExtension extension, KrbFile* file) noexcept;
+
+		// the frames of info.format.blockAlign bytes, fewer at the end
+		virtual size_t read(short* dest, size_t frames) noexcept = 0;
+		virtual bool seek(uint64_t frame) noexcept = 0;
+		// MP3 only, the index must stay while it is set
+		virtual bool setIndex(const KrbMp3Index* index) noexcept;
+
+		KrbSoundInfo info;
+		bool exactLength = true; // false if the length of info is estimated
+	};
+}
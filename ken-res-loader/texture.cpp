@@ -0,0 +1,430 @@
+#include "texture.h"
+#include "mipmap.h"
+#include "util.h"
+
+#include <string.h>
+#include <new>
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+#pragma pack(push, 1)
+	struct DDS_PIXELFORMAT
+	{
+		uint32_t dwSize;
+		uint32_t dwFlags;
+		uint32_t dwFourCC;
+		uint32_t dwRGBBitCount;
+		uint32_t dwRBitMask;
+		uint32_t dwGBitMask;
+		uint32_t dwBBitMask;
+		uint32_t dwABitMask;
+	};
+
+	struct DDS_HEADER
+	{
+		uint32_t dwMagic;
+		uint32_t dwSize;
+		uint32_t dwFlags;
+		uint32_t dwHeight;
+		uint32_t dwWidth;
+		uint32_t dwPitchOrLinearSize;
+		uint32_t dwDepth;
+		uint32_t dwMipMapCount;
+		uint32_t dwReserved1[11];
+		DDS_PIXELFORMAT ddspf;
+		uint32_t dwCaps;
+		uint32_t dwCaps2;
+		uint32_t dwCaps3;
+		uint32_t dwCaps4;
+		uint32_t dwReserved2;
+	};
+
+	struct DDS_HEADER_DXT10
+	{
+		uint32_t dxgiFormat;
+		uint32_t resourceDimension;
+		uint32_t miscFlag;
+		uint32_t arraySize;
+		uint32_t miscFlags2;
+	};
+
+	struct KTX2_HEADER
+	{
+		uint8_t identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;
+		uint32_t supercompressionScheme;
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+
+	struct KTX2_LEVEL
+	{
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+#pragma pack(pop)
+
+	constexpr uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+	constexpr uint32_t DDSD_DEPTH = 0x800000;
+	constexpr uint32_t DDPF_ALPHAPIXELS = 0x1;
+	constexpr uint32_t DDPF_ALPHA = 0x2;
+	constexpr uint32_t DDPF_FOURCC = 0x4;
+	constexpr uint32_t DDPF_RGB = 0x40;
+	constexpr uint32_t DDSCAPS2_CUBEMAP = 0x200;
+	constexpr uint32_t DDSCAPS2_VOLUME = 0x200000;
+	constexpr uint32_t DDS_RESOURCE_MISC_TEXTURECUBE = 0x4;
+	constexpr uint32_t DDS_DIMENSION_TEXTURE3D = 4;
+
+	constexpr uint32_t MAX_LEVELS = 32;
+	constexpr uint32_t MAX_SIZE = 65536; // keeps the pitches in 32 bits
+
+	inline uint32_t levelSize(uint32_t size, uint32_t level) noexcept
+	{
+		size >>= level;
+		return size ? size : 1;
+	}
+
+	// the bytes of a level of a layer or a face
+	uint64_t getImageBytes(const KrbTextureInfo& info, uint32_t level) noexcept
+	{
+		return (uint64_t)Mipmap::getLevelPitch(info.pixelformat, levelSize(info.width, level))
+			* Mipmap::getLevelRows(info.pixelformat, levelSize(info.height, level))
+			* levelSize(info.depth, level);
+	}
+
+	uint32_t getMaxLevels(const KrbTextureInfo& info) noexcept
+	{
+		uint32_t size = info.width | info.height | info.depth;
+		uint32_t count = 1;
+		while (size >>= 1) count++;
+		return count;
+	}
+
+	kr_pixelformat_t getDxgiFormat(uint32_t dxgiFormat, bool* srgb) noexcept
+	{
+		*srgb = false;
+		switch (dxgiFormat)
+		{
+		case 2: return PixelFormatRGBA32F; // R32G32B32A32_FLOAT
+		case 10: return PixelFormatRGBA16F; // R16G16B16A16_FLOAT
+		case 29: *srgb = true; return PixelFormatABGR8; // R8G8B8A8_UNORM_SRGB
+		case 28: return PixelFormatABGR8; // R8G8B8A8_UNORM
+		case 65: return PixelFormatA8; // A8_UNORM
+		case 72: *srgb = true; return PixelFormatBC1; // BC1_UNORM_SRGB
+		case 71: return PixelFormatBC1; // BC1_UNORM
+		case 78: *srgb = true; return PixelFormatBC3; // BC3_UNORM_SRGB
+		case 77: return PixelFormatBC3; // BC3_UNORM
+		case 80: return PixelFormatBC4; // BC4_UNORM
+		case 83: return PixelFormatBC5; // BC5_UNORM
+		case 85: return PixelFormatR5G6B5; // B5G6R5_UNORM
+		case 86: return PixelFormatA1RGB5; // B5G5R5A1_UNORM
+		case 91: *srgb = true; return PixelFormatARGB8; // B8G8R8A8_UNORM_SRGB
+		case 87: return PixelFormatARGB8; // B8G8R8A8_UNORM
+		case 93: *srgb = true; return PixelFormatXRGB8; // B8G8R8X8_UNORM_SRGB
+		case 88: return PixelFormatXRGB8; // B8G8R8X8_UNORM
+		case 99: *srgb = true; return PixelFormatBC7; // BC7_UNORM_SRGB
+		case 98: return PixelFormatBC7; // BC7_UNORM
+		case 115: return PixelFormatARGB4; // B4G4R4A4_UNORM
+		default: return PixelFormatInvalid;
+		}
+	}
+
+	kr_pixelformat_t getDdsFormat(const DDS_PIXELFORMAT& pf) noexcept
+	{
+		if (pf.dwFlags & DDPF_FOURCC)
+		{
+			switch (pf.dwFourCC)
+			{
+			case "DXT1"_sig: return PixelFormatBC1;
+			case "DXT5"_sig: return PixelFormatBC3;
+			case "ATI1"_sig: case "BC4U"_sig: return PixelFormatBC4;
+			case "ATI2"_sig: case "BC5U"_sig: return PixelFormatBC5;
+			case 113: return PixelFormatRGBA16F; // D3DFMT_A16B16G16R16F
+			case 116: return PixelFormatRGBA32F; // D3DFMT_A32B32G32R32F
+			default: return PixelFormatInvalid;
+			}
+		}
+
+		uint32_t a = (pf.dwFlags & (DDPF_ALPHAPIXELS | DDPF_ALPHA)) ? pf.dwABitMask : 0;
+		if (pf.dwFlags & DDPF_RGB)
+		{
+			switch (pf.dwRGBBitCount)
+			{
+			case 32:
+				if (pf.dwRBitMask == 0xff0000 && pf.dwGBitMask == 0xff00 && pf.dwBBitMask == 0xff)
+				{
+					return a == 0xff000000 ? PixelFormatARGB8 : PixelFormatXRGB8;
+				}
+				if (pf.dwRBitMask == 0xff && pf.dwGBitMask == 0xff00 && pf.dwBBitMask == 0xff0000)
+				{
+					return a == 0xff000000 ? PixelFormatABGR8 : PixelFormatXBGR8;
+				}
+				break;
+			case 24:
+				if (pf.dwRBitMask == 0xff0000 && pf.dwGBitMask == 0xff00 && pf.dwBBitMask == 0xff) return PixelFormatRGB8;
+				if (pf.dwRBitMask == 0xff && pf.dwGBitMask == 0xff00 && pf.dwBBitMask == 0xff0000) return PixelFormatBGR8;
+				break;
+			case 16:
+				if (pf.dwRBitMask == 0xf800 && pf.dwGBitMask == 0x7e0 && pf.dwBBitMask == 0x1f) return PixelFormatR5G6B5;
+				if (pf.dwRBitMask == 0x7c00 && pf.dwGBitMask == 0x3e0 && pf.dwBBitMask == 0x1f)
+				{
+					return a == 0x8000 ? PixelFormatA1RGB5 : PixelFormatX1RGB5;
+				}
+				if (pf.dwRBitMask == 0xf00 && pf.dwGBitMask == 0xf0 && pf.dwBBitMask == 0xf && a == 0xf000) return PixelFormatARGB4;
+				break;
+			}
+			return PixelFormatInvalid;
+		}
+		if ((pf.dwFlags & DDPF_ALPHA) && pf.dwRGBBitCount == 8 && a == 0xff) return PixelFormatA8;
+		return PixelFormatInvalid;
+	}
+
+	bool parseDds(KrbFile* file, uint64_t fileSize, KrbTexture* texture) noexcept
+	{
+		DDS_HEADER header;
+		if (file->read(&header, sizeof(header)) != sizeof(header)) return false;
+		if (header.dwMagic != "DDS "_sig || header.dwSize != 124) return false;
+
+		KrbTextureInfo& info = texture->info;
+		info.width = header.dwWidth;
+		info.height = header.dwHeight;
+		info.depth = 1;
+		info.mipLevels = (header.dwFlags & DDSD_MIPMAPCOUNT) && header.dwMipMapCount ? header.dwMipMapCount : 1;
+		info.layers = 1;
+		info.faces = 1;
+		info.srgb = false;
+
+		if ((header.ddspf.dwFlags & DDPF_FOURCC) && header.ddspf.dwFourCC == "DX10"_sig)
+		{
+			DDS_HEADER_DXT10 dx10;
+			if (file->read(&dx10, sizeof(dx10)) != sizeof(dx10)) return false;
+			info.pixelformat = getDxgiFormat(dx10.dxgiFormat, &info.srgb);
+			info.layers = dx10.arraySize ? dx10.arraySize : 1;
+			if (dx10.miscFlag & DDS_RESOURCE_MISC_TEXTURECUBE) info.faces = 6;
+			if (dx10.resourceDimension == DDS_DIMENSION_TEXTURE3D) info.depth = header.dwDepth ? header.dwDepth : 1;
+		}
+		else
+		{
+			info.pixelformat = getDdsFormat(header.ddspf);
+			if (header.dwCaps2 & DDSCAPS2_CUBEMAP) info.faces = 6; // the partial cube maps are not supported
+			if ((header.dwCaps2 & DDSCAPS2_VOLUME) && (header.dwFlags & DDSD_DEPTH)) info.depth = header.dwDepth ? header.dwDepth : 1;
+		}
+		if (info.pixelformat == PixelFormatInvalid) return false;
+		if (info.width == 0 || info.height == 0 || info.width > MAX_SIZE || info.height > MAX_SIZE || info.depth > MAX_SIZE) return false;
+		if (info.layers > MAX_SIZE || info.mipLevels > getMaxLevels(info)) return false;
+
+		// [layer][face][level] follow each other
+		uint64_t offset = file->tell();
+		if (offset > fileSize) return false;
+		texture->begin = offset;
+		texture->offsets.resize((size_t)info.layers * info.faces * info.mipLevels);
+		uint64_t* out = texture->offsets.data();
+		for (uint32_t i = 0; i < info.layers * info.faces; i++)
+		{
+			for (uint32_t level = 0; level < info.mipLevels; level++)
+			{
+				uint64_t imageBytes = getImageBytes(info, level);
+				if (imageBytes > fileSize - offset) return false;
+				*out++ = offset;
+				offset += imageBytes;
+			}
+		}
+		texture->end = offset;
+		return true;
+	}
+
+	kr_pixelformat_t getVkFormat(uint32_t vkFormat, bool* srgb) noexcept
+	{
+		*srgb = false;
+		switch (vkFormat)
+		{
+		case 4: return PixelFormatR5G6B5; // R5G6B5_UNORM_PACK16
+		case 8: return PixelFormatA1RGB5; // A1R5G5B5_UNORM_PACK16
+		case 29: *srgb = true; return PixelFormatBGR8; // R8G8B8_SRGB
+		case 23: return PixelFormatBGR8; // R8G8B8_UNORM
+		case 36: *srgb = true; return PixelFormatRGB8; // B8G8R8_SRGB
+		case 30: return PixelFormatRGB8; // B8G8R8_UNORM
+		case 43: *srgb = true; return PixelFormatABGR8; // R8G8B8A8_SRGB
+		case 37: return PixelFormatABGR8; // R8G8B8A8_UNORM
+		case 50: *srgb = true; return PixelFormatARGB8; // B8G8R8A8_SRGB
+		case 44: return PixelFormatARGB8; // B8G8R8A8_UNORM
+		case 97: return PixelFormatRGBA16F; // R16G16B16A16_SFLOAT
+		case 109: return PixelFormatRGBA32F; // R32G32B32A32_SFLOAT
+		case 132: case 134: *srgb = true; return PixelFormatBC1; // BC1_RGB(A)_SRGB_BLOCK
+		case 131: case 133: return PixelFormatBC1; // BC1_RGB(A)_UNORM_BLOCK
+		case 138: *srgb = true; return PixelFormatBC3; // BC3_SRGB_BLOCK
+		case 137: return PixelFormatBC3; // BC3_UNORM_BLOCK
+		case 139: return PixelFormatBC4; // BC4_UNORM_BLOCK
+		case 141: return PixelFormatBC5; // BC5_UNORM_BLOCK
+		case 146: *srgb = true; return PixelFormatBC7; // BC7_SRGB_BLOCK
+		case 145: return PixelFormatBC7; // BC7_UNORM_BLOCK
+		default: return PixelFormatInvalid;
+		}
+	}
+
+	bool parseKtx2(KrbFile* file, uint64_t fileSize, KrbTexture* texture) noexcept
+	{
+		static const uint8_t identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+		KTX2_HEADER header;
+		if (file->read(&header, sizeof(header)) != sizeof(header)) return false;
+		if (memcmp(header.identifier, identifier, sizeof(identifier)) != 0) return false;
+		if (header.supercompressionScheme != 0) return false; // the data must be usable as is
+
+		KrbTextureInfo& info = texture->info;
+		info.pixelformat = getVkFormat(header.vkFormat, &info.srgb);
+		info.width = header.pixelWidth;
+		info.height = header.pixelHeight ? header.pixelHeight : 1;
+		info.depth = header.pixelDepth ? header.pixelDepth : 1;
+		info.mipLevels = header.levelCount ? header.levelCount : 1;
+		info.layers = header.layerCount ? header.layerCount : 1;
+		info.faces = header.faceCount ? header.faceCount : 1;
+		if (info.pixelformat == PixelFormatInvalid) return false;
+		if (info.width == 0 || info.width > MAX_SIZE || info.height > MAX_SIZE || info.depth > MAX_SIZE) return false;
+		if (info.layers > MAX_SIZE || (info.faces != 1 && info.faces != 6)) return false;
+		if (info.mipLevels > MAX_LEVELS || info.mipLevels > getMaxLevels(info)) return false;
+
+		// a level holds [layer][face] of the level
+		KTX2_LEVEL levels[MAX_LEVELS];
+		size_t levelBytes = sizeof(KTX2_LEVEL) * info.mipLevels;
+		if (file->read(levels, levelBytes) != levelBytes) return false;
+
+		uint32_t images = info.layers * info.faces;
+		texture->offsets.resize((size_t)images * info.mipLevels);
+		texture->begin = UINT64_MAX;
+		texture->end = 0;
+		for (uint32_t level = 0; level < info.mipLevels; level++)
+		{
+			const KTX2_LEVEL& src = levels[level];
+			uint64_t imageBytes = getImageBytes(info, level);
+			// the offsets come from the file, the sums must not wrap past its end
+			if (src.byteOffset > fileSize || src.byteLength > fileSize - src.byteOffset) return false;
+			if (imageBytes > src.byteLength / images) return false; // the images of the level fit in its length
+			if (src.byteOffset < texture->begin) texture->begin = src.byteOffset;
+			if (src.byteOffset + src.byteLength > texture->end) texture->end = src.byteOffset + src.byteLength;
+			for (uint32_t i = 0; i < images; i++)
+			{
+				texture->offsets[(size_t)i * info.mipLevels + level] = src.byteOffset + imageBytes * i;
+			}
+		}
+		return true;
+	}
+}
+
+void KrbTexture::getLevel(uint32_t level, KrbTextureLevel* out) const noexcept
+{
+	out->width = levelSize(info.width, level);
+	out->height = levelSize(info.height, level);
+	out->depth = levelSize(info.depth, level);
+	out->pitchBytes = Mipmap::getLevelPitch(info.pixelformat, out->width);
+	out->size = (size_t)getImageBytes(info, level);
+	out->data = nullptr;
+}
+
+bool Texture::parse(KrbExtension extension, KrbFile* file, KrbTexture* texture) noexcept
+{
+	try
+	{
+		// the levels must be in the file
+		uint64_t position = file->tell();
+		file->seek_end(0);
+		uint64_t size = file->tell();
+		file->seek_set(position);
+
+		bool parsed;
+		switch (extension)
+		{
+		case KrbExtension::ImageDds: parsed = parseDds(file, size, texture); break;
+		case KrbExtension::ImageKtx2: parsed = parseKtx2(file, size, texture); break;
+		default: return false;
+		}
+		if (!parsed) return false;
+		return texture->begin <= texture->end && texture->end <= size;
+	}
+	catch (...)
+	{
+		return false;
+	}
+}
+KrbTexture* Texture::open(KrbExtension extension, KrbFile* file) noexcept
+{
+	KrbTexture* texture = new(std::nothrow) KrbTexture;
+	if (!texture) return nullptr;
+	if (!parse(extension, file, texture))
+	{
+		delete texture;
+		return nullptr;
+	}
+
+	size_t size = (size_t)(texture->end - texture->begin);
+	texture->data = (const uint8_t*)file->map(texture->begin, size);
+	if (!texture->data)
+	{
+		try
+		{
+			texture->copy.resize(size);
+			file->seek_set(texture->begin);
+			if (file->read(texture->copy.data(), size) != size) throw 0;
+			texture->data = texture->copy.data();
+		}
+		catch (...)
+		{
+			delete texture;
+			return nullptr;
+		}
+	}
+	return texture;
+}
+bool Texture::load(KrbExtension extension, KrbImageCallback* callback, KrbFile* file) noexcept
+{
+	KrbTexture texture;
+	if (!parse(extension, file, &texture)) return false;
+
+	KrbImageInfo info;
+	info.pixelformat = texture.info.pixelformat;
+	info.width = texture.info.width;
+	info.height = texture.info.height;
+	info.pitchBytes = Mipmap::getLevelPitch(info.pixelformat, info.width);
+	info.mipLevels = texture.info.depth == 1 ? texture.info.mipLevels : 1;
+	uint8_t* buffer = (uint8_t*)callback->start(callback, &info);
+	if (!buffer) return false;
+
+	for (uint32_t level = 0; level < info.mipLevels && level < texture.info.mipLevels; level++)
+	{
+		KrbTextureLevel src;
+		texture.getLevel(level, &src);
+		uint32_t rows = Mipmap::getLevelRows(info.pixelformat, src.height);
+		uint8_t* dest = buffer + Mipmap::getLevelOffset(&info, level);
+		size_t destPitch = level == 0 ? info.pitchBytes : src.pitchBytes;
+
+		const uint8_t* mapped = (const uint8_t*)file->map(texture.offsets[level], (size_t)src.pitchBytes * rows);
+		if (!mapped) file->seek_set(texture.offsets[level]);
+		for (uint32_t y = 0; y < rows; y++, dest += destPitch)
+		{
+			if (mapped)
+			{
+				memcpy(dest, mapped + (size_t)src.pitchBytes * y, src.pitchBytes);
+			}
+			else if (file->read(dest, src.pitchBytes) != src.pitchBytes)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
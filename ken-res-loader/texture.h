@@ -0,0 +1,35 @@
+#pragma once
+
+#include "include/common.h"
+#include "include/image.h"
+
+#include <vector>
+
+namespace kr
+{
+	class KrbTexture
+	{
+	public:
+		KrbTextureInfo info;
+		std::vector<uint64_t> offsets; // file offsets of [layer][face][level]
+		uint64_t begin; // the file offset of data
+		uint64_t end;
+		const uint8_t* data; // the mapped file or copy
+		std::vector<uint8_t> copy;
+
+		void getLevel(uint32_t level, KrbTextureLevel* out) const noexcept;
+	};
+
+	namespace backend
+	{
+		// DDS and KTX2 containers
+		class Texture
+		{
+		public:
+			// the header and the level offsets, the data is not read
+			static bool parse(KrbExtension extension, KrbFile* file, KrbTexture* texture) noexcept;
+			static KrbTexture* open(KrbExtension extension, KrbFile* file) noexcept;
+			static bool load(KrbExtension extension, KrbImageCallback* callback, KrbFile* file) noexcept;
+		};
+	}
+}
@@ -1,9 +1,13 @@
 #include "tga.h"
 #include "readstream.h"
+#include "imagedecoder.h"
+#include "lazyimage.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <new>
+#include <vector>
 
 #define TGA_PALETTE_ONE_SIZE (3)
 #define TGA_PALETTE_SIZE	(TGA_PALETTE_ONE_SIZE*256)
@@ -251,6 +255,87 @@ static const ColorInfos colorInfos[4] = {
 	},
 };
 
+namespace
+{
+	// the row output, the RLE packets may cross the rows
+	// the bottom-up rows are read by seeking, so the bottom-up RLE files do not come here
+	bool loadRows(KrbImageCallback* callback, KrbFile* file, const tga_head_t& head, const ColorInfos& cinfo) noexcept
+	{
+		uint32_t pixelBytes = head.bpp / 8;
+		size_t pitch = (size_t)pixelBytes * head.width;
+		bool rle = head.imagetype == 9 || head.imagetype == 10;
+		bool topDown = (head.descriptor & 0x20) != 0;
+		bool flip = (head.descriptor & 0x10) != 0;
+
+		KrbImageInfo imginfo;
+		imginfo.width = head.width;
+		imginfo.height = head.height;
+		imginfo.pixelformat = cinfo.pf;
+		imginfo.pitchBytes = (uint32_t)pitch;
+		imginfo.rowByRow = true;
+		if (!callback->start(callback, &imginfo)) return false;
+
+		uint8_t* temp = nullptr;
+		if (flip)
+		{
+			temp = (uint8_t*)malloc(pitch);
+			if (!temp) return false;
+		}
+		uint64_t dataPos = file->tell();
+		uint32_t packetLeft = 0;
+		bool packetRun = false;
+		uint8_t runPixel[4];
+		bool ok = true;
+		for (uint32_t y = 0; ok && y < head.height; y++)
+		{
+			uint8_t* row = callback->row(callback, y);
+			if (!row)
+			{
+				ok = false;
+				break;
+			}
+			uint8_t* dest = flip ? temp : row;
+			if (!rle)
+			{
+				if (!topDown) file->seek_set(dataPos + pitch * (head.height - 1 - y));
+				ok = file->read(dest, pitch) == pitch;
+			}
+			else
+			{
+				uint32_t x = 0;
+				while (x < head.width)
+				{
+					if (packetLeft == 0)
+					{
+						uint8_t chunk;
+						if (file->read(&chunk, 1) != 1) break;
+						packetRun = chunk >= 128;
+						packetLeft = packetRun ? chunk - 127 : chunk + 1;
+						if (packetRun && file->read(runPixel, pixelBytes) != pixelBytes) break;
+					}
+					uint32_t count = head.width - x;
+					if (count > packetLeft) count = packetLeft;
+					uint8_t* p = dest + (size_t)x * pixelBytes;
+					if (packetRun)
+					{
+						for (uint32_t i = 0; i < count; i++) memcpy(p + i * pixelBytes, runPixel, pixelBytes);
+					}
+					else if (file->read(p, (size_t)count * pixelBytes) != (size_t)count * pixelBytes)
+					{
+						break;
+					}
+					packetLeft -= count;
+					x += count;
+				}
+				ok = x == head.width;
+			}
+			if (ok && flip) cinfo.memcpy_rev(row, temp, pitch);
+		}
+		free(temp);
+		return ok;
+	}
+}
+
 bool backend::Tga::load(KrbImageCallback* callback, KrbFile* file) noexcept
 {
 	ReadStream is(file);
@@ -301,6 +386,11 @@ bool backend::Tga::load(KrbImageCallback* callback, KrbFile* file) noexcept
 
 	int pixel_byte = head.bpp / 8;
 	const ColorInfos & cinfo = colorInfos[pixel_byte - 1];
+	if (callback->row && ((head.descriptor & 0x20) || (head.imagetype != 9 && head.imagetype != 10)))
+	{
+		if (head.width == 0 || head.height == 0) return false;
+		return loadRows(callback, file, head, cinfo);
+	}
 	int size = head.width * head.height;
 	int total_byte = pixel_byte * size;
 
@@ -386,13 +476,13 @@ bool backend::Tga::load(KrbImageCallback* callback, KrbFile* file) noexcept
 	{
 		if (head.descriptor & 0x10) // reverse horizontal
 		{
-			uint8_t* src = pixels + total_byte - pitch;
+			uint8_t* src = pixels;
 			uint8_t* dest_end = dest + total_byte;
 			while (dest != dest_end)
 			{
 				cinfo.memcpy_rev(dest, src, pitch);
 				dest += imginfo.pitchBytes;
-				src -= pitch;
+				src += pitch;
 			}
 		}
 		else
@@ -510,3 +600,303 @@ bool backend::Tga::save(const KrbImageSaveInfo* info, KrbFile* file) noexcept
 	file->write(&dummy, 4);
 	return true;
 }
+
+namespace
+{
+	// decodes the pixels row by row, the RLE packets may cross the rows
+	class TgaDecoder :public KrbImageDecoder
+	{
+	public:
+		TgaDecoder(KrbImageCallback* callback) noexcept
+			:KrbImageDecoder(callback)
+		{
+		}
+		~TgaDecoder() noexcept override
+		{
+			free(m_row);
+		}
+
+		kr_decodestatus_t poll() noexcept override
+		{
+			switch (m_state)
+			{
+			case State::Header:
+				if (available() < sizeof(tga_head_t)) return needMore();
+				memcpy(&m_head, peek(), sizeof(tga_head_t));
+				consume(sizeof(tga_head_t));
+				switch (m_head.imagetype)
+				{
+				case 1: case 2: case 9: case 10:
+					break;
+				default:
+					return fail();
+				}
+				if (m_head.idsize != 0 || m_head.xstart != 0 || m_head.ystart != 0) return fail();
+				switch (m_head.bpp)
+				{
+				case 8: case 16: case 24: case 32:
+					break;
+				default:
+					return fail();
+				}
+				if (m_head.width == 0 || m_head.height == 0) return fail();
+				m_pixelBytes = m_head.bpp / 8;
+				m_info = &colorInfos[m_pixelBytes - 1];
+				m_state = State::Palette;
+				// fallthrough
+			case State::Palette:
+				if (m_head.bpp == 8)
+				{
+					if (available() < TGA_PALETTE_SIZE) return needMore();
+					const color3bytes_t* tripal = (const color3bytes_t*)peek();
+					assert(m_callback->palette);
+					for (size_t i = 0; i < 256; i++)
+					{
+						const color3bytes_t& src = tripal[i];
+						m_callback->palette->color[i] = 0xff000000 | (src.r << 16) | (src.g << 8) | (src.b);
+					}
+					consume(TGA_PALETTE_SIZE);
+				}
+				if (!start()) return fail();
+				m_state = State::Pixels;
+				// fallthrough
+			case State::Pixels:
+				while (m_y < m_head.height)
+				{
+					if (!readPixels()) return needMore();
+					if (m_x == m_head.width)
+					{
+						if (!writeRow()) return fail();
+						m_x = 0;
+						m_y++;
+					}
+				}
+				m_state = State::Done;
+				return DecodeStatusDone;
+			case State::Done:
+				return DecodeStatusDone;
+			default:
+				return DecodeStatusFailed;
+			}
+		}
+
+	private:
+		enum class State
+		{
+			Header,
+			Palette,
+			Pixels,
+			Done,
+			Failed,
+		};
+
+		kr_decodestatus_t fail() noexcept
+		{
+			m_state = State::Failed;
+			return DecodeStatusFailed;
+		}
+
+		bool start() noexcept
+		{
+			m_pitch = m_pixelBytes * m_head.width;
+			m_row = (uint8_t*)malloc(m_pitch);
+			if (!m_row) return false;
+
+			KrbImageInfo imginfo;
+			imginfo.width = m_head.width;
+			imginfo.height = m_head.height;
+			imginfo.pixelformat = m_info->pf;
+			imginfo.pitchBytes = (uint32_t)m_pitch;
+			m_rowByRow = m_callback->row != nullptr && (m_head.descriptor & 0x20);
+			imginfo.rowByRow = m_rowByRow;
+			m_dest = (uint8_t*)m_callback->start(m_callback, &imginfo);
+			m_pitchBytes = imginfo.pitchBytes;
+			return m_dest != nullptr;
+		}
+
+		// fills the current row as far as the input allows, false if it needs more bytes
+		bool readPixels() noexcept
+		{
+			while (m_x < m_head.width)
+			{
+				uint32_t count = m_head.width - m_x;
+				uint8_t* dest = m_row + m_x * m_pixelBytes;
+				if (m_head.imagetype == 9 || m_head.imagetype == 10)
+				{
+					if (m_packetLeft == 0)
+					{
+						if (available() < 1) return false;
+						uint8_t chunk = *peek();
+						if (chunk >= 128)
+						{
+							if (available() < 1 + m_pixelBytes) return false;
+							memcpy(m_runPixel, peek() + 1, m_pixelBytes);
+							consume(1 + m_pixelBytes);
+							m_packetRun = true;
+							m_packetLeft = chunk - 127;
+						}
+						else
+						{
+							consume(1);
+							m_packetRun = false;
+							m_packetLeft = chunk + 1;
+						}
+					}
+					if (count > m_packetLeft) count = m_packetLeft;
+					if (m_packetRun)
+					{
+						for (uint32_t i = 0; i < count; i++)
+						{
+							memcpy(dest, m_runPixel, m_pixelBytes);
+							dest += m_pixelBytes;
+						}
+						m_packetLeft -= count;
+						m_x += count;
+						continue;
+					}
+				}
+				size_t pixels = available() / m_pixelBytes;
+				if (pixels == 0) return false;
+				if (count > pixels) count = (uint32_t)pixels;
+				memcpy(dest, peek(), count * m_pixelBytes);
+				consume(count * m_pixelBytes);
+				if (m_packetLeft != 0) m_packetLeft -= count;
+				m_x += count;
+			}
+			return true;
+		}
+
+		// descriptor bit 5: top-down, bit 4: right-to-left
+		bool writeRow() noexcept
+		{
+			uint32_t y = m_y;
+			if (!(m_head.descriptor & 0x20)) y = m_head.height - 1 - y; // reverse vertical
+			uint8_t* dest = m_rowByRow ? m_callback->row(m_callback, y) : m_dest + (size_t)y * m_pitchBytes;
+			if (!dest) return false;
+			if (m_head.descriptor & 0x10) m_info->memcpy_rev(dest, m_row, m_pitch); // reverse horizontal
+			else memcpy(dest, m_row, m_pitch);
+			return true;
+		}
+
+		State m_state = State::Header;
+		tga_head_t m_head;
+		const ColorInfos* m_info = nullptr;
+		uint32_t m_pixelBytes = 0;
+		size_t m_pitch = 0;
+		uint8_t* m_row = nullptr;
+		bool m_rowByRow = false;
+		uint8_t* m_dest = nullptr;
+		uint32_t m_pitchBytes = 0;
+		uint32_t m_x = 0;
+		uint32_t m_y = 0;
+		uint32_t m_packetLeft = 0;
+		bool m_packetRun = false;
+		uint8_t m_runPixel[4];
+	};
+}
+
+KrbImageDecoder* backend::Tga::createDecoder(KrbImageCallback* callback) noexcept
+{
+	return new(std::nothrow) TgaDecoder(callback);
+}
+
+namespace
+{
+	// the uncompressed files seek to the rows
+	class TgaRowReader :public backend::RowReader
+	{
+	public:
+		TgaRowReader(KrbFile* file, const tga_head_t& head, uint64_t dataPos) noexcept
+			:m_file(file), m_head(head), m_dataPos(dataPos)
+		{
+			m_pixelBytes = head.bpp / 8;
+			m_pitch = (size_t)m_pixelBytes * head.width;
+			m_info = &colorInfos[m_pixelBytes - 1];
+		}
+
+		uint32_t getBandRows() const noexcept override
+		{
+			return 1;
+		}
+		bool read(uint8_t* dest, size_t pitch, uint32_t y0, uint32_t y1) noexcept override
+		{
+			bool flip = (m_head.descriptor & 0x10) != 0;
+			if (flip)
+			{
+				try
+				{
+					m_row.resize(m_pitch);
+				}
+				catch (...)
+				{
+					return false;
+				}
+			}
+			for (uint32_t y = y0; y < y1; y++)
+			{
+				uint32_t line = (m_head.descriptor & 0x20) ? y : m_head.height - 1 - y;
+				m_file->seek_set(m_dataPos + m_pitch * line);
+				uint8_t* row = flip ? m_row.data() : dest;
+				if (m_file->read(row, m_pitch) != m_pitch) return false;
+				if (flip) m_info->memcpy_rev(dest, row, m_pitch);
+				dest += pitch;
+			}
+			return true;
+		}
+
+	private:
+		KrbFile* const m_file;
+		const tga_head_t m_head;
+		const uint64_t m_dataPos;
+		const ColorInfos* m_info;
+		uint32_t m_pixelBytes;
+		size_t m_pitch;
+		std::vector<uint8_t> m_row;
+	};
+}
+
+backend::RowReader* backend::Tga::openRows(KrbFile* file, KrbImageInfo* info, KrbImagePalette* palette) noexcept
+{
+	uint64_t start = file->tell();
+	tga_head_t head;
+	if (file->read(&head, sizeof(head)) != sizeof(head)) return nullptr;
+	if (head.imagetype != 1 && head.imagetype != 2) return nullptr; // RLE
+	if (head.idsize != 0 || head.xstart != 0 || head.ystart != 0) return nullptr;
+	if (head.bpp != 8 && head.bpp != 16 && head.bpp != 24 && head.bpp != 32) return nullptr;
+	if (head.width == 0 || head.height == 0) return nullptr;
+	if (head.bpp == 8)
+	{
+		color3bytes_t tripal[256];
+		if (file->read(tripal, sizeof(tripal)) != sizeof(tripal)) return nullptr;
+		for (size_t i = 0; i < 256; i++)
+		{
+			color3bytes_t& src = tripal[i];
+			palette->color[i] = 0xff000000 | (src.r << 16) | (src.g << 8) | (src.b);
+		}
+	}
+	info->width = head.width;
+	info->height = head.height;
+	info->pixelformat = colorInfos[head.bpp / 8 - 1].pf;
+	info->pitchBytes = head.bpp / 8 * head.width;
+	return new(std::nothrow) TgaRowReader(file, head, start + sizeof(head) + (head.bpp == 8 ? TGA_PALETTE_SIZE : 0));
+}
+bool backend::Tga::probe(KrbFile* file, KrbImageInfo* info) noexcept
+{
+	tga_head_t head;
+	if (file->read(&head, sizeof(head)) != sizeof(head)) return false;
+	switch (head.imagetype)
+	{
+	case 1: case 2: case 9: case 10:
+		break;
+	default:
+		return false;
+	}
+	if (head.idsize != 0 || head.xstart != 0 || head.ystart != 0) return false;
+	if (head.bpp != 8 && head.bpp != 16 && head.bpp != 24 && head.bpp != 32) return false;
+	if (head.width == 0 || head.height == 0) return false;
+	info->width = head.width;
+	info->height = head.height;
+	info->pixelformat = colorInfos[head.bpp / 8 - 1].pf;
+	info->pitchBytes = head.bpp / 8 * head.width;
+	return true;
+}
@@ -7,10 +7,17 @@ namespace kr
 {
 	namespace backend
 	{
+		class RowReader;
+
 		class Tga
 		{
 		public:
 			static bool load(KrbImageCallback* callback, KrbFile* file) noexcept;
+			static KrbImageDecoder* createDecoder(KrbImageCallback* callback) noexcept;
+			// nullptr if the file cannot seek to the rows, the file is left anywhere
+			static RowReader* openRows(KrbFile* file, KrbImageInfo* info, KrbImagePalette* palette) noexcept;
+			// the header only, the file is left anywhere
+			static bool probe(KrbFile* file, KrbImageInfo* info) noexcept;
 			static bool save(const KrbImageSaveInfo* info, KrbFile* file) noexcept;
 		};
 	}
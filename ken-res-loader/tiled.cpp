@@ -0,0 +1,333 @@
+
+#define __USE_FILE_OFFSET64
+#define __USE_LARGEFILE64
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BIT 64
+
+#include "tiled.h"
+#include "layout.h"
+#include "mipmap.h"
+#include "util.h"
+
+#include <string.h>
+#include <new>
+#include <vector>
+
+#ifdef _MSC_VER
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace kr;
+using namespace kr::backend;
+
+namespace
+{
+#pragma pack(push, 1)
+	struct TILED_HEADER
+	{
+		uint32_t signature; // written last, the files of the failed loads have none
+		uint32_t version;
+		int32_t pixelformat;
+		uint32_t width;
+		uint32_t height;
+		uint32_t tileWidth;
+		uint32_t tileHeight;
+		uint32_t pixelBytes;
+		uint64_t dataOffset;
+		uint32_t palette[256];
+	};
+#pragma pack(pop)
+
+	constexpr uint32_t TILED_VERSION = 1;
+	constexpr uint64_t TILED_DATA_OFFSET = 4096; // the tiles start on a page
+
+	// a new file mapped one window at a time
+	class MappedOutput
+	{
+	public:
+		~MappedOutput() noexcept
+		{
+			close(false);
+		}
+
+		bool create(const fchar_t* path, uint64_t size) noexcept
+		{
+			m_path = path;
+#ifdef _MSC_VER
+			SYSTEM_INFO system;
+			GetSystemInfo(&system);
+			m_granularity = system.dwAllocationGranularity;
+			m_file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (m_file == INVALID_HANDLE_VALUE) return false;
+			// extends the file
+			m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, nullptr);
+			return m_mapping != nullptr;
+#else
+			m_granularity = (uint64_t)sysconf(_SC_PAGESIZE);
+			m_file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if (m_file < 0) return false;
+			return ftruncate(m_file, (off_t)size) == 0;
+#endif
+		}
+		// the bytes [pos, pos + size), one window at a time
+		uint8_t* map(uint64_t pos, size_t size) noexcept
+		{
+			unmap();
+			uint64_t base = pos / m_granularity * m_granularity;
+			size_t offset = (size_t)(pos - base);
+#ifdef _MSC_VER
+			void* view = MapViewOfFile(m_mapping, FILE_MAP_WRITE, (DWORD)(base >> 32), (DWORD)base, offset + size);
+			if (!view) return nullptr;
+#else
+			void* view = mmap(nullptr, offset + size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, (off_t)base);
+			if (view == MAP_FAILED) return nullptr;
+#endif
+			m_view = view;
+			m_viewSize = offset + size;
+			return (uint8_t*)view + offset;
+		}
+		void unmap() noexcept
+		{
+			if (!m_view) return;
+#ifdef _MSC_VER
+			UnmapViewOfFile(m_view);
+#else
+			munmap(m_view, m_viewSize);
+#endif
+			m_view = nullptr;
+		}
+		// the file is deleted if it is not kept
+		void close(bool keep) noexcept
+		{
+			unmap();
+#ifdef _MSC_VER
+			if (m_mapping) CloseHandle(m_mapping);
+			m_mapping = nullptr;
+			if (m_file == INVALID_HANDLE_VALUE) return;
+			CloseHandle(m_file);
+			m_file = INVALID_HANDLE_VALUE;
+			if (!keep) DeleteFileW(m_path);
+#else
+			if (m_file < 0) return;
+			::close(m_file);
+			m_file = -1;
+			if (!keep) unlink(m_path);
+#endif
+		}
+
+	private:
+#ifdef _MSC_VER
+		HANDLE m_file = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = nullptr;
+#else
+		int m_file = -1;
+#endif
+		const fchar_t* m_path = nullptr;
+		uint64_t m_granularity = 4096;
+		void* m_view = nullptr;
+		size_t m_viewSize = 0;
+	};
+
+	// gathers a band of tileHeight rows and copies it to the tiles of the band
+	// the loaders without the row output write to a full buffer, if it fits in the budget
+	class TiledWriter :public KrbImageCallback
+	{
+	public:
+		TiledWriter(const fchar_t* path, const KrbTiledLoadOptions* options) noexcept
+			:m_path(path), m_options(options)
+		{
+			start = [](KrbImageCallback* _this, KrbImageInfo* info)->void* {
+				return static_cast<TiledWriter*>(_this)->begin(info);
+			};
+			row = [](KrbImageCallback* _this, uint32_t y)->uint8_t* {
+				TiledWriter* callback = static_cast<TiledWriter*>(_this);
+				uint32_t band = y / callback->m_tileHeight;
+				if (band != callback->m_bandIndex)
+				{
+					// the rows come in order, the previous band is complete
+					if (!callback->writeBand(callback->m_bandIndex, callback->m_band.data(), callback->m_tileHeight)) callback->m_failed = true;
+					callback->m_bandIndex = band;
+				}
+				return callback->m_band.data() + (size_t)callback->m_pitch * (y - band * callback->m_tileHeight);
+			};
+			palette = &m_palette;
+			flags = options->flags & ~ImageFlagBuiltinPng; // libpng streams the rows
+			requestFormat = options->requestFormat;
+		}
+
+		// writes the rest of the tiles and the header
+		bool finish() noexcept
+		{
+			if (!m_started || m_failed) return false;
+			uint32_t bands = (m_height + m_tileHeight - 1) / m_tileHeight;
+			if (m_rowByRow)
+			{
+				if (!writeBand(m_bandIndex, m_band.data(), m_height - m_bandIndex * m_tileHeight)) return false;
+			}
+			else
+			{
+				for (uint32_t band = 0; band < bands; band++)
+				{
+					uint32_t y = band * m_tileHeight;
+					uint32_t rows = m_height - y < m_tileHeight ? m_height - y : m_tileHeight;
+					if (!writeBand(band, m_band.data() + (size_t)m_pitch * y, rows)) return false;
+				}
+			}
+			TILED_HEADER* head = (TILED_HEADER*)m_output.map(0, sizeof(TILED_HEADER));
+			if (!head) return false;
+			head->version = TILED_VERSION;
+			head->pixelformat = m_pixelformat;
+			head->width = m_width;
+			head->height = m_height;
+			head->tileWidth = m_tileWidth;
+			head->tileHeight = m_tileHeight;
+			head->pixelBytes = m_pixelBytes;
+			head->dataOffset = TILED_DATA_OFFSET;
+			if (m_pixelformat == PixelFormatIndex) memcpy(head->palette, m_palette.color, sizeof(head->palette));
+			head->signature = "KRBT"_sig;
+			m_output.close(true);
+			return true;
+		}
+
+	private:
+		void* begin(KrbImageInfo* info) noexcept
+		{
+			if (!ImageLayout::isSupported(ImageLayoutMorton, info->pixelformat)) return nullptr; // the formats with whole-byte pixels
+			if (info->width == 0 || info->height == 0 || m_options->tileWidth == 0 || m_options->tileHeight == 0) return nullptr;
+			m_pixelformat = info->pixelformat;
+			m_width = info->width;
+			m_height = info->height;
+			m_pixelBytes = Mipmap::getLevelPitch(m_pixelformat, 1);
+			m_tileWidth = m_options->tileWidth;
+			m_tileHeight = m_options->tileHeight;
+			if ((uint64_t)m_tileWidth * m_pixelBytes > UINT32_MAX) return nullptr;
+			m_tilesX = (m_width + m_tileWidth - 1) / m_tileWidth;
+			m_rowByRow = info->rowByRow;
+
+			// the band of rows and the mapped tiles of it
+			uint64_t rowBytes = (uint64_t)m_width * m_pixelBytes;
+			uint64_t tileRowBytes = (uint64_t)m_tilesX * m_tileWidth * m_pixelBytes;
+			uint64_t budget = m_options->bandBudget;
+			if (m_rowByRow)
+			{
+				while (m_tileHeight > 1 && (rowBytes + tileRowBytes) * m_tileHeight > budget) m_tileHeight >>= 1;
+				if ((rowBytes + tileRowBytes) * m_tileHeight > budget) return nullptr;
+			}
+			else
+			{
+				while (m_tileHeight > 1 && tileRowBytes * m_tileHeight > budget) m_tileHeight >>= 1;
+				if ((uint64_t)info->pitchBytes * m_height + tileRowBytes * m_tileHeight > budget) return nullptr;
+			}
+			m_tileBytes = (size_t)m_tileWidth * m_tileHeight * m_pixelBytes;
+
+			uint64_t tilesY = (m_height + m_tileHeight - 1) / m_tileHeight;
+			if (!m_output.create(m_path, TILED_DATA_OFFSET + (uint64_t)m_tilesX * tilesY * m_tileBytes)) return nullptr;
+			try
+			{
+				if (m_rowByRow)
+				{
+					m_pitch = (uint32_t)rowBytes;
+					info->pitchBytes = m_pitch;
+					m_band.resize((size_t)rowBytes * m_tileHeight);
+				}
+				else
+				{
+					m_pitch = info->pitchBytes;
+					m_band.resize((size_t)m_pitch * m_height);
+				}
+			}
+			catch (...)
+			{
+				return nullptr;
+			}
+			m_started = true;
+			return m_band.data();
+		}
+
+		bool writeBand(uint32_t band, const uint8_t* src, uint32_t rows) noexcept
+		{
+			size_t bandBytes = (size_t)m_tilesX * m_tileBytes;
+			uint8_t* dest = m_output.map(TILED_DATA_OFFSET + (uint64_t)band * bandBytes, bandBytes);
+			if (!dest) return false;
+			// the file is zero-filled, the padding of the edge tiles is not written
+			size_t tilePitch = (size_t)m_tileWidth * m_pixelBytes;
+			for (uint32_t tx = 0; tx < m_tilesX; tx++)
+			{
+				uint32_t x = tx * m_tileWidth;
+				size_t count = (size_t)(m_width - x < m_tileWidth ? m_width - x : m_tileWidth) * m_pixelBytes;
+				uint8_t* tile = dest + (size_t)tx * m_tileBytes;
+				for (uint32_t dy = 0; dy < rows; dy++)
+				{
+					memcpy(tile + tilePitch * dy, src + (size_t)m_pitch * dy + (size_t)x * m_pixelBytes, count);
+				}
+			}
+			m_output.unmap();
+			return true;
+		}
+
+		const fchar_t* const m_path;
+		const KrbTiledLoadOptions* const m_options;
+		MappedOutput m_output;
+		KrbImagePalette m_palette = {};
+		kr_pixelformat_t m_pixelformat = PixelFormatInvalid;
+		uint32_t m_width = 0;
+		uint32_t m_height = 0;
+		uint32_t m_pixelBytes = 0;
+		uint32_t m_tileWidth = 0;
+		uint32_t m_tileHeight = 1;
+		uint32_t m_tilesX = 0;
+		size_t m_tileBytes = 0;
+		uint32_t m_pitch = 0;
+		std::vector<uint8_t> m_band; // a band of rows, or the full image without the row output
+		uint32_t m_bandIndex = 0;
+		bool m_rowByRow = false;
+		bool m_started = false;
+		bool m_failed = false;
+	};
+}
+
+bool TiledImage::load(KrbExtension extension, KrbFile* file, const fchar_t* path, const KrbTiledLoadOptions* options) noexcept
+{
+	TiledWriter writer(path, options);
+	if (!krb_load_image(extension, &writer, file)) return false;
+	return writer.finish();
+}
+KrbTiledImage* TiledImage::open(KrbFile* file) noexcept
+{
+	const TILED_HEADER* head = (const TILED_HEADER*)file->map(0, sizeof(TILED_HEADER));
+	if (!head || head->signature != "KRBT"_sig || head->version != TILED_VERSION) return nullptr;
+	if (head->pixelformat < 0 || head->pixelformat >= PixelFormatCount) return nullptr;
+	kr_pixelformat_t pixelformat = (kr_pixelformat_t)head->pixelformat;
+	if (!ImageLayout::isSupported(ImageLayoutMorton, pixelformat) || head->pixelBytes != Mipmap::getLevelPitch(pixelformat, 1)) return nullptr;
+	if (head->width == 0 || head->height == 0 || head->tileWidth == 0 || head->tileHeight == 0) return nullptr;
+	if ((uint64_t)head->tileWidth * head->pixelBytes > UINT32_MAX) return nullptr;
+
+	KrbTiledImageInfo info;
+	info.pixelformat = pixelformat;
+	info.width = head->width;
+	info.height = head->height;
+	info.tileWidth = head->tileWidth;
+	info.tileHeight = head->tileHeight;
+	info.tilesX = (info.width + info.tileWidth - 1) / info.tileWidth;
+	info.tilesY = (info.height + info.tileHeight - 1) / info.tileHeight;
+	info.tilePitchBytes = info.tileWidth * head->pixelBytes;
+	uint64_t tileBytes = (uint64_t)info.tilePitchBytes * info.tileHeight;
+	uint64_t size = tileBytes * info.tilesX * info.tilesY;
+	if (size / info.tilesX / info.tilesY != tileBytes || size > SIZE_MAX) return nullptr;
+	info.tileBytes = (size_t)tileBytes;
+	memcpy(info.palette.color, head->palette, sizeof(info.palette.color));
+
+	const uint8_t* data = (const uint8_t*)file->map(head->dataOffset, (size_t)size);
+	if (!data) return nullptr;
+	KrbTiledImage* image = new(std::nothrow) KrbTiledImage;
+	if (!image) return nullptr;
+	image->info = info;
+	image->data = data;
+	return image;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "include/common.h"
+#include "include/image.h"
+
+namespace kr
+{
+	class KrbTiledImage
+	{
+	public:
+		KrbTiledImageInfo info;
+		const uint8_t* data; // the tiles in the mapped file, row by row
+	};
+
+	namespace backend
+	{
+		// the tiled files of krb_load_image_tiled
+		class TiledImage
+		{
+		public:
+			static bool load(KrbExtension extension, KrbFile* file, const fchar_t* path, const KrbTiledLoadOptions* options) noexcept;
+			static KrbTiledImage* open(KrbFile* file) noexcept;
+		};
+	}
+}
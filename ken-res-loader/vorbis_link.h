@@ -0,0 +1,39 @@
+#pragma once
+
+#include "include/common.h"
+#include "libloader.h"
+
+#include <stdio.h>
+#include <vorbis/codec.h>
+#include <vorbis/vorbisfile.h>
+
+KRL_BEGIN(LibVorbis, L"libvorbisd.dll", L"libvorbis.dll")
+KRL_END()
+
+KRL_BEGIN(LibVorbisFile, L"libvorbisfiled.dll", L"libvorbisfile.dll")
+KRL_IMPORT(ov_time_total)
+KRL_IMPORT(ov_pcm_total)
+KRL_IMPORT(ov_pcm_seek)
+KRL_IMPORT(ov_read)
+KRL_IMPORT(ov_info)
+KRL_IMPORT(ov_open_callbacks)
+KRL_IMPORT(ov_clear)
+KRL_END()
+
+// the datasource is the KrbFile
+const ov_callbacks KRB_OV_CALLBACKS = {
+	[](void* buffer, size_t elementSize, size_t elementCount, void* fp)->size_t {
+		return ((kr::KrbFile*)fp)->read(buffer, elementSize * elementCount);
+	},
+	[](void* fp, ogg_int64_t offset, int whence)->int {
+		switch (whence)
+		{
+		case SEEK_SET: ((kr::KrbFile*)fp)->seek_set(offset); break;
+		case SEEK_CUR: ((kr::KrbFile*)fp)->seek_cur(offset); break;
+		case SEEK_END: ((kr::KrbFile*)fp)->seek_end(offset); break;
+		}
+		return 0;
+	},
+	[](void* fp)->int { return 0; },
+	[](void* fp)->long { return (long)((kr::KrbFile*)fp)->tell(); }
+};
@@ -0,0 +1,54 @@
+#include "wav.h"
+#include "util.h"
+
+#include <string.h>
+
+using namespace kr;
+using namespace kr::backend;
+
+bool Wav::readHeader(KrbFile* file, KrbSoundInfo* info) noexcept
+{
+	uint32_t riff[3];
+	if (file->read(riff, sizeof(riff)) != sizeof(riff)) return false;
+	if (riff[0] != "RIFF"_sig || riff[2] != "WAVE"_sig) return false;
+
+	bool hasFormat = false;
+	for (;;)
+	{
+		uint32_t chunk[2];
+		if (file->read(chunk, sizeof(chunk)) != sizeof(chunk)) return false;
+		uint32_t size = chunk[1];
+		if (chunk[0] == "fmt "_sig)
+		{
+			// WAVEFORMAT without cbSize is 16 bytes
+			if (size < sizeof(KrbWaveFormat) - 2) return false;
+			size_t read = size < sizeof(info->format) ? size : sizeof(info->format);
+			memset(&info->format, 0, sizeof(info->format));
+			if (file->read(&info->format, read) != read) return false;
+			if (info->format.formatTag != WAVE_FORMAT_TAG || info->format.blockAlign == 0 || info->format.bytesPerSec == 0) return false;
+			hasFormat = true;
+			file->seek_cur(size - read + (size & 1));
+			continue;
+		}
+		if (chunk[0] == "data"_sig)
+		{
+			if (!hasFormat) return false;
+			info->totalBytes = size;
+			info->duration = (double)size / info->format.bytesPerSec;
+			return true;
+		}
+		file->seek_cur((uint64_t)size + (size & 1));
+	}
+}
+void Wav::setPcmFormat(KrbSoundInfo* info, uint32_t channels, uint32_t sampleRate, uint64_t frames) noexcept
+{
+	info->format.formatTag = WAVE_FORMAT_TAG;
+	info->format.channels = (uint16_t)channels;
+	info->format.bitsPerSample = 16;
+	info->format.blockAlign = (uint16_t)(channels * 2);
+	info->format.samplesPerSec = sampleRate;
+	info->format.bytesPerSec = sampleRate * info->format.blockAlign;
+	info->format.size = sizeof(info->format);
+	info->duration = (double)frames / sampleRate;
+	info->totalBytes = (uint32_t)(frames * info->format.blockAlign);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "include/common.h"
+#include "include/sound.h"
+
+namespace kr
+{
+	namespace backend
+	{
+		constexpr uint16_t WAVE_FORMAT_TAG = 1; // PCM
+
+		class Wav
+		{
+		public:
+			// the chunk headers until fmt and data, the file is left at the start of the data
+			static bool readHeader(KrbFile* file, KrbSoundInfo* info) noexcept;
+			// 16-bit PCM, the format of the decoded streams
+			static void setPcmFormat(KrbSoundInfo* info, uint32_t channels, uint32_t sampleRate, uint64_t frames) noexcept;
+		};
+	}
+}
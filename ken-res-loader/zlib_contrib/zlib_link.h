@@ -16,4 +16,7 @@ KRL_IMPORT(deflateInit2_)
 KRL_IMPORT(get_crc_table)
 KRL_IMPORT(deflateEnd)
 KRL_IMPORT(deflate)
+KRL_IMPORT(deflateBound)
+KRL_IMPORT(adler32)
+KRL_IMPORT(adler32_combine)
 KRL_END()
@@ -3,8 +3,12 @@
 
 #include "../ken-res-loader/include/compress.h"
 #include "../ken-res-loader/include/image.h"
+#include "../ken-res-loader/include/probe.h"
 #include "../ken-res-loader/include/sound.h"
+#include "../ken-res-loader/openmp3/src/synthesis.h"
 #include <vector>
+#include <chrono>
+#include <math.h>
 using namespace kr;
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
@@ -31,6 +35,204 @@ void loadImage(KrbExtension ext, const wchar_t* filepath) noexcept
 	delete[] loader.data;
 }
 
+// the pixels and the info of the last load, the fields of KrbImageCallback are set before load
+struct ImageLoader : KrbImageCallback
+{
+	KrbImageInfo info;
+	std::vector<uint8_t> data;
+
+	ImageLoader() noexcept
+	{
+		palette = nullptr;
+		start = [](KrbImageCallback* _this, KrbImageInfo* _info)->void* {
+			ImageLoader* loader = (ImageLoader*)_this;
+			loader->info = *_info;
+			loader->data.resize(krb_image_level_offset(_info, _info->mipLevels));
+			return loader->data.data();
+		};
+	}
+	void load(KrbExtension extension, const wchar_t* filepath)
+	{
+		KrbFile file;
+		bool file_open = krb_fopen(&file, filepath, L"rb");
+		Assert::IsTrue(file_open, L"resource file not found");
+		bool res = krb_load_image(extension, this, &file);
+		file.close();
+		Assert::IsTrue(res, L"image Load failed");
+	}
+};
+
+// 16 [R,G,B,A] pixels of a block written by krb_load_image, BC7 is mode 6 only
+bool decodeBcBlock(kr_pixelformat_t format, const uint8_t* block, uint8_t (*pixels)[4])
+{
+	auto color = [](const uint8_t* block, uint8_t (*pixels)[4], bool bc1) {
+		uint16_t c[2] = { (uint16_t)(block[0] | (block[1] << 8)), (uint16_t)(block[2] | (block[3] << 8)) };
+		int palette[4][4];
+		for (int i = 0; i < 2; i++)
+		{
+			int r = c[i] >> 11, g = (c[i] >> 5) & 63, b = c[i] & 31;
+			palette[i][0] = (r << 3) | (r >> 2);
+			palette[i][1] = (g << 2) | (g >> 4);
+			palette[i][2] = (b << 3) | (b >> 2);
+			palette[i][3] = 255;
+		}
+		for (int ch = 0; ch < 3; ch++)
+		{
+			if (!bc1 || c[0] > c[1])
+			{
+				palette[2][ch] = (2 * palette[0][ch] + palette[1][ch]) / 3;
+				palette[3][ch] = (palette[0][ch] + 2 * palette[1][ch]) / 3;
+			}
+			else
+			{
+				palette[2][ch] = (palette[0][ch] + palette[1][ch]) / 2;
+				palette[3][ch] = 0;
+			}
+		}
+		palette[2][3] = 255;
+		palette[3][3] = !bc1 || c[0] > c[1] ? 255 : 0;
+		uint32_t bits = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+		for (int i = 0; i < 16; i++)
+		{
+			for (int ch = 0; ch < 4; ch++) pixels[i][ch] = (uint8_t)palette[(bits >> (i * 2)) & 3][ch];
+		}
+	};
+	auto single = [](const uint8_t* block, uint8_t (*pixels)[4], int channel) {
+		int e0 = block[0], e1 = block[1];
+		int palette[8] = { e0, e1 };
+		if (e0 > e1)
+		{
+			for (int i = 1; i < 7; i++) palette[i + 1] = ((7 - i) * e0 + i * e1 + 3) / 7;
+		}
+		else
+		{
+			for (int i = 1; i < 5; i++) palette[i + 1] = ((5 - i) * e0 + i * e1 + 2) / 5;
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+		uint64_t bits = 0;
+		for (int i = 0; i < 6; i++) bits |= (uint64_t)block[2 + i] << (i * 8);
+		for (int i = 0; i < 16; i++) pixels[i][channel] = (uint8_t)palette[(bits >> (i * 3)) & 7];
+	};
+
+	switch (format)
+	{
+	case PixelFormatBC1:
+		color(block, pixels, true);
+		return true;
+	case PixelFormatBC3:
+		color(block + 8, pixels, false);
+		single(block, pixels, 3);
+		return true;
+	case PixelFormatBC4:
+		memset(pixels, 0, 16 * 4);
+		single(block, pixels, 0);
+		return true;
+	case PixelFormatBC5:
+		memset(pixels, 0, 16 * 4);
+		single(block, pixels, 0);
+		single(block + 8, pixels, 1);
+		return true;
+	case PixelFormatBC7:
+	{
+		int position = 0;
+		auto get = [&](int bits) {
+			int value = 0;
+			for (int i = 0; i < bits; i++, position++) value |= ((block[position >> 3] >> (position & 7)) & 1) << i;
+			return value;
+		};
+		if (get(7) != 0x40) return false;
+		int endpoints[2][4];
+		for (int ch = 0; ch < 4; ch++)
+		{
+			endpoints[0][ch] = get(7) << 1;
+			endpoints[1][ch] = get(7) << 1;
+		}
+		for (int e = 0; e < 2; e++)
+		{
+			int pbit = get(1);
+			for (int ch = 0; ch < 4; ch++) endpoints[e][ch] |= pbit;
+		}
+		static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		for (int i = 0; i < 16; i++)
+		{
+			int w = weights[get(i == 0 ? 3 : 4)];
+			for (int ch = 0; ch < 4; ch++) pixels[i][ch] = (uint8_t)(((64 - w) * endpoints[0][ch] + w * endpoints[1][ch] + 32) >> 6);
+		}
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+namespace OpenMP3
+{
+	extern const Float32 kSynthDtbl[512];
+}
+
+// MPEG1 Layer III 44.1kHz stereo, valid side info and random main data, no Xing frame
+// with the reservoir, the frames after the first start 4 bytes back in the frame before
+std::vector<uint8_t> makeMp3(uint32_t frames, uint32_t seed = 1, uint32_t kbps = 128, bool reservoir = false)
+{
+	static const uint32_t bitrates[] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 };
+	uint32_t bitrateIndex = 0;
+	while (bitrates[bitrateIndex] != kbps) bitrateIndex++;
+	const uint32_t bitrate = kbps * 1000;
+	std::vector<uint8_t> mp3;
+	auto random = [&seed](uint32_t range)->uint32_t {
+		seed = seed * 1664525 + 1013904223;
+		return (seed >> 8) % range;
+	};
+	const uint32_t tables[] = { 0, 1, 2, 3, 5, 6, 7, 8, 9, 10, 11, 12, 13, 15, 16, 17, 24, 25 };
+	uint32_t rest = 0;
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		rest += 144 * bitrate % 44100;
+		uint32_t padding = rest >= 44100 ? 1 : 0;
+		if (padding) rest -= 44100;
+		const uint32_t frameBytes = 144 * bitrate / 44100 + padding;
+		const uint32_t mainData = frameBytes - 4 - 32;
+		uint8_t frame[4 + 32] = { 0xff, 0xfb, (uint8_t)((bitrateIndex << 4) | (padding << 1)), 0x40 };
+		uint32_t bit = 32;
+		auto put = [&](uint32_t value, uint32_t bits) {
+			for (uint32_t k = bits; k-- > 0; bit++) frame[bit >> 3] |= ((value >> k) & 1) << (7 - (bit & 7));
+		};
+		put(reservoir && i != 0 ? 4 : 0, 9);
+		put(0, 3 + 4 + 4);
+		const uint32_t granuleBits = mainData * 8 / 4 - 8;
+		for (uint32_t g = 0; g < 4; g++)
+		{
+			put(granuleBits, 12);
+			put(random(25), 9);
+			put(120 + random(51), 8);
+			put(random(16), 4);
+			bool windowSwitching = random(10) < 3;
+			put(windowSwitching, 1);
+			if (windowSwitching)
+			{
+				uint32_t blockType = 1 + random(3);
+				put(blockType, 2);
+				put(blockType == 2 ? random(2) : 0, 1);
+				for (int k = 0; k < 2; k++) put(tables[random(18)], 5);
+				for (int k = 0; k < 3; k++) put(random(8), 3);
+			}
+			else
+			{
+				for (int k = 0; k < 3; k++) put(tables[random(18)], 5);
+				// region0 + region1 + 2 is at most the 22 long bands
+				uint32_t region0 = random(16);
+				put(region0, 4);
+				put(random(std::min(8u, 21 - region0)), 3);
+			}
+			put(random(8), 3);
+		}
+		mp3.insert(mp3.end(), frame, frame + sizeof(frame));
+		for (uint32_t k = 0; k < mainData; k++) mp3.push_back((uint8_t)random(256));
+	}
+	return mp3;
+}
+
 namespace test
 {
 	TEST_CLASS(test)
@@ -64,6 +266,1365 @@ namespace test
 		{
 			loadImage(KrbExtension::ImageJpg, L"../../../test/jpeg.jpg");
 		}
+		TEST_METHOD(savepng)
+		{
+			ImageLoader source;
+			source.load(KrbExtension::ImagePng, L"../../../test/png.png");
+
+			KrbImageSaveInfo info;
+			info.pixelformat = source.info.pixelformat;
+			info.width = source.info.width;
+			info.height = source.info.height;
+			info.pitchBytes = source.info.pitchBytes;
+			info.data = source.data.data();
+			info.palette = nullptr;
+			info.pngPreset = PngPresetFast;
+			{
+				KrbFile file;
+				bool file_open = krb_fopen(&file, L"savepng.png", L"wb");
+				Assert::IsTrue(file_open, L"output file not opened");
+				bool res = krb_save_image(KrbExtension::ImagePng, &info, &file);
+				file.close();
+				Assert::IsTrue(res, L"image Save failed");
+			}
+
+			ImageLoader saved;
+			saved.load(KrbExtension::ImagePng, L"savepng.png");
+			Assert::IsTrue(saved.data == source.data, L"saved pixels not matched");
+		}
+		TEST_METHOD(savepngbands)
+		{
+			// more than one band of 128 KiB filtered rows, gradients with noise so every filter is chosen
+			const uint32_t width = 600, height = 300;
+			std::vector<uint8_t> pixels((size_t)width * height * 4);
+			uint32_t seed = 1;
+			for (uint32_t y = 0; y < height; y++)
+			{
+				for (uint32_t x = 0; x < width; x++)
+				{
+					seed = seed * 1103515245 + 12345;
+					uint8_t* pixel = pixels.data() + ((size_t)y * width + x) * 4;
+					pixel[0] = (uint8_t)(x + y);
+					pixel[1] = (uint8_t)(y * 3);
+					pixel[2] = (uint8_t)((x / 16 + y / 16) & 1 ? 255 : x);
+					pixel[3] = (uint8_t)(y < height / 2 ? 255 : (seed >> 24));
+				}
+			}
+
+			// the loaders give ARGB8
+			std::vector<uint8_t> expected(pixels);
+			for (size_t i = 0; i < expected.size(); i += 4) std::swap(expected[i], expected[i + 2]);
+
+			for (kr_pngpreset_t preset : { PngPresetFast, PngPresetDefault, PngPresetMax })
+			{
+				KrbImageSaveInfo info;
+				info.pixelformat = PixelFormatABGR8;
+				info.width = width;
+				info.height = height;
+				info.pitchBytes = width * 4;
+				info.data = pixels.data();
+				info.palette = nullptr;
+				info.pngPreset = preset;
+				{
+					KrbFile file;
+					bool file_open = krb_fopen(&file, L"savepngbands.png", L"wb");
+					Assert::IsTrue(file_open, L"output file not opened");
+					bool res = krb_save_image(KrbExtension::ImagePng, &info, &file);
+					file.close();
+					Assert::IsTrue(res, L"image Save failed");
+				}
+
+				// the same file without the band index goes through libpng
+				std::vector<uint8_t> banded;
+				{
+					KrbFile file;
+					bool file_open = krb_fopen(&file, L"savepngbands.png", L"rb");
+					Assert::IsTrue(file_open, L"saved file not found");
+					file.seek_end(0);
+					banded.resize((size_t)file.tell());
+					file.seek_set(0);
+					Assert::AreEqual(banded.size(), file.read(banded.data(), banded.size()), L"saved file not read");
+					file.close();
+				}
+				std::vector<uint8_t> plain(banded.begin(), banded.begin() + 8);
+				uint32_t bandCount = 0;
+				for (size_t pos = 8; pos + 12 <= banded.size();)
+				{
+					size_t size = ((size_t)banded[pos] << 24) | ((size_t)banded[pos + 1] << 16) | ((size_t)banded[pos + 2] << 8) | banded[pos + 3];
+					const uint8_t* chunk = banded.data() + pos;
+					if (memcmp(chunk + 4, "krBI", 4) == 0) bandCount = ((uint32_t)chunk[16] << 24) | ((uint32_t)chunk[17] << 16) | ((uint32_t)chunk[18] << 8) | chunk[19];
+					else plain.insert(plain.end(), chunk, chunk + size + 12);
+					pos += size + 12;
+				}
+				Assert::IsTrue(bandCount > 1, L"band index not written");
+
+				ImageLoader bandDecoded;
+				bandDecoded.requestFormat = PixelFormatARGB8;
+				bandDecoded.load(KrbExtension::ImagePng, L"savepngbands.png");
+
+				ImageLoader libpngDecoded;
+				libpngDecoded.requestFormat = PixelFormatARGB8;
+				KrbFile file;
+				Assert::IsTrue(krb_mopen(&file, plain.data(), plain.size()));
+				bool res = krb_load_image(KrbExtension::ImagePng, &libpngDecoded, &file);
+				file.close();
+				Assert::IsTrue(res, L"libpng Load failed");
+
+				Assert::AreEqual((int)PixelFormatARGB8, (int)bandDecoded.info.pixelformat, L"format not matched");
+				Assert::AreEqual((int)PixelFormatARGB8, (int)libpngDecoded.info.pixelformat, L"format not matched");
+				Assert::IsTrue(bandDecoded.data == libpngDecoded.data, L"banded pixels not matched");
+				Assert::IsTrue(libpngDecoded.data == expected, L"saved pixels not matched");
+
+				// a band index length past the chunk limit is refused before it is allocated
+				std::vector<uint8_t> oversized = banded;
+				Assert::IsTrue(memcmp(oversized.data() + 33 + 4, "krBI", 4) == 0, L"band index not after IHDR");
+				oversized[33] = oversized[34] = oversized[35] = 0xff;
+				oversized[36] = 0xf0;
+				ImageLoader oversizedDecoded;
+				oversizedDecoded.requestFormat = PixelFormatARGB8;
+				Assert::IsTrue(krb_mopen(&file, oversized.data(), oversized.size()));
+				res = krb_load_image(KrbExtension::ImagePng, &oversizedDecoded, &file);
+				file.close();
+				Assert::IsFalse(res, L"oversized band index loaded");
+			}
+
+			// an indexed image needs its palette
+			uint8_t indices[16] = {};
+			KrbImageSaveInfo info;
+			info.pixelformat = PixelFormatIndex;
+			info.width = 4;
+			info.height = 4;
+			info.pitchBytes = 4;
+			info.data = indices;
+			info.palette = nullptr;
+			info.pngPreset = PngPresetFast;
+			std::vector<uint8_t> output(1024);
+			KrbFile file;
+			Assert::IsTrue(krb_mopen(&file, output.data(), output.size()));
+			Assert::IsFalse(krb_save_image(KrbExtension::ImagePng, &info, &file), L"indexed image saved without a palette");
+			file.close();
+		}
+		TEST_METHOD(builtinpng)
+		{
+			// average milliseconds of the repeated loads
+			auto load = [](ImageLoader* loader, uint32_t flags, int repeat)->double {
+				loader->flags = flags;
+				auto begin = std::chrono::steady_clock::now();
+				for (int i = 0; i < repeat; i++) loader->load(KrbExtension::ImagePng, L"../../../test/png.png");
+				std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+				return elapsed.count() / repeat;
+			};
+
+			constexpr int REPEAT = 100;
+			ImageLoader libpng;
+			double libpngTime = load(&libpng, ImageFlagNone, REPEAT);
+			ImageLoader builtin;
+			double builtinTime = load(&builtin, ImageFlagBuiltinPng, REPEAT);
+			Assert::IsTrue(builtin.info.pixelformat == libpng.info.pixelformat, L"pixel format not matched");
+			Assert::IsTrue(builtin.data == libpng.data, L"decoded pixels not matched");
+
+			wchar_t message[256];
+			swprintf(message, 256, L"png.png libpng: %.3fms, builtin: %.3fms\n", libpngTime, builtinTime);
+			Logger::WriteMessage(message);
+
+			ImageLoader bgra;
+			bgra.requestFormat = PixelFormatABGR8;
+			load(&bgra, ImageFlagBuiltinPng, 1);
+			Assert::IsTrue(bgra.info.pixelformat == PixelFormatABGR8, L"requested format not matched");
+		}
+		TEST_METHOD(saveqoi)
+		{
+			auto load = [](ImageLoader* loader, KrbExtension extension, const wchar_t* filepath) {
+				loader->flags = ImageFlagBuiltinPng;
+				loader->requestFormat = PixelFormatABGR8;
+				loader->load(extension, filepath);
+			};
+			auto save = [](const ImageLoader& source, KrbExtension extension, const wchar_t* filepath) {
+				KrbImageSaveInfo info;
+				info.pixelformat = source.info.pixelformat;
+				info.width = source.info.width;
+				info.height = source.info.height;
+				info.pitchBytes = source.info.pitchBytes;
+				info.data = (void*)source.data.data();
+				info.palette = nullptr;
+				info.pngPreset = PngPresetFast;
+				KrbFile file;
+				bool file_open = krb_fopen(&file, filepath, L"wb");
+				Assert::IsTrue(file_open, L"output file not opened");
+				bool res = krb_save_image(extension, &info, &file);
+				file.close();
+				Assert::IsTrue(res, L"image Save failed");
+			};
+			using clock = std::chrono::steady_clock;
+			auto elapsed = [](clock::time_point begin)->double {
+				return std::chrono::duration<double, std::milli>(clock::now() - begin).count();
+			};
+
+			ImageLoader source;
+			load(&source, KrbExtension::ImagePng, L"../../../test/png.png");
+
+			// the same image through both codecs
+			auto begin = clock::now();
+			save(source, KrbExtension::ImageQoi, L"saveqoi.qoi");
+			double qoiSave = elapsed(begin);
+			begin = clock::now();
+			save(source, KrbExtension::ImagePng, L"saveqoi.png");
+			double pngSave = elapsed(begin);
+
+			ImageLoader qoi;
+			begin = clock::now();
+			load(&qoi, KrbExtension::ImageQoi, L"saveqoi.qoi");
+			double qoiLoad = elapsed(begin);
+			ImageLoader png;
+			begin = clock::now();
+			load(&png, KrbExtension::ImagePng, L"saveqoi.png");
+			double pngLoad = elapsed(begin);
+			Assert::IsTrue(qoi.info.pixelformat == PixelFormatABGR8, L"requested format not matched");
+			Assert::IsTrue(qoi.data == source.data, L"saved pixels not matched");
+
+			// runs of 62 pixels over many output buffers
+			ImageLoader uniform;
+			uniform.info.pixelformat = PixelFormatARGB8;
+			uniform.info.width = 3000;
+			uniform.info.height = 2000;
+			uniform.info.pitchBytes = 3000 * 4;
+			uniform.data.resize((size_t)uniform.info.pitchBytes * uniform.info.height);
+			for (size_t i = 0; i < uniform.data.size(); i += 4)
+			{
+				uniform.data[i] = 0xff;
+				uniform.data[i + 1] = 0x20;
+				uniform.data[i + 2] = 0x40;
+				uniform.data[i + 3] = 0x80;
+			}
+			save(uniform, KrbExtension::ImageQoi, L"saveqoi_uniform.qoi");
+			ImageLoader uniformQoi;
+			uniformQoi.requestFormat = PixelFormatARGB8;
+			uniformQoi.load(KrbExtension::ImageQoi, L"saveqoi_uniform.qoi");
+			Assert::IsTrue(uniformQoi.info.pixelformat == PixelFormatARGB8, L"requested format not matched");
+			Assert::IsTrue(uniformQoi.data == uniform.data, L"saved uniform pixels not matched");
+
+			wchar_t message[256];
+			swprintf(message, 256, L"png.png save qoi: %.3fms, png: %.3fms, load qoi: %.3fms, png: %.3fms\n", qoiSave, pngSave, qoiLoad, pngLoad);
+			Logger::WriteMessage(message);
+		}
+		TEST_METHOD(premultiplylinear)
+		{
+			auto load = [](ImageLoader* loader, uint32_t flags, kr_pixelformat_t requestFormat) {
+				loader->flags = ImageFlagBuiltinPng | flags;
+				loader->requestFormat = requestFormat;
+				loader->load(KrbExtension::ImagePng, L"../../../test/png.png");
+			};
+
+			ImageLoader source;
+			load(&source, ImageFlagNone, PixelFormatABGR8);
+			ImageLoader premultiplied;
+			load(&premultiplied, ImageFlagPremultiplyAlpha, PixelFormatABGR8);
+			ImageLoader linear;
+			load(&linear, ImageFlagPremultiplyAlpha | ImageFlagSrgbToLinear, PixelFormatInvalid);
+			Assert::IsTrue(premultiplied.info.pixelformat == PixelFormatABGR8, L"premultiplied format not matched");
+			Assert::IsTrue(linear.info.pixelformat == PixelFormatRGBA32F, L"linear format not matched");
+
+			for (uint32_t y = 0; y < source.info.height; y++)
+			{
+				const uint8_t* src = source.data.data() + (size_t)source.info.pitchBytes * y;
+				const uint8_t* pm = premultiplied.data.data() + (size_t)premultiplied.info.pitchBytes * y;
+				const float* lin = (const float*)(linear.data.data() + (size_t)linear.info.pitchBytes * y);
+				for (uint32_t x = 0; x < source.info.width * 4; x++)
+				{
+					uint32_t alpha = src[x | 3];
+					uint8_t expected = (x & 3) == 3 ? src[x] : (uint8_t)((src[x] * alpha + 127) / 255);
+					Assert::IsTrue(pm[x] == expected, L"premultiplied pixels not matched");
+
+					float c = src[x] / 255.f;
+					float expectedLinear = (x & 3) == 3 ? c : (c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f)) * (alpha / 255.f);
+					Assert::IsTrue(fabsf(lin[x] - expectedLinear) < 1e-5f, L"linear pixels not matched");
+				}
+			}
+		}
+		TEST_METHOD(progress)
+		{
+			struct Source
+			{
+				const wchar_t* path;
+				const wchar_t* reference; // the same pixels, not interlaced or progressive
+				KrbExtension extension;
+				uint32_t minPasses;
+			};
+			for (const Source& source : {
+				Source{ L"../../../test/interlaced.png", L"../../../test/png.png", KrbExtension::ImagePng, 7 },
+				Source{ L"../../../test/progressive.jpg", L"../../../test/jpeg.jpg", KrbExtension::ImageJpg, 2 } })
+			{
+				struct Loader : ImageLoader
+				{
+					std::vector<uint32_t> passes;
+					bool final = false;
+					bool monotonic = true;
+				};
+				Loader loader;
+				loader.progress = [](KrbImageCallback* _this, uint32_t pass, bool final) {
+					Loader* loader = (Loader*)_this;
+					if (loader->final) loader->monotonic = false;
+					if (!loader->passes.empty() && pass <= loader->passes.back()) loader->monotonic = false;
+					loader->passes.push_back(pass);
+					loader->final = final;
+				};
+				loader.load(source.extension, source.path);
+				Assert::IsTrue(loader.passes.size() >= source.minPasses, L"passes not reported");
+				Assert::AreEqual(1u, loader.passes.front(), L"first pass not matched");
+				Assert::IsTrue(loader.monotonic, L"passes not increasing");
+				Assert::IsTrue(loader.final, L"last pass not final");
+
+				ImageLoader reference;
+				reference.load(source.extension, source.reference);
+				Assert::AreEqual((int)reference.info.pixelformat, (int)loader.info.pixelformat, L"format not matched");
+				Assert::IsTrue(reference.data == loader.data, L"final pixels not matched");
+			}
+		}
+		TEST_METHOD(imagestatistics)
+		{
+			struct Loader : ImageLoader
+			{
+				KrbImageInfo finished;
+				bool called = false;
+			};
+			Loader loader;
+			loader.requestFormat = PixelFormatABGR8;
+			loader.finish = [](KrbImageCallback* _this, const KrbImageInfo* _info) {
+				Loader* loader = (Loader*)_this;
+				loader->finished = *_info;
+				loader->called = true;
+			};
+			loader.load(KrbExtension::ImagePng, L"../../../test/png.png");
+			Assert::IsTrue(loader.called && loader.finished.hasStatistics, L"statistics not filled");
+
+			uint8_t minAlpha = 255;
+			uint8_t maxAlpha = 0;
+			bool binary = true;
+			bool gray = true;
+			for (uint32_t y = 0; y < loader.info.height; y++)
+			{
+				const uint8_t* p = loader.data.data() + (size_t)loader.info.pitchBytes * y;
+				for (uint32_t x = 0; x < loader.info.width; x++, p += 4)
+				{
+					if (p[3] < minAlpha) minAlpha = p[3];
+					if (p[3] > maxAlpha) maxAlpha = p[3];
+					if (p[3] != 0 && p[3] != 255) binary = false;
+					if (p[0] != p[1] || p[1] != p[2]) gray = false;
+				}
+			}
+			Assert::IsTrue(loader.finished.minAlpha == minAlpha && loader.finished.maxAlpha == maxAlpha, L"alpha range not matched");
+			Assert::IsTrue(loader.finished.allOpaque == (minAlpha == 255), L"opaque flag not matched");
+			Assert::IsTrue(loader.finished.binaryAlpha == binary, L"binary alpha flag not matched");
+			Assert::IsTrue(loader.finished.grayscale == gray, L"grayscale flag not matched");
+		}
+		TEST_METHOD(imagelayout)
+		{
+			auto load = [](ImageLoader* loader, kr_imagelayout_t layout) {
+				loader->requestFormat = PixelFormatABGR8;
+				loader->layout = layout;
+				loader->load(KrbExtension::ImagePng, L"../../../test/png.png");
+				Assert::IsTrue(loader->info.layout == layout, L"layout not matched");
+			};
+
+			ImageLoader linear, tiled, planar;
+			load(&linear, ImageLayoutLinear);
+			load(&tiled, ImageLayoutTiled4x4);
+			load(&planar, ImageLayoutPlanar);
+			for (uint32_t y = 0; y < linear.info.height; y++)
+			{
+				for (uint32_t x = 0; x < linear.info.width; x++)
+				{
+					const uint8_t* src = linear.data.data() + (size_t)linear.info.pitchBytes * y + x * 4;
+					const uint8_t* tile = tiled.data.data() + (size_t)tiled.info.pitchBytes * (y / 4) + (x / 4) * 64 + ((y % 4) * 4 + x % 4) * 4;
+					Assert::IsTrue(memcmp(src, tile, 4) == 0, L"tiled pixels not matched");
+					for (uint32_t c = 0; c < 4; c++)
+					{
+						const uint8_t* plane = planar.data.data() + (size_t)planar.info.pitchBytes * (linear.info.height * c + y);
+						Assert::IsTrue(plane[x] == src[c], L"planar pixels not matched");
+					}
+				}
+			}
+		}
+		TEST_METHOD(loadtiled)
+		{
+			ImageLoader linear;
+			linear.load(KrbExtension::ImagePng, L"../../../test/png.png");
+
+			KrbTiledLoadOptions options;
+			options.tileWidth = 16;
+			options.tileHeight = 16;
+			options.bandBudget = 64 << 10;
+			KrbFile file;
+			bool file_open = krb_fopen(&file, L"../../../test/png.png", L"rb");
+			Assert::IsTrue(file_open, L"resource file not found");
+			bool res = krb_load_image_tiled(KrbExtension::ImagePng, &file, L"tiled.krbt", &options);
+			file.close();
+			Assert::IsTrue(res, L"tiled load failed");
+
+			KrbFile mapped;
+			Assert::IsTrue(krb_fmap(&mapped, L"tiled.krbt"), L"tiled file not found");
+			KrbTiledImage* image = krb_tiled_open(&mapped);
+			Assert::IsNotNull(image, L"tiled open failed");
+			const KrbTiledImageInfo* info = krb_tiled_info(image);
+			Assert::IsTrue(info->width == linear.info.width && info->height == linear.info.height, L"size not matched");
+			uint32_t pixelBytes = info->tilePitchBytes / info->tileWidth;
+			for (uint32_t y = 0; y < info->height; y++)
+			{
+				for (uint32_t x = 0; x < info->width; x++)
+				{
+					const uint8_t* tile = (const uint8_t*)krb_tiled_tile(image, x / info->tileWidth, y / info->tileHeight);
+					const uint8_t* pixel = tile + (size_t)info->tilePitchBytes * (y % info->tileHeight) + (x % info->tileWidth) * pixelBytes;
+					const uint8_t* src = linear.data.data() + (size_t)linear.info.pitchBytes * y + x * pixelBytes;
+					Assert::IsTrue(memcmp(src, pixel, pixelBytes) == 0, L"tiled pixels not matched");
+				}
+			}
+			krb_tiled_close(image);
+			mapped.close();
+		}
+		TEST_METHOD(lazyopen)
+		{
+			ImageLoader linear;
+			linear.load(KrbExtension::ImagePng, L"../../../test/png.png");
+
+			KrbFile file;
+			bool file_open = krb_fopen(&file, L"../../../test/png.png", L"rb");
+			Assert::IsTrue(file_open, L"resource file not found");
+			KrbImage* image = krb_open_image(KrbExtension::ImagePng, &file);
+			Assert::IsNotNull(image, L"image open failed");
+			const KrbImageInfo* info = krb_image_info(image);
+			Assert::IsTrue(info->width == linear.info.width && info->height == linear.info.height, L"size not matched");
+
+			// the lower half first, the upper half decodes again from the start
+			uint32_t half = info->height / 2;
+			uint32_t ranges[2][2] = { { half, info->height }, { 0, half } };
+			for (auto& range : ranges)
+			{
+				const uint8_t* rows = krb_image_lock_rows(image, range[0], range[1]);
+				Assert::IsNotNull(rows, L"rows lock failed");
+				for (uint32_t y = range[0]; y < range[1]; y++)
+				{
+					const uint8_t* row = rows + (size_t)info->pitchBytes * (y - range[0]);
+					Assert::IsTrue(memcmp(row, linear.data.data() + (size_t)linear.info.pitchBytes * y, linear.info.pitchBytes) == 0, L"rows not matched");
+				}
+				krb_image_unlock_rows(image, range[0], range[1]);
+			}
+			krb_image_close(image);
+			file.close();
+		}
+		TEST_METHOD(probe)
+		{
+			ImageLoader linear;
+			KrbFile file;
+			bool file_open = krb_fopen(&file, L"../../../test/png.png", L"rb");
+			Assert::IsTrue(file_open, L"resource file not found");
+			KrbProbeInfo info;
+			bool res = krb_probe(KrbExtension::ImagePng, &file, &info);
+			Assert::IsTrue(res, L"image probe failed");
+			Assert::IsTrue(info.kind == ProbeKindImage && info.bytesRead < 64, L"not header only");
+			Assert::IsTrue(file.tell() == 0, L"file position not restored");
+			res = krb_load_image(KrbExtension::ImagePng, &linear, &file);
+			file.close();
+			Assert::IsTrue(res, L"image Load failed");
+			Assert::IsTrue(info.image.width == linear.info.width && info.image.height == linear.info.height, L"size not matched");
+			Assert::IsTrue(info.image.pixelformat == linear.info.pixelformat && info.image.pitchBytes == linear.info.pitchBytes, L"format not matched");
+
+			file_open = krb_fopen(&file, L"../../../test/ogg.ogg", L"rb");
+			Assert::IsTrue(file_open, L"resource file not found");
+			res = krb_probe(KrbExtension::SoundOgg, &file, &info);
+			file.close();
+			Assert::IsTrue(res, L"sound probe failed");
+			Assert::IsTrue(info.sound.format.channels == 2 && info.sound.format.samplesPerSec == 32000, L"format not matched");
+			Assert::IsTrue(fabs(info.sound.duration - 74.35) < 0.01, L"duration not matched");
+
+			file_open = krb_fopen(&file, L"../../../test/test.zip", L"rb");
+			Assert::IsTrue(file_open, L"resource file not found");
+			res = krb_probe(KrbExtension::CompressZip, &file, &info);
+			file.close();
+			Assert::IsTrue(res, L"zip probe failed");
+			Assert::IsTrue(info.entries == 4, L"entries not matched");
+		}
+		TEST_METHOD(sniff)
+		{
+			ImageLoader linear;
+			const struct { const wchar_t* path; KrbExtension extension; } files[] = {
+				{ L"../../../test/png.png", KrbExtension::ImagePng },
+				{ L"../../../test/jpeg.jpg", KrbExtension::ImageJpeg },
+				{ L"../../../test/ogg.ogg", KrbExtension::SoundOgg },
+				{ L"../../../test/test.zip", KrbExtension::CompressZip },
+			};
+			for (auto& f : files)
+			{
+				KrbFile file;
+				bool file_open = krb_fopen(&file, f.path, L"rb");
+				Assert::IsTrue(file_open, L"resource file not found");
+				KrbExtension extension = krb_sniff(&file);
+				Assert::IsTrue(extension == f.extension, L"format not matched");
+				Assert::IsTrue(file.tell() == 0, L"file position not restored");
+				file.close();
+			}
+
+			KrbFile file;
+			bool file_open = krb_fopen(&file, L"../../../test/jpeg.jpg", L"rb");
+			Assert::IsTrue(file_open, L"resource file not found");
+			bool res = krb_load_image_auto(&linear, &file);
+			file.close();
+			Assert::IsTrue(res, L"image Load failed");
+			Assert::IsTrue(linear.info.width == 279 && linear.info.height == 71, L"size not matched");
+
+			file_open = krb_fopen(&file, L"../../../test/test.zip", L"rb");
+			Assert::IsTrue(file_open, L"resource file not found");
+			res = krb_load_image_auto(&linear, &file);
+			file.close();
+			Assert::IsFalse(res, L"archive loaded as image");
+		}
+		TEST_METHOD(soundstream)
+		{
+			// 22050Hz stereo PCM with a chunk of odd size before data
+			std::vector<uint8_t> wav;
+			{
+				const uint32_t frames = 40000;
+				auto put32 = [&wav](uint32_t value) { wav.insert(wav.end(), (uint8_t*)&value, (uint8_t*)&value + 4); };
+				auto put16 = [&wav](uint16_t value) { wav.insert(wav.end(), (uint8_t*)&value, (uint8_t*)&value + 2); };
+				auto putTag = [&wav](const char* tag) { wav.insert(wav.end(), tag, tag + 4); };
+				putTag("RIFF");
+				put32(4 + 8 + 16 + 8 + 3 + 1 + 8 + frames * 4);
+				putTag("WAVE");
+				putTag("fmt ");
+				put32(16);
+				put16(1);
+				put16(2);
+				put32(22050);
+				put32(22050 * 4);
+				put16(4);
+				put16(16);
+				putTag("LIST");
+				put32(3);
+				wav.insert(wav.end(), { 'a', 'b', 'c', 0 });
+				putTag("data");
+				put32(frames * 4);
+				for (uint32_t i = 0; i < frames * 2; i++) put16((uint16_t)(i * 7919));
+			}
+			std::vector<uint8_t> mp3 = makeMp3(200);
+
+			struct Source
+			{
+				KrbExtension extension;
+				const wchar_t* path; // nullptr for the memory
+				const std::vector<uint8_t>* data;
+				uint32_t channels;
+				uint32_t sampleRate;
+			};
+			for (const Source& source : {
+				Source{ KrbExtension::SoundWav, nullptr, &wav, 2, 22050 },
+				Source{ KrbExtension::SoundMp3, nullptr, &mp3, 2, 44100 },
+				Source{ KrbExtension::SoundOgg, L"../../../test/ogg.ogg", nullptr, 2, 32000 } })
+			{
+				struct Loader : KrbSoundCallback
+				{
+					std::vector<uint8_t> data;
+				};
+				Loader loader;
+				loader.start = [](KrbSoundCallback* _this, KrbSoundInfo* _info)->short* {
+					Loader* loader = (Loader*)_this;
+					loader->data.resize(_info->totalBytes);
+					return (short*)loader->data.data();
+				};
+				KrbFile file;
+				bool file_open = source.path ? krb_fopen(&file, source.path, L"rb") : krb_mopen(&file, source.data->data(), source.data->size());
+				Assert::IsTrue(file_open, L"resource file not found");
+				bool res = krb_load_sound(source.extension, &loader, &file);
+				Assert::IsTrue(res, L"sound Load failed");
+				file.seek_set(0);
+
+				KrbSoundStream* stream = krb_sound_open(source.extension, &file);
+				Assert::IsNotNull(stream, L"stream open failed");
+				const KrbSoundInfo* info = krb_sound_info(stream);
+				Assert::IsTrue(info->format.channels == source.channels && info->format.samplesPerSec == source.sampleRate, L"format not matched");
+				const size_t blockAlign = info->format.blockAlign;
+
+				// the chunks give the bytes of the whole load
+				std::vector<short> chunk(1000 * source.channels);
+				size_t offset = 0;
+				while (offset + 1000 * blockAlign <= loader.data.size())
+				{
+					size_t frames = krb_sound_read(stream, chunk.data(), 1000);
+					Assert::IsTrue(frames == 1000, L"stream read failed");
+					Assert::IsTrue(memcmp(chunk.data(), loader.data.data() + offset, frames * blockAlign) == 0, L"data not matched");
+					offset += frames * blockAlign;
+				}
+
+				const uint64_t seekFrame = source.sampleRate / 2 + 17;
+				res = krb_sound_seek(stream, seekFrame);
+				Assert::IsTrue(res, L"stream seek failed");
+				size_t frames = krb_sound_read(stream, chunk.data(), 1000);
+				Assert::IsTrue(frames == 1000, L"stream read failed");
+				Assert::IsTrue(memcmp(chunk.data(), loader.data.data() + seekFrame * blockAlign, frames * blockAlign) == 0, L"seek data not matched");
+				krb_sound_close(stream);
+				file.close();
+			}
+		}
+		TEST_METHOD(mp3decode)
+		{
+			// the DCT synthesis against the matrix of the standard with V shifted by 64 for each sample
+			{
+				OpenMP3::FrameData data = {};
+				std::vector<float> vVec(1024, 0.0f);
+				OpenMP3::UInt vPos = 0;
+				std::vector<double> reference(1024, 0.0);
+				std::vector<float> is(576), out(576);
+				const double pi = acos(-1.0);
+				uint32_t seed = 5;
+				double maxError = 0.0, maxLevel = 0.0;
+				for (uint32_t granule = 0; granule < 8; granule++)
+				{
+					for (float& s : is)
+					{
+						seed = seed * 1664525 + 1013904223;
+						s = (float)((seed >> 8) / double(1 << 23) - 1.0);
+					}
+					OpenMP3::SubbandSynthesis(data, is.data(), vVec.data(), vPos, out.data());
+					for (uint32_t ss = 0; ss < 18; ss++)
+					{
+						std::copy_backward(reference.begin(), reference.end() - 64, reference.end());
+						for (uint32_t i = 0; i < 64; i++)
+						{
+							double sum = 0.0;
+							for (uint32_t k = 0; k < 32; k++) sum += cos((16 + i) * (2 * k + 1) * pi / 64.0) * is[k * 18 + ss];
+							reference[i] = sum;
+						}
+						for (uint32_t i = 0; i < 32; i++)
+						{
+							double sum = 0.0;
+							for (uint32_t j = 0; j < 16; j++) sum += reference[(j >> 1) * 128 + (j & 1) * 96 + i] * OpenMP3::kSynthDtbl[j * 32 + i];
+							maxError = std::max(maxError, fabs(sum - out[ss * 32 + i]));
+							maxLevel = std::max(maxLevel, fabs(sum));
+						}
+					}
+				}
+				char message[256];
+				snprintf(message, 256, "mp3 synthesis: max error %g of %g\n", maxError, maxLevel);
+				Logger::WriteMessage(message);
+				Assert::IsTrue(maxError < 1e-6 * maxLevel, L"synthesis not matched");
+			}
+
+			// the IMDCT and the overlap of the hybrid synthesis against the sums of the standard
+			{
+				struct Block
+				{
+					uint32_t type;
+					bool mixed;
+					uint32_t lines;
+				};
+				const Block blocks[] = { { 0, false, 576 }, { 1, false, 400 }, { 2, false, 576 }, { 2, false, 100 }, { 3, false, 576 }, { 2, true, 576 }, { 2, true, 30 }, { 0, false, 0 }, { 0, false, 576 } };
+				OpenMP3::FrameData::Granule granule = {};
+				float store[32][18] = {};
+				double reference[32][18] = {};
+				const double pi = acos(-1.0);
+				auto window = [pi](uint32_t type, uint32_t i)->double {
+					double sine = sin(pi / 36.0 * (i + 0.5));
+					if (type == 1) return i < 18 ? sine : i < 24 ? 1.0 : i < 30 ? sin(pi / 12.0 * (i - 18 + 0.5)) : 0.0;
+					if (type == 3) return i < 6 ? 0.0 : i < 12 ? sin(pi / 12.0 * (i - 6 + 0.5)) : i < 18 ? 1.0 : sine;
+					return sine;
+				};
+				uint32_t seed = 9;
+				double maxError = 0.0, maxLevel = 0.0;
+				for (const Block& block : blocks)
+				{
+					for (uint32_t i = 0; i < 576; i++)
+					{
+						seed = seed * 1664525 + 1013904223;
+						granule.is[i] = i < block.lines ? (float)((seed >> 8) / double(1 << 23) - 1.0) : 0.0f;
+					}
+					granule.window_switching = block.type != 0;
+					granule.block_type = block.type;
+					granule.mixed_block = block.mixed;
+					float in[576];
+					memcpy(in, granule.is, sizeof(in));
+					OpenMP3::HybridSynthesis(granule, store);
+					for (uint32_t sb = 0; sb < 32; sb++)
+					{
+						const uint32_t type = block.mixed && sb < 2 ? 0 : block.type;
+						double raw[36] = {};
+						if (type == 2)
+						{
+							for (uint32_t w = 0; w < 3; w++) for (uint32_t i = 0; i < 12; i++)
+							{
+								double sum = 0.0;
+								for (uint32_t k = 0; k < 6; k++) sum += in[sb * 18 + 3 * k + w] * cos(pi / 24.0 * (2 * i + 1 + 6) * (2 * k + 1));
+								raw[6 + 6 * w + i] += sum * sin(pi / 12.0 * (i + 0.5));
+							}
+						}
+						else
+						{
+							for (uint32_t i = 0; i < 36; i++)
+							{
+								double sum = 0.0;
+								for (uint32_t k = 0; k < 18; k++) sum += in[sb * 18 + k] * cos(pi / 72.0 * (2 * i + 1 + 18) * (2 * k + 1));
+								raw[i] = sum * window(type, i);
+							}
+						}
+						for (uint32_t i = 0; i < 18; i++)
+						{
+							double sum = raw[i] + reference[sb][i];
+							reference[sb][i] = raw[i + 18];
+							maxError = std::max(maxError, fabs(sum - granule.is[sb * 18 + i]));
+							maxLevel = std::max(maxLevel, fabs(sum));
+						}
+					}
+				}
+				char message[256];
+				snprintf(message, 256, "mp3 imdct: max error %g of %g\n", maxError, maxLevel);
+				Logger::WriteMessage(message);
+				Assert::IsTrue(maxError < 1e-6 * maxLevel, L"imdct not matched");
+			}
+
+			constexpr uint32_t FRAMES = 200;
+			std::vector<uint8_t> mp3 = makeMp3(FRAMES);
+
+			KrbFile file;
+			Assert::IsTrue(krb_mopen(&file, mp3.data(), mp3.size()));
+			KrbSoundStream* stream = krb_sound_open(KrbExtension::SoundMp3, &file);
+			Assert::IsNotNull(stream, L"stream open failed");
+			std::vector<short> pcm(1152 * 2);
+			size_t samples = 0;
+			auto begin = std::chrono::steady_clock::now();
+			for (size_t read; (read = krb_sound_read(stream, pcm.data(), 1152)) != 0;) samples += read;
+			std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - begin;
+			krb_sound_close(stream);
+			file.close();
+			Assert::IsTrue(samples == FRAMES * 1152, L"decoded samples not matched");
+
+			wchar_t message[256];
+			swprintf(message, 256, L"mp3 decode: %.2fus per frame\n", elapsed.count() / FRAMES);
+			Logger::WriteMessage(message);
+		}
+		TEST_METHOD(mp3chunked)
+		{
+			// CBR without a Xing frame, the length is estimated by the bitrate of the first frame
+			struct Case
+			{
+				uint32_t firstKbps;
+				uint32_t kbps;
+			};
+			for (const Case& c : { Case{ 320, 32 }, Case{ 32, 320 } })
+			{
+				const uint32_t frames = 200;
+				std::vector<uint8_t> mp3 = makeMp3(1, 1, c.firstKbps);
+				std::vector<uint8_t> rest = makeMp3(frames, 2, c.kbps);
+				mp3.insert(mp3.end(), rest.begin(), rest.end());
+
+				struct Loader : KrbSoundCallback
+				{
+					std::vector<uint8_t> data;
+				};
+				Loader loader;
+				loader.start = [](KrbSoundCallback* _this, KrbSoundInfo* _info)->short* {
+					Loader* loader = (Loader*)_this;
+					loader->data.resize(_info->totalBytes);
+					return (short*)loader->data.data();
+				};
+				KrbFile file;
+				Assert::IsTrue(krb_mopen(&file, mp3.data(), mp3.size()));
+				bool res = krb_load_sound(KrbExtension::SoundMp3, &loader, &file);
+				Assert::IsTrue(res, L"sound Load failed");
+				Assert::AreEqual((size_t)(frames + 1) * 1152 * 4, loader.data.size(), L"length not matched");
+
+				file.seek_set(0);
+				KrbSoundStream* stream = krb_sound_open(KrbExtension::SoundMp3, &file);
+				Assert::IsNotNull(stream, L"stream open failed");
+				std::vector<short> pcm;
+				std::vector<short> chunk(1152 * 2);
+				for (size_t read; (read = krb_sound_read(stream, chunk.data(), 1152)) != 0;) pcm.insert(pcm.end(), chunk.begin(), chunk.begin() + read * 2);
+				krb_sound_close(stream);
+				file.close();
+				Assert::IsTrue(pcm.size() * 2 == loader.data.size() && memcmp(pcm.data(), loader.data.data(), loader.data.size()) == 0, L"data not matched");
+			}
+		}
+		TEST_METHOD(mp3iterator)
+		{
+			// an ID3v2 tag with a false sync, junk before some frames and CRC-protected frames
+			std::vector<uint8_t> clean = makeMp3(40, 7);
+			std::vector<uint8_t> mp3 = { 'I', 'D', '3', 3, 0, 0, 0, 0, 1, 72 };
+			mp3.resize(mp3.size() + 200, 0);
+			mp3[60] = 0xff;
+			mp3[61] = 0xfb;
+			mp3[62] = 0x90;
+			mp3[63] = 0x40;
+			std::vector<uint64_t> starts; // the junk before the frame or the frame
+			std::vector<uint64_t> ends;
+			for (size_t pos = 0, i = 0; pos < clean.size(); i++)
+			{
+				size_t frameBytes = 144 * 128000 / 44100 + ((clean[pos + 2] >> 1) & 1);
+				std::vector<uint8_t> frame(clean.begin() + pos, clean.begin() + pos + frameBytes);
+				pos += frameBytes;
+				starts.push_back(mp3.size());
+				if (i % 10 == 5)
+				{
+					// a false sync after the resync
+					static const uint8_t junk[] = { 0x00, 0xff, 0x00, 0xff, 0xfb, 0x12, 0x00, 0xff, 0xe0, 1, 2, 3, 4, 5, 6 };
+					mp3.insert(mp3.end(), junk, junk + sizeof(junk));
+				}
+				if (i >= 20 && i < 30)
+				{
+					// the last bytes of the main data are not used
+					frame[1] &= ~1;
+					frame.insert(frame.begin() + 4, { 0xab, 0xcd });
+					frame.resize(frameBytes);
+				}
+				mp3.insert(mp3.end(), frame.begin(), frame.end());
+				ends.push_back(mp3.size());
+			}
+
+			KrbFile file;
+			Assert::IsTrue(krb_mopen(&file, mp3.data(), mp3.size()));
+			OpenMP3::Library library;
+			OpenMP3::Iterator iterator(library, &file);
+			OpenMP3::Frame frame;
+			for (size_t i = 0; i < ends.size(); i++)
+			{
+				Assert::IsTrue(iterator.GetNext(frame) == OpenMP3::kResultOk, L"frame not found");
+				Assert::AreEqual(ends[i], iterator.GetPosition(), L"frame position not matched");
+			}
+			Assert::IsFalse(iterator.GetNext(frame) == OpenMP3::kResultOk, L"frame past the end");
+
+			for (size_t i : { 17, 25, 0, 39, 5, 20 })
+			{
+				iterator.Seek(starts[i]);
+				Assert::IsTrue(iterator.GetNext(frame) == OpenMP3::kResultOk, L"frame not found after seek");
+				Assert::AreEqual(ends[i], iterator.GetPosition(), L"frame position not matched after seek");
+			}
+			iterator.Seek(0);
+			Assert::IsTrue(iterator.GetNext(frame) == OpenMP3::kResultOk, L"frame not found after the tag");
+			Assert::AreEqual(ends[0], iterator.GetPosition(), L"tag not skipped");
+			file.close();
+
+			// the frames decode as without the tag, the junk and the CRC
+			auto decode = [](std::vector<uint8_t>& data) {
+				KrbFile file;
+				Assert::IsTrue(krb_mopen(&file, data.data(), data.size()));
+				KrbSoundStream* stream = krb_sound_open(KrbExtension::SoundMp3, &file);
+				Assert::IsNotNull(stream, L"stream open failed");
+				std::vector<short> pcm;
+				std::vector<short> chunk(1152 * 2);
+				for (size_t read; (read = krb_sound_read(stream, chunk.data(), 1152)) != 0;) pcm.insert(pcm.end(), chunk.begin(), chunk.begin() + read * 2);
+				krb_sound_close(stream);
+				file.close();
+				return pcm;
+			};
+			std::vector<short> expected = decode(clean);
+			Assert::AreEqual((size_t)40 * 1152 * 2, expected.size(), L"decoded samples not matched");
+			Assert::IsTrue(decode(mp3) == expected, L"decoded data not matched");
+		}
+		TEST_METHOD(mp3index)
+		{
+			const uint32_t frames = 300;
+			std::vector<uint8_t> mp3 = makeMp3(frames, 3, 128, true);
+			auto decode = [](KrbSoundStream* stream, size_t count) {
+				std::vector<short> pcm;
+				std::vector<short> chunk(1152 * 2);
+				for (size_t read; pcm.size() < count * 2 && (read = krb_sound_read(stream, chunk.data(), 1152)) != 0;)
+				{
+					pcm.insert(pcm.end(), chunk.begin(), chunk.begin() + read * 2);
+				}
+				if (pcm.size() > count * 2) pcm.resize(count * 2);
+				return pcm;
+			};
+
+			KrbFile file;
+			Assert::IsTrue(krb_mopen(&file, mp3.data(), mp3.size()));
+			KrbSoundStream* stream = krb_sound_open(KrbExtension::SoundMp3, &file);
+			Assert::IsNotNull(stream, L"stream open failed");
+			std::vector<short> sequential = decode(stream, SIZE_MAX);
+			krb_sound_close(stream);
+			Assert::AreEqual((size_t)frames * 1152 * 2, sequential.size(), L"decoded samples not matched");
+
+			// built, saved and loaded back from the memory
+			file.seek_set(0);
+			KrbMp3Index* built = krb_mp3_index_build(&file);
+			Assert::IsNotNull(built, L"index build failed");
+			{
+				KrbFile out;
+				bool file_open = krb_fopen(&out, L"mp3index.bin", L"wb");
+				Assert::IsTrue(file_open, L"output file not opened");
+				bool res = krb_mp3_index_save(built, &out);
+				out.close();
+				Assert::IsTrue(res, L"index save failed");
+			}
+			krb_mp3_index_free(built);
+			std::vector<uint8_t> saved;
+			{
+				KrbFile in;
+				bool file_open = krb_fopen(&in, L"mp3index.bin", L"rb");
+				Assert::IsTrue(file_open, L"saved index not found");
+				in.seek_end(0);
+				saved.resize((size_t)in.tell());
+				in.seek_set(0);
+				Assert::AreEqual(saved.size(), in.read(saved.data(), saved.size()), L"saved index not read");
+				in.close();
+			}
+			KrbFile indexFile;
+			Assert::IsTrue(krb_mopen(&indexFile, saved.data(), saved.size()));
+			KrbMp3Index* index = krb_mp3_index_load(&indexFile);
+			indexFile.close();
+			Assert::IsNotNull(index, L"index load failed");
+
+			file.seek_set(0);
+			stream = krb_sound_open(KrbExtension::SoundMp3, &file);
+			Assert::IsNotNull(stream, L"stream open failed");
+			Assert::IsTrue(krb_sound_set_index(stream, index), L"index not set");
+			for (uint64_t position : { 1152ull * 150, 0ull, 1151ull, 1152ull * 37 + 5, 1152ull * 299 + 100, 1152ull * 10 + 3, 1152ull * 200 })
+			{
+				Assert::IsTrue(krb_sound_seek(stream, position), L"stream seek failed");
+				std::vector<short> pcm = decode(stream, 3000);
+				size_t expected = std::min<size_t>(3000, (size_t)(frames * 1152 - position));
+				Assert::AreEqual(expected * 2, pcm.size(), L"seek length not matched");
+				Assert::IsTrue(memcmp(pcm.data(), sequential.data() + position * 2, pcm.size() * sizeof(short)) == 0, L"seek data not matched");
+			}
+			krb_sound_close(stream);
+			file.close();
+
+			// the frames of another file start after an ID3v2 tag
+			std::vector<uint8_t> other = { 'I', 'D', '3', 4, 0, 0, 0, 0, 0, 16 };
+			other.resize(other.size() + 16, 0);
+			other.insert(other.end(), mp3.begin(), mp3.end());
+			Assert::IsTrue(krb_mopen(&file, other.data(), other.size()));
+			stream = krb_sound_open(KrbExtension::SoundMp3, &file);
+			Assert::IsNotNull(stream, L"stream open failed");
+			Assert::IsFalse(krb_sound_set_index(stream, index), L"index of another file set");
+			krb_sound_close(stream);
+			file.close();
+			krb_mp3_index_free(index);
+		}
+		TEST_METHOD(decoderpush)
+		{
+			struct Source
+			{
+				const wchar_t* path;
+				KrbExtension extension;
+			};
+			for (const Source& source : {
+				Source{ L"../../../test/png.png", KrbExtension::ImagePng },
+				Source{ L"../../../test/jpeg.jpg", KrbExtension::ImageJpg } })
+			{
+				KrbFile file;
+				bool file_open = krb_fopen(&file, source.path, L"rb");
+				Assert::IsTrue(file_open, L"resource file not found");
+				ImageLoader pulled;
+				bool res = krb_load_image(source.extension, &pulled, &file);
+				Assert::IsTrue(res, L"image Load failed");
+
+				// feed the same bytes in small pieces
+				file.seek_set(0);
+				ImageLoader pushed;
+				KrbImageDecoder* decoder = krb_image_decoder_create(source.extension, &pushed);
+				Assert::IsNotNull(decoder, L"decoder not created");
+				kr_decodestatus_t status = DecodeStatusNeedMore;
+				uint8_t buffer[1000];
+				while (status == DecodeStatusNeedMore)
+				{
+					size_t readed = file.read(buffer, sizeof(buffer));
+					if (readed == 0) krb_image_decoder_finish(decoder);
+					else krb_image_decoder_feed(decoder, buffer, readed);
+					status = krb_image_decoder_poll(decoder);
+				}
+				krb_image_decoder_delete(decoder);
+				file.close();
+				Assert::IsTrue(status == DecodeStatusDone, L"push decoding failed");
+				Assert::IsTrue(pushed.data == pulled.data, L"decoded pixels not matched");
+			}
+		}
+		TEST_METHOD(mipmap)
+		{
+			for (kr_imagefilter_t filter : { ImageFilterBox, ImageFilterKaiser, ImageFilterLanczos })
+			{
+				ImageLoader loader;
+				loader.requestFormat = PixelFormatARGB8;
+				loader.mipFilter = filter;
+				loader.flags = ImageFlagFilterSrgb | ImageFlagFilterAlphaWeighted;
+				loader.load(KrbExtension::ImagePng, L"../../../test/png.png");
+
+				uint32_t levels = 1;
+				uint32_t size = loader.info.width > loader.info.height ? loader.info.width : loader.info.height;
+				for (; size > 1; size >>= 1) levels++;
+				Assert::AreEqual(levels, loader.info.mipLevels, L"incomplete mip chain");
+				Assert::AreEqual(loader.data.size() - 4, krb_image_level_offset(&loader.info, levels - 1), L"last level is not 1x1");
+			}
+		}
+		TEST_METHOD(resizeonload)
+		{
+			struct Source
+			{
+				const wchar_t* path;
+				KrbExtension extension;
+			};
+			for (const Source& source : {
+				Source{ L"../../../test/png.png", KrbExtension::ImagePng },
+				Source{ L"../../../test/jpeg.jpg", KrbExtension::ImageJpg } })
+			for (kr_imagefilter_t filter : { ImageFilterBox, ImageFilterLanczos })
+			{
+				ImageLoader loader;
+				loader.resizeFilter = filter;
+				loader.targetWidth = 64;
+				loader.targetHeight = 48;
+				loader.load(source.extension, source.path);
+				Assert::AreEqual(64u, loader.info.width, L"width not matched");
+				Assert::AreEqual(48u, loader.info.height, L"height not matched");
+
+				ImageLoader full;
+				full.load(source.extension, source.path);
+				Assert::AreEqual((int)full.info.pixelformat, (int)loader.info.pixelformat, L"format not matched");
+				uint32_t bpp = full.info.pixelformat == PixelFormatBGR8 || full.info.pixelformat == PixelFormatRGB8 ? 3 : 4;
+
+				// area average of the source, the filter differs but the mean and the edges must follow it
+				double error = 0, edgeError = 0;
+				double meanReference = 0, meanResized = 0;
+				for (uint32_t y = 0; y < 48; y++)
+				{
+					for (uint32_t x = 0; x < 64; x++)
+					{
+						double x0 = x * (double)full.info.width / 64, x1 = (x + 1) * (double)full.info.width / 64;
+						double y0 = y * (double)full.info.height / 48, y1 = (y + 1) * (double)full.info.height / 48;
+						for (uint32_t c = 0; c < bpp; c++)
+						{
+							double sum = 0, weight = 0;
+							for (uint32_t sy = (uint32_t)y0; sy < y1; sy++)
+							{
+								double wy = std::min<double>(sy + 1, y1) - std::max<double>(sy, y0);
+								for (uint32_t sx = (uint32_t)x0; sx < x1; sx++)
+								{
+									double w = wy * (std::min<double>(sx + 1, x1) - std::max<double>(sx, x0));
+									sum += w * full.data[(size_t)sy * full.info.pitchBytes + sx * bpp + c];
+									weight += w;
+								}
+							}
+							double reference = sum / weight;
+							double resized = loader.data[(size_t)y * loader.info.pitchBytes + x * bpp + c];
+							double diff = fabs(reference - resized);
+							error += diff;
+							if (x == 0 || y == 0 || x == 63 || y == 47) edgeError += diff;
+							meanReference += reference;
+							meanResized += resized;
+						}
+					}
+				}
+				size_t count = (size_t)64 * 48 * bpp;
+				size_t edgeCount = (size_t)(64 + 48 - 2) * 2 * bpp;
+				char message[128];
+				snprintf(message, sizeof(message), "resize: mean error %.3f, edge %.3f, mean %.3f / %.3f\n",
+					error / count, edgeError / edgeCount, meanResized / count, meanReference / count);
+				Logger::WriteMessage(message);
+				Assert::IsTrue(error / count < 6.0, L"resized pixels not matched");
+				Assert::IsTrue(fabs(meanResized - meanReference) / count < 1.0, L"resized mean not matched");
+				Assert::IsTrue(edgeError / edgeCount < 6.0, L"resized edges not matched");
+			}
+		}
+		TEST_METHOD(compressbc)
+		{
+			// [R,G,B,A] of the source
+			ImageLoader source;
+			source.flags = ImageFlagBuiltinPng;
+			source.requestFormat = PixelFormatABGR8;
+			source.load(KrbExtension::ImagePng, L"../../../test/png.png");
+			Assert::AreEqual((int)PixelFormatABGR8, (int)source.info.pixelformat, L"format not matched");
+
+			struct Case
+			{
+				kr_pixelformat_t format;
+				kr_bcpreset_t preset;
+				int channels; // R, RG, RGB or RGBA
+				double maxMeanError;
+			};
+			for (const Case& c : {
+				Case{ PixelFormatBC1, BcPresetFast, 3, 8.0 },
+				Case{ PixelFormatBC1, BcPresetHigh, 3, 5.0 },
+				Case{ PixelFormatBC3, BcPresetFast, 4, 6.0 },
+				Case{ PixelFormatBC3, BcPresetHigh, 4, 4.0 },
+				Case{ PixelFormatBC4, BcPresetFast, 1, 2.0 },
+				Case{ PixelFormatBC5, BcPresetHigh, 2, 2.0 },
+				Case{ PixelFormatBC7, BcPresetFast, 4, 5.0 },
+				Case{ PixelFormatBC7, BcPresetHigh, 4, 2.0 } })
+			{
+				ImageLoader loader;
+				loader.requestFormat = c.format;
+				loader.bcPreset = c.preset;
+				loader.load(KrbExtension::ImagePng, L"../../../test/png.png");
+				Assert::AreEqual((int)c.format, (int)loader.info.pixelformat, L"format not matched");
+				uint32_t blockBytes = c.format == PixelFormatBC1 || c.format == PixelFormatBC4 ? 8 : 16;
+				Assert::AreEqual((loader.info.width + 3) / 4 * blockBytes, loader.info.pitchBytes, L"pitch not matched");
+
+				uint64_t error = 0, count = 0;
+				int maxError = 0;
+				for (uint32_t by = 0; by < loader.info.height; by += 4)
+				{
+					for (uint32_t bx = 0; bx < loader.info.width; bx += 4)
+					{
+						uint8_t pixels[16][4];
+						const uint8_t* block = loader.data.data() + (size_t)(by / 4) * loader.info.pitchBytes + bx / 4 * blockBytes;
+						Assert::IsTrue(decodeBcBlock(c.format, block, pixels), L"block not decoded");
+						for (uint32_t i = 0; i < 16; i++)
+						{
+							uint32_t x = bx + i % 4, y = by + i / 4;
+							if (x >= source.info.width || y >= source.info.height) continue;
+							const uint8_t* expected = source.data.data() + (size_t)y * source.info.pitchBytes + x * 4;
+							if (c.format == PixelFormatBC1)
+							{
+								// 1-bit alpha, the color of the transparent pixels is black
+								Assert::AreEqual(expected[3] >= 128 ? 255 : 0, (int)pixels[i][3], L"BC1 alpha not matched");
+								if (expected[3] < 128) continue;
+							}
+							for (int ch = 0; ch < c.channels; ch++)
+							{
+								int diff = abs((int)expected[ch] - (int)pixels[i][ch]);
+								error += diff;
+								count++;
+								if (diff > maxError) maxError = diff;
+							}
+						}
+					}
+				}
+				double meanError = (double)error / count;
+				char message[128];
+				snprintf(message, sizeof(message), "format %d preset %d: mean error %.3f, max %d\n", (int)c.format, (int)c.preset, meanError, maxError);
+				Logger::WriteMessage(message);
+				Assert::IsTrue(meanError < c.maxMeanError, L"decoded blocks not matched");
+			}
+
+			// constant blocks have c0 == c1, the decoders read BC1 as the 3-color mode and index 3 as transparent
+			std::vector<uint8_t> constant(8 * 8 * 4);
+			for (size_t i = 0; i < constant.size(); i += 4)
+			{
+				constant[i] = 0x40;
+				constant[i + 1] = 0x82;
+				constant[i + 2] = 0xc4;
+				constant[i + 3] = 0xff;
+			}
+			KrbImageSaveInfo info;
+			info.pixelformat = PixelFormatABGR8;
+			info.width = 8;
+			info.height = 8;
+			info.pitchBytes = 8 * 4;
+			info.data = constant.data();
+			info.palette = nullptr;
+			{
+				KrbFile file;
+				bool file_open = krb_fopen(&file, L"compressbc.png", L"wb");
+				Assert::IsTrue(file_open, L"output file not opened");
+				bool res = krb_save_image(KrbExtension::ImagePng, &info, &file);
+				file.close();
+				Assert::IsTrue(res, L"image Save failed");
+			}
+			for (kr_pixelformat_t format : { PixelFormatBC1, PixelFormatBC3, PixelFormatBC7 })
+			{
+				for (kr_bcpreset_t preset : { BcPresetFast, BcPresetHigh })
+				{
+					ImageLoader loader;
+					loader.requestFormat = format;
+					loader.bcPreset = preset;
+					loader.load(KrbExtension::ImagePng, L"compressbc.png");
+					uint8_t pixels[16][4];
+					Assert::IsTrue(decodeBcBlock(format, loader.data.data(), pixels), L"block not decoded");
+					for (int i = 0; i < 16; i++)
+					{
+						Assert::AreEqual(255, (int)pixels[i][3], L"constant block not opaque");
+						for (int ch = 0; ch < 3; ch++)
+						{
+							Assert::IsTrue(abs((int)pixels[i][ch] - (int)constant[ch]) <= 4, L"constant block not matched");
+						}
+					}
+				}
+			}
+		}
+		TEST_METHOD(texturezerocopy)
+		{
+			// 8x8 BC1 DDS with 2 mip levels, in memory
+			std::vector<uint32_t> dds(32 + 4 * 2 + 1 * 2, 0);
+			dds[0] = 0x20534444; // "DDS "
+			dds[1] = 124;
+			dds[2] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000;
+			dds[3] = 8;
+			dds[4] = 8;
+			dds[7] = 2;
+			dds[19] = 32;
+			dds[20] = 0x4;
+			dds[21] = 0x31545844; // "DXT1"
+			for (size_t i = 32; i < dds.size(); i++) dds[i] = (uint32_t)i;
+
+			KrbFile file;
+			Assert::IsTrue(krb_mopen(&file, dds.data(), dds.size() * sizeof(uint32_t)));
+			KrbTexture* texture = krb_texture_open(KrbExtension::ImageDds, &file);
+			Assert::IsNotNull(texture, L"texture open failed");
+			const KrbTextureInfo* info = krb_texture_info(texture);
+			Assert::AreEqual((int)PixelFormatBC1, (int)info->pixelformat, L"format not matched");
+			Assert::AreEqual(2u, info->mipLevels, L"level count not matched");
+
+			KrbTextureLevel level;
+			Assert::IsTrue(krb_texture_level(texture, 0, 0, 1, &level));
+			Assert::AreEqual(4u, level.width, L"width not matched");
+			Assert::AreEqual((size_t)8, level.size, L"size not matched");
+			Assert::IsTrue(level.data == dds.data() + 32 + 4 * 2, L"not a pointer into the file");
+			krb_texture_close(texture);
+			file.close();
+		}
+		TEST_METHOD(texturektx2)
+		{
+			// 8x4 R8G8B8A8_SRGB with 2 layers and 2 levels, the smaller level first as the writers do
+			std::vector<uint8_t> ktx(80 + 24 * 2 + 32 * 2 + 128 * 2);
+			static const uint8_t identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+			memcpy(ktx.data(), identifier, sizeof(identifier));
+			uint32_t header[10] = { 43, 1, 8, 4, 0, 2, 1, 2, 0, 0 }; // vkFormat, typeSize, width, height, depth, layers, faces, levels, supercompression, no dfd
+			memcpy(ktx.data() + 12, header, sizeof(header));
+			uint64_t levels[2][3] = { { 80 + 48 + 64, 256, 256 }, { 80 + 48, 64, 64 } };
+			memcpy(ktx.data() + 80, levels, sizeof(levels));
+			for (size_t i = 80 + 48; i < ktx.size(); i++) ktx[i] = (uint8_t)i;
+
+			KrbFile file;
+			Assert::IsTrue(krb_mopen(&file, ktx.data(), ktx.size()));
+			KrbTexture* texture = krb_texture_open(KrbExtension::ImageKtx2, &file);
+			Assert::IsNotNull(texture, L"texture open failed");
+			const KrbTextureInfo* info = krb_texture_info(texture);
+			Assert::AreEqual((int)PixelFormatABGR8, (int)info->pixelformat, L"format not matched");
+			Assert::IsTrue(info->srgb, L"srgb not matched");
+			Assert::AreEqual(8u, info->width, L"width not matched");
+			Assert::AreEqual(4u, info->height, L"height not matched");
+			Assert::AreEqual(2u, info->mipLevels, L"level count not matched");
+			Assert::AreEqual(2u, info->layers, L"layer count not matched");
+			Assert::AreEqual(1u, info->faces, L"face count not matched");
+
+			KrbTextureLevel level;
+			Assert::IsTrue(krb_texture_level(texture, 1, 0, 0, &level));
+			Assert::AreEqual(32u, level.pitchBytes, L"pitch not matched");
+			Assert::AreEqual((size_t)128, level.size, L"size not matched");
+			Assert::IsTrue(level.data == ktx.data() + 80 + 48 + 64 + 128, L"layer 1 not matched");
+			Assert::IsTrue(krb_texture_level(texture, 1, 0, 1, &level));
+			Assert::AreEqual(4u, level.width, L"width not matched");
+			Assert::AreEqual(2u, level.height, L"height not matched");
+			Assert::IsTrue(level.data == ktx.data() + 80 + 48 + 32, L"level 1 not matched");
+			Assert::IsFalse(krb_texture_level(texture, 2, 0, 0, &level), L"layer out of range");
+			Assert::IsFalse(krb_texture_level(texture, 0, 0, 2, &level), L"level out of range");
+			krb_texture_close(texture);
+			file.close();
+
+			// the first layer with the levels of the file
+			ImageLoader loader;
+			Assert::IsTrue(krb_mopen(&file, ktx.data(), ktx.size()));
+			bool res = krb_load_image(KrbExtension::ImageKtx2, &loader, &file);
+			file.close();
+			Assert::IsTrue(res, L"image Load failed");
+			Assert::AreEqual(2u, loader.info.mipLevels, L"level count not matched");
+			Assert::IsTrue(memcmp(loader.data.data(), ktx.data() + 80 + 48 + 64, 128) == 0, L"level 0 not matched");
+			Assert::IsTrue(memcmp(loader.data.data() + krb_image_level_offset(&loader.info, 1), ktx.data() + 80 + 48, 32) == 0, L"level 1 not matched");
+
+			// a level whose offset and length wrap to the start of the file
+			std::vector<uint8_t> wrapped = ktx;
+			uint64_t wrappedLevel[3] = { UINT64_MAX - 63, 64, 64 };
+			memcpy(wrapped.data() + 80 + 24, wrappedLevel, sizeof(wrappedLevel));
+			Assert::IsTrue(krb_mopen(&file, wrapped.data(), wrapped.size()));
+			Assert::IsNull(krb_texture_open(KrbExtension::ImageKtx2, &file), L"wrapped level opened");
+			file.close();
+
+			// a level past the end of the file
+			ktx.resize(ktx.size() - 1);
+			Assert::IsTrue(krb_mopen(&file, ktx.data(), ktx.size()));
+			Assert::IsNull(krb_texture_open(KrbExtension::ImageKtx2, &file), L"truncated file opened");
+			file.close();
+		}
+		TEST_METHOD(loadjpegplanar)
+		{
+			KrbFile file;
+			bool file_open = krb_fopen(&file, L"../../../test/jpeg.jpg", L"rb");
+			Assert::IsTrue(file_open, L"resource file not found");
+
+			struct Loader : KrbImageCallback
+			{
+				uint8_t* data;
+			};
+			Loader loader;
+			loader.palette = nullptr;
+			loader.flags = ImageFlagPlanarYCbCr;
+			loader.start = [](KrbImageCallback* _this, KrbImageInfo* _info)->void* {
+				Assert::IsTrue(_info->pixelformat == PixelFormatYCbCr420, L"planar format not matched");
+				Assert::AreEqual((uint32_t)140, _info->chromaWidth, L"chroma width not matched");
+				Assert::AreEqual((uint32_t)36, _info->chromaHeight, L"chroma height not matched");
+				size_t size = (size_t)_info->pitchBytes * _info->height + (size_t)_info->chromaPitchBytes * _info->chromaHeight * 2;
+				return ((Loader*)_this)->data = new uint8_t[size];
+			};
+			bool res = krb_load_image(KrbExtension::ImageJpg, &loader, &file);
+			Assert::IsTrue(res, L"image Load failed");
+			delete[] loader.data;
+		}
+		TEST_METHOD(transformjpeg)
+		{
+			ImageLoader source;
+			source.load(KrbExtension::ImageJpg, L"../../../test/jpeg.jpg");
+			Assert::AreEqual((int)PixelFormatBGR8, (int)source.info.pixelformat, L"format not matched");
+
+			// 4:2:0, the flipped edges are trimmed to the 16x16 MCU
+			const uint32_t mcu = 16;
+			const uint32_t trimmedWidth = source.info.width - source.info.width % mcu;
+			const uint32_t trimmedHeight = source.info.height - source.info.height % mcu;
+			struct Case
+			{
+				KrbJpegTransform transform;
+				bool transpose;
+				uint32_t width, height;
+			};
+			for (const Case& c : {
+				Case{ { JpegTransformFlipHorizontal, 0, 0, 0, 0 }, false, trimmedWidth, source.info.height },
+				Case{ { JpegTransformFlipVertical, 0, 0, 0, 0 }, false, source.info.width, trimmedHeight },
+				Case{ { JpegTransformTranspose, 0, 0, 0, 0 }, true, source.info.height, source.info.width },
+				Case{ { JpegTransformTransverse, 0, 0, 0, 0 }, true, trimmedHeight, trimmedWidth },
+				Case{ { JpegTransformRotate90, 0, 0, 0, 0 }, true, trimmedHeight, source.info.width },
+				Case{ { JpegTransformRotate180, 0, 0, 0, 0 }, false, trimmedWidth, trimmedHeight },
+				Case{ { JpegTransformRotate270, 0, 0, 0, 0 }, true, source.info.height, trimmedWidth },
+				Case{ { JpegTransformRotate90, 16, 32, 32, 40 }, true, 32, 40 },
+				Case{ { JpegTransformNone, 37, 20, 64, 30 }, false, 64 + 5, 30 + 4 } })
+			{
+				KrbFile src, dest;
+				Assert::IsTrue(krb_fopen(&src, L"../../../test/jpeg.jpg", L"rb"), L"resource file not found");
+				Assert::IsTrue(krb_fopen(&dest, L"transformjpeg.jpg", L"wb"), L"output file not opened");
+				bool res = krb_transform_jpeg(&c.transform, &dest, &src);
+				dest.close();
+				src.close();
+				Assert::IsTrue(res, L"jpeg transform failed");
+
+				ImageLoader transformed;
+				transformed.load(KrbExtension::ImageJpg, L"transformjpeg.jpg");
+				Assert::AreEqual(c.width, transformed.info.width, L"width not matched");
+				Assert::AreEqual(c.height, transformed.info.height, L"height not matched");
+
+				// the blocks are moved without requantization, only the rounding of the idct and the upsampling differ
+				uint32_t cropX = c.transform.cropX - c.transform.cropX % mcu;
+				uint32_t cropY = c.transform.cropY - c.transform.cropY % mcu;
+				uint64_t error = 0;
+				int maxError = 0;
+				for (uint32_t y = 0; y < c.height; y++)
+				{
+					for (uint32_t x = 0; x < c.width; x++)
+					{
+						uint32_t u = x + cropX, v = y + cropY;
+						if (c.transpose) std::swap(u, v);
+						kr_jpegtransform_t t = c.transform.transform;
+						if (t == JpegTransformFlipHorizontal || t == JpegTransformRotate180 || t == JpegTransformTransverse || t == JpegTransformRotate270)
+							u = trimmedWidth - 1 - u;
+						if (t == JpegTransformFlipVertical || t == JpegTransformRotate180 || t == JpegTransformTransverse || t == JpegTransformRotate90)
+							v = trimmedHeight - 1 - v;
+						const uint8_t* expected = source.data.data() + (size_t)v * source.info.pitchBytes + u * 3;
+						const uint8_t* actual = transformed.data.data() + (size_t)y * transformed.info.pitchBytes + x * 3;
+						for (int i = 0; i < 3; i++)
+						{
+							int diff = abs((int)expected[i] - (int)actual[i]);
+							error += diff;
+							if (diff > maxError) maxError = diff;
+						}
+					}
+				}
+				double meanError = (double)error / ((size_t)c.width * c.height * 3);
+				char message[128];
+				snprintf(message, sizeof(message), "jpeg transform %d: mean error %.3f, max %d\n", (int)c.transform.transform, meanError, maxError);
+				Logger::WriteMessage(message);
+				Assert::IsTrue(meanError < 0.5, L"transformed pixels not matched");
+			}
+		}
 		TEST_METHOD(loadzip)
 		{
 			struct Entry